@@ -130,10 +130,21 @@ typedef struct {
     mtexinfo_t          *texinfo;
 } mbrushside_t;
 
+// brush side planes repacked in structure of arrays layout, so that
+// collision code can test several of them at once
+#define BRUSH_BLOCK_PLANES      4
+#define BRUSH_NUM_BLOCKS(n)     (((n) + BRUSH_BLOCK_PLANES - 1) / BRUSH_BLOCK_PLANES)
+
+typedef struct {
+    float               normal[3][BRUSH_BLOCK_PLANES];
+    float               dist[BRUSH_BLOCK_PLANES];
+} mbrushblock_t;
+
 typedef struct {
     int                 contents;
     int                 numsides;
     mbrushside_t        *firstbrushside;
+    mbrushblock_t       *blocks;
     int                 checkcount;        // to avoid repeated testings
 } mbrush_t;
 
@@ -220,10 +231,12 @@ typedef struct bsp_s {
 
     int             numbrushes;
     mbrush_t        *brushes;
+    mbrushblock_t   *brushblocks;   // side planes of all brushes
 
     int             numvisibility;
     int             visrowsize;
     dvis_t          *vis;
+    struct visstore_s *phs;     // decompressed PHS rows
 
     int             numentitychars;
     char            *entitystring;
@@ -290,6 +303,7 @@ void BSP_TransformedLightPoint(lightpoint_t *point, const vec3_t start, const ve
 byte *BSP_ClusterVis(bsp_t *bsp, byte *mask, int cluster, int vis);
 mleaf_t *BSP_PointLeaf(mnode_t *node, const vec3_t p);
 mmodel_t *BSP_InlineModel(bsp_t *bsp, const char *name);
+void BSP_PackBrushSides(mbrushblock_t *blocks, const mbrushside_t *sides, int numsides);
 
 byte* BSP_GetPvs(bsp_t *bsp, int cluster);
 byte* BSP_GetPvs2(bsp_t *bsp, int cluster);
@@ -66,6 +66,13 @@ void        CM_TransformedBoxTrace(trace_t *trace,
                                    const vec3_t origin, const vec3_t angles);
 void        CM_ClipEntity(trace_t *dst, const trace_t *src, struct edict_s *ent);
 
+// records inputs of the next count traces run against the map, then saves
+// them to traces/filename.trc, if given
+void        CM_RecordTraces(cm_t *cm, int count, const char *filename);
+
+// replays recorded traces through scalar and vectorized brush tests
+void        CM_TraceBench(cm_t *cm, int iterations, const char *filename);
+
 // call with topnode set to the headnode, returns with topnode
 // set to the first node that splits the box
 int         CM_BoxLeafs(cm_t *cm, const vec3_t mins, const vec3_t maxs,
@@ -73,6 +80,8 @@ int         CM_BoxLeafs(cm_t *cm, const vec3_t mins, const vec3_t maxs,
 mleaf_t     *CM_PointLeaf(cm_t *cm, const vec3_t p);
 
 byte        *CM_FatPVS(cm_t *cm, byte *mask, const vec3_t org, int vis);
+int         CM_FatClusters(cm_t *cm, int *clusters, int maxclusters, const vec3_t org);
+byte        *CM_ClusterListVis(cm_t *cm, byte *mask, const int *clusters, int numclusters, int vis);
 
 void        CM_SetAreaPortalState(cm_t *cm, int portalnum, bool open);
 bool        CM_GetAreaPortalState(cm_t *cm, int portalnum);
@@ -147,4 +147,70 @@ char *Cvar_VariableString(const char *var_name);
 
 void Cvar_Set_f(void);
 
+/*
+Bound cvars resolve their name once, on first use, and keep the cvar_t
+pointer afterwards. Use them in code that runs every frame instead of
+calling Cvar_Get or Cvar_VariableValue by name.
+
+static cvarbind_t tm_knee_start = CVAR_BIND("tm_knee_start", "0.9", 0);
+...
+if (Cvar_BindChanged(&tm_knee_start))
+    rebuild_curve(Cvar_BoundValue(&tm_knee_start));
+*/
+
+typedef struct {
+    const char  *name;
+    const char  *default_string;
+    int         flags;
+    cvar_t      *var;
+    int         modified_count;
+} cvarbind_t;
+
+#define CVAR_BIND(name, value, flags) \
+    { name, value, flags, NULL, -1 }
+
+cvar_t *Cvar_Bind(cvarbind_t *bind);
+// looks up or creates the variable and caches it in the binding
+
+bool Cvar_BindChanged(cvarbind_t *bind);
+// returns true once after each change (and on first call)
+
+static inline cvar_t *Cvar_BoundVar(cvarbind_t *bind)
+{
+    return bind->var ? bind->var : Cvar_Bind(bind);
+}
+
+static inline int Cvar_BoundInteger(cvarbind_t *bind)
+{
+    return Cvar_BoundVar(bind)->integer;
+}
+
+static inline float Cvar_BoundValue(cvarbind_t *bind)
+{
+    return Cvar_BoundVar(bind)->value;
+}
+
+static inline const char *Cvar_BoundString(cvarbind_t *bind)
+{
+    return Cvar_BoundVar(bind)->string;
+}
+
+#if USE_DEBUG
+// with cvar_debug_lookups enabled, every lookup by name is attributed to
+// the file and line it came from and reported at the end of the frame
+void Cvar_LookupSite(const char *file, int line);
+void Cvar_LookupFrame(void);
+
+#define CVAR_SITE(call) \
+    (Cvar_LookupSite(__FILE__, __LINE__), call)
+
+#define Cvar_FindVar(name)              CVAR_SITE(Cvar_FindVar(name))
+#define Cvar_Get(name, value, flags)    CVAR_SITE(Cvar_Get(name, value, flags))
+#define Cvar_SetEx(name, value, from)   CVAR_SITE(Cvar_SetEx(name, value, from))
+#define Cvar_Set(name, value)           CVAR_SITE(Cvar_Set(name, value))
+#define Cvar_VariableValue(name)        CVAR_SITE(Cvar_VariableValue(name))
+#define Cvar_VariableInteger(name)      CVAR_SITE(Cvar_VariableInteger(name))
+#define Cvar_VariableString(name)       CVAR_SITE(Cvar_VariableString(name))
+#endif
+
 #endif // CVAR_H
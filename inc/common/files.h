@@ -92,6 +92,7 @@ typedef struct file_info_s {
 #define FS_LoadFileFlags(path, buf, flags)  \
                                 FS_LoadFileEx(path, buf, (flags), TAG_FILESYSTEM)
 #define FS_FreeFile(buf)        Z_Free(buf)
+#define FS_MapFile(path, buf)   FS_MapFileEx(path, buf, 0)
 
 // just regular malloc for now
 #define FS_AllocTempMem(size)   FS_Malloc(size)
@@ -113,11 +114,13 @@ int FS_RenameFile(const char *from, const char *to);
 #endif
 
 int FS_CreatePath(char *path);
+void FS_FlushLookupCache(void);
 
 char    *FS_CopyExtraInfo(const char *name, const file_info_t *info);
 
 int64_t FS_OpenFile(const char *filename, qhandle_t *f, unsigned mode);
 int     FS_CloseFile(qhandle_t f);
+int     FS_GetFileInfo(qhandle_t f, file_info_t *info);
 qhandle_t FS_EasyOpenFile(char *buf, size_t size, unsigned mode,
                           const char *dir, const char *name, const char *ext);
 
@@ -130,6 +133,9 @@ int FS_LoadFileEx(const char *path, void **buffer, unsigned flags, unsigned tag)
 // a NULL buffer will just return the file length without loading
 // length < 0 indicates error
 
+int FS_MapFileEx(const char *path, const void **buffer, unsigned flags);
+void FS_UnmapFile(const void *buffer);
+
 int FS_WriteFile(const char *path, const void *data, size_t len);
 
 bool FS_EasyWriteFile(char *buf, size_t size, unsigned mode,
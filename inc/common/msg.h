@@ -41,7 +41,8 @@ typedef enum {
 extern sizebuf_t    msg_write;
 extern byte         msg_write_buffer[MAX_MSGLEN];
 
-extern sizebuf_t    msg_read;
+// thread local, so that independent messages can be parsed in parallel
+extern q_thread_local sizebuf_t msg_read;
 extern byte         msg_read_buffer[MAX_MSGLEN];
 
 extern const entity_state_t    nullEntityState;
@@ -62,14 +63,18 @@ void    MSG_WriteCoord(float f);
 void    MSG_WritePos(const vec3_t pos);
 void    MSG_WriteAngle(float f);
 void    MSG_WriteAngle16(float f);
-#if USE_CLIENT
 void    MSG_WriteBits(int value, int bits);
 int     MSG_WriteDeltaUsercmd(const usercmd_t *from, const usercmd_t *cmd);
-#endif
 void    MSG_WriteDir(const vec3_t vector);
 uint32_t MSG_EntityWillWrite(const entity_state_t *from,
                              const entity_state_t *to,
                              msgEsFlags_t         flags);
+uint32_t MSG_EntityWillWriteScalar(const entity_state_t *from,
+                                   const entity_state_t *to,
+                                   msgEsFlags_t         flags);
+void MSG_WriteDeltaEntityBits(const entity_state_t *to,
+                              uint32_t             bits,
+                              msgEsFlags_t         flags);
 void MSG_WriteDeltaEntity(const entity_state_t *from,
                           const entity_state_t *to,
                           msgEsFlags_t         flags);
@@ -104,19 +109,15 @@ float   MSG_ReadFloat(void);
 uint64_t MSG_ReadVarInt(void);
 size_t  MSG_ReadString(char *dest, size_t size);
 size_t  MSG_ReadStringLine(char *dest, size_t size);
-#if USE_CLIENT
 void    MSG_ReadPos(vec3_t pos);
 void    MSG_ReadDir(vec3_t vector);
-#endif
 int     MSG_ReadBits(int bits);
 void    MSG_ReadDeltaUsercmd(const usercmd_t *from, usercmd_t *to);
 int     MSG_ParseEntityBits(int *bits, msgEsFlags_t flags);
 void    MSG_ParseDeltaEntity(const entity_state_t *from, entity_state_t *to, int number, int bits, msgEsFlags_t flags);
 void    MSG_ParseDeltaPacketEntity(const entity_state_t *from, entity_state_t *to, int number, int bits, msgEsFlags_t flags);
 void    MSG_ParseDeltaAmbientEntity(const entity_state_t *from, entity_state_t *to, int number, int bits, msgEsFlags_t flags);
-#if USE_CLIENT
 void    MSG_ParseDeltaPlayerstate(const player_state_t *from, player_state_t *to, int flags, int extraflags);
-#endif
 
 #if USE_DEBUG
 #if USE_CLIENT
@@ -205,6 +205,7 @@ void        NET_UpdateStats(void);
 
 bool        NET_GetAddress(netsrc_t sock, netadr_t *adr);
 void        NET_GetPackets(netsrc_t sock, void (*packet_cb)(void));
+void        NET_FlushPackets(void);
 bool        NET_SendPacket(netsrc_t sock, const void *data,
                            size_t len, const netadr_t *to);
 
@@ -225,6 +226,11 @@ neterr_t    NET_RunConnect(netstream_t *s);
 neterr_t    NET_RunStream(netstream_t *s);
 void        NET_UpdateStream(netstream_t *s);
 
+qsocket_t   NET_OpenUdpSocket(const char *iface, netadr_t *adr);
+void        NET_CloseUdpSocket(qsocket_t sock);
+int         NET_RecvUdp(qsocket_t sock, void *data, size_t len, netadr_t *from);
+int         NET_SendUdp(qsocket_t sock, const void *data, size_t len, const netadr_t *to);
+
 ioentry_t   *NET_AddFd(qsocket_t fd);
 void        NET_RemoveFd(qsocket_t fd);
 int         NET_Sleep(int msec);
@@ -0,0 +1,54 @@
+/*
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef PROF_H
+#define PROF_H
+
+//
+// server frame zone profiler
+//
+
+typedef enum {
+    PROF_FRAME,         // whole server frame
+    PROF_PACKETS,       // receiving and processing packets
+    PROF_GAME,          // game frame
+    PROF_AMBIENT,       // ambient entity checks
+    PROF_SEND,          // sending messages to clients
+    PROF_BUILD,         // building client frames
+    PROF_BUILD_JOB,     // single job of parallel frame building
+    PROF_WRITE,         // writing client frame
+    PROF_NETSEND,       // flushing queued packets
+
+    PROF_NUM_ZONES
+} profzone_t;
+
+extern int prof_enabled;
+
+void PROF_Init(void);
+void PROF_BeginZone(profzone_t zone);
+void PROF_EndZone(profzone_t zone);
+void PROF_EndFrame(void);
+void PROF_Hold(bool hold);
+unsigned PROF_FrameTime(profzone_t zone);
+const char *PROF_ZoneName(profzone_t zone);
+
+// zones of the same kind may not nest on one thread
+#define PROF_Begin(zone) \
+    do { if (prof_enabled) PROF_BeginZone(zone); } while (0)
+#define PROF_End(zone) \
+    do { if (prof_enabled) PROF_EndZone(zone); } while (0)
+
+#endif // PROF_H
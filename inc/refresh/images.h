@@ -106,6 +106,9 @@ void IMG_ReloadAll(void);
 image_t *IMG_Find(const char *name, imagetype_t type, imageflags_t flags);
 image_t *IMG_FindExisting(const char *name, imagetype_t type);
 image_t *IMG_Clone(image_t *image, const char* new_name);
+void IMG_FinishLoad(image_t *image);
+void IMG_FinishLoads(void);
+void IMG_CacheEmissiveInfo(const image_t *image);
 void IMG_FreeUnused(void);
 void IMG_FreeAll(void);
 void IMG_Init(void);
@@ -128,6 +128,9 @@ void R_ComputeIQMLocalSpaceMatricesFromRelative(const iqm_model_t *model, const
 // compute world space matrices for the given pose transformations.
 void R_ComputeIQMWorldSpaceMatricesFromRelative(const iqm_model_t *model, const iqm_transform_t *relativeJoints, float *pose_matrices);
 
+// compare the vectorized pose evaluation against the scalar code
+void MOD_IQMBench_f(void);
+
 // these are implemented in [gl,sw]_models.c
 typedef int (*mod_load_t)(model_t *, const void *, size_t, const char*);
 int MOD_LoadMD2(model_t *model, const void *rawdata, size_t length, const char* mod_name);
@@ -128,6 +128,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #endif
 
 #define q_unused            __attribute__((unused))
+#define q_thread_local      __thread
 
 #else /* __GNUC__ */
 
@@ -148,5 +149,6 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #endif
 
 #define q_unused
+#define q_thread_local      __declspec(thread)
 
 #endif /* !__GNUC__ */
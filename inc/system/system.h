@@ -35,6 +35,7 @@ void    Sys_FreeLibrary(void *handle);
 void    *Sys_GetProcAddress(void *handle, const char *sym);
 
 unsigned Sys_Milliseconds(void);
+uint64_t Sys_Microseconds(void);
 void     Sys_Sleep(int msec);
 
 void    Sys_Init(void);
@@ -61,9 +62,42 @@ void    Sys_ListFiles_r(listfiles_t *list, const char *path, int depth);
 bool    Sys_IsDir(const char *path);
 bool    Sys_IsFile(const char *path);
 
+typedef struct {
+    void    *base;
+    size_t  size;
+} mappedfile_t;
+
+// maps part of an open file read-only, returns pointer to data at offset
+const void  *Sys_MapFile(FILE *fp, int64_t offset, size_t length, mappedfile_t *map);
+void        Sys_UnmapFile(mappedfile_t *map);
+
 void    Sys_DebugBreak(void);
 
-#if USE_CLIENT
+typedef enum {
+    JOB_HIGH,       // work the current frame is waiting for
+    JOB_NORMAL,     // loading work somebody will wait for
+    JOB_LOW,        // background work nobody waits for
+    JOB_NUM_PRIORITIES
+} jobpriority_t;
+
+// number of queued and running jobs, protected by the job system
+typedef struct {
+    int     pending;
+} jobcounter_t;
+
+typedef void (*jobfunc_t)(void *arg);
+typedef void (*parallelfunc_t)(void *arg, int index);
+
+#define MAX_JOB_THREADS     16
+
+int  Sys_NumParallelThreads(void);
+int  Sys_ThreadIndex(void);
+void Sys_QueueJob(jobfunc_t func, void *arg, jobpriority_t priority, jobcounter_t *counter);
+bool Sys_JobsPending(jobcounter_t *counter);
+void Sys_WaitForJobs(jobcounter_t *counter);
+void Sys_ParallelFor(int count, parallelfunc_t func, void *arg);
+void Sys_ShutdownJobs(void);
+
 typedef struct asyncwork_s {
     void (*work_cb)(void *);
     void (*done_cb)(void *);
@@ -72,9 +106,7 @@ typedef struct asyncwork_s {
 } asyncwork_t;
 
 void Sys_QueueAsyncWork(asyncwork_t *work);
-void Sys_ShutdownAsyncQueue(void);
 void Sys_CompleteAsyncQueue(void);
-#endif
 
 extern cvar_t   *sys_basedir;
 extern cvar_t   *sys_libdir;
@@ -436,6 +436,10 @@ typedef struct client_static_s {
         int         file_percent;
         sizebuf_t   buffer;
         list_t      snapshots;
+        struct demoindex_s  *index;     // snapshots loaded from seek index file
+        int         numindex;
+        qhandle_t   indexfile;
+        char        indexpath[MAX_OSPATH];
         bool        paused;
         bool        seeking;
         bool        eof;
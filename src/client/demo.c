@@ -21,6 +21,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 //
 
 #include "client.h"
+#include "common/intreadwrite.h"
 
 static byte     demo_buffer[MAX_MSGLEN];
 
@@ -670,6 +671,7 @@ static void CL_PlayDemo_f(void)
 
     cls.demo.playback = f;
     cls.state = ca_connected;
+    Q_concat(cls.demo.indexpath, sizeof(cls.demo.indexpath), name, ".idx");
     Q_strlcpy(cls.servername, COM_SkipPath(name), sizeof(cls.servername));
     cls.serverAddress.type = NA_LOOPBACK;
 
@@ -721,6 +723,10 @@ void CL_EmitDemoSnapshot(void)
     if (cl_demosnaps->integer <= 0)
         return;
 
+    // indexed snapshots cover the whole demo
+    if (cls.demo.index)
+        return;
+
     if (cls.demo.frames_read < cls.demo.last_snapshot + cl_demosnaps->integer * 10)
         return;
 
@@ -802,6 +808,254 @@ static demosnap_t *find_snapshot(int framenum)
     return prev;
 }
 
+static void parse_info_string(demoInfo_t *info, int clientNum, int index, const char *string)
+{
+    size_t len;
+    char *p;
+
+    if (index >= CS_PLAYERSKINS && index < CS_PLAYERSKINS + MAX_CLIENTS) {
+        if (index - CS_PLAYERSKINS == clientNum) {
+            Q_strlcpy(info->pov, string, sizeof(info->pov));
+            p = strchr(info->pov, '\\');
+            if (p) {
+                *p = 0;
+            }
+        }
+    } else if (index == CS_MODELS + 1) {
+        len = strlen(string);
+        if (len > 9) {
+            memcpy(info->map, string + 5, len - 9);   // skip "maps/"
+            info->map[len - 9] = 0; // cut off ".bsp"
+        }
+    }
+}
+
+/*
+===============================================================================
+
+SEEK INDEX
+
+Snapshots emitted while parsing the whole demo can be saved to a file next
+to it, so that later playback can seek anywhere by reading the nearest
+snapshot instead of parsing preceding frames. The file also keeps demo info
+for the demo browser. All values are little endian.
+
+header:
+    ident, version          2 x uint32
+    demo file length        int64
+    number of frames        uint32
+    number of snapshots     uint32
+    map, pov                char[MAX_QPATH], char[MAX_CLIENT_NAME]
+snapshot table, sorted by frame number:
+    frame number, length    2 x uint32
+    demo file position      int64
+    data position           int64
+snapshot data
+
+===============================================================================
+*/
+
+#define DEMOINDEX_IDENT     MakeLittleLong('D','I','D','X')
+#define DEMOINDEX_VERSION   1
+#define DEMOINDEX_HEADER    (24 + MAX_QPATH + MAX_CLIENT_NAME)
+#define DEMOINDEX_ENTRY     24
+#define DEMOINDEX_MAXSNAPS  0x100000
+
+typedef struct demoindex_s {
+    int         framenum;
+    unsigned    msglen;
+    int64_t     filepos;
+    int64_t     dataofs;
+} demoindex_t;
+
+typedef struct {
+    int64_t     length;
+    int         numframes;
+    int         numsnaps;
+    demoInfo_t  info;
+} demoindexheader_t;
+
+static bool read_index_header(qhandle_t f, demoindexheader_t *header)
+{
+    byte buf[DEMOINDEX_HEADER];
+
+    if (FS_Read(buf, sizeof(buf), f) != sizeof(buf))
+        return false;
+    if (RL32(buf) != DEMOINDEX_IDENT || RL32(buf + 4) != DEMOINDEX_VERSION)
+        return false;
+
+    header->length = RL64(buf + 8);
+    header->numframes = RL32(buf + 16);
+    header->numsnaps = RL32(buf + 20);
+    memcpy(header->info.map, buf + 24, MAX_QPATH);
+    memcpy(header->info.pov, buf + 24 + MAX_QPATH, MAX_CLIENT_NAME);
+    header->info.map[MAX_QPATH - 1] = 0;
+    header->info.pov[MAX_CLIENT_NAME - 1] = 0;
+
+    return header->numframes >= 0 && header->numsnaps >= 0 &&
+           header->numsnaps <= header->numframes && header->numsnaps <= DEMOINDEX_MAXSNAPS;
+}
+
+// opens index file and checks it was made for the demo of given length
+static qhandle_t open_index(const char *path, int64_t length, demoindexheader_t *header)
+{
+    qhandle_t f;
+
+    if (length <= 0)
+        return 0;
+
+    FS_OpenFile(path, &f, FS_MODE_READ);
+    if (!f)
+        return 0;
+
+    if (!read_index_header(f, header) || header->length != length) {
+        Com_DPrintf("Ignoring stale or invalid %s\n", path);
+        FS_CloseFile(f);
+        return 0;
+    }
+
+    return f;
+}
+
+static void load_index(void)
+{
+    demoindexheader_t header;
+    demoindex_t *index;
+    byte *buf, *p;
+    qhandle_t f;
+    int i;
+
+    f = open_index(cls.demo.indexpath, FS_Length(cls.demo.playback), &header);
+    if (!f)
+        return;
+
+    buf = Z_Malloc(header.numsnaps * DEMOINDEX_ENTRY + 1);
+    if (FS_Read(buf, header.numsnaps * DEMOINDEX_ENTRY, f) != header.numsnaps * DEMOINDEX_ENTRY) {
+        Com_WPrintf("Couldn't read %s\n", cls.demo.indexpath);
+        goto fail;
+    }
+
+    index = Z_Malloc(header.numsnaps * sizeof(index[0]) + 1);
+    for (i = 0, p = buf; i < header.numsnaps; i++, p += DEMOINDEX_ENTRY) {
+        index[i].framenum = RL32(p);
+        index[i].msglen = RL32(p + 4);
+        index[i].filepos = RL64(p + 8);
+        index[i].dataofs = RL64(p + 16);
+        if (index[i].msglen > MAX_MSGLEN || (i && index[i].framenum <= index[i - 1].framenum)) {
+            Com_WPrintf("Bad snapshot in %s\n", cls.demo.indexpath);
+            Z_Free(index);
+            goto fail;
+        }
+    }
+
+    Z_Free(buf);
+
+    Com_DPrintf("Loaded %d snapshots from %s\n", header.numsnaps, cls.demo.indexpath);
+    cls.demo.index = index;
+    cls.demo.numindex = header.numsnaps;
+    cls.demo.indexfile = f;
+    return;
+
+fail:
+    Z_Free(buf);
+    FS_CloseFile(f);
+}
+
+// returns the last indexed snapshot not after framenum
+static const demoindex_t *find_index(int framenum)
+{
+    int lo = 0, hi = cls.demo.numindex - 1, mid;
+
+    if (!cls.demo.numindex || cls.demo.index[0].framenum > framenum)
+        return NULL;
+
+    while (lo < hi) {
+        mid = (lo + hi + 1) / 2;
+        if (cls.demo.index[mid].framenum > framenum)
+            hi = mid - 1;
+        else
+            lo = mid;
+    }
+
+    return &cls.demo.index[lo];
+}
+
+static int read_index(const demoindex_t *snap)
+{
+    int ret;
+
+    ret = FS_Seek(cls.demo.indexfile, snap->dataofs, SEEK_SET);
+    if (ret < 0)
+        return ret;
+
+    SZ_Init(&msg_read, msg_read_buffer, sizeof(msg_read_buffer));
+    msg_read.cursize = snap->msglen;
+
+    ret = FS_Read(msg_read.data, snap->msglen, cls.demo.indexfile);
+    if (ret != snap->msglen)
+        return ret < 0 ? ret : Q_ERR_UNEXPECTED_EOF;
+
+    return 0;
+}
+
+static void write_index_header(qhandle_t f, int numframes, int numsnaps)
+{
+    byte buf[DEMOINDEX_HEADER];
+    demoInfo_t info;
+
+    memset(&info, 0, sizeof(info));
+    parse_info_string(&info, cl.clientNum, CS_MODELS + 1, cl.baseconfigstrings[CS_MODELS + 1]);
+    parse_info_string(&info, cl.clientNum, CS_PLAYERSKINS + cl.clientNum,
+                      cl.baseconfigstrings[CS_PLAYERSKINS + cl.clientNum]);
+
+    memset(buf, 0, sizeof(buf));
+    WL32(buf, DEMOINDEX_IDENT);
+    WL32(buf + 4, DEMOINDEX_VERSION);
+    WL64(buf + 8, FS_Length(cls.demo.playback));
+    WL32(buf + 16, numframes);
+    WL32(buf + 20, numsnaps);
+    memcpy(buf + 24, info.map, MAX_QPATH);
+    memcpy(buf + 24 + MAX_QPATH, info.pov, MAX_CLIENT_NAME);
+
+    FS_Write(buf, sizeof(buf), f);
+}
+
+static int write_index(int numframes)
+{
+    byte buf[DEMOINDEX_ENTRY];
+    demosnap_t *snap;
+    int64_t dataofs;
+    int numsnaps;
+    qhandle_t f;
+    int ret;
+
+    numsnaps = 0;
+    LIST_FOR_EACH(demosnap_t, snap, &cls.demo.snapshots, entry)
+        numsnaps++;
+
+    ret = FS_OpenFile(cls.demo.indexpath, &f, FS_MODE_WRITE);
+    if (!f)
+        return ret;
+
+    write_index_header(f, numframes, numsnaps);
+
+    dataofs = DEMOINDEX_HEADER + numsnaps * DEMOINDEX_ENTRY;
+    LIST_FOR_EACH(demosnap_t, snap, &cls.demo.snapshots, entry) {
+        WL32(buf, snap->framenum);
+        WL32(buf + 4, snap->msglen);
+        WL64(buf + 8, snap->filepos);
+        WL64(buf + 16, dataofs);
+        FS_Write(buf, sizeof(buf), f);
+        dataofs += snap->msglen;
+    }
+
+    LIST_FOR_EACH(demosnap_t, snap, &cls.demo.snapshots, entry)
+        FS_Write(snap->data, snap->msglen, f);
+
+    ret = FS_CloseFile(f);
+    return ret < 0 ? ret : numsnaps;
+}
+
 /*
 ====================
 CL_FirstDemoFrame
@@ -840,49 +1094,65 @@ void CL_FirstDemoFrame(void)
 
     // force initial snapshot
     cls.demo.last_snapshot = INT_MIN;
+
+    if (!cls.demo.index)
+        load_index();
 }
 
-static void CL_Seek_f(void)
+// rewinds demo file and client state to a snapshot already in msg_read
+static bool restore_snapshot(int framenum, int64_t filepos)
 {
-    demosnap_t *snap;
-    int i, j, ret, index, frames, dest, prev;
     char *from, *to;
+    int i, ret;
 
-    if (Cmd_Argc() < 2) {
-        Com_Printf("Usage: %s [+-]<timespec>\n", Cmd_Argv(0));
-        return;
+    ret = FS_Seek(cls.demo.playback, filepos, SEEK_SET);
+    if (ret < 0) {
+        Com_EPrintf("Couldn't seek demo: %s\n", Q_ErrorString(ret));
+        return false;
     }
 
-    if (!cls.demo.playback) {
-        Com_Printf("Not playing a demo.\n");
-        return;
-    }
+    // clear end-of-file flag
+    cls.demo.eof = false;
 
-    to = Cmd_Argv(1);
+    // reset configstrings
+    for (i = 0; i < MAX_CONFIGSTRINGS; i++) {
+        from = cl.baseconfigstrings[i];
+        to = cl.configstrings[i];
 
-    if (*to == '-' || *to == '+') {
-        // relative to current frame
-        if (!Com_ParseTimespec(to + 1, &frames)) {
-            Com_Printf("Invalid relative timespec.\n");
-            return;
-        }
-        if (*to == '-')
-            frames = -frames;
-        dest = cls.demo.frames_read + frames;
-    } else {
-        // relative to first frame
-        if (!Com_ParseTimespec(to, &dest)) {
-            Com_Printf("Invalid absolute timespec.\n");
-            return;
-        }
-        frames = dest - cls.demo.frames_read;
+        if (!strcmp(from, to))
+            continue;
+
+        Q_SetBit(cl.dcs, i);
+        strcpy(to, from);
     }
 
+    CL_SeekDemoMessage();
+    cls.demo.frames_read = framenum;
+    Com_DPrintf("[%d] after snap parse %d\n", cls.demo.frames_read, cl.frame.number);
+    return true;
+}
+
+/*
+====================
+seek_demo
+
+Seeks to the given demo frame, or to the last frame if it is past the end.
+With `stop_at_eof', end of demo doesn't finish playback even if cl_demowait
+is disabled.
+====================
+*/
+static void seek_demo(int dest, bool stop_at_eof)
+{
+    const demoindex_t *indexed;
+    demosnap_t *snap;
+    int i, j, ret, index, frames, prev;
+
+    frames = dest - cls.demo.frames_read;
     if (!frames)
         // already there
         return;
 
-    if (frames > 0 && cls.demo.eof && cl_demowait->integer)
+    if (frames > 0 && cls.demo.eof && (cl_demowait->integer || stop_at_eof))
         // already at end
         return;
 
@@ -901,38 +1171,32 @@ static void CL_Seek_f(void)
     Com_DPrintf("[%d] seeking to %d\n", cls.demo.frames_read, dest);
 
     // seek to the previous most recent snapshot
-    if (frames < 0 || cls.demo.last_snapshot > cls.demo.frames_read) {
-        snap = find_snapshot(dest);
+    if (cls.demo.index) {
+        indexed = find_index(dest);
 
-        if (snap) {
-            Com_DPrintf("found snap at %d\n", snap->framenum);
-            ret = FS_Seek(cls.demo.playback, snap->filepos, SEEK_SET);
+        // skip snapshots behind when seeking forward
+        if (indexed && (frames < 0 || indexed->framenum > cls.demo.frames_read)) {
+            Com_DPrintf("found indexed snap at %d\n", indexed->framenum);
+            ret = read_index(indexed);
             if (ret < 0) {
-                Com_EPrintf("Couldn't seek demo: %s\n", Q_ErrorString(ret));
+                Com_EPrintf("Couldn't read %s: %s\n", cls.demo.indexpath, Q_ErrorString(ret));
                 goto done;
             }
+            if (!restore_snapshot(indexed->framenum, indexed->filepos))
+                goto done;
+        } else if (frames < 0) {
+            Com_Printf("Couldn't seek backwards without snapshots!\n");
+            goto done;
+        }
+    } else if (frames < 0 || cls.demo.last_snapshot > cls.demo.frames_read) {
+        snap = find_snapshot(dest);
 
-            // clear end-of-file flag
-            cls.demo.eof = false;
-
-            // reset configstrings
-            for (i = 0; i < MAX_CONFIGSTRINGS; i++) {
-                from = cl.baseconfigstrings[i];
-                to = cl.configstrings[i];
-
-                if (!strcmp(from, to))
-                    continue;
-
-                Q_SetBit(cl.dcs, i);
-                strcpy(to, from);
-            }
-
+        if (snap) {
+            Com_DPrintf("found snap at %d\n", snap->framenum);
             SZ_Init(&msg_read, snap->data, snap->msglen);
             msg_read.cursize = snap->msglen;
-
-            CL_SeekDemoMessage();
-            cls.demo.frames_read = snap->framenum;
-            Com_DPrintf("[%d] after snap parse %d\n", cls.demo.frames_read, cl.frame.number);
+            if (!restore_snapshot(snap->framenum, snap->filepos))
+                goto done;
         } else if (frames < 0) {
             Com_Printf("Couldn't seek backwards without snapshots!\n");
             goto done;
@@ -942,7 +1206,7 @@ static void CL_Seek_f(void)
     // skip forward to destination frame
     while (cls.demo.frames_read < dest) {
         ret = read_next_message(cls.demo.playback);
-        if (ret == 0 && cl_demowait->integer) {
+        if (ret == 0 && (cl_demowait->integer || stop_at_eof)) {
             cls.demo.eof = true;
             break;
         }
@@ -993,45 +1257,115 @@ done:
     cls.demo.seeking = false;
 }
 
-static void parse_info_string(demoInfo_t *info, int clientNum, int index, const char *string)
+static void CL_Seek_f(void)
 {
-    size_t len;
-    char *p;
+    int frames, dest;
+    char *to;
 
-    if (index >= CS_PLAYERSKINS && index < CS_PLAYERSKINS + MAX_CLIENTS) {
-        if (index - CS_PLAYERSKINS == clientNum) {
-            Q_strlcpy(info->pov, string, sizeof(info->pov));
-            p = strchr(info->pov, '\\');
-            if (p) {
-                *p = 0;
-            }
+    if (Cmd_Argc() < 2) {
+        Com_Printf("Usage: %s [+-]<timespec>\n", Cmd_Argv(0));
+        return;
+    }
+
+    if (!cls.demo.playback) {
+        Com_Printf("Not playing a demo.\n");
+        return;
+    }
+
+    to = Cmd_Argv(1);
+
+    if (*to == '-' || *to == '+') {
+        // relative to current frame
+        if (!Com_ParseTimespec(to + 1, &frames)) {
+            Com_Printf("Invalid relative timespec.\n");
+            return;
         }
-    } else if (index == CS_MODELS + 1) {
-        len = strlen(string);
-        if (len > 9) {
-            memcpy(info->map, string + 5, len - 9);   // skip "maps/"
-            info->map[len - 9] = 0; // cut off ".bsp"
+        if (*to == '-')
+            frames = -frames;
+        dest = cls.demo.frames_read + frames;
+    } else {
+        // relative to first frame
+        if (!Com_ParseTimespec(to, &dest)) {
+            Com_Printf("Invalid absolute timespec.\n");
+            return;
         }
     }
+
+    seek_demo(dest, false);
+}
+
+/*
+====================
+CL_IndexDemo_f
+
+Parses the rest of the demo being played to emit snapshots for all of it,
+saves them to the seek index file and returns to the current frame.
+====================
+*/
+static void CL_IndexDemo_f(void)
+{
+    int frame, ret;
+
+    if (!cls.demo.playback) {
+        Com_Printf("Not playing a demo.\n");
+        return;
+    }
+
+    if (cls.demo.index) {
+        Com_Printf("Demo is already indexed.\n");
+        return;
+    }
+
+    if (cls.state != ca_active || !cls.demo.file_size || cl_demosnaps->integer <= 0) {
+        Com_Printf("Can't index this demo.\n");
+        return;
+    }
+
+    frame = cls.demo.frames_read;
+    seek_demo(INT_MAX, true);
+
+    ret = write_index(cls.demo.frames_read);
+    if (ret < 0)
+        Com_EPrintf("Couldn't write %s: %s\n", cls.demo.indexpath, Q_ErrorString(ret));
+    else
+        Com_Printf("Wrote %d snapshots for %d frames to %s.\n", ret,
+                   cls.demo.frames_read, cls.demo.indexpath);
+
+    seek_demo(frame, true);
 }
 
 /*
 ====================
 CL_GetDemoInfo
+
+Takes info from the seek index file if there is one for the demo.
 ====================
 */
 demoInfo_t *CL_GetDemoInfo(const char *path, demoInfo_t *info)
 {
-    qhandle_t f;
+    demoindexheader_t header;
+    char buffer[MAX_OSPATH];
+    qhandle_t f, g;
     int index;
     char string[MAX_QPATH];
     int clientNum, type;
+    int64_t length;
 
-    FS_OpenFile(path, &f, FS_MODE_READ | FS_FLAG_GZIP);
+    length = FS_OpenFile(path, &f, FS_MODE_READ | FS_FLAG_GZIP);
     if (!f) {
         return NULL;
     }
 
+    if (Q_concat(buffer, sizeof(buffer), path, ".idx") < sizeof(buffer)) {
+        g = open_index(buffer, length, &header);
+        if (g) {
+            FS_CloseFile(g);
+            FS_CloseFile(f);
+            *info = header.info;
+            return info;
+        }
+    }
+
     type = read_first_message(f);
     if (type < 0) {
         goto fail;
@@ -1125,6 +1459,10 @@ void CL_CleanupDemos(void)
     if (total)
         Com_DPrintf("Freed %zu bytes of snaps\n", total);
 
+    if (cls.demo.indexfile)
+        FS_CloseFile(cls.demo.indexfile);
+    Z_Free(cls.demo.index);
+
     memset(&cls.demo, 0, sizeof(cls.demo));
 
     List_Init(&cls.demo.snapshots);
@@ -1176,6 +1514,7 @@ static const cmdreg_t c_demo[] = {
     { "stop", CL_Stop_f },
     { "suspend", CL_Suspend_f },
     { "seek", CL_Seek_f },
+    { "indexdemo", CL_IndexDemo_f },
 
     { NULL }
 };
@@ -870,6 +870,7 @@ fail2:
             if (rename(dl->path, temp))
                 Com_EPrintf("[HTTP] Failed to rename '%s' to '%s': %s\n",
                             dl->path, dl->queue->path, strerror(errno));
+            FS_FlushLookupCache();
             dl->path[0] = 0;
 
             //a pak file is very special...
@@ -1305,6 +1305,214 @@ static int BSP_ValidateAreaPortals(bsp_t *bsp)
     return Q_ERR_SUCCESS;
 }
 
+/*
+===============================================================================
+
+VISIBILITY STORE
+
+Decompressed visibility rows in a compact form that still allows fetching
+any row directly. Identical rows are stored once. A row is kept as a list of
+its nonzero 64-bit words, or as a plain bitmap if it is dense enough that
+the word indices would not pay off. This keeps memory well below the
+numclusters^2 bits of a full matrix on maps with many clusters.
+
+===============================================================================
+*/
+
+typedef struct {
+    uint32_t    first;      // index into words
+    uint16_t    count;      // number of stored words
+    bool        dense;      // count covers the whole row
+} visrow_t;
+
+typedef struct visstore_s {
+    int         numwords;
+    int         numrows;
+    uint32_t    *clusters;  // row number for each cluster
+    visrow_t    *rows;
+    uint16_t    *index;     // word position for each word of sparse rows
+    uint64_t    *words;
+    size_t      numstored;
+} visstore_t;
+
+static uint32_t hash_vis_row(const uint64_t *row, int numwords)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    int i;
+
+    for (i = 0; i < numwords; i++) {
+        hash ^= row[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return (uint32_t)(hash ^ (hash >> 32));
+}
+
+static bool vis_row_equal(const visstore_t *store, const visrow_t *row, const uint64_t *words)
+{
+    int i, j;
+
+    if (row->dense)
+        return !memcmp(store->words + row->first, words, store->numwords * sizeof(words[0]));
+
+    for (i = j = 0; i < store->numwords; i++) {
+        if (!words[i])
+            continue;
+        if (j == row->count || store->index[row->first + j] != i ||
+            store->words[row->first + j] != words[i])
+            return false;
+        j++;
+    }
+
+    return j == row->count;
+}
+
+static void BSP_FreeVisStore(visstore_t *store)
+{
+    if (!store)
+        return;
+
+    Z_Free(store->clusters);
+    Z_Free(store->rows);
+    Z_Free(store->index);
+    Z_Free(store->words);
+    Z_Free(store);
+}
+
+static visstore_t *BSP_BuildVisStore(bsp_t *bsp, int vis)
+{
+    uint64_t    words[VIS_MAX_BYTES / sizeof(uint64_t)];
+    int         numclusters = bsp->vis->numclusters;
+    int         *hash_table, hash_size;
+    size_t      maxstored;
+    visstore_t  *store;
+    visrow_t    *row;
+    uint32_t    hash;
+    int         i, j, k, nonzero;
+
+    store = Z_Mallocz(sizeof(*store));
+    store->numwords = (bsp->visrowsize + sizeof(words[0]) - 1) / sizeof(words[0]);
+    store->clusters = Z_Malloc(numclusters * sizeof(store->clusters[0]));
+    store->rows = Z_Malloc(numclusters * sizeof(store->rows[0]));
+
+    maxstored = store->numwords;
+    store->index = Z_Malloc(maxstored * sizeof(store->index[0]));
+    store->words = Z_Malloc(maxstored * sizeof(store->words[0]));
+
+    hash_size = npot32(numclusters * 2);
+    hash_table = Z_Malloc(hash_size * sizeof(hash_table[0]));
+    for (i = 0; i < hash_size; i++)
+        hash_table[i] = -1;
+
+    for (i = 0; i < numclusters; i++) {
+        memset(words, 0, store->numwords * sizeof(words[0]));
+        BSP_ClusterVis(bsp, (byte *)words, i, vis);
+
+        // look for identical row
+        hash = hash_vis_row(words, store->numwords);
+        for (j = hash & (hash_size - 1); hash_table[j] != -1; j = (j + 1) & (hash_size - 1)) {
+            if (vis_row_equal(store, &store->rows[hash_table[j]], words))
+                break;
+        }
+        if (hash_table[j] != -1) {
+            store->clusters[i] = hash_table[j];
+            continue;
+        }
+
+        nonzero = 0;
+        for (k = 0; k < store->numwords; k++)
+            nonzero += words[k] != 0;
+
+        if (store->numstored + store->numwords > maxstored) {
+            maxstored = max(maxstored * 2, store->numstored + store->numwords);
+            store->index = Z_Realloc(store->index, maxstored * sizeof(store->index[0]));
+            store->words = Z_Realloc(store->words, maxstored * sizeof(store->words[0]));
+        }
+
+        row = &store->rows[store->numrows];
+        row->first = store->numstored;
+
+        // word index costs a quarter of the word itself
+        if (nonzero * 5 >= store->numwords * 4) {
+            memcpy(store->words + store->numstored, words, store->numwords * sizeof(words[0]));
+            row->count = store->numwords;
+            row->dense = true;
+        } else {
+            row->count = 0;
+            for (k = 0; k < store->numwords; k++) {
+                if (words[k]) {
+                    store->index[row->first + row->count] = k;
+                    store->words[row->first + row->count] = words[k];
+                    row->count++;
+                }
+            }
+            row->dense = false;
+        }
+        store->numstored += row->count;
+
+        hash_table[j] = store->numrows;
+        store->clusters[i] = store->numrows++;
+    }
+
+    Z_Free(hash_table);
+
+    Com_DPrintf("%s: %d clusters, %d unique rows, %zu bytes\n", __func__,
+                numclusters, store->numrows, store->numstored *
+                (sizeof(store->index[0]) + sizeof(store->words[0])));
+
+    return store;
+}
+
+static byte *BSP_FetchVisRow(const visstore_t *store, byte *mask, int cluster, size_t rowsize)
+{
+    const visrow_t *row = &store->rows[store->clusters[cluster]];
+    const uint64_t *words = store->words + row->first;
+    const uint16_t *index = store->index + row->first;
+    size_t ofs;
+    int i;
+
+    if (row->dense)
+        return memcpy(mask, words, rowsize);
+
+    memset(mask, 0, rowsize);
+    for (i = 0; i < row->count; i++) {
+        ofs = index[i] * sizeof(words[0]);
+        memcpy(mask + ofs, &words[i], min(sizeof(words[0]), rowsize - ofs));
+    }
+
+    return mask;
+}
+
+/*
+================
+BSP_BuildBrushBlocks
+
+Repacks side planes of each brush into blocks for vectorized collision.
+Allocated separately from the hunk, since the number of blocks is only known
+after brushes are loaded.
+================
+*/
+static void BSP_BuildBrushBlocks(bsp_t *bsp)
+{
+    mbrushblock_t   *block;
+    mbrush_t        *brush;
+    int             i, numblocks;
+
+    numblocks = 0;
+    for (i = 0, brush = bsp->brushes; i < bsp->numbrushes; i++, brush++)
+        numblocks += BRUSH_NUM_BLOCKS(brush->numsides);
+
+    if (!numblocks)
+        return;
+
+    block = bsp->brushblocks = Z_Malloc(sizeof(*block) * numblocks);
+    for (i = 0, brush = bsp->brushes; i < bsp->numbrushes; i++, brush++) {
+        BSP_PackBrushSides(block, brush->firstbrushside, brush->numsides);
+        brush->blocks = block;
+        block += BRUSH_NUM_BLOCKS(brush->numsides);
+    }
+}
+
 void BSP_Free(bsp_t *bsp)
 {
     if (!bsp) {
@@ -1319,6 +1527,10 @@ void BSP_Free(bsp_t *bsp)
 			bsp->pvs2_matrix = NULL;
 		}
 
+        Z_Free(bsp->pvs_matrix);
+        BSP_FreeVisStore(bsp->phs);
+        Z_Free(bsp->brushblocks);
+
         Hunk_Free(&bsp->hunk);
         List_Remove(&bsp->entry);
         Z_Free(bsp);
@@ -1583,7 +1795,7 @@ int BSP_Load(const char *name, bsp_t **bsp_p)
     //
     // load the file
     //
-    filelen = FS_LoadFile(name, (void **)&buf);
+    filelen = FS_MapFile(name, (const void **)&buf);
     if (!buf) {
         return filelen;
     }
@@ -1672,6 +1884,8 @@ int BSP_Load(const char *name, bsp_t **bsp_p)
         goto fail1;
     }
 
+    BSP_BuildBrushBlocks(bsp);
+
 	if (!BSP_LoadPatchedPVS(bsp))
 	{
 		BSP_BuildPvsMatrix(bsp);
@@ -1681,6 +1895,11 @@ int BSP_Load(const char *name, bsp_t **bsp_p)
 		bsp->pvs_patched = true;
 	}
 
+    // PHS rows are looked up for every multicast and client frame
+    if (bsp->vis) {
+        bsp->phs = BSP_BuildVisStore(bsp, DVIS_PHS);
+    }
+
 #if USE_REF
     if (normal_lump_size)
 	{
@@ -1692,7 +1911,7 @@ int BSP_Load(const char *name, bsp_t **bsp_p)
 
     List_Append(&bsp_cache, &bsp->entry);
 
-    FS_FreeFile(buf);
+    FS_UnmapFile(buf);
 
     *bsp_p = bsp;
     return Q_ERR_SUCCESS;
@@ -1701,7 +1920,7 @@ fail1:
     Hunk_Free(&bsp->hunk);
     Z_Free(bsp);
 fail2:
-    FS_FreeFile(buf);
+    FS_UnmapFile(buf);
     return ret;
 }
 
@@ -1840,6 +2059,10 @@ byte *BSP_ClusterVis(bsp_t *bsp, byte *mask, int cluster, int vis)
         Com_Errorf(ERR_DROP, "%s: bad cluster", __func__);
     }
 
+    if (vis == DVIS_PHS && bsp->phs) {
+        return BSP_FetchVisRow(bsp->phs, mask, cluster, bsp->visrowsize);
+    }
+
 	if (vis == DVIS_PVS2)
 	{
 		if (bsp->pvs2_matrix)
@@ -1963,6 +2186,36 @@ mmodel_t *BSP_InlineModel(bsp_t *bsp, const char *name)
     return &bsp->models[num];
 }
 
+/*
+==================
+BSP_PackBrushSides
+
+Copies side planes into BRUSH_NUM_BLOCKS(numsides) blocks. Unused slots of
+the last block get planes that everything is behind, so they never clip.
+==================
+*/
+void BSP_PackBrushSides(mbrushblock_t *blocks, const mbrushside_t *sides, int numsides)
+{
+    mbrushblock_t   *block;
+    const cplane_t  *plane;
+    int             i, j, k;
+
+    for (i = 0; i < BRUSH_NUM_BLOCKS(numsides) * BRUSH_BLOCK_PLANES; i++) {
+        block = &blocks[i / BRUSH_BLOCK_PLANES];
+        k = i % BRUSH_BLOCK_PLANES;
+        if (i < numsides) {
+            plane = sides[i].plane;
+            for (j = 0; j < 3; j++)
+                block->normal[j][k] = plane->normal[j];
+            block->dist[k] = plane->dist;
+        } else {
+            for (j = 0; j < 3; j++)
+                block->normal[j][k] = 0;
+            block->dist[k] = 1e30f;
+        }
+    }
+}
+
 void BSP_Init(void)
 {
     map_visibility_patch = Cvar_Get("map_visibility_patch", "1", 0);
@@ -23,9 +23,18 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common/cmodel.h"
 #include "common/common.h"
 #include "common/cvar.h"
+#include "common/files.h"
 #include "common/math.h"
 #include "common/zone.h"
 #include "system/hunk.h"
+#include "system/system.h"
+
+#if (defined __SSE2__) || (defined _M_X64) || (defined _M_IX86_FP && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define USE_SSE2    1
+#else
+#define USE_SSE2    0
+#endif
 
 mtexinfo_t nulltexinfo;
 
@@ -38,6 +47,29 @@ static cvar_t       *map_noareas;
 
 static void    FloodAreaConnections(cm_t *cm);
 
+// recorded trace inputs for the trace benchmark
+typedef struct {
+    vec3_t      start, end;
+    vec3_t      mins, maxs;
+    vec3_t      boxmins, boxmaxs;   // box hull bounds
+    int32_t     headnode;           // node number, -1 for box hull,
+                                    // -2 - leaf number for leafs
+    int32_t     brushmask;
+} tracerec_t;
+
+static struct {
+    cm_t        *cm;                // map being recorded
+    uint32_t    checksum;
+    tracerec_t  *recs;
+    int         numrecs, maxrecs;
+    char        filename[MAX_OSPATH];
+} tracerec;
+
+static void CM_RecordTrace(const vec3_t start, const vec3_t end,
+                           const vec3_t mins, const vec3_t maxs,
+                           mnode_t *headnode, int brushmask);
+static void CM_FinishRecording(void);
+
 /*
 ==================
 CM_FreeMap
@@ -45,6 +77,9 @@ CM_FreeMap
 */
 void CM_FreeMap(cm_t *cm)
 {
+    if (tracerec.cm == cm)
+        CM_FinishRecording();
+
     Z_Free(cm->floodnums);
     BSP_Free(cm->cache);
 
@@ -112,6 +147,7 @@ static mnode_t  *box_headnode;
 static mbrush_t box_brush;
 static mbrush_t *box_leafbrush;
 static mbrushside_t box_brushsides[6];
+static mbrushblock_t box_blocks[BRUSH_NUM_BLOCKS(6)];
 static mleaf_t  box_leaf;
 static mleaf_t  box_emptyleaf;
 
@@ -135,6 +171,7 @@ static void CM_InitBoxHull(void)
 
     box_brush.numsides = 6;
     box_brush.firstbrushside = &box_brushsides[0];
+    box_brush.blocks = &box_blocks[0];
     box_brush.contents = CONTENTS_MONSTER;
 
     box_leaf.contents = CONTENTS_MONSTER;
@@ -170,6 +207,8 @@ static void CM_InitBoxHull(void)
         p->signbits = 1 << (i >> 1);
         p->normal[i >> 1] = -1;
     }
+
+    BSP_PackBrushSides(box_blocks, box_brushsides, 6);
 }
 
 /*
@@ -182,6 +221,8 @@ BSP trees instead of being compared directly.
 */
 mnode_t *CM_HeadnodeForBox(const vec3_t mins, const vec3_t maxs)
 {
+    int     i;
+
     box_planes[0].dist = maxs[0];
     box_planes[1].dist = -maxs[0];
     box_planes[2].dist = mins[0];
@@ -195,6 +236,9 @@ mnode_t *CM_HeadnodeForBox(const vec3_t mins, const vec3_t maxs)
     box_planes[10].dist = mins[2];
     box_planes[11].dist = -mins[2];
 
+    for (i = 0; i < 6; i++)
+        box_blocks[i / BRUSH_BLOCK_PLANES].dist[i % BRUSH_BLOCK_PLANES] = box_brushsides[i].plane->dist;
+
     return box_headnode;
 }
 
@@ -213,54 +257,58 @@ CM_BoxLeafnums
 Fills in a list of all the leafs touched
 =============
 */
-static int          leaf_count, leaf_maxcount;
-static mleaf_t      **leaf_list;
-static const vec_t  *leaf_mins, *leaf_maxs;
-static mnode_t      *leaf_topnode;
-
-static void CM_BoxLeafs_r(mnode_t *node)
+typedef struct {
+    int             count, maxcount;
+    mleaf_t         **list;
+    const vec_t     *mins, *maxs;
+    mnode_t         *topnode;
+} boxleafs_t;
+
+static void CM_BoxLeafs_r(boxleafs_t *bl, mnode_t *node)
 {
     int     s;
 
     while (node->plane) {
-        s = BoxOnPlaneSideFast(leaf_mins, leaf_maxs, node->plane);
+        s = BoxOnPlaneSideFast(bl->mins, bl->maxs, node->plane);
         if (s == 1) {
             node = node->children[0];
         } else if (s == 2) {
             node = node->children[1];
         } else {
             // go down both
-            if (!leaf_topnode) {
-                leaf_topnode = node;
+            if (!bl->topnode) {
+                bl->topnode = node;
             }
-            CM_BoxLeafs_r(node->children[0]);
+            CM_BoxLeafs_r(bl, node->children[0]);
             node = node->children[1];
         }
     }
 
-    if (leaf_count < leaf_maxcount) {
-        leaf_list[leaf_count++] = (mleaf_t *)node;
+    if (bl->count < bl->maxcount) {
+        bl->list[bl->count++] = (mleaf_t *)node;
     }
 }
 
+// reentrant, may be called from multiple threads
 static int CM_BoxLeafs_headnode(const vec3_t mins, const vec3_t maxs,
                                 mleaf_t **list, int listsize,
                                 mnode_t *headnode, mnode_t **topnode)
 {
-    leaf_list = list;
-    leaf_count = 0;
-    leaf_maxcount = listsize;
-    leaf_mins = mins;
-    leaf_maxs = maxs;
+    boxleafs_t bl;
 
-    leaf_topnode = NULL;
+    bl.list = list;
+    bl.count = 0;
+    bl.maxcount = listsize;
+    bl.mins = mins;
+    bl.maxs = maxs;
+    bl.topnode = NULL;
 
-    CM_BoxLeafs_r(headnode);
+    CM_BoxLeafs_r(&bl, headnode);
 
     if (topnode)
-        *topnode = leaf_topnode;
+        *topnode = bl.topnode;
 
-    return leaf_count;
+    return bl.count;
 }
 
 int CM_BoxLeafs(cm_t *cm, const vec3_t mins, const vec3_t maxs,
@@ -330,13 +378,14 @@ static vec3_t   trace_extents;
 static trace_t  *trace_trace;
 static int      trace_contents;
 static bool     trace_ispoint;      // optimized case
+static bool     trace_scalar;       // skip vectorized brush tests
 
 /*
 ================
-CM_ClipBoxToBrush
+CM_ClipBoxToBrushScalar
 ================
 */
-static void CM_ClipBoxToBrush(const vec3_t p1, const vec3_t p2, trace_t *trace, mbrush_t *brush)
+static void CM_ClipBoxToBrushScalar(const vec3_t p1, const vec3_t p2, trace_t *trace, mbrush_t *brush)
 {
     int         i;
     cplane_t    *plane, *clipplane;
@@ -429,10 +478,10 @@ static void CM_ClipBoxToBrush(const vec3_t p1, const vec3_t p2, trace_t *trace,
 
 /*
 ================
-CM_TestBoxInBrush
+CM_TestBoxInBrushScalar
 ================
 */
-static void CM_TestBoxInBrush(const vec3_t p1, trace_t *trace, mbrush_t *brush)
+static void CM_TestBoxInBrushScalar(const vec3_t p1, trace_t *trace, mbrush_t *brush)
 {
     int         i;
     cplane_t    *plane;
@@ -466,6 +515,222 @@ static void CM_TestBoxInBrush(const vec3_t p1, trace_t *trace, mbrush_t *brush)
     trace->contents = brush->contents;
 }
 
+#if USE_SSE2
+
+// trace bounds for the vectorized brush tests, one vector per axis
+static __m128   trace_mins4[3], trace_maxs4[3];
+
+#define SELECT_PS(m, a, b)  _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b))
+
+static inline __m128 CM_BlockDot(const mbrushblock_t *block, const __m128 p[3])
+{
+    __m128 d;
+
+    d = _mm_mul_ps(p[0], _mm_loadu_ps(block->normal[0]));
+    d = _mm_add_ps(d, _mm_mul_ps(p[1], _mm_loadu_ps(block->normal[1])));
+    d = _mm_add_ps(d, _mm_mul_ps(p[2], _mm_loadu_ps(block->normal[2])));
+
+    return d;
+}
+
+// push the planes out apropriately for mins/maxs, picking the same box
+// corner as trace_offsets[plane->signbits] does for each of them
+static inline __m128 CM_BlockDist(const mbrushblock_t *block)
+{
+    __m128 zero = _mm_setzero_ps();
+    __m128 n, m, o[3];
+    int j;
+
+    for (j = 0; j < 3; j++) {
+        n = _mm_loadu_ps(block->normal[j]);
+        m = _mm_cmplt_ps(n, zero);
+        o[j] = SELECT_PS(m, trace_maxs4[j], trace_mins4[j]);
+    }
+
+    return _mm_sub_ps(_mm_loadu_ps(block->dist), CM_BlockDot(block, o));
+}
+
+/*
+================
+CM_ClipBoxToBrushSSE2
+
+Same as CM_ClipBoxToBrushScalar, but tests a block of planes at once. Each
+lane keeps the first plane it entered last, lanes are merged at the end to
+pick the same plane the scalar version would.
+================
+*/
+static void CM_ClipBoxToBrushSSE2(const vec3_t p1, const vec3_t p2, trace_t *trace, mbrush_t *brush)
+{
+    const mbrushblock_t *block;
+    __m128      zero, eps, dist, d1, d2, denom, f, m, front1, front2;
+    __m128      p1v[3], p2v[3];
+    __m128      enter4, leave4, getout4, startout4;
+    __m128i     enterblock4;
+    float       enter[BRUSH_BLOCK_PLANES], leave[BRUSH_BLOCK_PLANES];
+    int32_t     enterblock[BRUSH_BLOCK_PLANES];
+    float       enterfrac, leavefrac;
+    int         i, j, numblocks, index;
+    mbrushside_t    *leadside;
+
+    if (!brush->numsides)
+        return;
+
+    for (j = 0; j < 3; j++) {
+        p1v[j] = _mm_set1_ps(p1[j]);
+        p2v[j] = _mm_set1_ps(p2[j]);
+    }
+
+    zero = _mm_setzero_ps();
+    eps = _mm_set1_ps(DIST_EPSILON);
+    enter4 = _mm_set1_ps(-1);
+    leave4 = _mm_set1_ps(1);
+    enterblock4 = _mm_setzero_si128();
+    getout4 = startout4 = zero;
+
+    block = brush->blocks;
+    numblocks = BRUSH_NUM_BLOCKS(brush->numsides);
+    for (i = 0; i < numblocks; i++, block++) {
+        if (!trace_ispoint)
+            dist = CM_BlockDist(block);
+        else
+            dist = _mm_loadu_ps(block->dist);
+
+        d1 = _mm_sub_ps(CM_BlockDot(block, p1v), dist);
+        d2 = _mm_sub_ps(CM_BlockDot(block, p2v), dist);
+
+        front1 = _mm_cmpgt_ps(d1, zero);
+        front2 = _mm_cmpgt_ps(d2, zero);
+
+        // if completely in front of any face, no intersection
+        if (_mm_movemask_ps(_mm_and_ps(front1, _mm_cmpge_ps(d2, d1))))
+            return;
+
+        getout4 = _mm_or_ps(getout4, front2);
+        startout4 = _mm_or_ps(startout4, front1);
+
+        denom = _mm_sub_ps(d1, d2);
+
+        // crosses face on the way in
+        f = _mm_div_ps(_mm_sub_ps(d1, eps), denom);
+        m = _mm_and_ps(_mm_and_ps(front1, _mm_cmpgt_ps(d1, d2)), _mm_cmpgt_ps(f, enter4));
+        enter4 = SELECT_PS(m, f, enter4);
+        enterblock4 = _mm_or_si128(_mm_and_si128(_mm_castps_si128(m), _mm_set1_epi32(i)),
+                                   _mm_andnot_si128(_mm_castps_si128(m), enterblock4));
+
+        // crosses face on the way out
+        f = _mm_div_ps(_mm_add_ps(d1, eps), denom);
+        m = _mm_and_ps(front2, _mm_cmple_ps(d1, d2));
+        leave4 = _mm_min_ps(SELECT_PS(m, f, leave4), leave4);
+    }
+
+    if (!_mm_movemask_ps(startout4)) {
+        // original point was inside brush
+        trace->startsolid = true;
+        if (!_mm_movemask_ps(getout4)) {
+            trace->allsolid = true;
+            trace->fraction = 0;
+            trace->contents = brush->contents;
+        }
+        return;
+    }
+
+    _mm_storeu_ps(enter, enter4);
+    _mm_storeu_ps(leave, leave4);
+    _mm_storeu_si128((__m128i *)enterblock, enterblock4);
+
+    enterfrac = -1;
+    leavefrac = 1;
+    index = -1;
+    for (j = 0; j < BRUSH_BLOCK_PLANES; j++) {
+        i = enterblock[j] * BRUSH_BLOCK_PLANES + j;
+        if (enter[j] > enterfrac || (enter[j] == enterfrac && enter[j] > -1 && i < index)) {
+            enterfrac = enter[j];
+            index = i;
+        }
+        if (leave[j] < leavefrac)
+            leavefrac = leave[j];
+    }
+
+    if (enterfrac < leavefrac) {
+        if (enterfrac > -1 && enterfrac < trace->fraction) {
+            if (enterfrac < 0)
+                enterfrac = 0;
+            leadside = brush->firstbrushside + index;
+            trace->fraction = enterfrac;
+            trace->plane = *leadside->plane;
+            trace->surface = &(leadside->texinfo->c);
+            trace->contents = brush->contents;
+        }
+    }
+}
+
+/*
+================
+CM_TestBoxInBrushSSE2
+================
+*/
+static void CM_TestBoxInBrushSSE2(const vec3_t p1, trace_t *trace, mbrush_t *brush)
+{
+    const mbrushblock_t *block;
+    __m128      p1v[3], d1;
+    int         i, j, numblocks;
+
+    if (!brush->numsides)
+        return;
+
+    for (j = 0; j < 3; j++)
+        p1v[j] = _mm_set1_ps(p1[j]);
+
+    block = brush->blocks;
+    numblocks = BRUSH_NUM_BLOCKS(brush->numsides);
+    for (i = 0; i < numblocks; i++, block++) {
+        d1 = _mm_sub_ps(CM_BlockDot(block, p1v), CM_BlockDist(block));
+
+        // if completely in front of face, no intersection
+        if (_mm_movemask_ps(_mm_cmpgt_ps(d1, _mm_setzero_ps())))
+            return;
+    }
+
+    // inside this brush
+    trace->startsolid = trace->allsolid = true;
+    trace->fraction = 0;
+    trace->contents = brush->contents;
+}
+
+#endif // USE_SSE2
+
+/*
+================
+CM_ClipBoxToBrush
+================
+*/
+static void CM_ClipBoxToBrush(const vec3_t p1, const vec3_t p2, trace_t *trace, mbrush_t *brush)
+{
+#if USE_SSE2
+    if (!trace_scalar) {
+        CM_ClipBoxToBrushSSE2(p1, p2, trace, brush);
+        return;
+    }
+#endif
+    CM_ClipBoxToBrushScalar(p1, p2, trace, brush);
+}
+
+/*
+================
+CM_TestBoxInBrush
+================
+*/
+static void CM_TestBoxInBrush(const vec3_t p1, trace_t *trace, mbrush_t *brush)
+{
+#if USE_SSE2
+    if (!trace_scalar) {
+        CM_TestBoxInBrushSSE2(p1, trace, brush);
+        return;
+    }
+#endif
+    CM_TestBoxInBrushScalar(p1, trace, brush);
+}
+
 /*
 ================
 CM_TraceToLeaf
@@ -635,12 +900,21 @@ void CM_BoxTrace(trace_t *trace,
         return;
     }
 
+    if (tracerec.cm)
+        CM_RecordTrace(start, end, mins, maxs, headnode, brushmask);
+
     trace_contents = brushmask;
     VectorCopy(start, trace_start);
     VectorCopy(end, trace_end);
     for (i = 0; i < 8; i++)
         for (j = 0; j < 3; j++)
             trace_offsets[i][j] = bounds[i >> j & 1][j];
+#if USE_SSE2
+    for (j = 0; j < 3; j++) {
+        trace_mins4[j] = _mm_set1_ps(mins[j]);
+        trace_maxs4[j] = _mm_set1_ps(maxs[j]);
+    }
+#endif
 
     //
     // check for position test special case
@@ -752,6 +1026,275 @@ void CM_ClipEntity(trace_t *dst, const trace_t *src, struct edict_s *ent)
 /*
 ===============================================================================
 
+TRACE BENCHMARK
+
+Inputs of traces run against the map are recorded, saved to a file and
+replayed through both scalar and vectorized brush tests. Box hull traces are
+recorded with the bounds of the hull, so that entity clipping is replayed too.
+
+===============================================================================
+*/
+
+#define TRACE_IDENT     MakeLittleLong('T','R','C','E')
+#define TRACE_VERSION   1
+
+static void CM_TracePath(char *path, size_t size, const char *filename)
+{
+    Q_snprintf(path, size, "traces/%s", filename);
+    COM_DefaultExtension(path, ".trc", size);
+}
+
+static void CM_FinishRecording(void)
+{
+    uint32_t    header[4];
+    qhandle_t   f;
+    int         ret;
+
+    Com_Printf("Recorded %d traces.\n", tracerec.numrecs);
+    tracerec.maxrecs = tracerec.numrecs;
+    tracerec.cm = NULL;
+
+    if (!tracerec.filename[0])
+        return;
+
+    header[0] = TRACE_IDENT;
+    header[1] = TRACE_VERSION;
+    header[2] = tracerec.checksum;
+    header[3] = tracerec.numrecs;
+
+    ret = FS_OpenFile(tracerec.filename, &f, FS_MODE_WRITE);
+    if (!f) {
+        Com_EPrintf("Couldn't open %s: %s\n", tracerec.filename, Q_ErrorString(ret));
+        return;
+    }
+
+    FS_Write(header, sizeof(header), f);
+    FS_Write(tracerec.recs, sizeof(tracerec.recs[0]) * tracerec.numrecs, f);
+
+    ret = FS_CloseFile(f);
+    if (ret)
+        Com_EPrintf("Couldn't write %s: %s\n", tracerec.filename, Q_ErrorString(ret));
+    else
+        Com_Printf("Wrote %s.\n", tracerec.filename);
+}
+
+static void CM_RecordTrace(const vec3_t start, const vec3_t end,
+                           const vec3_t mins, const vec3_t maxs,
+                           mnode_t *headnode, int brushmask)
+{
+    bsp_t       *bsp = tracerec.cm->cache;
+    mleaf_t     *leaf = (mleaf_t *)headnode;
+    tracerec_t  *rec;
+    int         j;
+
+    rec = &tracerec.recs[tracerec.numrecs];
+    if (headnode == box_headnode) {
+        rec->headnode = -1;
+        for (j = 0; j < 3; j++) {
+            rec->boxmaxs[j] = box_planes[j * 4 + 0].dist;
+            rec->boxmins[j] = box_planes[j * 4 + 2].dist;
+        }
+    } else if (headnode >= bsp->nodes && headnode < bsp->nodes + bsp->numnodes) {
+        rec->headnode = headnode - bsp->nodes;
+        VectorClear(rec->boxmins);
+        VectorClear(rec->boxmaxs);
+    } else if (leaf >= bsp->leafs && leaf < bsp->leafs + bsp->numleafs) {
+        rec->headnode = -2 - (int)(leaf - bsp->leafs);
+        VectorClear(rec->boxmins);
+        VectorClear(rec->boxmaxs);
+    } else {
+        return;     // not against this map
+    }
+
+    VectorCopy(start, rec->start);
+    VectorCopy(end, rec->end);
+    VectorCopy(mins, rec->mins);
+    VectorCopy(maxs, rec->maxs);
+    rec->brushmask = brushmask;
+
+    if (++tracerec.numrecs == tracerec.maxrecs)
+        CM_FinishRecording();
+}
+
+/*
+==================
+CM_RecordTraces
+
+Starts recording inputs of the next count traces run against the map.
+==================
+*/
+void CM_RecordTraces(cm_t *cm, int count, const char *filename)
+{
+    if (!cm->cache) {
+        Com_Printf("No map loaded.\n");
+        return;
+    }
+
+    Z_Free(tracerec.recs);
+    tracerec.recs = Z_Malloc(sizeof(tracerec.recs[0]) * count);
+    tracerec.numrecs = 0;
+    tracerec.maxrecs = count;
+    tracerec.cm = cm;
+    tracerec.checksum = cm->cache->checksum;
+    if (filename)
+        CM_TracePath(tracerec.filename, sizeof(tracerec.filename), filename);
+    else
+        tracerec.filename[0] = 0;
+
+    Com_Printf("Recording %d traces.\n", count);
+}
+
+static bool CM_LoadTraces(cm_t *cm, const char *filename)
+{
+    char        path[MAX_OSPATH];
+    uint32_t    *header;
+    tracerec_t  *recs;
+    void        *data;
+    int         i, len, count;
+
+    CM_TracePath(path, sizeof(path), filename);
+
+    len = FS_LoadFile(path, &data);
+    if (!data) {
+        Com_EPrintf("Couldn't load %s: %s\n", path, Q_ErrorString(len));
+        return false;
+    }
+
+    header = data;
+    count = -1;
+    if (len >= sizeof(header[0]) * 4)
+        count = (len - sizeof(header[0]) * 4) / sizeof(recs[0]);
+    if (count < 0 || header[0] != TRACE_IDENT ||
+        header[1] != TRACE_VERSION || header[3] != count) {
+        Com_EPrintf("%s is not a valid trace file\n", path);
+        goto fail;
+    }
+
+    if (header[2] != cm->cache->checksum) {
+        Com_EPrintf("%s was recorded on a different map\n", path);
+        goto fail;
+    }
+
+    recs = (tracerec_t *)(header + 4);
+    for (i = 0; i < count; i++) {
+        if (recs[i].headnode >= cm->cache->numnodes ||
+            recs[i].headnode < -1 - cm->cache->numleafs) {
+            Com_EPrintf("%s has bad headnode\n", path);
+            goto fail;
+        }
+    }
+
+    Z_Free(tracerec.recs);
+    tracerec.recs = Z_Malloc(sizeof(recs[0]) * count);
+    memcpy(tracerec.recs, recs, sizeof(recs[0]) * count);
+    tracerec.numrecs = tracerec.maxrecs = count;
+    tracerec.checksum = header[2];
+
+    FS_FreeFile(data);
+    return true;
+
+fail:
+    FS_FreeFile(data);
+    return false;
+}
+
+static void CM_ReplayTrace(trace_t *trace, bsp_t *bsp, const tracerec_t *rec)
+{
+    mnode_t     *headnode;
+
+    if (rec->headnode == -1)
+        headnode = CM_HeadnodeForBox(rec->boxmins, rec->boxmaxs);
+    else if (rec->headnode < -1)
+        headnode = (mnode_t *)(bsp->leafs + (-2 - rec->headnode));
+    else
+        headnode = bsp->nodes + rec->headnode;
+
+    CM_BoxTrace(trace, rec->start, rec->end, rec->mins, rec->maxs, headnode, rec->brushmask);
+}
+
+static bool CM_TracesEqual(const trace_t *a, const trace_t *b)
+{
+    return a->allsolid == b->allsolid && a->startsolid == b->startsolid &&
+        a->fraction == b->fraction && VectorCompare(a->endpos, b->endpos) &&
+        VectorCompare(a->plane.normal, b->plane.normal) &&
+        a->plane.dist == b->plane.dist && a->surface == b->surface &&
+        a->contents == b->contents;
+}
+
+/*
+==================
+CM_TraceBench
+
+Replays recorded traces, optionally loaded from file, through both scalar
+and vectorized brush tests, verifies they produce identical results and
+prints time per trace.
+==================
+*/
+void CM_TraceBench(cm_t *cm, int iterations, const char *filename)
+{
+    trace_t     scalar_tr, vector_tr;
+    uint64_t    start, scalar, vector;
+    bsp_t       *bsp = cm->cache;
+    int         i, j, mismatches;
+
+    if (!bsp) {
+        Com_Printf("No map loaded.\n");
+        return;
+    }
+
+    if (tracerec.cm) {
+        Com_Printf("Still recording traces (%d of %d).\n",
+                   tracerec.numrecs, tracerec.maxrecs);
+        return;
+    }
+
+    if (filename && !CM_LoadTraces(cm, filename))
+        return;
+
+    if (!tracerec.numrecs) {
+        Com_Printf("No traces recorded.\n");
+        return;
+    }
+
+    if (tracerec.checksum != bsp->checksum) {
+        Com_Printf("Traces were recorded on a different map.\n");
+        return;
+    }
+
+    mismatches = 0;
+    for (i = 0; i < tracerec.numrecs; i++) {
+        trace_scalar = true;
+        CM_ReplayTrace(&scalar_tr, bsp, &tracerec.recs[i]);
+        trace_scalar = false;
+        CM_ReplayTrace(&vector_tr, bsp, &tracerec.recs[i]);
+        if (!CM_TracesEqual(&scalar_tr, &vector_tr))
+            mismatches++;
+    }
+
+    trace_scalar = true;
+    start = Sys_Microseconds();
+    for (j = 0; j < iterations; j++)
+        for (i = 0; i < tracerec.numrecs; i++)
+            CM_ReplayTrace(&scalar_tr, bsp, &tracerec.recs[i]);
+    scalar = Sys_Microseconds() - start;
+
+    trace_scalar = false;
+    start = Sys_Microseconds();
+    for (j = 0; j < iterations; j++)
+        for (i = 0; i < tracerec.numrecs; i++)
+            CM_ReplayTrace(&vector_tr, bsp, &tracerec.recs[i]);
+    vector = Sys_Microseconds() - start;
+
+    Com_Printf("%d traces, %d iterations\n", tracerec.numrecs, iterations);
+    Com_Printf("scalar: %.1f ns per trace\n", scalar * 1000.0 / ((uint64_t)tracerec.numrecs * iterations));
+    Com_Printf("active: %.1f ns per trace\n", vector * 1000.0 / ((uint64_t)tracerec.numrecs * iterations));
+    if (mismatches)
+        Com_EPrintf("%d mismatched traces\n", mismatches);
+}
+
+/*
+===============================================================================
+
 AREAPORTALS
 
 ===============================================================================
@@ -976,28 +1519,18 @@ bool CM_HeadnodeVisible(mnode_t *node, byte *visbits)
 
 /*
 ============
-CM_FatPVS
+CM_FatClusters
 
-The client will interpolate the view position,
-so we can't use a single PVS point
-===========
+Returns the list of distinct clusters touched by a small box around the
+view position, in leaf order
+============
 */
-byte *CM_FatPVS(cm_t *cm, byte *mask, const vec3_t org, int vis)
+int CM_FatClusters(cm_t *cm, int *clusters, int maxclusters, const vec3_t org)
 {
-    byte    temp[VIS_MAX_BYTES];
     mleaf_t *leafs[64];
-    int     clusters[64];
-    int     i, j, count, longs;
-    size_t  *src, *dst;
+    int     i, j, count, numclusters;
     vec3_t  mins, maxs;
 
-    if (!cm->cache) {   // map not loaded
-        return memset(mask, 0, VIS_MAX_BYTES);
-    }
-    if (!cm->cache->vis) {
-        return memset(mask, 0xff, VIS_MAX_BYTES);
-    }
-
     for (i = 0; i < 3; i++) {
         mins[i] = org[i] - 8;
         maxs[i] = org[i] + 8;
@@ -1007,33 +1540,76 @@ byte *CM_FatPVS(cm_t *cm, byte *mask, const vec3_t org, int vis)
     if (count < 1)
         Com_Error(ERR_DROP, "CM_FatPVS: leaf count < 1");
 
-    // convert leafs to clusters
+    numclusters = 0;
     for (i = 0; i < count; i++) {
-        clusters[i] = leafs[i]->cluster;
+        for (j = 0; j < numclusters; j++) {
+            if (clusters[j] == leafs[i]->cluster) {
+                break;  // already have the cluster we want
+            }
+        }
+        if (j < numclusters)
+            continue;
+        if (numclusters == maxclusters)
+            return -1;
+        clusters[numclusters++] = leafs[i]->cluster;
     }
 
+    return numclusters;
+}
+
+/*
+============
+CM_ClusterListVis
+
+Combines visibility rows of the given clusters
+============
+*/
+byte *CM_ClusterListVis(cm_t *cm, byte *mask, const int *clusters, int numclusters, int vis)
+{
+    byte    temp[VIS_MAX_BYTES];
+    int     i, j, longs;
+    size_t  *src, *dst;
+
     BSP_ClusterVis(cm->cache, mask, clusters[0], vis);
     longs = VIS_FAST_LONGS(cm->cache);
 
     // or in all the other leaf bits
-    for (i = 1; i < count; i++) {
-        for (j = 0; j < i; j++) {
-            if (clusters[i] == clusters[j]) {
-                goto nextleaf; // already have the cluster we want
-            }
-        }
+    for (i = 1; i < numclusters; i++) {
         src = (size_t *)BSP_ClusterVis(cm->cache, temp, clusters[i], vis);
         dst = (size_t *)mask;
         for (j = 0; j < longs; j++) {
             *dst++ |= *src++;
         }
-
-nextleaf:;
     }
 
     return mask;
 }
 
+/*
+============
+CM_FatPVS
+
+The client will interpolate the view position,
+so we can't use a single PVS point
+===========
+*/
+byte *CM_FatPVS(cm_t *cm, byte *mask, const vec3_t org, int vis)
+{
+    int     clusters[64];
+    int     count;
+
+    if (!cm->cache) {   // map not loaded
+        return memset(mask, 0, VIS_MAX_BYTES);
+    }
+    if (!cm->cache->vis) {
+        return memset(mask, 0xff, VIS_MAX_BYTES);
+    }
+
+    count = CM_FatClusters(cm, clusters, q_countof(clusters), org);
+
+    return CM_ClusterListVis(cm, mask, clusters, count, vis);
+}
+
 /*
 =============
 CM_Init
@@ -28,6 +28,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common/cmodel.h"
 #include "common/common.h"
 #include "common/cvar.h"
+#include "common/demoproc.h"
 #include "common/error.h"
 #include "common/field.h"
 #include "common/fifo.h"
@@ -38,6 +39,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common/net/net.h"
 #include "common/net/chan.h"
 #include "common/pmove.h"
+#include "common/prof.h"
 #include "common/prompt.h"
 #include "common/protocol.h"
 #include "common/tests.h"
@@ -985,6 +987,8 @@ void Qcommon_Init(int argc, char **argv)
 
     Netchan_Init();
     NET_Init();
+    PROF_Init();
+    DP_Init();
     BSP_Init();
     CM_Init();
     SV_Init();
@@ -1106,6 +1110,9 @@ void Qcommon_Frame(void)
 
     remaining = SV_Frame(msec);
 
+    // send UDP packets queued by the server this frame
+    NET_FlushPackets();
+
 #if USE_CLIENT
     if (host_speeds->integer)
         time_between = Sys_Milliseconds();
@@ -1134,5 +1141,9 @@ void Qcommon_Frame(void)
                    all, ev, sv, gm, cl, rf);
     }
 #endif
+
+#if USE_DEBUG
+    Cvar_LookupFrame();
+#endif
 }
 
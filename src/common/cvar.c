@@ -27,6 +27,16 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common/zone.h"
 #include "client/client.h"
 
+#if USE_DEBUG
+#undef Cvar_FindVar
+#undef Cvar_Get
+#undef Cvar_SetEx
+#undef Cvar_Set
+#undef Cvar_VariableValue
+#undef Cvar_VariableInteger
+#undef Cvar_VariableString
+#endif
+
 cvar_t  *cvar_vars;
 
 int     cvar_modified;
@@ -37,6 +47,122 @@ int     cvar_modified;
 
 static cvar_t *cvarHash[CVARHASH_SIZE];
 
+#if USE_DEBUG
+
+#define LOOKUP_SITES    256
+
+typedef struct {
+    const char  *file;
+    int         line;
+    unsigned    count;
+} lookupsite_t;
+
+static cvar_t       *cvar_debug_lookups;
+
+static lookupsite_t lookup_sites[LOOKUP_SITES];
+static unsigned     lookup_total, lookup_dropped;
+static const char   *lookup_file;
+static int          lookup_line;
+
+/*
+============
+Cvar_LookupSite
+
+Remembers where the next lookup by name comes from.
+============
+*/
+void Cvar_LookupSite(const char *file, int line)
+{
+    lookup_file = file;
+    lookup_line = line;
+}
+
+static void count_lookup(void)
+{
+    const char *file = lookup_file;
+    int line = lookup_line;
+    lookupsite_t *site;
+    unsigned i, hash;
+
+    lookup_file = NULL;
+    if (!cvar_debug_lookups || !cvar_debug_lookups->integer) {
+        return;
+    }
+
+    if (!file) {
+        // lookup made by cvar.c itself on behalf of an unmarked caller
+        file = __FILE__;
+        line = 0;
+    }
+
+    lookup_total++;
+
+    hash = ((uintptr_t)file >> 2) ^ (line * 31);
+    for (i = 0; i < LOOKUP_SITES; i++) {
+        site = &lookup_sites[(hash + i) & (LOOKUP_SITES - 1)];
+        if (!site->file) {
+            site->file = file;
+            site->line = line;
+        }
+        if (site->file == file && site->line == line) {
+            site->count++;
+            return;
+        }
+    }
+
+    lookup_dropped++;
+}
+
+static int lookupcmp(const void *p1, const void *p2)
+{
+    const lookupsite_t *a = p1, *b = p2;
+
+    if (a->count != b->count) {
+        return a->count < b->count ? 1 : -1;
+    }
+    return a->line - b->line;
+}
+
+/*
+============
+Cvar_LookupFrame
+
+Called once per frame. Reports every place that looked up a cvar by name
+during the frame.
+============
+*/
+void Cvar_LookupFrame(void)
+{
+    lookupsite_t *site;
+    int i, n;
+
+    if (!lookup_total) {
+        return;
+    }
+
+    for (i = n = 0; i < LOOKUP_SITES; i++) {
+        if (lookup_sites[i].file) {
+            lookup_sites[n++] = lookup_sites[i];
+        }
+    }
+
+    qsort(lookup_sites, n, sizeof(lookup_sites[0]), lookupcmp);
+
+    Com_Printf("%u cvar lookups in frame %u:\n", lookup_total, com_framenum);
+    for (i = 0; i < n; i++) {
+        site = &lookup_sites[i];
+        Com_Printf("%6u %s:%d\n", site->count, COM_SkipPath(site->file), site->line);
+    }
+    if (lookup_dropped) {
+        Com_Printf("%6u from untracked sites\n", lookup_dropped);
+    }
+
+    memset(lookup_sites, 0, sizeof(lookup_sites));
+    lookup_total = lookup_dropped = 0;
+}
+
+#endif // USE_DEBUG
+
 /*
 ============
 Cvar_FindVar
@@ -47,6 +173,10 @@ cvar_t *Cvar_FindVar(const char *var_name)
     cvar_t *var;
     unsigned hash;
 
+#if USE_DEBUG
+    count_lookup();
+#endif
+
     hash = Com_HashString(var_name, CVARHASH_SIZE);
 
     for (var = cvarHash[hash]; var; var = var->hashNext) {
@@ -316,6 +446,40 @@ cvar_t *Cvar_Get(const char *var_name, const char *var_value, int flags)
     return var;
 }
 
+/*
+============
+Cvar_Bind
+============
+*/
+cvar_t *Cvar_Bind(cvarbind_t *bind)
+{
+    if (!bind->var) {
+        bind->var = Cvar_Get(bind->name, bind->default_string, bind->flags);
+        if (!bind->var) {
+            Com_Errorf(ERR_FATAL, "%s: couldn't bind '%s'", __func__, bind->name);
+        }
+    }
+
+    return bind->var;
+}
+
+/*
+============
+Cvar_BindChanged
+============
+*/
+bool Cvar_BindChanged(cvarbind_t *bind)
+{
+    cvar_t *var = Cvar_BoundVar(bind);
+
+    if (bind->modified_count == var->modified_count) {
+        return false;
+    }
+
+    bind->modified_count = var->modified_count;
+    return true;
+}
+
 /*
 ============
 Cvar_WeakGet
@@ -1146,5 +1310,9 @@ Cvar_Init
 void Cvar_Init(void)
 {
     Cmd_Register(c_cvar);
+
+#if USE_DEBUG
+    cvar_debug_lookups = Cvar_Get("cvar_debug_lookups", "0", 0);
+#endif
 }
 
@@ -0,0 +1,1280 @@
+/*
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+//
+// demoproc.c -- headless demo analysis and transcoding
+//
+
+#include "shared/shared.h"
+#include "common/cmd.h"
+#include "common/common.h"
+#include "common/demoproc.h"
+#include "common/files.h"
+#include "common/intreadwrite.h"
+#include "common/msg.h"
+#include "common/protocol.h"
+#include "common/sizebuf.h"
+#include "common/zone.h"
+#include "system/system.h"
+
+#include <zlib.h>
+
+/*
+===============================================================================
+
+Demos are processed in batches. The main thread loads files of a batch
+from the filesystem, then each demo is decompressed, parsed and encoded by
+a single parallel job, using its own thread local msg_read. Jobs never
+call Com_Error; a parse error stops processing of that demo and is
+reported together with the results gathered up to that point. Output files
+are written by the main thread once the whole batch is done.
+
+Parsing follows CL_ParseServerMessage, but only tracks state needed to
+decode frames: baselines, recent frames and their entities.
+
+Analysis writes two tables per demo, with one row per frame for player
+state and one row per entity per frame. Tables are stored column by column:
+
+    "DCOL", version, number of columns, number of rows
+    for each column: 16 byte name, type (0 = int32, 1 = float)
+    for each column: values of all rows
+
+All numbers are 32-bit little endian.
+
+===============================================================================
+*/
+
+#define DP_VERSION      1
+
+typedef enum {
+    DC_INT,
+    DC_FLOAT
+} dpcoltype_t;
+
+typedef struct {
+    char        name[16];
+    dpcoltype_t type;
+} dpcolumn_t;
+
+enum {
+    PC_FRAME,
+    PC_CLIENT,
+    PC_PM_TYPE,
+    PC_PM_FLAGS,
+    PC_ORIGIN_X,
+    PC_ORIGIN_Y,
+    PC_ORIGIN_Z,
+    PC_VELOCITY_X,
+    PC_VELOCITY_Y,
+    PC_VELOCITY_Z,
+    PC_PITCH,
+    PC_YAW,
+    PC_ROLL,
+    PC_GUN_INDEX,
+    PC_GUN_FRAME,
+    PC_FOV,
+    PC_RDFLAGS,
+    PC_HEALTH,
+
+    PC_NUM_COLUMNS
+};
+
+static const dpcolumn_t player_columns[PC_NUM_COLUMNS] = {
+    [PC_FRAME]      = { "frame",        DC_INT },
+    [PC_CLIENT]     = { "client",       DC_INT },
+    [PC_PM_TYPE]    = { "pm_type",      DC_INT },
+    [PC_PM_FLAGS]   = { "pm_flags",     DC_INT },
+    [PC_ORIGIN_X]   = { "origin_x",     DC_FLOAT },
+    [PC_ORIGIN_Y]   = { "origin_y",     DC_FLOAT },
+    [PC_ORIGIN_Z]   = { "origin_z",     DC_FLOAT },
+    [PC_VELOCITY_X] = { "velocity_x",   DC_FLOAT },
+    [PC_VELOCITY_Y] = { "velocity_y",   DC_FLOAT },
+    [PC_VELOCITY_Z] = { "velocity_z",   DC_FLOAT },
+    [PC_PITCH]      = { "pitch",        DC_FLOAT },
+    [PC_YAW]        = { "yaw",          DC_FLOAT },
+    [PC_ROLL]       = { "roll",         DC_FLOAT },
+    [PC_GUN_INDEX]  = { "gun_index",    DC_INT },
+    [PC_GUN_FRAME]  = { "gun_frame",    DC_INT },
+    [PC_FOV]        = { "fov",          DC_FLOAT },
+    [PC_RDFLAGS]    = { "rdflags",      DC_INT },
+    [PC_HEALTH]     = { "health",       DC_INT },
+};
+
+enum {
+    EC_FRAME,
+    EC_NUMBER,
+    EC_MODEL,
+    EC_MODEL2,
+    EC_ANIM_FRAME,
+    EC_SKIN,
+    EC_EFFECTS,
+    EC_RENDERFX,
+    EC_ORIGIN_X,
+    EC_ORIGIN_Y,
+    EC_ORIGIN_Z,
+    EC_ANGLE_X,
+    EC_ANGLE_Y,
+    EC_ANGLE_Z,
+    EC_SOLID,
+    EC_SOUND,
+    EC_EVENT,
+
+    EC_NUM_COLUMNS
+};
+
+static const dpcolumn_t entity_columns[EC_NUM_COLUMNS] = {
+    [EC_FRAME]      = { "frame",        DC_INT },
+    [EC_NUMBER]     = { "number",       DC_INT },
+    [EC_MODEL]      = { "model",        DC_INT },
+    [EC_MODEL2]     = { "model2",       DC_INT },
+    [EC_ANIM_FRAME] = { "anim_frame",   DC_INT },
+    [EC_SKIN]       = { "skin",         DC_INT },
+    [EC_EFFECTS]    = { "effects",      DC_INT },
+    [EC_RENDERFX]   = { "renderfx",     DC_INT },
+    [EC_ORIGIN_X]   = { "origin_x",     DC_FLOAT },
+    [EC_ORIGIN_Y]   = { "origin_y",     DC_FLOAT },
+    [EC_ORIGIN_Z]   = { "origin_z",     DC_FLOAT },
+    [EC_ANGLE_X]    = { "angle_x",      DC_FLOAT },
+    [EC_ANGLE_Y]    = { "angle_y",      DC_FLOAT },
+    [EC_ANGLE_Z]    = { "angle_z",      DC_FLOAT },
+    [EC_SOLID]      = { "solid",        DC_INT },
+    [EC_SOUND]      = { "sound",        DC_INT },
+    [EC_EVENT]      = { "event",        DC_INT },
+};
+
+typedef struct {
+    const dpcolumn_t    *columns;
+    int                 numcolumns;
+    uint32_t            numrows;
+    uint32_t            maxrows;
+    uint32_t            *data[max((int)PC_NUM_COLUMNS, (int)EC_NUM_COLUMNS)];
+} dptable_t;
+
+typedef struct {
+    bool            valid;
+    int             number;
+    int             clientNum;
+    unsigned        firstEntity;
+    int             numEntities;
+    player_state_t  ps;
+} dpframe_t;
+
+typedef struct {
+    char            name[MAX_OSPATH];   // relative to demos/
+    bool            analyze;
+    bool            transcode;
+
+    byte            *raw;               // file contents
+    size_t          rawlen;
+    byte            *data;              // uncompressed demo
+    size_t          datalen;
+    size_t          parsedlen;          // length of well formed messages
+    char            error[MAX_QPATH];
+
+    // parse state
+    entity_state_t  *baselines;
+    entity_state_t  *entities;          // MAX_PARSE_ENTITIES ring
+    unsigned        numentities;
+    dpframe_t       frames[UPDATE_BACKUP];
+    dpframe_t       frame;              // last valid frame
+    int             num_items;
+    bool            finished;
+    bool            zpacket;
+    bool            zinit;
+    z_stream        z;
+    byte            *zbuffer;
+
+    // results
+    char            levelname[MAX_QPATH];
+    unsigned        messages;
+    unsigned        numframes;
+    dptable_t       players;
+    dptable_t       ents;
+    byte            *packed;
+    size_t          packedlen;
+} dpdemo_t;
+
+static bool dp_fail(dpdemo_t *d, const char *fmt, ...) q_printf(2, 3);
+
+// keeps the first error only, later ones are usually a consequence
+static bool dp_fail(dpdemo_t *d, const char *fmt, ...)
+{
+    va_list argptr;
+
+    if (!d->error[0]) {
+        va_start(argptr, fmt);
+        Q_vsnprintf(d->error, sizeof(d->error), fmt, argptr);
+        va_end(argptr);
+    }
+
+    return false;
+}
+
+/*
+===============================================================================
+
+COLUMNAR TABLES
+
+===============================================================================
+*/
+
+static void table_init(dptable_t *t, const dpcolumn_t *columns, int numcolumns)
+{
+    memset(t, 0, sizeof(*t));
+    t->columns = columns;
+    t->numcolumns = numcolumns;
+}
+
+static void table_free(dptable_t *t)
+{
+    int i;
+
+    for (i = 0; i < t->numcolumns; i++)
+        Z_Free(t->data[i]);
+
+    table_init(t, t->columns, t->numcolumns);
+}
+
+static uint32_t table_add_row(dptable_t *t)
+{
+    int i;
+
+    if (t->numrows == t->maxrows) {
+        t->maxrows = t->maxrows ? t->maxrows * 2 : 4096;
+        for (i = 0; i < t->numcolumns; i++)
+            t->data[i] = Z_Realloc(t->data[i], t->maxrows * sizeof(t->data[i][0]));
+    }
+
+    return t->numrows++;
+}
+
+static inline void put_int(dptable_t *t, uint32_t row, int column, int32_t value)
+{
+    t->data[column][row] = LittleLong(value);
+}
+
+static inline void put_float(dptable_t *t, uint32_t row, int column, float value)
+{
+    union {
+        float       f;
+        uint32_t    u;
+    } dat = { .f = value };
+
+    t->data[column][row] = LittleLong(dat.u);
+}
+
+static void emit_frame(dpdemo_t *d, const dpframe_t *frame)
+{
+    const player_state_t *ps = &frame->ps;
+    const entity_state_t *s;
+    dptable_t *t;
+    uint32_t row;
+    int i;
+
+    t = &d->players;
+    row = table_add_row(t);
+    put_int(t, row, PC_FRAME, frame->number);
+    put_int(t, row, PC_CLIENT, frame->clientNum);
+    put_int(t, row, PC_PM_TYPE, ps->pmove.pm_type);
+    put_int(t, row, PC_PM_FLAGS, ps->pmove.pm_flags);
+    put_float(t, row, PC_ORIGIN_X, ps->pmove.origin[0]);
+    put_float(t, row, PC_ORIGIN_Y, ps->pmove.origin[1]);
+    put_float(t, row, PC_ORIGIN_Z, ps->pmove.origin[2]);
+    put_float(t, row, PC_VELOCITY_X, ps->pmove.velocity[0]);
+    put_float(t, row, PC_VELOCITY_Y, ps->pmove.velocity[1]);
+    put_float(t, row, PC_VELOCITY_Z, ps->pmove.velocity[2]);
+    put_float(t, row, PC_PITCH, ps->viewangles[PITCH]);
+    put_float(t, row, PC_YAW, ps->viewangles[YAW]);
+    put_float(t, row, PC_ROLL, ps->viewangles[ROLL]);
+    put_int(t, row, PC_GUN_INDEX, ps->gun[0].index);
+    put_int(t, row, PC_GUN_FRAME, ps->gun[0].frame);
+    put_float(t, row, PC_FOV, ps->fov);
+    put_int(t, row, PC_RDFLAGS, ps->rdflags);
+    put_int(t, row, PC_HEALTH, ps->stats[STAT_HEALTH]);
+
+    t = &d->ents;
+    for (i = 0; i < frame->numEntities; i++) {
+        s = &d->entities[(frame->firstEntity + i) & PARSE_ENTITIES_MASK];
+        row = table_add_row(t);
+        put_int(t, row, EC_FRAME, frame->number);
+        put_int(t, row, EC_NUMBER, s->number);
+        put_int(t, row, EC_MODEL, s->modelindex);
+        put_int(t, row, EC_MODEL2, s->modelindex2);
+        put_int(t, row, EC_ANIM_FRAME, s->frame);
+        put_int(t, row, EC_SKIN, s->skinnum);
+        put_int(t, row, EC_EFFECTS, s->effects);
+        put_int(t, row, EC_RENDERFX, s->renderfx);
+        put_float(t, row, EC_ORIGIN_X, s->origin[0]);
+        put_float(t, row, EC_ORIGIN_Y, s->origin[1]);
+        put_float(t, row, EC_ORIGIN_Z, s->origin[2]);
+        put_float(t, row, EC_ANGLE_X, s->angles[0]);
+        put_float(t, row, EC_ANGLE_Y, s->angles[1]);
+        put_float(t, row, EC_ANGLE_Z, s->angles[2]);
+        put_int(t, row, EC_SOLID, s->bbox);
+        put_int(t, row, EC_SOUND, s->sound);
+        put_int(t, row, EC_EVENT, s->event);
+    }
+}
+
+static int write_table(const char *path, const dptable_t *t)
+{
+    uint32_t header[4];
+    dpcolumn_t column;
+    qhandle_t f;
+    int i, ret;
+
+    ret = FS_OpenFile(path, &f, FS_MODE_WRITE);
+    if (!f)
+        return ret;
+
+    header[0] = MakeLittleLong('D', 'C', 'O', 'L');
+    header[1] = LittleLong(DP_VERSION);
+    header[2] = LittleLong(t->numcolumns);
+    header[3] = LittleLong(t->numrows);
+    FS_Write(header, sizeof(header), f);
+
+    for (i = 0; i < t->numcolumns; i++) {
+        memset(&column, 0, sizeof(column));
+        Q_strlcpy(column.name, t->columns[i].name, sizeof(column.name));
+        column.type = LittleLong(t->columns[i].type);
+        FS_Write(&column, sizeof(column), f);
+    }
+
+    for (i = 0; i < t->numcolumns; i++)
+        FS_Write(t->data[i], t->numrows * sizeof(t->data[i][0]), f);
+
+    return FS_CloseFile(f);
+}
+
+/*
+===============================================================================
+
+MESSAGE PARSING
+
+===============================================================================
+*/
+
+static bool parse_message(dpdemo_t *d);
+
+static void parse_delta_entity(dpdemo_t *d, dpframe_t *frame, int newnum,
+                               const entity_state_t *old, int bits)
+{
+    entity_state_t *state = &d->entities[d->numentities & PARSE_ENTITIES_MASK];
+
+    d->numentities++;
+    frame->numEntities++;
+
+    MSG_ParseDeltaEntity(old, state, newnum, bits, 0);
+
+    // shuffle previous origin to old
+    if (!(bits & U_OLDORIGIN) && !(state->renderfx & RF_MASK_BEAMLIKE))
+        VectorCopy(old->origin, state->old_origin);
+}
+
+static const entity_state_t *old_entity(const dpdemo_t *d, const dpframe_t *oldframe,
+                                        int index, int *num)
+{
+    const entity_state_t *state;
+
+    if (!oldframe || index >= oldframe->numEntities) {
+        *num = 99999;
+        return NULL;
+    }
+
+    state = &d->entities[(oldframe->firstEntity + index) & PARSE_ENTITIES_MASK];
+    *num = state->number;
+    return state;
+}
+
+static bool parse_packet_entities(dpdemo_t *d, const dpframe_t *oldframe, dpframe_t *frame)
+{
+    const entity_state_t *oldstate;
+    int newnum, oldnum, oldindex, bits;
+
+    frame->firstEntity = d->numentities;
+    frame->numEntities = 0;
+
+    oldindex = 0;
+    oldstate = old_entity(d, oldframe, oldindex, &oldnum);
+
+    while (1) {
+        newnum = MSG_ParseEntityBits(&bits, 0);
+        if (newnum < 0 || newnum >= MAX_PACKET_ENTITIES)
+            return dp_fail(d, "bad entity number %d", newnum);
+
+        if (msg_read.readcount > msg_read.cursize)
+            return dp_fail(d, "read past end of message");
+
+        if (!newnum)
+            break;
+
+        // one or more entities from the old packet are unchanged
+        while (oldnum < newnum) {
+            parse_delta_entity(d, frame, oldnum, oldstate, 0);
+            oldstate = old_entity(d, oldframe, ++oldindex, &oldnum);
+        }
+
+        if (bits & U_REMOVE) {
+            if (!oldframe)
+                return dp_fail(d, "U_REMOVE without delta frame");
+            oldstate = old_entity(d, oldframe, ++oldindex, &oldnum);
+            continue;
+        }
+
+        if (oldnum == newnum) {
+            parse_delta_entity(d, frame, newnum, oldstate, bits);
+            oldstate = old_entity(d, oldframe, ++oldindex, &oldnum);
+            continue;
+        }
+
+        parse_delta_entity(d, frame, newnum, &d->baselines[newnum], bits);
+    }
+
+    // any remaining entities in the old frame are copied over
+    while (oldnum != 99999) {
+        parse_delta_entity(d, frame, oldnum, oldstate, 0);
+        oldstate = old_entity(d, oldframe, ++oldindex, &oldnum);
+    }
+
+    return true;
+}
+
+static bool parse_frame(dpdemo_t *d, int extrabits)
+{
+    uint32_t bits, extraflags;
+    int currentframe, deltaframe, delta, length;
+    const dpframe_t *oldframe;
+    const player_state_t *from;
+    dpframe_t frame;
+
+    memset(&frame, 0, sizeof(frame));
+
+    bits = MSG_ReadLong();
+    currentframe = bits & FRAMENUM_MASK;
+    delta = bits >> FRAMENUM_BITS;
+    deltaframe = delta == 31 ? -1 : currentframe - delta;
+
+    bits = MSG_ReadByte();
+    extraflags = (extrabits << 4) | (bits >> SUPPRESSCOUNT_BITS);
+
+    frame.number = currentframe;
+
+    if (deltaframe > 0) {
+        oldframe = &d->frames[deltaframe & UPDATE_MASK];
+        if (deltaframe != currentframe && oldframe->number == deltaframe && oldframe->valid &&
+            d->numentities - oldframe->firstEntity <= MAX_PARSE_ENTITIES - MAX_PACKET_ENTITIES) {
+            frame.valid = true;
+        } else if (d->frame.valid) {
+            // recover broken demo the same way client does
+            oldframe = &d->frame;
+            frame.valid = true;
+        }
+        from = &oldframe->ps;
+    } else {
+        oldframe = NULL;
+        from = NULL;
+        frame.valid = true;
+    }
+
+    // skip areabits
+    length = MSG_ReadByte();
+    if (length < 0 || !MSG_ReadData(length))
+        return dp_fail(d, "read past end of message");
+
+    bits = MSG_ReadWord();
+    MSG_ParseDeltaPlayerstate(from, &frame.ps, bits, extraflags);
+
+    if (extraflags & EPS_CLIENTNUM)
+        frame.clientNum = MSG_ReadByte();
+    else if (oldframe)
+        frame.clientNum = oldframe->clientNum;
+
+    if (!parse_packet_entities(d, oldframe, &frame))
+        return false;
+
+    d->frames[currentframe & UPDATE_MASK] = frame;
+
+    if (!frame.valid) {
+        d->frame.valid = false;
+        return true;
+    }
+
+    d->frame = frame;
+    d->numframes++;
+
+    if (d->analyze)
+        emit_frame(d, &frame);
+
+    return true;
+}
+
+static bool parse_ambient(dpdemo_t *d, int index, int bits)
+{
+    entity_state_t state;
+
+    if (index < OFFSET_AMBIENT_ENTITIES || index >= OFFSET_PRIVATE_ENTITIES)
+        return dp_fail(d, "bad ambient number %d", index);
+
+    // ambients are not part of the output, only skip over them
+    MSG_ParseDeltaEntity(NULL, &state, index, bits, MSG_ES_AMBIENT);
+    return true;
+}
+
+static bool parse_ambients(dpdemo_t *d)
+{
+    int index, bits;
+
+    MSG_ReadByte();
+    MSG_ReadWord();
+
+    while (1) {
+        index = MSG_ParseEntityBits(&bits, MSG_ES_AMBIENT);
+        if (msg_read.readcount > msg_read.cursize)
+            return dp_fail(d, "read past end of message");
+
+        if (index == OFFSET_PRIVATE_ENTITIES)
+            return true;
+
+        if (!parse_ambient(d, index, bits))
+            return false;
+    }
+}
+
+static bool parse_configstring(dpdemo_t *d, int index)
+{
+    char buffer[MAX_QPATH];
+
+    if (index < 0 || index >= MAX_CONFIGSTRINGS)
+        return dp_fail(d, "bad configstring index %d", index);
+
+    MSG_ReadString(buffer, sizeof(buffer));
+
+    if (index == CS_NUMITEMS) {
+        d->num_items = atoi(buffer);
+        clamp(d->num_items, 0, MAX_ITEMS);
+    }
+
+    return true;
+}
+
+static bool parse_gamestate(dpdemo_t *d)
+{
+    int index, bits;
+
+    while (msg_read.readcount < msg_read.cursize) {
+        index = MSG_ReadShort();
+        if (index == MAX_CONFIGSTRINGS)
+            break;
+        if (!parse_configstring(d, index))
+            return false;
+    }
+
+    while (msg_read.readcount < msg_read.cursize) {
+        index = MSG_ParseEntityBits(&bits, 0);
+        if (!index)
+            break;
+        if (index < 1 || index >= MAX_PACKET_ENTITIES)
+            return dp_fail(d, "bad baseline number %d", index);
+        MSG_ParseDeltaEntity(NULL, &d->baselines[index], index, bits, 0);
+    }
+
+    while (msg_read.readcount < msg_read.cursize) {
+        index = MSG_ParseEntityBits(&bits, MSG_ES_AMBIENT);
+        if (index == OFFSET_PRIVATE_ENTITIES)
+            break;
+        if (!parse_ambient(d, index, bits))
+            return false;
+    }
+
+    MSG_ReadByte();
+    MSG_ReadWord();
+    return true;
+}
+
+static void parse_serverdata(dpdemo_t *d)
+{
+    MSG_ReadLong();             // protocol
+    MSG_ReadLong();             // servercount
+    MSG_ReadByte();             // attractloop
+    MSG_ReadString(NULL, 0);    // gamedir
+    MSG_ReadShort();            // clientNum
+    MSG_ReadString(d->levelname, sizeof(d->levelname));
+
+    // start from scratch, like CL_ClearState does
+    memset(d->baselines, 0, sizeof(d->baselines[0]) * MAX_PACKET_ENTITIES);
+    memset(d->frames, 0, sizeof(d->frames));
+    memset(&d->frame, 0, sizeof(d->frame));
+    d->num_items = 0;
+}
+
+static bool parse_tent(dpdemo_t *d)
+{
+    int type, len;
+
+    type = MSG_ReadByte();
+
+    // see CL_ParseTEntPacket, positions are 12 bytes and directions 1 byte
+    switch (type) {
+    case TE_BLOOD:
+    case TE_GUNSHOT:
+    case TE_SPARKS:
+    case TE_BULLET_SPARKS:
+    case TE_SCREEN_SPARKS:
+    case TE_SHIELD_SPARKS:
+    case TE_SHOTGUN:
+    case TE_BLASTER:
+    case TE_GREENBLOOD:
+    case TE_BLASTER2:
+    case TE_FLECHETTE:
+    case TE_HEATBEAM_SPARKS:
+    case TE_HEATBEAM_STEAM:
+    case TE_MOREBLOOD:
+    case TE_ELECTRIC_SPARKS:
+        len = 12 + 1;
+        break;
+
+    case TE_SPLASH:
+    case TE_LASER_SPARKS:
+    case TE_WELDING_SPARKS:
+    case TE_TUNNEL_SPARKS:
+        len = 1 + 12 + 1 + 1;
+        break;
+
+    case TE_BLUEHYPERBLASTER:
+    case TE_RAILTRAIL:
+    case TE_BUBBLETRAIL:
+    case TE_DEBUGTRAIL:
+    case TE_BUBBLETRAIL2:
+    case TE_BFG_LASER:
+        len = 12 + 12;
+        break;
+
+    case TE_GRENADE_EXPLOSION:
+    case TE_GRENADE_EXPLOSION_WATER:
+    case TE_EXPLOSION2:
+    case TE_PLASMA_EXPLOSION:
+    case TE_ROCKET_EXPLOSION:
+    case TE_ROCKET_EXPLOSION_WATER:
+    case TE_EXPLOSION1:
+    case TE_EXPLOSION1_NP:
+    case TE_EXPLOSION1_BIG:
+    case TE_BFG_EXPLOSION:
+    case TE_BFG_BIGEXPLOSION:
+    case TE_BOSSTPORT:
+    case TE_PLAIN_EXPLOSION:
+    case TE_CHAINFIST_SMOKE:
+    case TE_TRACKER_EXPLOSION:
+    case TE_TELEPORT_EFFECT:
+    case TE_DBALL_GOAL:
+    case TE_WIDOWSPLASH:
+    case TE_NUKEBLAST:
+        len = 12;
+        break;
+
+    case TE_PARASITE_ATTACK:
+    case TE_MEDIC_CABLE_ATTACK:
+    case TE_HEATBEAM:
+    case TE_MONSTER_HEATBEAM:
+        len = 2 + 12 + 12;
+        break;
+
+    case TE_GRAPPLE_CABLE:
+        len = 2 + 12 + 12 + 12;
+        break;
+
+    case TE_LIGHTNING:
+        len = 2 + 2 + 12 + 12;
+        break;
+
+    case TE_FLASHLIGHT:
+    case TE_WIDOWBEAMOUT:
+        len = 12 + 2;
+        break;
+
+    case TE_FORCEWALL:
+        len = 12 + 12 + 1;
+        break;
+
+    case TE_STEAM:
+        len = 1 + 12 + 1 + 1 + 2;
+        if (MSG_ReadShort() != -1)
+            len += 4;
+        break;
+
+    case TE_FLARE:
+        len = 2 + 1 + 12 + 1;
+        break;
+
+    default:
+        return dp_fail(d, "bad temp entity type %d", type);
+    }
+
+    if (!MSG_ReadData(len))
+        return dp_fail(d, "read past end of message");
+
+    return true;
+}
+
+static void parse_sound(void)
+{
+    int flags = MSG_ReadByte();
+
+    MSG_ReadByte();
+
+    if (flags & SND_VOLUME)
+        MSG_ReadByte();
+    if (flags & SND_ATTENUATION)
+        MSG_ReadByte();
+    if (flags & SND_ENT)
+        MSG_ReadShort();
+    if (flags & SND_POS)
+        MSG_ReadData(12);
+    if (flags & SND_PITCH)
+        MSG_ReadChar();
+}
+
+static bool parse_zpacket(dpdemo_t *d)
+{
+    sizebuf_t temp;
+    int ret, inlen, outlen;
+    bool ok;
+
+    if (d->zpacket)
+        return dp_fail(d, "recursive zpacket");
+
+    inlen = MSG_ReadWord();
+    outlen = MSG_ReadWord();
+
+    if (inlen == -1 || outlen == -1 || msg_read.readcount + inlen > msg_read.cursize)
+        return dp_fail(d, "read past end of message");
+
+    if (outlen > MAX_MSGLEN)
+        return dp_fail(d, "invalid zpacket length");
+
+    if (!d->zinit) {
+        if (inflateInit2(&d->z, -MAX_WBITS) != Z_OK)
+            return dp_fail(d, "inflateInit2() failed");
+        d->zbuffer = Z_Malloc(MAX_MSGLEN);
+        d->zinit = true;
+    }
+
+    inflateReset(&d->z);
+
+    d->z.next_in = msg_read.data + msg_read.readcount;
+    d->z.avail_in = (uInt)inlen;
+    d->z.next_out = d->zbuffer;
+    d->z.avail_out = (uInt)outlen;
+    ret = inflate(&d->z, Z_FINISH);
+    if (ret != Z_STREAM_END)
+        return dp_fail(d, "inflate() failed with error %d", ret);
+
+    msg_read.readcount += inlen;
+
+    temp = msg_read;
+    SZ_Init(&msg_read, d->zbuffer, outlen);
+    msg_read.cursize = outlen;
+
+    d->zpacket = true;
+    ok = parse_message(d);
+    d->zpacket = false;
+
+    msg_read = temp;
+    return ok;
+}
+
+static bool parse_message(dpdemo_t *d)
+{
+    int cmd, extrabits, i;
+    bool ok;
+
+    while (1) {
+        if (msg_read.readcount > msg_read.cursize)
+            return dp_fail(d, "read past end of server message");
+
+        if ((cmd = MSG_ReadByte()) == -1)
+            return true;
+
+        extrabits = cmd >> SVCMD_BITS;
+        cmd &= SVCMD_MASK;
+
+        switch (cmd) {
+        case svc_nop:
+            ok = true;
+            break;
+
+        case svc_disconnect:
+        case svc_reconnect:
+            d->finished = true;
+            return true;
+
+        case svc_print:
+            MSG_ReadByte();
+            // fall through
+
+        case svc_centerprint:
+        case svc_stufftext:
+        case svc_layout:
+            MSG_ReadString(NULL, 0);
+            ok = true;
+            break;
+
+        case svc_serverdata:
+            parse_serverdata(d);
+            ok = true;
+            break;
+
+        case svc_configstring:
+            ok = parse_configstring(d, MSG_ReadShort());
+            break;
+
+        case svc_sound:
+            parse_sound();
+            ok = true;
+            break;
+
+        case svc_temp_entity:
+            ok = parse_tent(d);
+            break;
+
+        case svc_muzzleflash:
+        case svc_muzzleflash2:
+            MSG_ReadShort();
+            MSG_ReadByte();
+            ok = true;
+            break;
+
+        case svc_frame:
+            ok = parse_frame(d, extrabits);
+            break;
+
+        case svc_ambient:
+            ok = parse_ambients(d);
+            break;
+
+        case svc_inventory:
+            for (i = 0; i < d->num_items; i++)
+                MSG_ReadShort();
+            ok = true;
+            break;
+
+        case svc_zpacket:
+            ok = parse_zpacket(d);
+            break;
+
+        case svc_gamestate:
+            ok = parse_gamestate(d);
+            break;
+
+        case svc_setting:
+            MSG_ReadLong();
+            MSG_ReadLong();
+            ok = true;
+            break;
+
+        default:
+            return dp_fail(d, "illegible server message %d", cmd);
+        }
+
+        if (!ok)
+            return false;
+    }
+}
+
+/*
+===============================================================================
+
+DEMO PROCESSING
+
+===============================================================================
+*/
+
+static void inflate_demo(dpdemo_t *d)
+{
+    z_stream z;
+    size_t size;
+    int ret;
+
+    if (d->rawlen < 18 || d->raw[0] != 0x1f || d->raw[1] != 0x8b) {
+        d->data = d->raw;
+        d->datalen = d->rawlen;
+        d->raw = NULL;
+        return;
+    }
+
+    memset(&z, 0, sizeof(z));
+    if (inflateInit2(&z, MAX_WBITS + 16) != Z_OK) {
+        dp_fail(d, "inflateInit2() failed");
+        Z_Free(d->raw);
+        d->raw = NULL;
+        return;
+    }
+
+    // gzip trailer has uncompressed size modulo 2^32, use it as a hint
+    size = RL32(d->raw + d->rawlen - 4);
+    clamp(size, d->rawlen, MAX_LOADFILE);
+    d->data = Z_Malloc(size);
+
+    z.next_in = d->raw;
+    z.avail_in = d->rawlen;
+
+    while (1) {
+        z.next_out = d->data + z.total_out;
+        z.avail_out = size - z.total_out;
+
+        ret = inflate(&z, Z_NO_FLUSH);
+        if (ret == Z_STREAM_END)
+            break;
+
+        // keep whatever has been decompressed so far
+        if (ret == Z_BUF_ERROR && z.avail_out) {
+            dp_fail(d, "unexpected end of gzip stream");
+            break;
+        }
+        if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            dp_fail(d, "inflate() failed with error %d", ret);
+            break;
+        }
+        if (z.avail_out)
+            continue;
+
+        if (size >= MAX_LOADFILE) {
+            dp_fail(d, "uncompressed demo too large");
+            break;
+        }
+        size = min(size * 2, MAX_LOADFILE);
+        d->data = Z_Realloc(d->data, size);
+    }
+
+    d->datalen = z.total_out;
+    inflateEnd(&z);
+
+    Z_Free(d->raw);
+    d->raw = NULL;
+}
+
+// re-encodes parsed messages at maximum zlib compression level,
+// dropping anything that follows the last well formed message
+static void transcode_demo(dpdemo_t *d)
+{
+    static const uint32_t eof = (uint32_t)-1;
+    z_stream z;
+    uLong bound;
+    int ret;
+
+    memset(&z, 0, sizeof(z));
+    if (deflateInit2(&z, Z_BEST_COMPRESSION, Z_DEFLATED, MAX_WBITS + 16,
+                     MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK) {
+        dp_fail(d, "deflateInit2() failed");
+        return;
+    }
+
+    bound = deflateBound(&z, d->parsedlen + sizeof(eof));
+    d->packed = Z_Malloc(bound);
+
+    z.next_out = d->packed;
+    z.avail_out = bound;
+
+    z.next_in = d->data;
+    z.avail_in = d->parsedlen;
+    ret = deflate(&z, Z_NO_FLUSH);
+
+    if (ret == Z_OK) {
+        z.next_in = (Bytef *)&eof;
+        z.avail_in = sizeof(eof);
+        ret = deflate(&z, Z_FINISH);
+    }
+
+    if (ret == Z_STREAM_END) {
+        d->packedlen = z.total_out;
+    } else {
+        dp_fail(d, "deflate() failed with error %d", ret);
+        Z_Free(d->packed);
+        d->packed = NULL;
+    }
+
+    deflateEnd(&z);
+}
+
+static void process_demo(dpdemo_t *d)
+{
+    sizebuf_t saved = msg_read;
+    size_t offset = 0;
+    uint32_t msglen;
+
+    inflate_demo(d);
+
+    d->baselines = Z_Mallocz(sizeof(d->baselines[0]) * MAX_PACKET_ENTITIES);
+    d->entities = Z_Malloc(sizeof(d->entities[0]) * MAX_PARSE_ENTITIES);
+    if (d->analyze) {
+        table_init(&d->players, player_columns, PC_NUM_COLUMNS);
+        table_init(&d->ents, entity_columns, EC_NUM_COLUMNS);
+    }
+
+    while (!d->finished && offset + 4 <= d->datalen) {
+        msglen = RL32(d->data + offset);
+        if (msglen == (uint32_t)-1)
+            break;
+
+        if (msglen > MAX_MSGLEN) {
+            dp_fail(d, "bad message length %u", msglen);
+            break;
+        }
+        if (msglen > d->datalen - offset - 4) {
+            dp_fail(d, "truncated message");
+            break;
+        }
+
+        SZ_Init(&msg_read, d->data + offset + 4, msglen);
+        msg_read.cursize = msglen;
+
+        if (!parse_message(d))
+            break;
+
+        offset += 4 + msglen;
+        d->messages++;
+    }
+
+    d->parsedlen = offset;
+
+    Z_Free(d->baselines);
+    d->baselines = NULL;
+    Z_Free(d->entities);
+    d->entities = NULL;
+    if (d->zinit) {
+        inflateEnd(&d->z);
+        Z_Free(d->zbuffer);
+        d->zbuffer = NULL;
+        d->zinit = false;
+    }
+
+    if (d->transcode)
+        transcode_demo(d);
+
+    Z_Free(d->data);
+    d->data = NULL;
+
+    // the main thread may be parsing a packet while running this
+    msg_read = saved;
+}
+
+static void process_job(void *arg, int index)
+{
+    dpdemo_t *demos = arg;
+
+    process_demo(&demos[index]);
+}
+
+static void base_name(char *out, const char *name, size_t size)
+{
+    char buffer[MAX_OSPATH];
+
+    if (COM_CompareExtension(name, ".gz")) {
+        COM_StripExtension(buffer, name, sizeof(buffer));
+        name = buffer;
+    }
+
+    COM_StripExtension(out, name, size);
+}
+
+static void write_output(const char *dir, const char *base, const char *ext,
+                         const dptable_t *t, const void *data, size_t len)
+{
+    char path[MAX_OSPATH];
+    int ret;
+
+    if (Q_concat(path, sizeof(path), "demos/", dir, base, ext) >= sizeof(path)) {
+        Com_EPrintf("Oversize output path for %s\n", base);
+        return;
+    }
+
+    if (t)
+        ret = write_table(path, t);
+    else
+        ret = FS_WriteFile(path, data, len);
+
+    if (ret < 0)
+        Com_EPrintf("Couldn't write %s: %s\n", path, Q_ErrorString(ret));
+}
+
+static void finish_demo(dpdemo_t *d, uint64_t *totals)
+{
+    char base[MAX_OSPATH];
+
+    base_name(base, d->name, sizeof(base));
+
+    if (d->analyze) {
+        write_output("analysis/", base, ".players.col", &d->players, NULL, 0);
+        write_output("analysis/", base, ".entities.col", &d->ents, NULL, 0);
+
+        totals[0] += d->players.numrows;
+        totals[1] += d->ents.numrows;
+        table_free(&d->players);
+        table_free(&d->ents);
+    }
+
+    if (d->packed) {
+        write_output("transcoded/", base, ".dm2.gz", NULL, d->packed, d->packedlen);
+
+        totals[2] += d->rawlen;
+        totals[3] += d->packedlen;
+        Z_Free(d->packed);
+        d->packed = NULL;
+    }
+
+    Com_Printf("%s: \"%s\", %u messages, %u frames", d->name,
+               d->levelname, d->messages, d->numframes);
+    if (d->transcode)
+        Com_Printf(", %zu -> %zu bytes", d->rawlen, d->packedlen);
+    Com_Printf("\n");
+
+    if (d->error[0])
+        Com_WPrintf("%s: stopped at offset %zu: %s\n", d->name, d->parsedlen, d->error);
+}
+
+static int add_names(char ***names, int count, const char *arg)
+{
+    void **list;
+    int i, n;
+
+    if (!strpbrk(arg, "*?[")) {
+        *names = Z_Realloc(*names, sizeof(**names) * (count + 1));
+        (*names)[count++] = Z_CopyString(arg);
+        return count;
+    }
+
+    list = FS_ListFiles("demos", arg, FS_SEARCH_SAVEPATH | FS_SEARCH_BYFILTER, &n);
+    if (!list)
+        return count;
+
+    *names = Z_Realloc(*names, sizeof(**names) * (count + n));
+    for (i = 0; i < n; i++)
+        (*names)[count++] = Z_CopyString(list[i]);
+
+    FS_FreeList(list);
+    return count;
+}
+
+static void process_demos(bool analyze, bool transcode)
+{
+    char path[MAX_OSPATH];
+    char **names = NULL;
+    uint64_t totals[4] = { 0 };
+    unsigned start, processed = 0;
+    int i, next, count, batch, numnames = 0;
+    dpdemo_t *demos, *d;
+    void *data;
+    int ret;
+
+    if (Cmd_Argc() < 2) {
+        Com_Printf("Usage: %s <demo|wildcard> [...]\n", Cmd_Argv(0));
+        return;
+    }
+
+    for (i = 1; i < Cmd_Argc(); i++)
+        numnames = add_names(&names, numnames, Cmd_Argv(i));
+
+    if (!numnames) {
+        Com_Printf("No demos found.\n");
+        return;
+    }
+
+    start = Sys_Milliseconds();
+
+    // a couple of demos per thread evens out differences in length
+    batch = Sys_NumParallelThreads() * 2;
+    demos = Z_Malloc(sizeof(demos[0]) * batch);
+
+    for (next = 0; next < numnames; ) {
+        // filesystem is not thread safe, load on main thread
+        for (count = 0; next < numnames && count < batch; next++) {
+            if (COM_CompareExtension(names[next], ".dm2") || COM_CompareExtension(names[next], ".gz"))
+                ret = Q_concat(path, sizeof(path), "demos/", names[next]);
+            else
+                ret = Q_concat(path, sizeof(path), "demos/", names[next], ".dm2");
+
+            if (ret >= sizeof(path)) {
+                Com_EPrintf("Oversize demo name: %s\n", names[next]);
+                continue;
+            }
+
+            ret = FS_LoadFile(path, &data);
+            if (!data) {
+                Com_EPrintf("Couldn't load %s: %s\n", path, Q_ErrorString(ret));
+                continue;
+            }
+
+            d = &demos[count++];
+            memset(d, 0, sizeof(*d));
+            Q_strlcpy(d->name, names[next], sizeof(d->name));
+            d->analyze = analyze;
+            d->transcode = transcode;
+            d->raw = data;
+            d->rawlen = ret;
+        }
+
+        Sys_ParallelFor(count, process_job, demos);
+
+        for (i = 0; i < count; i++)
+            finish_demo(&demos[i], totals);
+
+        processed += count;
+    }
+
+    Com_Printf("Processed %u of %d demos in %u ms.\n", processed, numnames,
+               Sys_Milliseconds() - start);
+    if (analyze)
+        Com_Printf("%"PRIu64" player rows, %"PRIu64" entity rows.\n", totals[0], totals[1]);
+    if (transcode)
+        Com_Printf("Transcoded %"PRIu64" -> %"PRIu64" bytes.\n", totals[2], totals[3]);
+
+    for (i = 0; i < numnames; i++)
+        Z_Free(names[i]);
+    Z_Free(names);
+    Z_Free(demos);
+}
+
+static void DP_Analyze_f(void)
+{
+    process_demos(true, false);
+}
+
+static void DP_Transcode_f(void)
+{
+    process_demos(false, true);
+}
+
+static void DP_Process_f(void)
+{
+    process_demos(true, true);
+}
+
+static void DP_Demo_c(genctx_t *ctx, int argnum)
+{
+    FS_File_g("demos", "*.dm2;*.dm2.gz", FS_SEARCH_SAVEPATH | FS_SEARCH_BYFILTER, ctx);
+}
+
+static const cmdreg_t c_demoproc[] = {
+    { "analyzedemos", DP_Analyze_f, DP_Demo_c },
+    { "transcodedemos", DP_Transcode_f, DP_Demo_c },
+    { "processdemos", DP_Process_f, DP_Demo_c },
+
+    { NULL }
+};
+
+void DP_Init(void)
+{
+    Cmd_Register(c_demoproc);
+}
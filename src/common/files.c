@@ -57,7 +57,14 @@ QUAKE FILESYSTEM
 
 #define MAX_FILE_HANDLES    1024
 
-#define ZIP_BUFSIZE     (1 << 16)   // inflate in blocks of 64k
+#define ZIP_BUFSIZE     (1 << 18)   // read ahead 256k of compressed data
+#define ZIP_SKIPSIZE    (1 << 16)   // discard in blocks of 64k when seeking
+#define ZIP_WINSIZE     (1 << 15)   // inflate dictionary size
+
+// streams of deflated members at least this large record seek points
+// every ZIP_SEEKSPAN bytes of output while being read
+#define ZIP_SEEKSPAN    (1 << 19)
+#define ZIP_MINSEEKABLE (ZIP_SEEKSPAN * 2)
 #define ZIP_MAXFILES    (1 << 20)   // 1 million files
 
 #define ZIP_SIZELOCALHEADER     30
@@ -107,10 +114,20 @@ typedef enum {
     FS_BAD
 } filetype_t;
 
+// inflate state at a deflate block boundary, enough to resume from
 typedef struct {
-    z_stream    stream;
-    int64_t     rest_in;
-    byte        buffer[ZIP_BUFSIZE];
+    int64_t     out;        // uncompressed position
+    int64_t     in;         // compressed bytes consumed
+    int         bits;       // unused bits of the last consumed byte
+    byte        window[ZIP_WINSIZE];
+} zipseekpoint_t;
+
+typedef struct {
+    z_stream        stream;
+    int64_t         rest_in;
+    zipseekpoint_t  **points;   // sorted by position
+    int             num_points;
+    byte            buffer[ZIP_BUFSIZE];
 } zipstream_t;
 
 typedef struct packfile_s {
@@ -178,20 +195,66 @@ static int          fs_num_files;
 
 static bool         fs_non_uniq_open;
 
+// merged index of all pack entries, rebuilt when search paths change.
+// entries with the same name are chained in search order.
+typedef struct packindex_s {
+    struct packindex_s  *hash_next;
+    searchpath_t        *search;
+    packfile_t          *entry;
+} packindex_t;
+
+static packindex_t  *fs_index;
+static packindex_t  **fs_index_hash;
+static unsigned     fs_index_size;
+static unsigned     fs_index_count;
+
+// names known to be missing from all directory search paths
+typedef struct negentry_s {
+    struct negentry_s   *hash_next;
+    unsigned            hash;
+    unsigned            mode;       // FS_PATH_* bits of the lookup
+    int                 ret;
+    size_t              namelen;
+    char                name[];
+} negentry_t;
+
+#define NEGCACHE_HASH_SIZE      16384
+#define NEGCACHE_MAX_ENTRIES    65536
+
+static negentry_t   *fs_neg_hash[NEGCACHE_HASH_SIZE];
+static unsigned     fs_neg_count;
+
+static cvar_t       *fs_lookup_cache;
+
+// views returned by FS_MapFile
+typedef struct {
+    const void      *data;      // NULL if slot is free
+    mappedfile_t    map;
+    pack_t          *pack;      // referenced while mapped
+} filemap_t;
+
+#define MAX_MAPPED_FILES    32
+#define MIN_MAPPED_FILE     0x10000     // smaller files are just loaded
+
+static filemap_t    fs_maps[MAX_MAPPED_FILES];
+
 #if USE_DEBUG
 static int          fs_count_read;
 static int          fs_count_open;
 static int          fs_count_strcmp;
 static int          fs_count_strlwr;
+static int          fs_count_neghit;
 #define FS_COUNT_READ       fs_count_read++
 #define FS_COUNT_OPEN       fs_count_open++
 #define FS_COUNT_STRCMP     fs_count_strcmp++
 #define FS_COUNT_STRLWR     fs_count_strlwr++
+#define FS_COUNT_NEGHIT     fs_count_neghit++
 #else
 #define FS_COUNT_READ       (void)0
 #define FS_COUNT_OPEN       (void)0
 #define FS_COUNT_STRCMP     (void)0
 #define FS_COUNT_STRLWR     (void)0
+#define FS_COUNT_NEGHIT     (void)0
 #endif
 
 #if USE_DEBUG
@@ -735,6 +798,34 @@ static int get_fp_info(FILE *fp, file_info_t *info)
     return Q_ERR_SUCCESS;
 }
 
+/*
+================
+FS_GetFileInfo
+
+Returns identity of the file behind an open read handle. For files from
+packs, size is the uncompressed entry length and timestamps are those of
+the containing pack file.
+================
+*/
+int FS_GetFileInfo(qhandle_t f, file_info_t *info)
+{
+    file_t *file = file_for_handle(f);
+    int ret;
+
+    if (!file)
+        return Q_ERR(EBADF);
+
+    if ((file->mode & FS_MODE_MASK) != FS_MODE_READ)
+        return Q_ERR(EBADF);
+
+    ret = get_fp_info(file->fp, info);
+    if (ret)
+        return ret;
+
+    info->size = file->length;
+    return Q_ERR_SUCCESS;
+}
+
 FILE *Q_fopen(const char *path, const char *mode)
 {
 #ifdef _WIN32
@@ -915,6 +1006,9 @@ static int64_t open_file_write(file_t *file, const char *name)
         goto fail;
     }
 
+    // the file exists now
+    FS_FlushLookupCache();
+
     FS_DPrintf("%s: %s: %"PRId64" bytes\n", __func__, fullpath, pos);
     return pos;
 
@@ -993,6 +1087,8 @@ static void open_zip_file(file_t *file)
     if (IS_UNIQUE(file)) {
         s = FS_Malloc(sizeof(*s));
         memset(&s->stream, 0, sizeof(s->stream));
+        s->points = NULL;
+        s->num_points = 0;
     } else {
         s = &fs_zipstream;
     }
@@ -1018,6 +1114,11 @@ static void open_zip_file(file_t *file)
 static void close_zip_file(file_t *file)
 {
     zipstream_t *s = file->zfp;
+    int i;
+
+    for (i = 0; i < s->num_points; i++)
+        Z_Free(s->points[i]);
+    Z_Free(s->points);
 
     inflateEnd(&s->stream);
     Z_Free(s);
@@ -1025,11 +1126,45 @@ static void close_zip_file(file_t *file)
     fclose(file->fp);
 }
 
+// remembers inflate state if the stream stopped at a block boundary
+// far enough from the previous seek point
+static void add_seek_point(file_t *file, int64_t out)
+{
+    zipstream_t *s = file->zfp;
+    z_streamp z = &s->stream;
+    zipseekpoint_t *point;
+    int64_t last;
+    uInt len;
+
+    // bit 7 is set at the end of a block, bit 6 if it was the last one
+    if ((z->data_type & 192) != 128) {
+        return;
+    }
+
+    last = s->num_points ? s->points[s->num_points - 1]->out : 0;
+    if (out - last < ZIP_SEEKSPAN) {
+        return;
+    }
+
+    point = FS_Malloc(sizeof(*point));
+    if (inflateGetDictionary(z, point->window, &len) != Z_OK || len != ZIP_WINSIZE) {
+        Z_Free(point);
+        return;
+    }
+    point->out = out;
+    point->in = file->entry->complen - s->rest_in - z->avail_in;
+    point->bits = z->data_type & 7;
+
+    s->points = Z_Realloc(s->points, sizeof(s->points[0]) * (s->num_points + 1));
+    s->points[s->num_points++] = point;
+}
+
 static int read_zip_file(file_t *file, void *buf, size_t len)
 {
     zipstream_t *s = file->zfp;
     z_streamp z = &s->stream;
     size_t block, result;
+    bool seekable;
     int ret;
 
     len = min(len, file->length - file->position);
@@ -1040,6 +1175,11 @@ static int read_zip_file(file_t *file, void *buf, size_t len)
     z->next_out = buf;
     z->avail_out = (uInt)len;
 
+    // stop at each block boundary to find seek points. positions are only
+    // monotonic during a forward read, so seek points are only recorded
+    // past the last one.
+    seekable = IS_UNIQUE(file) && file->length >= ZIP_MINSEEKABLE;
+
     do {
         if (!z->avail_in) {
             if (!s->rest_in) {
@@ -1061,7 +1201,7 @@ static int read_zip_file(file_t *file, void *buf, size_t len)
             z->avail_in = result;
         }
 
-        ret = inflate(z, Z_SYNC_FLUSH);
+        ret = inflate(z, seekable ? Z_BLOCK : Z_SYNC_FLUSH);
         if (ret == Z_STREAM_END) {
             break;
         }
@@ -1069,6 +1209,9 @@ static int read_zip_file(file_t *file, void *buf, size_t len)
             file->error = Q_ERR_INFLATE_FAILED;
             break;
         }
+        if (seekable) {
+            add_seek_point(file, file->position + len - z->avail_out);
+        }
         if (file->error) {
             break;
         }
@@ -1084,31 +1227,73 @@ static int read_zip_file(file_t *file, void *buf, size_t len)
     return len;
 }
 
-static int seek_zip_file(file_t *file, int64_t offset, int whence)
+// restarts inflate from the given seek point, or from the beginning
+static int restart_zip_file(file_t *file, const zipseekpoint_t *point)
 {
     packfile_t *entry = file->entry;
     zipstream_t *s = file->zfp;
     z_streamp z = &s->stream;
+    int64_t in = 0;
+    byte c;
+
+    if (point)
+        in = point->in - (point->bits ? 1 : 0);
+
+    if (os_fseek(file->fp, entry->filepos + in, SEEK_SET))
+        return Q_ERRNO;
+
+    inflateReset(z);
+
+    z->avail_in = z->avail_out = 0;
+    z->next_in = z->next_out = NULL;
+
+    s->rest_in = entry->complen - in;
+    file->position = 0;
+    file->error = Q_ERR_SUCCESS;
+
+    if (!point)
+        return Q_ERR_SUCCESS;
+
+    // feed the bits of the partially consumed byte back
+    if (point->bits) {
+        if (!fread(&c, 1, 1, file->fp))
+            return FS_ERR_READ(file->fp);
+        s->rest_in--;
+        inflatePrime(z, point->bits, c >> (8 - point->bits));
+    }
+
+    inflateSetDictionary(z, point->window, ZIP_WINSIZE);
+    file->position = point->out;
+    return Q_ERR_SUCCESS;
+}
+
+static int seek_zip_file(file_t *file, int64_t offset, int whence)
+{
+    zipstream_t *s = file->zfp;
+    const zipseekpoint_t *point = NULL;
+    int i, ret;
 
     offset = get_seek_offset(file, offset, whence);
     if (offset < 0)
         return offset;
 
-    if (offset < file->position) {
-        if (os_fseek(file->fp, entry->filepos, SEEK_SET))
-            return Q_ERRNO;
-
-        inflateReset(z);
-
-        z->avail_in = z->avail_out = 0;
-        z->next_in = z->next_out = NULL;
+    // find the closest seek point before the target
+    for (i = s->num_points - 1; i >= 0; i--) {
+        if (s->points[i]->out <= offset) {
+            point = s->points[i];
+            break;
+        }
+    }
 
-        s->rest_in = entry->complen;
-        file->position = 0;
+    // restart if the target is behind, or a seek point is closer
+    if (offset < file->position || (point && point->out > file->position)) {
+        ret = restart_zip_file(file, point);
+        if (ret)
+            return ret;
     }
 
     while (file->position < offset) {
-        byte buf[ZIP_BUFSIZE];
+        byte buf[ZIP_SKIPSIZE];
 
         int len = min(offset - file->position, sizeof(buf));
         int ret = read_zip_file(file, buf, len);
@@ -1346,6 +1531,196 @@ int FS_LastModified(char const * file, uint64_t * last_modified)
     return Q_ERR_INVALID_PATH;
 }
 
+/*
+=================================================================
+
+LOOKUP INDEX
+
+Pack contents are merged into a single hash table, so that a lookup
+needs one probe instead of one per pack. Names that were not found in
+any directory search path are remembered until something is written
+through the filesystem, or FS_FlushLookupCache is called. Only lookups
+allowed to hit both directories and packs are cached this way, lookups
+of real files only always go to disk.
+
+=================================================================
+*/
+
+static void free_lookup_index(void)
+{
+    Z_Free(fs_index);
+    Z_Free(fs_index_hash);
+    fs_index = NULL;
+    fs_index_hash = NULL;
+    fs_index_size = fs_index_count = 0;
+
+    FS_FlushLookupCache();
+}
+
+static void build_lookup_index(void)
+{
+    searchpath_t    *search, **paths;
+    packindex_t     *index;
+    packfile_t      *entry;
+    pack_t          *pack;
+    unsigned        hash;
+    int             i, j, num_paths;
+
+    free_lookup_index();
+
+    num_paths = 0;
+    for (search = fs_searchpaths; search; search = search->next) {
+        if (search->pack) {
+            fs_index_count += search->pack->num_files;
+        }
+        num_paths++;
+    }
+
+    paths = FS_Malloc(num_paths * sizeof(paths[0]));
+    for (i = 0, search = fs_searchpaths; search; search = search->next) {
+        paths[i++] = search;
+    }
+
+    fs_index_size = npot32(fs_index_count / 3);
+    fs_index_hash = FS_Mallocz(fs_index_size * sizeof(fs_index_hash[0]));
+    fs_index = index = FS_Malloc(fs_index_count * sizeof(fs_index[0]) + 1);
+
+    // insert in reverse search order so that chains end up in search
+    // order, within a pack later duplicates win as with pack_calc_hashes
+    for (i = num_paths - 1; i >= 0; i--) {
+        if (!(pack = paths[i]->pack)) {
+            continue;
+        }
+        for (j = 0, entry = pack->files; j < pack->num_files; j++, entry++) {
+            hash = FS_HashPath(pack->names + entry->nameofs, fs_index_size);
+            index->search = paths[i];
+            index->entry = entry;
+            index->hash_next = fs_index_hash[hash];
+            fs_index_hash[hash] = index++;
+        }
+    }
+
+    Z_Free(paths);
+}
+
+/*
+================
+FS_FlushLookupCache
+
+Forgets all names known to be missing. Must be called after creating
+files in the game directory other than through the filesystem.
+================
+*/
+void FS_FlushLookupCache(void)
+{
+    negentry_t *neg, *next;
+    int i;
+
+    if (!fs_neg_count) {
+        return;
+    }
+
+    for (i = 0; i < NEGCACHE_HASH_SIZE; i++) {
+        for (neg = fs_neg_hash[i]; neg; neg = next) {
+            next = neg->hash_next;
+            Z_Free(neg);
+        }
+        fs_neg_hash[i] = NULL;
+    }
+
+    fs_neg_count = 0;
+}
+
+// returns the first pack entry visible to the lookup, in search order
+static packindex_t *find_pack_entry(unsigned mode, unsigned hash,
+                                    const char *normalized, size_t namelen)
+{
+    packindex_t *index;
+    packfile_t  *entry;
+    pack_t      *pack;
+
+    if (!fs_index_hash) {
+        return NULL;
+    }
+
+    for (index = fs_index_hash[hash & (fs_index_size - 1)]; index; index = index->hash_next) {
+        if (mode & FS_PATH_MASK) {
+            if ((mode & index->search->mode & FS_PATH_MASK) == 0) {
+                continue;
+            }
+        }
+
+        entry = index->entry;
+        if (entry->namelen != namelen) {
+            continue;
+        }
+
+        pack = index->search->pack;
+        if ((mode & FS_FLAG_DEFLATE) && (pack->type != FS_ZIP || entry->compmtd != Z_DEFLATED)) {
+            continue;
+        }
+
+        FS_COUNT_STRCMP;
+        if (!FS_pathcmp(pack->names + entry->nameofs, normalized)) {
+            return index;
+        }
+    }
+
+    return NULL;
+}
+
+static negentry_t *find_negative(unsigned mode, unsigned hash,
+                                 const char *normalized, size_t namelen)
+{
+    negentry_t *neg;
+
+    for (neg = fs_neg_hash[hash & (NEGCACHE_HASH_SIZE - 1)]; neg; neg = neg->hash_next) {
+        if (neg->hash == hash && neg->mode == (mode & FS_PATH_MASK) &&
+            neg->namelen == namelen && !FS_pathcmp(neg->name, normalized)) {
+            return neg;
+        }
+    }
+
+    return NULL;
+}
+
+static void add_negative(unsigned mode, unsigned hash,
+                         const char *normalized, size_t namelen, int ret)
+{
+    negentry_t *neg;
+
+    if (fs_neg_count >= NEGCACHE_MAX_ENTRIES) {
+        FS_FlushLookupCache();
+    }
+
+    neg = FS_Malloc(sizeof(*neg) + namelen + 1);
+    neg->hash = hash;
+    neg->mode = mode & FS_PATH_MASK;
+    neg->ret = ret;
+    neg->namelen = namelen;
+    memcpy(neg->name, normalized, namelen + 1);
+    neg->hash_next = fs_neg_hash[hash & (NEGCACHE_HASH_SIZE - 1)];
+    fs_neg_hash[hash & (NEGCACHE_HASH_SIZE - 1)] = neg;
+    fs_neg_count++;
+}
+
+// returns true if any directory search path after the given one is
+// visible to the lookup
+static bool dirs_follow(const searchpath_t *search, unsigned mode)
+{
+    for (search = search->next; search; search = search->next) {
+        if (search->pack) {
+            continue;
+        }
+        if ((mode & FS_PATH_MASK) && (mode & search->mode & FS_PATH_MASK) == 0) {
+            continue;
+        }
+        return true;
+    }
+
+    return false;
+}
+
 // Finds the file in the search path.
 // Fills file_t and returns file length.
 // Used for streaming data out of either a pak file or a seperate file.
@@ -1353,11 +1728,12 @@ static int64_t open_file_read(file_t *file, const char *normalized, size_t namel
 {
     char            fullpath[MAX_OSPATH];
     searchpath_t    *search;
-    pack_t          *pak;
+    packindex_t     *found;
+    negentry_t      *neg;
     unsigned        hash;
-    packfile_t      *entry;
     int64_t         ret;
     int             valid;
+    bool            cache;
 
     FS_COUNT_READ;
 
@@ -1365,6 +1741,23 @@ static int64_t open_file_read(file_t *file, const char *normalized, size_t namel
 
     valid = PATH_NOT_CHECKED;
 
+    // find the pack entry that wins unless overridden by a loose file
+    // don't bother searching in paks if length exceedes MAX_QPATH
+    found = NULL;
+    if ((file->mode & FS_TYPE_MASK) != FS_TYPE_REAL && namelen < MAX_QPATH) {
+        found = find_pack_entry(file->mode, hash, normalized, namelen);
+    }
+
+    cache = !(file->mode & (FS_TYPE_MASK | FS_FLAG_DEFLATE)) && fs_lookup_cache->integer;
+    if (cache && (neg = find_negative(file->mode, hash, normalized, namelen))) {
+        FS_COUNT_NEGHIT;
+        if (found) {
+            return open_from_pack(file, found->search->pack, found->entry);
+        }
+        ret = neg->ret;
+        goto fail;
+    }
+
 // search through the path, one element at a time
     for (search = fs_searchpaths; search; search = search->next) {
         if (file->mode & FS_PATH_MASK) {
@@ -1375,36 +1768,14 @@ static int64_t open_file_read(file_t *file, const char *normalized, size_t namel
 
         // is the element a pak file?
         if (search->pack) {
-            if ((file->mode & FS_TYPE_MASK) == FS_TYPE_REAL) {
-                continue;
-            }
-            // don't bother searching in paks if length exceedes MAX_QPATH
-            if (namelen >= MAX_QPATH) {
+            if (!found || found->search != search) {
                 continue;
             }
-            pak = search->pack;
-
-            if ((file->mode & FS_FLAG_DEFLATE) && pak->type != FS_ZIP) {
-                continue;
-            }
-
-            // look through all the pak file elements
-            entry = pak->file_hash[hash & (pak->hash_size - 1)];
-            for (; entry; entry = entry->hash_next) {
-                if (entry->namelen != namelen) {
-                    continue;
-                }
-
-                if ((file->mode & FS_FLAG_DEFLATE) && entry->compmtd != Z_DEFLATED) {
-                    continue;
-                }
-
-                FS_COUNT_STRCMP;
-                if (!FS_pathcmp(pak->names + entry->nameofs, normalized)) {
-                    // found it!
-                    return open_from_pack(file, pak, entry);
-                }
+            // found it!
+            if (cache && !dirs_follow(search, file->mode)) {
+                add_negative(file->mode, hash, normalized, namelen, Q_ERR(ENOENT));
             }
+            return open_from_pack(file, search->pack, found->entry);
         } else {
             if ((file->mode & FS_TYPE_MASK) == FS_TYPE_PAK) {
                 continue;
@@ -1450,6 +1821,10 @@ static int64_t open_file_read(file_t *file, const char *normalized, size_t namel
     // return error if path was checked and found to be invalid
     ret = valid ? Q_ERR(ENOENT) : Q_ERR_INVALID_PATH;
 
+    if (cache) {
+        add_negative(file->mode, hash, normalized, namelen, ret);
+    }
+
 fail:
     FS_DPrintf("%s: %s: %s\n", __func__, normalized, Q_ErrorString(ret));
     return ret;
@@ -1908,6 +2283,101 @@ done:
     return len;
 }
 
+/*
+============
+FS_MapFileEx
+
+Returns read-only contents of the file. Large loose files and files stored
+uncompressed in packs are mapped into memory without copying, anything else
+is loaded the same way FS_LoadFile does. Unlike with FS_LoadFile, buffer is
+not NUL terminated. Must be released with FS_UnmapFile.
+============
+*/
+int FS_MapFileEx(const char *path, const void **buffer, unsigned flags)
+{
+    filemap_t   *map;
+    file_t      *file;
+    qhandle_t   f;
+    int64_t     len, offset;
+    const void  *data;
+    int         i;
+
+    Q_assert(path);
+    Q_assert(buffer);
+
+    *buffer = NULL;
+
+    for (i = 0, map = fs_maps; i < MAX_MAPPED_FILES; i++, map++) {
+        if (!map->data) {
+            break;
+        }
+    }
+    if (i == MAX_MAPPED_FILES) {
+        goto load;
+    }
+
+    len = FS_OpenFile(path, &f, (flags & ~FS_MODE_MASK) | FS_MODE_READ | FS_FLAG_LOADFILE);
+    if (!f) {
+        return len;
+    }
+
+    // compressed files can't be mapped
+    file = file_for_handle(f);
+    if (len < MIN_MAPPED_FILE || len > MAX_LOADFILE ||
+        (file->type != FS_REAL && file->type != FS_PAK)) {
+        FS_CloseFile(f);
+        goto load;
+    }
+
+    offset = file->type == FS_PAK ? file->entry->filepos : 0;
+    data = Sys_MapFile(file->fp, offset, len, &map->map);
+    if (!data) {
+        FS_DPrintf("%s: %s: couldn't map %"PRId64" bytes\n", __func__, path, len);
+        FS_CloseFile(f);
+        goto load;
+    }
+
+    // mapping stays valid after the file is closed, but keep the pack
+    // referenced for as long as it is used
+    if (file->type == FS_PAK) {
+        map->pack = pack_get(file->pack);
+    }
+    map->data = data;
+    FS_CloseFile(f);
+
+    *buffer = data;
+    return len;
+
+load:
+    return FS_LoadFileEx(path, (void **)buffer, flags, TAG_FILESYSTEM);
+}
+
+/*
+============
+FS_UnmapFile
+============
+*/
+void FS_UnmapFile(const void *buffer)
+{
+    filemap_t *map;
+    int i;
+
+    if (!buffer) {
+        return;
+    }
+
+    for (i = 0, map = fs_maps; i < MAX_MAPPED_FILES; i++, map++) {
+        if (map->data == buffer) {
+            Sys_UnmapFile(&map->map);
+            pack_put(map->pack);
+            memset(map, 0, sizeof(*map));
+            return;
+        }
+    }
+
+    FS_FreeFile((void *)buffer);
+}
+
 static int write_and_close(const void *data, size_t len, qhandle_t f)
 {
     int ret1 = FS_Write(data, len, f);
@@ -2003,6 +2473,7 @@ int FS_RenameFile(const char *from, const char *to)
     if (rename(frompath, topath))
         return Q_ERRNO;
 
+    FS_FlushLookupCache();
     return Q_ERR_SUCCESS;
 }
 
@@ -3270,6 +3741,9 @@ static void FS_Stats_f(void)
     Com_Printf("Total path comparsions: %d\n", fs_count_strcmp);
     Com_Printf("Total calls to open_from_disk: %d\n", fs_count_open);
     Com_Printf("Total mixed-case reopens: %d\n", fs_count_strlwr);
+    Com_Printf("Total negative cache hits: %d\n", fs_count_neghit);
+    Com_Printf("Pack entries in lookup index: %u (%u buckets)\n", fs_index_count, fs_index_size);
+    Com_Printf("Names in negative cache: %u\n", fs_neg_count);
 
     if (!totalHashSize) {
         Com_Printf("No stats to display\n");
@@ -3447,6 +3921,8 @@ static void free_all_paths(void)
 {
     searchpath_t *path, *next;
 
+    free_lookup_index();
+
     for (path = fs_searchpaths; path; path = next) {
         next = path->next;
         free_search_path(path);
@@ -3459,6 +3935,8 @@ static void free_game_paths(void)
 {
     searchpath_t *path, *next;
 
+    free_lookup_index();
+
     for (path = fs_searchpaths; path != fs_base_searchpaths; path = next) {
         next = path->next;
         free_search_path(path);
@@ -3531,6 +4009,8 @@ static void setup_game_paths(void)
 
     // this var is used by the game library to find it's home directory
     Cvar_FullSet("fs_gamedir", fs_gamedir, CVAR_ROM, FROM_CODE);
+
+    build_lookup_index();
 }
 
 /*
@@ -3687,6 +4167,11 @@ static void fs_game_changed(cvar_t *self)
     Com_AddConfigFile(COM_POSTEXEC_CFG, FS_TYPE_REAL);
 }
 
+static void fs_lookup_cache_changed(cvar_t *self)
+{
+    FS_FlushLookupCache();
+}
+
 /*
 ================
 FS_Init
@@ -3705,6 +4190,9 @@ void FS_Init(void)
     fs_debug = Cvar_Get("fs_debug", "0", 0);
 #endif
 
+    fs_lookup_cache = Cvar_Get("fs_lookup_cache", "1", 0);
+    fs_lookup_cache->changed = fs_lookup_cache_changed;
+
     // get the game cvar and start the filesystem
     fs_game = Cvar_Get("game", DEFGAME, CVAR_LATCH | CVAR_SERVERINFO);
     fs_game->changed = fs_game_changed;
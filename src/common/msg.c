@@ -23,6 +23,15 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common/math.h"
 #include "common/intreadwrite.h"
 
+#if (defined __SSE2__) || (defined _M_X64) || (defined _M_IX86_FP && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define USE_SSE2    1
+#else
+#define USE_SSE2    0
+#endif
+
+#include <assert.h>
+
 /*
 ==============================================================================
 
@@ -35,7 +44,7 @@ Handles byte ordering and avoids alignment errors
 sizebuf_t   msg_write;
 byte        msg_write_buffer[MAX_MSGLEN];
 
-sizebuf_t   msg_read;
+q_thread_local sizebuf_t msg_read;
 byte        msg_read_buffer[MAX_MSGLEN];
 
 const entity_state_t   nullEntityState;
@@ -278,8 +287,6 @@ void MSG_WriteAngle16(float f)
     MSG_WriteShort(ANGLE2SHORT(f));
 }
 
-#if USE_CLIENT
-
 /*
 =============
 MSG_WriteBits
@@ -420,16 +427,22 @@ int MSG_WriteDeltaUsercmd(const usercmd_t *from,
     return bits;
 }
 
-#endif // USE_CLIENT
-
 void MSG_WriteDir(const vec3_t dir)
 {
     MSG_WriteByte(DirToByte(dir));
 }
 
-uint32_t MSG_EntityWillWrite(const entity_state_t *from,
-                             const entity_state_t *to,
-                             msgEsFlags_t         flags)
+/*
+=============
+MSG_EntityWillWriteScalar
+
+Returns update bits for delta from `from' to `to', comparing fields one by
+one. Reference for the vectorized version below.
+=============
+*/
+uint32_t MSG_EntityWillWriteScalar(const entity_state_t *from,
+                                   const entity_state_t *to,
+                                   msgEsFlags_t         flags)
 {
     uint32_t bits;
 
@@ -521,12 +534,192 @@ uint32_t MSG_EntityWillWrite(const entity_state_t *from,
     return bits;
 }
 
-void MSG_WriteDeltaEntity(const entity_state_t *from,
-    const entity_state_t *to,
-    msgEsFlags_t         flags)
+#if USE_SSE2
+
+// bit N of change mask is set if 32-bit word N + 1 of entity_state_t differs
+#define ES_WORD(field)      (q_offsetof(entity_state_t, field) / 4 - 1)
+#define ES_CHANGED(field)   (changed & (1U << ES_WORD(field)))
+
+static_assert(q_offsetof(entity_state_t, origin) == 4, "bad entity_state_t layout");
+static_assert(ES_WORD(sound_pitch) == 19, "bad entity_state_t layout");
+
+/*
+=============
+entity_will_write_sse2
+
+Words 1 to 20 of entity_state_t (origin to sound_pitch) are compared in 5
+lanes of 4. Origin and angles are first converted to integers exactly as
+COORD2SHORT and ANGLE2SHORT do, with float multiplication and division in
+the same order, so resulting bits are the same as in scalar version.
+old_origin words are ignored here, beams compare them separately.
+=============
+*/
+static uint32_t entity_will_write_sse2(const entity_state_t *from,
+                                       const entity_state_t *to,
+                                       msgEsFlags_t         flags)
 {
-    uint32_t bits = MSG_EntityWillWrite(from, to, flags);
+    const float *f = &from->origin[0];
+    const float *t = &to->origin[0];
+    __m128 mul, div;
+    __m128i mask, a, b;
+    uint32_t changed, bits;
+
+    // origin[0..2], angles[0]
+    mul = _mm_setr_ps(COORDSCALE, COORDSCALE, COORDSCALE, 65536);
+    div = _mm_setr_ps(1, 1, 1, 360);
+    mask = _mm_setr_epi32(-1, -1, -1, 65535);
+    a = _mm_and_si128(_mm_cvttps_epi32(_mm_div_ps(_mm_mul_ps(_mm_loadu_ps(f), mul), div)), mask);
+    b = _mm_and_si128(_mm_cvttps_epi32(_mm_div_ps(_mm_mul_ps(_mm_loadu_ps(t), mul), div)), mask);
+    changed = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(a, b)));
+
+    // angles[1..2], old_origin[0..1]
+    mul = _mm_setr_ps(65536, 65536, 1, 1);
+    div = _mm_setr_ps(360, 360, 1, 1);
+    mask = _mm_setr_epi32(65535, 65535, 0, 0);
+    a = _mm_and_si128(_mm_cvttps_epi32(_mm_div_ps(_mm_mul_ps(_mm_loadu_ps(f + 4), mul), div)), mask);
+    b = _mm_and_si128(_mm_cvttps_epi32(_mm_div_ps(_mm_mul_ps(_mm_loadu_ps(t + 4), mul), div)), mask);
+    changed |= _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(a, b))) << 4;
+
+    // old_origin[2] to sound_pitch are compared as integers
+    a = _mm_loadu_si128((const __m128i *)(f + 8));
+    b = _mm_loadu_si128((const __m128i *)(t + 8));
+    changed |= _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(a, b))) << 8;
+    a = _mm_loadu_si128((const __m128i *)(f + 12));
+    b = _mm_loadu_si128((const __m128i *)(t + 12));
+    changed |= _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(a, b))) << 12;
+    a = _mm_loadu_si128((const __m128i *)(f + 16));
+    b = _mm_loadu_si128((const __m128i *)(t + 16));
+    changed |= _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(a, b))) << 16;
+
+    changed = ~changed & 0xfffff;
+    changed &= ~((1U << ES_WORD(old_origin[0])) |
+                 (1U << ES_WORD(old_origin[1])) |
+                 (1U << ES_WORD(old_origin[2])));
+
+    // nothing changed but event
+    if (!changed && !to->event && !(to->renderfx & (RF_FRAMELERP | RF_MASK_BEAMLIKE)) &&
+        !(flags & MSG_ES_NEWENTITY))
+        return 0;
+
+    bits = 0;
 
+    if (!(flags & MSG_ES_FIRSTPERSON)) {
+        if (ES_CHANGED(origin[0]))
+            bits |= U_ORIGIN1;
+        if (ES_CHANGED(origin[1]))
+            bits |= U_ORIGIN2;
+        if (ES_CHANGED(origin[2]))
+            bits |= U_ORIGIN3;
+
+        if (ES_CHANGED(angles[0]))
+            bits |= U_ANGLE1;
+        if (ES_CHANGED(angles[1]))
+            bits |= U_ANGLE2;
+        if (ES_CHANGED(angles[2]))
+            bits |= U_ANGLE3;
+
+        if ((flags & MSG_ES_NEWENTITY) && !CoordCompare(to->old_origin, from->origin))
+            bits |= U_OLDORIGIN;
+    }
+
+    if (ES_CHANGED(skinnum)) {
+        if (to->skinnum & 0xffff0000)
+            bits |= U_SKIN8 | U_SKIN16;
+        else if (to->skinnum & 0x0000ff00)
+            bits |= U_SKIN16;
+        else
+            bits |= U_SKIN8;
+    }
+
+    if (ES_CHANGED(frame)) {
+        if (to->frame & 0xff00)
+            bits |= U_FRAME16;
+        else
+            bits |= U_FRAME8;
+    }
+
+    if (ES_CHANGED(effects)) {
+        if (to->effects & 0xffff0000)
+            bits |= U_EFFECTS8 | U_EFFECTS16;
+        else if (to->effects & 0x0000ff00)
+            bits |= U_EFFECTS16;
+        else
+            bits |= U_EFFECTS8;
+    }
+
+    if (ES_CHANGED(renderfx)) {
+        if (to->renderfx & 0xffff0000)
+            bits |= U_RENDERFX8 | U_RENDERFX16;
+        else if (to->renderfx & 0x0000ff00)
+            bits |= U_RENDERFX16;
+        else
+            bits |= U_RENDERFX8;
+    }
+
+    if (ES_CHANGED(bbox))
+        bits |= U_SOLID;
+
+    if (to->event)
+        bits |= U_EVENT;
+
+    if (ES_CHANGED(modelindex))
+        bits |= U_MODEL;
+    if (ES_CHANGED(modelindex2))
+        bits |= U_MODEL2;
+    if (ES_CHANGED(modelindex3))
+        bits |= U_MODEL3;
+    if (ES_CHANGED(modelindex4))
+        bits |= U_MODEL4;
+
+    if (ES_CHANGED(sound))
+        bits |= U_SOUND;
+
+    if (to->renderfx & RF_FRAMELERP) {
+        bits |= U_OLDORIGIN;
+    } else if (to->renderfx & RF_MASK_BEAMLIKE) {
+        if (!VectorCompare(to->old_origin, from->old_origin))
+            bits |= U_OLDORIGIN;
+    }
+
+    if (ES_CHANGED(sound_pitch))
+        bits |= U_SOUNDPITCH;
+
+    return bits;
+}
+
+#endif // USE_SSE2
+
+/*
+=============
+MSG_EntityWillWrite
+
+Returns update bits for delta from `from' to `to'. Doesn't include bits
+that depend on how the message is written, like U_NUMBER16 and U_MOREBITS.
+=============
+*/
+uint32_t MSG_EntityWillWrite(const entity_state_t *from,
+                             const entity_state_t *to,
+                             msgEsFlags_t         flags)
+{
+#if USE_SSE2
+    return entity_will_write_sse2(from, to, flags);
+#else
+    return MSG_EntityWillWriteScalar(from, to, flags);
+#endif
+}
+
+/*
+=============
+MSG_WriteDeltaEntityBits
+
+Writes entity update with bits returned by MSG_EntityWillWrite. Output only
+depends on `to', `bits' and `flags', which allows caching it.
+=============
+*/
+void MSG_WriteDeltaEntityBits(const entity_state_t *to,
+                              uint32_t             bits,
+                              msgEsFlags_t         flags)
+{
     //
     // write the message
     //
@@ -626,6 +819,13 @@ void MSG_WriteDeltaEntity(const entity_state_t *from,
         MSG_WriteChar(to->sound_pitch);
 }
 
+void MSG_WriteDeltaEntity(const entity_state_t *from,
+    const entity_state_t *to,
+    msgEsFlags_t         flags)
+{
+    MSG_WriteDeltaEntityBits(to, MSG_EntityWillWrite(from, to, flags), flags);
+}
+
 void MSG_WriteDeltaPacketEntity(const entity_state_t *from,
     const entity_state_t *to,
     msgEsFlags_t         flags)
@@ -1329,8 +1529,6 @@ void MSG_ReadDeltaUsercmd(const usercmd_t *from,
     }
 }
 
-#if USE_CLIENT
-
 /*
 =================
 MSG_ParseEntityBits
@@ -1515,10 +1713,6 @@ void MSG_ParseDeltaAmbientEntity(const entity_state_t *from,
     MSG_ParseDeltaEntity(from, to, number, bits, flags);
 }
 
-#endif // USE_CLIENT
-
-#if USE_CLIENT
-
 /*
 ===================
 MSG_ParseDeltaPlayerstate_Default
@@ -1675,8 +1869,6 @@ void MSG_ParseDeltaPlayerstate(const player_state_t    *from,
     }
 }
 
-#endif // USE_CLIENT
-
 /*
 ==============================================================================
 
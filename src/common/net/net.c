@@ -58,9 +58,15 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #undef IP_RECVERR
 #undef IPV6_RECVERR
 #endif
+#include <netinet/udp.h>
+#define USE_MMSG    1
 #endif // __linux__
 #endif // !_WIN32
 
+#ifndef USE_MMSG
+#define USE_MMSG    0
+#endif
+
 // prevents infinite retry loops caused by broken TCP/IP stacks
 #define MAX_ERROR_RETRIES   64
 
@@ -106,6 +112,13 @@ static cvar_t   *net_enable_ipv6;
 static cvar_t   *net_ignore_icmp;
 #endif
 
+#if USE_MMSG
+static cvar_t   *net_batch;
+#ifdef UDP_SEGMENT
+static cvar_t   *net_udp_gso;
+#endif
+#endif
+
 static netflag_t    net_active;
 static int          net_error;
 
@@ -140,6 +153,55 @@ static uint64_t     net_bytes_sent;
 static uint64_t     net_packets_rcvd;
 static uint64_t     net_packets_sent;
 
+// per UDP socket statistics
+typedef struct {
+    uint64_t    recv_calls;
+    uint64_t    recv_packets;
+    uint64_t    send_calls;
+    uint64_t    send_packets;
+    uint64_t    gso_packets;    // packets sent as GSO segments
+    uint64_t    overflows;      // send queue flushed early
+} udpstats_t;
+
+static udpstats_t   udp_stats[NS_COUNT][2];
+
+#if USE_MMSG
+
+#define MAX_RECV_BATCH      32
+#define MAX_SEND_BATCH      64
+#define SEND_QUEUE_SIZE     0x40000
+
+#define MAX_GSO_SEGMENTS    64
+#define MAX_GSO_SIZE        0xff00
+
+// ring of receive buffers filled by a single recvmmsg() call
+static struct {
+    struct mmsghdr          hdrs[MAX_RECV_BATCH];
+    struct iovec            iovs[MAX_RECV_BATCH];
+    struct sockaddr_storage addrs[MAX_RECV_BATCH];
+    byte                    data[MAX_RECV_BATCH][MAX_PACKETLEN];
+} udp_recv;
+
+typedef struct {
+    qsocket_t   sock;
+    netadr_t    to;
+    udpstats_t  *stats;
+    size_t      ofs;        // offset into send queue data
+    size_t      len;        // total length of all segments
+    size_t      segsize;    // length of each segment but the last
+    int         numsegs;
+} udpsend_t;
+
+// packets deferred until NET_FlushPackets()
+static struct {
+    udpsend_t   packets[MAX_SEND_BATCH];
+    int         numpackets;
+    size_t      cursize;
+    byte        data[SEND_QUEUE_SIZE];
+} udp_send;
+
+#endif // USE_MMSG
+
 //=============================================================================
 
 static size_t NET_NetadrToSockadr(const netadr_t *a, struct sockaddr_storage *s)
@@ -495,6 +557,9 @@ static void NET_Stats_f(void)
 {
     time_t diff, now = time(NULL);
     char buffer[MAX_QPATH];
+    udpstats_t *s;
+    netsrc_t sock;
+    int i;
 
     if (com_startTime > now) {
         com_startTime = now;
@@ -523,6 +588,20 @@ static void NET_Stats_f(void)
 #endif
     Com_Printf("Current upload rate: %zu bytes/sec\n", net_rate_up);
     Com_Printf("Current download rate: %zu bytes/sec\n", net_rate_dn);
+
+    for (sock = 0; sock < NS_COUNT; sock++) {
+        for (i = 0; i < 2; i++) {
+            s = &udp_stats[sock][i];
+            if (!s->recv_calls && !s->send_calls)
+                continue;
+            Com_Printf("%s UDP%s: %"PRIu64"/%"PRIu64" packets in "
+                       "%"PRIu64"/%"PRIu64" calls (sent/rcvd), "
+                       "%"PRIu64" GSO, %"PRIu64" overflows\n",
+                       sock == NS_SERVER ? "Server" : "Client", i ? "6" : "",
+                       s->send_packets, s->recv_packets, s->send_calls,
+                       s->recv_calls, s->gso_packets, s->overflows);
+        }
+    }
 }
 
 static size_t NET_UpRate_m(char *buffer, size_t size)
@@ -766,7 +845,78 @@ int NET_Sleep(int msec)
 
 //=============================================================================
 
-static void NET_GetUdpPackets(qsocket_t sock, void (*packet_cb)(void))
+static void NET_ReadUdpPacket(const void *data, int len, void (*packet_cb)(void))
+{
+#if USE_DEBUG
+    if (net_log_enable->integer)
+        NET_LogPacket(&net_from, "UDP recv", data, len);
+#endif
+
+    net_rate_rcvd += len;
+    net_bytes_rcvd += len;
+    net_packets_rcvd++;
+
+    if (data != msg_read_buffer)
+        memcpy(msg_read_buffer, data, len);
+
+    SZ_Init(&msg_read, msg_read_buffer, sizeof(msg_read_buffer));
+    msg_read.cursize = len;
+
+    (*packet_cb)();
+}
+
+#if USE_MMSG
+
+static void NET_GetUdpBatch(qsocket_t sock, ioentry_t *e, udpstats_t *stats,
+                            void (*packet_cb)(void))
+{
+    struct mmsghdr *hdr;
+    int i, ret;
+
+    while (1) {
+        memset(udp_recv.addrs, 0, sizeof(udp_recv.addrs));
+        for (i = 0; i < MAX_RECV_BATCH; i++) {
+            hdr = &udp_recv.hdrs[i];
+            udp_recv.iovs[i].iov_base = udp_recv.data[i];
+            udp_recv.iovs[i].iov_len = MAX_PACKETLEN;
+            memset(hdr, 0, sizeof(*hdr));
+            hdr->msg_hdr.msg_name = &udp_recv.addrs[i];
+            hdr->msg_hdr.msg_namelen = sizeof(udp_recv.addrs[i]);
+            hdr->msg_hdr.msg_iov = &udp_recv.iovs[i];
+            hdr->msg_hdr.msg_iovlen = 1;
+        }
+
+        ret = os_udp_recv_many(sock, udp_recv.hdrs, MAX_RECV_BATCH);
+        stats->recv_calls++;
+        if (ret == NET_AGAIN) {
+            e->canread = false;
+            break;
+        }
+
+        if (ret == NET_ERROR) {
+            Com_DPrintf("%s: %s\n", __func__, NET_ErrorString());
+            net_recv_errors++;
+            break;
+        }
+
+        stats->recv_packets += ret;
+
+        for (i = 0; i < ret; i++) {
+            NET_SockadrToNetadr(&udp_recv.addrs[i], &net_from);
+            NET_ReadUdpPacket(udp_recv.data[i], udp_recv.hdrs[i].msg_len, packet_cb);
+        }
+
+        // short batch means socket has been drained
+        if (ret < MAX_RECV_BATCH) {
+            e->canread = false;
+            break;
+        }
+    }
+}
+
+#endif // USE_MMSG
+
+static void NET_GetUdpPackets(qsocket_t sock, udpstats_t *stats, void (*packet_cb)(void))
 {
     ioentry_t *e;
     int ret;
@@ -778,8 +928,16 @@ static void NET_GetUdpPackets(qsocket_t sock, void (*packet_cb)(void))
     if (!e->canread)
         return;
 
+#if USE_MMSG
+    if (net_batch->integer) {
+        NET_GetUdpBatch(sock, e, stats, packet_cb);
+        return;
+    }
+#endif
+
     while (1) {
         ret = os_udp_recv(sock, msg_read_buffer, MAX_PACKETLEN, &net_from);
+        stats->recv_calls++;
         if (ret == NET_AGAIN) {
             e->canread = false;
             break;
@@ -792,19 +950,9 @@ static void NET_GetUdpPackets(qsocket_t sock, void (*packet_cb)(void))
             break;
         }
 
-#if USE_DEBUG
-        if (net_log_enable->integer)
-            NET_LogPacket(&net_from, "UDP recv", msg_read_buffer, ret);
-#endif
+        stats->recv_packets++;
 
-        net_rate_rcvd += ret;
-        net_bytes_rcvd += ret;
-        net_packets_rcvd++;
-
-        SZ_Init(&msg_read, msg_read_buffer, sizeof(msg_read_buffer));
-        msg_read.cursize = ret;
-
-        (*packet_cb)();
+        NET_ReadUdpPacket(msg_read_buffer, ret, packet_cb);
     }
 }
 
@@ -827,12 +975,195 @@ void NET_GetPackets(netsrc_t sock, void (*packet_cb)(void))
 #endif
 
     // process UDP packets
-    NET_GetUdpPackets(udp_sockets[sock], packet_cb);
+    NET_GetUdpPackets(udp_sockets[sock], &udp_stats[sock][0], packet_cb);
 
     // process UDP6 packets
-    NET_GetUdpPackets(udp6_sockets[sock], packet_cb);
+    NET_GetUdpPackets(udp6_sockets[sock], &udp_stats[sock][1], packet_cb);
+}
+
+static void NET_SentUdpPacket(udpstats_t *stats, size_t len, int numpackets)
+{
+    net_rate_sent += len;
+    net_bytes_sent += len;
+    net_packets_sent += numpackets;
+    stats->send_packets += numpackets;
+}
+
+#if USE_MMSG
+
+// fallback for kernels or interfaces that refuse UDP_SEGMENT
+static void NET_SendUdpSegments(const udpsend_t *p)
+{
+    const byte *data = udp_send.data + p->ofs;
+    size_t len, sent = 0;
+    int ret;
+
+    while (sent < p->len) {
+        len = min(p->segsize, p->len - sent);
+        ret = os_udp_send(p->sock, data + sent, len, &p->to);
+        p->stats->send_calls++;
+        if (ret == NET_AGAIN)
+            return;
+        if (ret == NET_ERROR) {
+            Com_DPrintf("%s: %s to %s\n", __func__,
+                        NET_ErrorString(), NET_AdrToString(&p->to));
+            net_send_errors++;
+            return;
+        }
+        NET_SentUdpPacket(p->stats, ret, 1);
+        sent += len;
+    }
+}
+
+/*
+=============
+NET_FlushPackets
+
+Sends packets queued by NET_SendPacket with one sendmmsg() call per socket.
+=============
+*/
+void NET_FlushPackets(void)
+{
+    struct mmsghdr          hdrs[MAX_SEND_BATCH];
+    struct iovec            iovs[MAX_SEND_BATCH];
+    struct sockaddr_storage addrs[MAX_SEND_BATCH];
+#ifdef UDP_SEGMENT
+    union {
+        byte            buf[CMSG_SPACE(sizeof(uint16_t))];
+        struct cmsghdr  align;
+    } ctrl[MAX_SEND_BATCH];
+    struct cmsghdr *cmsg;
+#endif
+    struct mmsghdr *hdr;
+    udpsend_t *p;
+    int i, j, k, count, ret;
+
+    for (i = 0; i < udp_send.numpackets; i = j) {
+        // sendmmsg works on a single socket
+        for (j = i; j < udp_send.numpackets; j++) {
+            p = &udp_send.packets[j];
+            if (p->sock != udp_send.packets[i].sock)
+                break;
+
+            hdr = &hdrs[j];
+            memset(hdr, 0, sizeof(*hdr));
+            iovs[j].iov_base = udp_send.data + p->ofs;
+            iovs[j].iov_len = p->len;
+            hdr->msg_hdr.msg_name = &addrs[j];
+            hdr->msg_hdr.msg_namelen = NET_NetadrToSockadr(&p->to, &addrs[j]);
+            hdr->msg_hdr.msg_iov = &iovs[j];
+            hdr->msg_hdr.msg_iovlen = 1;
+#ifdef UDP_SEGMENT
+            if (p->numsegs > 1) {
+                hdr->msg_hdr.msg_control = ctrl[j].buf;
+                hdr->msg_hdr.msg_controllen = sizeof(ctrl[j].buf);
+                cmsg = CMSG_FIRSTHDR(&hdr->msg_hdr);
+                cmsg->cmsg_level = SOL_UDP;
+                cmsg->cmsg_type = UDP_SEGMENT;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                *(uint16_t *)CMSG_DATA(cmsg) = p->segsize;
+            }
+#endif
+        }
+
+        for (k = i; k < j; k += ret) {
+            p = &udp_send.packets[k];
+            count = j - k;
+            ret = os_udp_send_many(p->sock, &hdrs[k], count, &p->to);
+            p->stats->send_calls++;
+            if (ret == NET_AGAIN)
+                break;
+
+            if (ret == NET_ERROR) {
+#ifdef UDP_SEGMENT
+                if (p->numsegs > 1 && (net_error == EIO || net_error == EINVAL)) {
+                    Com_WPrintf("UDP segmentation offload failed, disabling.\n");
+                    Cvar_Set("net_udp_gso", "0");
+                    NET_SendUdpSegments(p);
+                } else
+#endif
+                {
+                    Com_DPrintf("%s: %s to %s\n", __func__,
+                                NET_ErrorString(), NET_AdrToString(&p->to));
+                    net_send_errors++;
+                }
+                // skip offending packet
+                ret = 1;
+                continue;
+            }
+
+            for (count = 0; count < ret; count++, p++) {
+                if (hdrs[k + count].msg_len < p->len)
+                    Com_WPrintf("%s: short send to %s\n", __func__,
+                                NET_AdrToString(&p->to));
+                if (p->numsegs > 1)
+                    p->stats->gso_packets += p->numsegs;
+                NET_SentUdpPacket(p->stats, hdrs[k + count].msg_len, p->numsegs);
+            }
+
+            if (!ret)
+                break;
+        }
+    }
+
+    udp_send.numpackets = 0;
+    udp_send.cursize = 0;
+}
+
+static void NET_QueueUdpPacket(qsocket_t s, udpstats_t *stats, const void *data,
+                               size_t len, const netadr_t *to)
+{
+    udpsend_t *p;
+
+#ifdef UDP_SEGMENT
+    // append to previous packet if it goes to the same address and all
+    // segments so far are of equal size
+    if (net_udp_gso->integer && udp_send.numpackets) {
+        p = &udp_send.packets[udp_send.numpackets - 1];
+        if (p->sock == s && NET_IsEqualAdr(&p->to, to) && len <= p->segsize &&
+            p->len == p->segsize * p->numsegs && p->numsegs < MAX_GSO_SEGMENTS &&
+            p->len + len <= MAX_GSO_SIZE && udp_send.cursize + len <= SEND_QUEUE_SIZE) {
+            memcpy(udp_send.data + udp_send.cursize, data, len);
+            udp_send.cursize += len;
+            p->len += len;
+            p->numsegs++;
+            return;
+        }
+    }
+#endif
+
+    if (udp_send.numpackets == MAX_SEND_BATCH ||
+        udp_send.cursize + len > SEND_QUEUE_SIZE) {
+        stats->overflows++;
+        NET_FlushPackets();
+    }
+
+    p = &udp_send.packets[udp_send.numpackets++];
+    p->sock = s;
+    p->to = *to;
+    p->stats = stats;
+    p->ofs = udp_send.cursize;
+    p->len = len;
+    p->segsize = len;
+    p->numsegs = 1;
+
+    memcpy(udp_send.data + udp_send.cursize, data, len);
+    udp_send.cursize += len;
+}
+
+static void net_batch_changed(cvar_t *self)
+{
+    NET_FlushPackets();
+}
+
+#else
+
+void NET_FlushPackets(void)
+{
 }
 
+#endif // !USE_MMSG
+
 /*
 =============
 NET_SendPacket
@@ -842,6 +1173,7 @@ NET_SendPacket
 bool NET_SendPacket(netsrc_t sock, const void *data,
                     size_t len, const netadr_t *to)
 {
+    udpstats_t *stats;
     int ret;
     qsocket_t s;
 
@@ -864,9 +1196,11 @@ bool NET_SendPacket(netsrc_t sock, const void *data,
     case NA_IP:
     case NA_BROADCAST:
         s = udp_sockets[sock];
+        stats = &udp_stats[sock][0];
         break;
     case NA_IP6:
         s = udp6_sockets[sock];
+        stats = &udp_stats[sock][1];
         break;
     default:
         Q_assert(!"bad address type");
@@ -875,7 +1209,20 @@ bool NET_SendPacket(netsrc_t sock, const void *data,
     if (s == -1)
         return false;
 
+#if USE_MMSG
+    // server packets are sent in one batch at the end of frame
+    if (sock == NS_SERVER && net_batch->integer) {
+#if USE_DEBUG
+        if (net_log_enable->integer)
+            NET_LogPacket(to, "UDP send", data, len);
+#endif
+        NET_QueueUdpPacket(s, stats, data, len, to);
+        return true;
+    }
+#endif
+
     ret = os_udp_send(s, data, len, to);
+    stats->send_calls++;
     if (ret == NET_AGAIN)
         return false;
 
@@ -895,9 +1242,7 @@ bool NET_SendPacket(netsrc_t sock, const void *data,
         NET_LogPacket(to, "UDP send", data, ret);
 #endif
 
-    net_rate_sent += ret;
-    net_bytes_sent += ret;
-    net_packets_sent++;
+    NET_SentUdpPacket(stats, ret, 1);
 
     return true;
 }
@@ -1242,6 +1587,9 @@ void NET_Config(netflag_t flag)
     }
 
     if (flag == NET_NONE) {
+        // don't leave queued packets for closed sockets
+        NET_FlushPackets();
+
         // shut down any existing sockets
         for (sock = 0; sock < NS_COUNT; sock++) {
             if (udp_sockets[sock] != -1) {
@@ -1290,6 +1638,50 @@ bool NET_GetAddress(netsrc_t sock, netadr_t *adr)
     return true;
 }
 
+/*
+====================
+NET_OpenUdpSocket
+
+Opens an IPv4 UDP socket that is not tied to any netsrc_t and adds it to the
+list of monitored descriptors. Used by the server load generator to talk to
+the local server like remote clients do.
+====================
+*/
+qsocket_t NET_OpenUdpSocket(const char *iface, netadr_t *adr)
+{
+    ioentry_t *e;
+    qsocket_t s;
+
+    s = UDP_OpenSocket(iface, PORT_ANY, AF_INET);
+    if (s == -1)
+        return -1;
+
+    if (os_getsockname(s, adr)) {
+        os_closesocket(s);
+        return -1;
+    }
+
+    e = NET_AddFd(s);
+    e->wantread = true;
+    return s;
+}
+
+void NET_CloseUdpSocket(qsocket_t sock)
+{
+    NET_RemoveFd(sock);
+    os_closesocket(sock);
+}
+
+int NET_RecvUdp(qsocket_t sock, void *data, size_t len, netadr_t *from)
+{
+    return os_udp_recv(sock, data, len, from);
+}
+
+int NET_SendUdp(qsocket_t sock, const void *data, size_t len, const netadr_t *to)
+{
+    return os_udp_send(sock, data, len, to);
+}
+
 //=============================================================================
 
 void NET_CloseStream(netstream_t *s)
@@ -1887,6 +2279,14 @@ void NET_Init(void)
     net_ignore_icmp = Cvar_Get("net_ignore_icmp", "0", 0);
 #endif
 
+#if USE_MMSG
+    net_batch = Cvar_Get("net_batch", "1", 0);
+    net_batch->changed = net_batch_changed;
+#ifdef UDP_SEGMENT
+    net_udp_gso = Cvar_Get("net_udp_gso", "0", 0);
+#endif
+#endif
+
 #if USE_DEBUG
     net_log_enable_changed(net_log_enable);
 #endif
@@ -0,0 +1,440 @@
+/*
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+//
+// prof.c -- server frame zone profiler
+//
+
+#include "shared/shared.h"
+#include "common/cmd.h"
+#include "common/common.h"
+#include "common/cvar.h"
+#include "common/files.h"
+#include "common/prof.h"
+#include "common/zone.h"
+#include "system/system.h"
+
+/*
+===============================================================================
+
+Each thread that runs zones has its own slot, indexed by Sys_ThreadIndex,
+and is the only writer of it. Completed zones are added to per-thread totals
+and to a ring buffer of events used for trace export. At the end of each
+server frame the main thread turns total increments into per-frame zone
+times, which are kept for the last PROF_FRAMES frames and accumulated into
+log2 histograms. Zones running on several threads at once sum their times.
+
+===============================================================================
+*/
+
+#define PROF_THREADS    (MAX_JOB_THREADS + 1)
+#define PROF_EVENTS     0x8000      // per thread, must be power of two
+#define PROF_FRAMES     1024        // must be power of two
+#define PROF_BUCKETS    24
+
+typedef struct {
+    uint64_t    start;
+    uint32_t    usec;
+    uint32_t    zone;
+} profevent_t;
+
+typedef struct {
+    uint64_t    start[PROF_NUM_ZONES];
+    uint64_t    total[PROF_NUM_ZONES];
+    uint64_t    reported[PROF_NUM_ZONES];   // totals at the last frame end
+    profevent_t *events;
+    unsigned    numevents;
+} profthread_t;
+
+typedef struct {
+    unsigned    number;
+    uint32_t    usec[PROF_NUM_ZONES];
+} profframe_t;
+
+int prof_enabled;
+
+static cvar_t       *prof_enable;
+static int          prof_holds;
+
+static profthread_t prof_threads[PROF_THREADS];
+static profframe_t  prof_frames[PROF_FRAMES];
+static unsigned     prof_numframes;
+
+// bucket N counts frames that took less than 2^N usec, but not less
+// than 2^(N-1) usec; bucket 0 counts frames where zone didn't run
+static uint32_t     prof_hist[PROF_NUM_ZONES][PROF_BUCKETS];
+static uint64_t     prof_sum[PROF_NUM_ZONES];
+static uint32_t     prof_max[PROF_NUM_ZONES];
+
+static const char *const prof_names[PROF_NUM_ZONES] = {
+    "frame",
+    "packets",
+    "game",
+    "ambient",
+    "send",
+    "build",
+    "build_job",
+    "write",
+    "netsend"
+};
+
+const char *PROF_ZoneName(profzone_t zone)
+{
+    Q_assert(zone < PROF_NUM_ZONES);
+    return prof_names[zone];
+}
+
+void PROF_BeginZone(profzone_t zone)
+{
+    prof_threads[Sys_ThreadIndex()].start[zone] = Sys_Microseconds();
+}
+
+void PROF_EndZone(profzone_t zone)
+{
+    profthread_t *t = &prof_threads[Sys_ThreadIndex()];
+    profevent_t *e;
+    uint64_t now;
+
+    // profiler was enabled while zone was running
+    if (!t->start[zone])
+        return;
+
+    now = Sys_Microseconds();
+
+    if (!t->events)
+        t->events = Z_Malloc(PROF_EVENTS * sizeof(t->events[0]));
+
+    e = &t->events[t->numevents++ & (PROF_EVENTS - 1)];
+    e->start = t->start[zone];
+    e->usec = now - t->start[zone];
+    e->zone = zone;
+
+    t->total[zone] += e->usec;
+    t->start[zone] = 0;
+}
+
+static int hist_bucket(uint32_t usec)
+{
+    int n = 0;
+
+    while (usec && n < PROF_BUCKETS - 1) {
+        usec >>= 1;
+        n++;
+    }
+
+    return n;
+}
+
+/*
+=================
+PROF_EndFrame
+
+Called by the main thread at the end of each server frame, when no
+worker threads run any zones.
+=================
+*/
+void PROF_EndFrame(void)
+{
+    profframe_t *frame;
+    profthread_t *t;
+    uint64_t usec;
+    int i, j;
+
+    if (!prof_enabled)
+        return;
+
+    frame = &prof_frames[prof_numframes++ & (PROF_FRAMES - 1)];
+    frame->number = prof_numframes;
+
+    for (i = 0; i < PROF_NUM_ZONES; i++) {
+        usec = 0;
+        for (j = 0, t = prof_threads; j < PROF_THREADS; j++, t++) {
+            usec += t->total[i] - t->reported[i];
+            t->reported[i] = t->total[i];
+        }
+        usec = min(usec, UINT32_MAX);
+
+        frame->usec[i] = usec;
+        prof_hist[i][hist_bucket(usec)]++;
+        prof_sum[i] += usec;
+        prof_max[i] = max(prof_max[i], usec);
+    }
+}
+
+/*
+=================
+PROF_FrameTime
+
+Returns time spent in zone during the last server frame.
+=================
+*/
+unsigned PROF_FrameTime(profzone_t zone)
+{
+    if (!prof_numframes)
+        return 0;
+
+    return prof_frames[(prof_numframes - 1) & (PROF_FRAMES - 1)].usec[zone];
+}
+
+static void prof_reset(void)
+{
+    int i;
+
+    for (i = 0; i < PROF_THREADS; i++) {
+        memcpy(prof_threads[i].reported, prof_threads[i].total,
+               sizeof(prof_threads[i].reported));
+        memset(prof_threads[i].start, 0, sizeof(prof_threads[i].start));
+        prof_threads[i].numevents = 0;
+    }
+
+    prof_numframes = 0;
+    memset(prof_hist, 0, sizeof(prof_hist));
+    memset(prof_sum, 0, sizeof(prof_sum));
+    memset(prof_max, 0, sizeof(prof_max));
+}
+
+static void prof_update(void)
+{
+    bool enabled = prof_enable->integer || prof_holds;
+
+    if (enabled && !prof_enabled)
+        prof_reset();
+
+    prof_enabled = enabled;
+}
+
+/*
+=================
+PROF_Hold
+
+Keeps profiler enabled regardless of prof_enable while held.
+=================
+*/
+void PROF_Hold(bool hold)
+{
+    prof_holds += hold ? 1 : -1;
+    Q_assert(prof_holds >= 0);
+    prof_update();
+}
+
+/*
+===============================================================================
+
+COMMANDS
+
+===============================================================================
+*/
+
+// upper bound of the bucket containing given fraction of frames
+static unsigned hist_percentile(int zone, unsigned frac)
+{
+    uint64_t count = 0, target = (uint64_t)prof_numframes * frac / 100;
+    int i;
+
+    for (i = 0; i < PROF_BUCKETS - 1; i++) {
+        count += prof_hist[zone][i];
+        if (count > target)
+            break;
+    }
+
+    return i ? 1U << i : 0;
+}
+
+static void PROF_Stats_f(void)
+{
+    int i;
+
+    if (!prof_numframes) {
+        Com_Printf("No frames profiled.\n");
+        return;
+    }
+
+    Com_Printf("%u frames profiled\n"
+               "zone          mean     p50<     p99<      max (usec)\n"
+               "---------- -------- -------- -------- --------\n",
+               prof_numframes);
+
+    for (i = 0; i < PROF_NUM_ZONES; i++) {
+        Com_Printf("%-10s %8"PRIu64" %8u %8u %8u\n", prof_names[i],
+                   prof_sum[i] / prof_numframes, hist_percentile(i, 50),
+                   hist_percentile(i, 99), prof_max[i]);
+    }
+}
+
+static void PROF_Reset_f(void)
+{
+    prof_reset();
+}
+
+static void dump_csv(qhandle_t f, unsigned first)
+{
+    const profframe_t *frame;
+    unsigned n;
+    int i;
+
+    FS_FPrintf(f, "frame");
+    for (i = 0; i < PROF_NUM_ZONES; i++)
+        FS_FPrintf(f, ",%s", prof_names[i]);
+    FS_FPrintf(f, "\n");
+
+    for (n = first; n < prof_numframes; n++) {
+        frame = &prof_frames[n & (PROF_FRAMES - 1)];
+        FS_FPrintf(f, "%u", frame->number);
+        for (i = 0; i < PROF_NUM_ZONES; i++)
+            FS_FPrintf(f, ",%u", frame->usec[i]);
+        FS_FPrintf(f, "\n");
+    }
+}
+
+static void dump_json(qhandle_t f, unsigned first)
+{
+    const profframe_t *frame;
+    unsigned n;
+    int i, j;
+
+    FS_FPrintf(f, "{\n\"numframes\": %u,\n\"zones\": {\n", prof_numframes);
+    for (i = 0; i < PROF_NUM_ZONES; i++) {
+        FS_FPrintf(f, "  \"%s\": { \"mean\": %"PRIu64", \"max\": %u, \"histogram\": [",
+                   prof_names[i], prof_sum[i] / max(prof_numframes, 1), prof_max[i]);
+        for (j = 0; j < PROF_BUCKETS; j++)
+            FS_FPrintf(f, "%s%u", j ? ", " : "", prof_hist[i][j]);
+        FS_FPrintf(f, "] }%s\n", i < PROF_NUM_ZONES - 1 ? "," : "");
+    }
+
+    FS_FPrintf(f, "},\n\"frames\": [\n");
+    for (n = first; n < prof_numframes; n++) {
+        frame = &prof_frames[n & (PROF_FRAMES - 1)];
+        FS_FPrintf(f, "  { \"frame\": %u", frame->number);
+        for (i = 0; i < PROF_NUM_ZONES; i++)
+            FS_FPrintf(f, ", \"%s\": %u", prof_names[i], frame->usec[i]);
+        FS_FPrintf(f, " }%s\n", n < prof_numframes - 1 ? "," : "");
+    }
+    FS_FPrintf(f, "]\n}\n");
+}
+
+static void PROF_Dump_f(void)
+{
+    char buffer[MAX_OSPATH];
+    unsigned first;
+    qhandle_t f;
+    bool json;
+
+    if (Cmd_Argc() < 2) {
+        Com_Printf("Usage: %s <filename> [csv|json]\n", Cmd_Argv(0));
+        return;
+    }
+
+    json = !strcmp(Cmd_Argv(2), "json");
+
+    f = FS_EasyOpenFile(buffer, sizeof(buffer), FS_MODE_WRITE | FS_FLAG_TEXT,
+                        "profile/", Cmd_Argv(1), json ? ".json" : ".csv");
+    if (!f)
+        return;
+
+    first = prof_numframes > PROF_FRAMES ? prof_numframes - PROF_FRAMES : 0;
+    if (json)
+        dump_json(f, first);
+    else
+        dump_csv(f, first);
+
+    if (FS_CloseFile(f))
+        Com_EPrintf("Error writing %s\n", buffer);
+    else
+        Com_Printf("Wrote %u frames to %s.\n", prof_numframes - first, buffer);
+}
+
+// writes events in Chrome trace event format
+static void PROF_Trace_f(void)
+{
+    char buffer[MAX_OSPATH];
+    const profthread_t *t;
+    const profevent_t *e;
+    uint64_t base;
+    unsigned n, first, total;
+    bool comma;
+    qhandle_t f;
+    int i;
+
+    if (Cmd_Argc() < 2) {
+        Com_Printf("Usage: %s <filename>\n", Cmd_Argv(0));
+        return;
+    }
+
+    f = FS_EasyOpenFile(buffer, sizeof(buffer), FS_MODE_WRITE | FS_FLAG_TEXT,
+                        "profile/", Cmd_Argv(1), ".json");
+    if (!f)
+        return;
+
+    // make timestamps relative to the oldest event
+    base = UINT64_MAX;
+    for (i = 0, t = prof_threads; i < PROF_THREADS; i++, t++) {
+        if (!t->numevents)
+            continue;
+        first = t->numevents > PROF_EVENTS ? t->numevents - PROF_EVENTS : 0;
+        base = min(base, t->events[first & (PROF_EVENTS - 1)].start);
+    }
+
+    FS_FPrintf(f, "{\"traceEvents\":[\n");
+    comma = false;
+    total = 0;
+    for (i = 0, t = prof_threads; i < PROF_THREADS; i++, t++) {
+        if (!t->numevents)
+            continue;
+
+        FS_FPrintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                   "\"args\":{\"name\":\"%s %d\"}}", comma ? ",\n" : "", i,
+                   i ? "worker" : "main", i);
+        comma = true;
+
+        first = t->numevents > PROF_EVENTS ? t->numevents - PROF_EVENTS : 0;
+        for (n = first; n < t->numevents; n++) {
+            e = &t->events[n & (PROF_EVENTS - 1)];
+            FS_FPrintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+                       "\"ts\":%"PRIu64",\"dur\":%u}", prof_names[e->zone], i,
+                       e->start - base, e->usec);
+        }
+        total += n - first;
+    }
+    FS_FPrintf(f, "\n]}\n");
+
+    if (FS_CloseFile(f))
+        Com_EPrintf("Error writing %s\n", buffer);
+    else
+        Com_Printf("Wrote %u events to %s.\n", total, buffer);
+}
+
+static void prof_enable_changed(cvar_t *self)
+{
+    prof_update();
+}
+
+static const cmdreg_t c_prof[] = {
+    { "prof_stats", PROF_Stats_f },
+    { "prof_reset", PROF_Reset_f },
+    { "prof_dump", PROF_Dump_f },
+    { "prof_trace", PROF_Trace_f },
+
+    { NULL }
+};
+
+void PROF_Init(void)
+{
+    prof_enable = Cvar_Get("prof_enable", "0", 0);
+    prof_enable->changed = prof_enable_changed;
+    prof_update();
+
+    Cmd_Register(c_prof);
+}
@@ -20,6 +20,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common/common.h"
 #include "common/cvar.h"
 #include "common/zone.h"
+#include <SDL.h>
 
 #define Z_MAGIC     0x1d0d
 
@@ -51,6 +52,12 @@ static zhead_t      z_chain;
 static zstatic_t    z_static[11];
 static zstats_t     z_stats[TAG_MAX];
 
+// protects z_chain and z_stats, allocations may come from job threads
+static SDL_SpinLock z_lock;
+
+#define Z_Lock()    SDL_AtomicLock(&z_lock)
+#define Z_Unlock()  SDL_AtomicUnlock(&z_lock)
+
 static const char   z_tagnames[TAG_MAX][8] = {
     "game",
     "static",
@@ -89,6 +96,7 @@ void Z_LeakTest(unsigned tag)
     zhead_t *z;
     size_t numLeaks = 0, numBytes = 0;
 
+    Z_Lock();
     Z_FOR_EACH(z) {
         Z_Validate(z);
         if (z->tag == tag) {
@@ -96,6 +104,7 @@ void Z_LeakTest(unsigned tag)
             numBytes += z->size;
         }
     }
+    Z_Unlock();
 
     if (numLeaks) {
         Com_WPrintf("************* Z_LeakTest *************\n"
@@ -123,15 +132,21 @@ void Z_Free(void *ptr)
 
     Z_Validate(z);
 
+    Z_Lock();
     Z_CountFree(z);
 
-    if (z->tag != TAG_STATIC) {
-        z->prev->next = z->next;
-        z->next->prev = z->prev;
-        z->magic = 0xdead;
-        z->tag = TAG_FREE;
-        free(z);
+    if (z->tag == TAG_STATIC) {
+        Z_Unlock();
+        return;
     }
+
+    z->prev->next = z->next;
+    z->next->prev = z->prev;
+    Z_Unlock();
+
+    z->magic = 0xdead;
+    z->tag = TAG_FREE;
+    free(z);
 }
 
 /*
@@ -165,7 +180,12 @@ void *Z_Realloc(void *ptr, size_t size)
 
     Q_assert(z->tag != TAG_STATIC);
 
+    // unlink while the block moves
+    Z_Lock();
     Z_CountFree(z);
+    z->prev->next = z->next;
+    z->next->prev = z->prev;
+    Z_Unlock();
 
     z = realloc(z, size);
     if (!z) {
@@ -173,10 +193,14 @@ void *Z_Realloc(void *ptr, size_t size)
     }
 
     z->size = size;
-    z->prev->next = z;
-    z->next->prev = z;
 
+    Z_Lock();
+    z->next = z_chain.next;
+    z->prev = &z_chain;
+    z_chain.next->prev = z;
+    z_chain.next = z;
     Z_CountAlloc(z);
+    Z_Unlock();
 
     return z + 1;
 }
@@ -195,6 +219,7 @@ void Z_Stats_f(void)
     Com_Printf("    bytes blocks name\n"
                "--------- ------ -------\n");
 
+    // racy with job threads, but only used for display
     for (i = 0, s = z_stats; i < TAG_MAX; i++, s++) {
         if (!s->count) {
             continue;
@@ -216,14 +241,28 @@ Z_FreeTags
 */
 void Z_FreeTags(unsigned tag)
 {
-    zhead_t *z, *n;
+    zhead_t *z, *n, *list = NULL;
 
+    // unlink under the lock, free outside of it
+    Z_Lock();
     Z_FOR_EACH_SAFE(z, n) {
         Z_Validate(z);
         if (z->tag == tag) {
-            Z_Free(z + 1);
+            Z_CountFree(z);
+            z->prev->next = z->next;
+            z->next->prev = z->prev;
+            z->next = list;
+            list = z;
         }
     }
+    Z_Unlock();
+
+    for (z = list; z; z = n) {
+        n = z->next;
+        z->magic = 0xdead;
+        z->tag = TAG_FREE;
+        free(z);
+    }
 }
 
 /*
@@ -251,16 +290,17 @@ void *Z_TagMalloc(size_t size, unsigned tag)
     z->tag = tag;
     z->size = size;
 
-    z->next = z_chain.next;
-    z->prev = &z_chain;
-    z_chain.next->prev = z;
-    z_chain.next = z;
-
     if (z_perturb && z_perturb->integer) {
         memset(z + 1, z_perturb->integer, size - sizeof(*z));
     }
 
+    Z_Lock();
+    z->next = z_chain.next;
+    z->prev = &z_chain;
+    z_chain.next->prev = z;
+    z_chain.next = z;
     Z_CountAlloc(z);
+    Z_Unlock();
 
     return z + 1;
 }
@@ -384,6 +424,8 @@ char *Z_CvarCopyString(const char *in)
 
     // return static storage
     z = &z_static[i];
+    Z_Lock();
     Z_CountAlloc(&z->z);
+    Z_Unlock();
     return z->data;
 }
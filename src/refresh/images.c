@@ -362,6 +362,8 @@ IMG_LOAD(DDS)
     DDS_HEADER_DXT10* header10 = rawdata + sizeof(DDS_HEADER);
     uint32_t headers_size = sizeof(DDS_HEADER) + sizeof(DDS_HEADER_DXT10);
 
+    if (rawlen < headers_size)
+        return Q_ERR_FILE_TOO_SMALL;
     if(header->magic != DDS_MAGIC)
         return Q_ERR_LIBRARY_ERROR;
     // Require DX10 header
@@ -390,6 +392,9 @@ IMG_LOAD(DDS)
         img_size += DDS_mip_size(header->width, header->height, i);
 	}
 
+    if (img_size > rawlen - headers_size)
+        return Q_ERR_UNEXPECTED_EOF;
+
     // Allocate enough memory for the data, because this file is freed after the function returns, so we need to copy the data
     byte* pic_data = (byte*)IMG_AllocPixels(img_size);
 
@@ -405,7 +410,8 @@ IMG_LOAD(DDS)
 
 }
 
-IMG_LOAD(STB)
+// doesn't touch any engine state, so it is safe to call from job threads
+static int decode_stb(byte *rawdata, size_t rawlen, image_t *image, byte **pic)
 {
 	int w, h, channels;
 	byte* data = NULL;
@@ -430,10 +436,7 @@ IMG_LOAD(STB)
 	}
 
 	if (!data)
-	{
-		Com_SetLastError(stbi_failure_reason());
 		return Q_ERR_LIBRARY_ERROR;
-	}
 
 	*pic = data;
 
@@ -446,6 +449,16 @@ IMG_LOAD(STB)
     return Q_ERR_SUCCESS;
 }
 
+IMG_LOAD(STB)
+{
+    int ret = decode_stb(rawdata, rawlen, image, pic);
+
+    if (ret < 0)
+        Com_SetLastError(stbi_failure_reason());
+
+    return ret;
+}
+
 
 /*
 =================================================================
@@ -944,6 +957,7 @@ static int              img_total;
 static cvar_t   *r_override_textures;
 static cvar_t   *r_texture_formats;
 static cvar_t   *r_texture_overrides;
+static cvar_t   *r_parallel_decode;
 
 static const cmd_option_t o_imagelist[] = {
     { "f", "fonts", "list fonts" },
@@ -1124,28 +1138,508 @@ static image_t *lookup_image(const char *name,
     return NULL;
 }
 
+/*
+=================================================================
+
+TEXTURE CACHE
+
+Decoded PNG, JPG and TGA pixels can be kept in <gamedir>/texcache, one file
+per source image, so that later loads skip decoding entirely. Entries are
+named by a hash of the image path and stay valid while size and modification
+time of the source (of the containing pack for packed files) match. Pixels
+start at a fixed aligned offset, so an entry can be read or mapped as is.
+
+Emissive texture info is added to the header of an existing entry once the
+renderer has scanned the pixels, and restored on later loads so the scan
+is skipped.
+
+=================================================================
+*/
+
+#define TEXCACHE_IDENT      MakeLittleLong('Q','T','C','F')
+#define TEXCACHE_VERSION    2
+#define TEXCACHE_DATAOFS    256
+
+#define TEXCACHE_EMISSIVE           1   // emissive info is valid
+#define TEXCACHE_EMISSIVE_ENTIRE    2   // entire texture is emissive
+
+typedef struct {
+    uint32_t    ident;
+    uint32_t    version;
+    int64_t     source_size;
+    int64_t     source_mtime;
+    uint32_t    width;
+    uint32_t    height;
+    uint32_t    pixel_format;
+    uint32_t    flags;
+    uint32_t    datalen;
+    char        name[MAX_QPATH];
+    uint32_t    emissive;
+    float       light_color[3];
+    float       min_light_texcoord[2];
+    float       max_light_texcoord[2];
+} texcache_header_t;
+
+typedef struct {
+    char                path[MAX_OSPATH];   // empty if caching is disabled
+    texcache_header_t   header;
+} texcache_t;
+
+static cvar_t   *r_texture_cache;
+
+static uint32_t texcache_datalen(uint32_t width, uint32_t height, uint32_t pixel_format)
+{
+    return width * height * (pixel_format == PF_R16_UNORM ? 2 : 4);
+}
+
+static bool texcache_path(const char *name, char *path, size_t size)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    const char *s;
+
+    for (s = name; *s; s++) {
+        hash ^= Q_tolower(*s);
+        hash *= 1099511628211ULL;
+    }
+
+    return Q_snprintf(path, size, "%s/texcache/%016"PRIx64".bin",
+                      fs_gamedir, hash) < size;
+}
+
+// fills in cache entry path and source stamp, and opens the entry if it is
+// up to date. returns error only if the source file can't be opened.
+static int texcache_open(image_t *image, unsigned fs_flags, texcache_t *tc, FILE **cache)
+{
+    texcache_header_t header;
+    file_info_t info;
+    qhandle_t f;
+    int64_t ret;
+    FILE *fp;
+
+    tc->path[0] = 0;
+    *cache = NULL;
+
+    ret = FS_OpenFile(image->name, &f, FS_MODE_READ | FS_FLAG_LOADFILE | fs_flags);
+    if (!f)
+        return ret;
+    ret = FS_GetFileInfo(f, &info);
+    FS_CloseFile(f);
+    if (ret < 0)
+        return Q_ERR_SUCCESS;
+
+    if (!texcache_path(image->name, tc->path, sizeof(tc->path))) {
+        tc->path[0] = 0;
+        return Q_ERR_SUCCESS;
+    }
+
+    memset(&tc->header, 0, sizeof(tc->header));
+    tc->header.ident = TEXCACHE_IDENT;
+    tc->header.version = TEXCACHE_VERSION;
+    tc->header.source_size = info.size;
+    tc->header.source_mtime = info.mtime;
+    Q_strlcpy(tc->header.name, image->name, sizeof(tc->header.name));
+
+    fp = Q_fopen(tc->path, "rb");
+    if (!fp) {
+        // make sure the directory exists for storing the entry later
+        FS_CreatePath(tc->path);
+        return Q_ERR_SUCCESS;
+    }
+
+    if (fread(&header, sizeof(header), 1, fp) != 1)
+        goto stale;
+    if (header.ident != tc->header.ident || header.version != tc->header.version)
+        goto stale;
+    if (header.source_size != tc->header.source_size ||
+        header.source_mtime != tc->header.source_mtime)
+        goto stale;
+    if (Q_stricmp(header.name, tc->header.name))
+        goto stale;     // hash collision
+    if (header.width < 1 || header.width > 32768 ||
+        header.height < 1 || header.height > 32768)
+        goto stale;
+    if (header.datalen != texcache_datalen(header.width, header.height, header.pixel_format))
+        goto stale;
+    if (fseek(fp, 0, SEEK_END) || ftell(fp) < TEXCACHE_DATAOFS + (long)header.datalen)
+        goto stale;
+    if (fseek(fp, TEXCACHE_DATAOFS, SEEK_SET))
+        goto stale;
+
+    tc->header = header;
+    *cache = fp;
+    return Q_ERR_SUCCESS;
+
+stale:
+    fclose(fp);
+    return Q_ERR_SUCCESS;
+}
+
+// reads pixels of an entry opened by texcache_open and closes it.
+// safe to call from job threads.
+static bool texcache_read(const texcache_t *tc, FILE *fp, byte **pic)
+{
+    byte *data = IMG_AllocPixels(tc->header.datalen);
+    bool ok = fread(data, 1, tc->header.datalen, fp) == tc->header.datalen;
+
+    fclose(fp);
+    if (!ok) {
+        Z_Free(data);
+        return false;
+    }
+
+    *pic = data;
+    return true;
+}
+
+// writes decoded pixels of the image. safe to call from job threads.
+static void texcache_store(const texcache_t *tc, const image_t *image, const byte *pic)
+{
+    static const byte pad[TEXCACHE_DATAOFS];
+    texcache_header_t header = tc->header;
+    char temp[MAX_OSPATH + 32];
+    bool ok;
+    FILE *fp;
+
+    header.width = image->width;
+    header.height = image->height;
+    header.pixel_format = image->pixel_format;
+    header.flags = image->flags & IF_OPAQUE;
+    header.datalen = texcache_datalen(header.width, header.height, header.pixel_format);
+    header.emissive = 0;
+
+    // concurrent loads of the same file must not write to the same temp file
+    Q_snprintf(temp, sizeof(temp), "%s.%p", tc->path, (void *)tc);
+
+    fp = Q_fopen(temp, "wb");
+    if (!fp)
+        return;
+
+    ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+         fwrite(pad, TEXCACHE_DATAOFS - sizeof(header), 1, fp) == 1 &&
+         fwrite(pic, header.datalen, 1, fp) == 1;
+
+    if (fclose(fp))
+        ok = false;
+
+    if (ok) {
+#ifdef _WIN32
+        remove(tc->path);
+#endif
+        ok = !rename(temp, tc->path);
+    }
+
+    if (!ok)
+        remove(temp);
+}
+
+/*
+================
+IMG_CacheEmissiveInfo
+
+Adds emissive info extracted from the pixels of the image to its texture
+cache entry.
+================
+*/
+void IMG_CacheEmissiveInfo(const image_t *image)
+{
+#if USE_REF == REF_VKPT
+    texcache_header_t header;
+    char path[MAX_OSPATH];
+    FILE *fp;
+
+    if (!r_texture_cache->integer || !image->filepath[0])
+        return;
+    // thresholded copies share the file path, but not the pixels
+    if (image->flags & IF_FAKE_EMISSIVE)
+        return;
+    if (!texcache_path(image->filepath, path, sizeof(path)))
+        return;
+
+    fp = Q_fopen(path, "r+b");
+    if (!fp)
+        return;
+
+    // only update an entry holding exactly the scanned pixels
+    if (fread(&header, sizeof(header), 1, fp) != 1)
+        goto done;
+    if (header.ident != TEXCACHE_IDENT || header.version != TEXCACHE_VERSION)
+        goto done;
+    if (Q_stricmp(header.name, image->filepath))
+        goto done;
+    if (header.width != image->upload_width || header.height != image->upload_height ||
+        header.pixel_format != image->pixel_format)
+        goto done;
+
+    header.emissive = TEXCACHE_EMISSIVE;
+    if (image->entire_texture_emissive)
+        header.emissive |= TEXCACHE_EMISSIVE_ENTIRE;
+    memcpy(header.light_color, image->light_color, sizeof(header.light_color));
+    memcpy(header.min_light_texcoord, image->min_light_texcoord, sizeof(header.min_light_texcoord));
+    memcpy(header.max_light_texcoord, image->max_light_texcoord, sizeof(header.max_light_texcoord));
+
+    if (!fseek(fp, 0, SEEK_SET))
+        fwrite(&header, sizeof(header), 1, fp);
+
+done:
+    fclose(fp);
+#endif
+}
+
+/*
+=================================================================
+
+DEFERRED DECODING
+
+PNG, JPG and TGA files found by find_or_load_image are only probed for
+their header on the main thread, which is enough to fill in image size and
+format. The actual decoding runs as a job, and the pixels are handed over
+to IMG_Load by IMG_FinishLoad or IMG_FinishLoads, whichever comes first.
+
+=================================================================
+*/
+
+typedef struct {
+    image_t         *image;
+    byte            *data;      // raw file contents, freed by the job
+    size_t          len;
+    FILE            *cache;     // texture cache entry to read instead
+    texcache_t      tc;
+    jobcounter_t    counter;
+    int             ret;
+    image_t         result;
+    byte            *pic;
+    char            error[MAX_QPATH];
+} imgdecode_t;
+
+static imgdecode_t  *img_pending[MAX_RIMAGES];
+static int          img_num_pending;
+static bool         img_defer;
+
+static void decode_job(void *arg)
+{
+    imgdecode_t *d = arg;
+
+    if (d->cache) {
+        d->ret = Q_ERR_SUCCESS;
+        if (!texcache_read(&d->tc, d->cache, &d->pic)) {
+            d->ret = Q_ERR_UNEXPECTED_EOF;
+            Q_strlcpy(d->error, "texture cache read error", sizeof(d->error));
+        }
+        d->cache = NULL;
+        return;
+    }
+
+    d->ret = decode_stb(d->data, d->len, &d->result, &d->pic);
+    if (d->ret < 0)
+        Q_strlcpy(d->error, stbi_failure_reason(), sizeof(d->error));
+    else if (d->tc.path[0])
+        texcache_store(&d->tc, &d->result, d->pic);
+
+    FS_FreeFile(d->data);
+    d->data = NULL;
+}
+
+static void queue_decode(imgdecode_t *d)
+{
+    image_t *image = d->image;
+
+    Q_assert(!img_pending[image - r_images]);
+    img_pending[image - r_images] = d;
+    img_num_pending++;
+
+    Sys_QueueJob(decode_job, d, JOB_NORMAL, &d->counter);
+}
+
+// takes ownership of data if returns true
+static bool defer_decode(imageformat_t fmt, image_t *image, byte *data, size_t len,
+                         const texcache_t *tc)
+{
+    imgdecode_t *d;
+    int w, h, comp;
+
+    if (!img_defer || fmt < IM_TGA || fmt > IM_PNG)
+        return false;
+
+    // fall back to the immediate path if the header doesn't parse, so that
+    // errors are reported the usual way
+    if (!stbi_info_from_memory(data, len, &w, &h, &comp))
+        return false;
+
+    // logical size is restored afterwards if this replaces an 8-bit texture
+    image->upload_width = image->width = w;
+    image->upload_height = image->height = h;
+    if (supports_extended_pixel_format() && comp == 1 && stbi_is_16_bit_from_memory(data, len))
+        image->pixel_format = PF_R16_UNORM;
+    else
+        image->pixel_format = PF_R8G8B8A8_UNORM;
+    if (comp == 3)
+        image->flags |= IF_OPAQUE;
+
+    d = R_Mallocz(sizeof(*d));
+    d->image = image;
+    d->data = data;
+    d->len = len;
+    d->tc = *tc;
+
+    queue_decode(d);
+    return true;
+}
+
+// takes ownership of cache entry. returns false if pixels couldn't be read.
+static bool texcache_load(image_t *image, const texcache_t *tc, FILE *fp, byte **pic)
+{
+    const texcache_header_t *header = &tc->header;
+    imgdecode_t *d;
+
+    if (img_defer) {
+        d = R_Mallocz(sizeof(*d));
+        d->image = image;
+        d->cache = fp;
+        d->tc = *tc;
+        d->result.width = header->width;
+        d->result.height = header->height;
+        d->result.pixel_format = header->pixel_format;
+        queue_decode(d);
+        *pic = NULL;
+    } else if (!texcache_read(tc, fp, pic)) {
+        return false;
+    }
+
+    image->upload_width = image->width = header->width;
+    image->upload_height = image->height = header->height;
+    image->pixel_format = header->pixel_format;
+    image->flags |= header->flags & IF_OPAQUE;
+
+#if USE_REF == REF_VKPT
+    if (header->emissive & TEXCACHE_EMISSIVE) {
+        memcpy(image->light_color, header->light_color, sizeof(image->light_color));
+        memcpy(image->min_light_texcoord, header->min_light_texcoord, sizeof(image->min_light_texcoord));
+        memcpy(image->max_light_texcoord, header->max_light_texcoord, sizeof(image->max_light_texcoord));
+        image->entire_texture_emissive = header->emissive & TEXCACHE_EMISSIVE_ENTIRE;
+        image->processing_complete = true;
+    }
+#endif
+    return true;
+}
+
+static void finish_decode(imgdecode_t *d)
+{
+    image_t *image = d->image;
+
+    Sys_WaitForJobs(&d->counter);
+
+    img_pending[image - r_images] = NULL;
+    img_num_pending--;
+
+    if (d->ret < 0) {
+        Com_LPrintf(PRINT_ERROR, "Couldn't load %s: %s\n", image->name, d->error);
+        // the slot is referenced already, so turn it into the same empty
+        // texture R_NOTEXTURE is, which is what the immediate path returns
+        image->upload_width = image->upload_height = 0;
+        image->width = image->height = 0;
+        image->pixel_format = PF_R8G8B8A8_UNORM;
+        image->flags &= ~IF_OPAQUE;
+#if USE_REF == REF_VKPT
+        // drop emissive info restored from a cache entry that failed to read
+        image->processing_complete = false;
+#endif
+        IMG_Load(image, NULL);
+    } else {
+        // width and height keep the original size of a replaced 8-bit texture
+        image->upload_width = d->result.width;
+        image->upload_height = d->result.height;
+        image->pixel_format = d->result.pixel_format;
+        IMG_Load(image, d->pic);
+    }
+
+    Z_Free(d);
+}
+
+/*
+================
+IMG_FinishLoad
+
+Waits until pixels of the given image are available.
+================
+*/
+void IMG_FinishLoad(image_t *image)
+{
+    imgdecode_t *d = img_pending[image - r_images];
+
+    if (d)
+        finish_decode(d);
+}
+
+/*
+================
+IMG_FinishLoads
+
+Waits until all queued images are decoded and loaded.
+================
+*/
+void IMG_FinishLoads(void)
+{
+    int i;
+
+    for (i = 1; i < r_numImages && img_num_pending; i++)
+        if (img_pending[i])
+            finish_decode(img_pending[i]);
+}
+
 #define TRY_IMAGE_SRC_GAME      1
 #define TRY_IMAGE_SRC_BASE      0
 
 static int _try_image_format(imageformat_t fmt, image_t *image, int try_src, byte **pic)
 {
+    texcache_t  tc;
+    FILE        *cache = NULL;
     byte        *data;
     int         len;
     int         ret;
 
-    // load the file
     int fs_flags = 0;
     if (try_src > 0)
         fs_flags = try_src == TRY_IMAGE_SRC_GAME ? FS_PATH_GAME : FS_PATH_BASE;
-    len = FS_LoadFileFlags(image->name, (void **)&data, fs_flags);
+
+    // look for decoded pixels in the texture cache
+    tc.path[0] = 0;
+    if (r_texture_cache->integer && fmt >= IM_TGA && fmt <= IM_PNG) {
+        ret = texcache_open(image, fs_flags, &tc, &cache);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    if (cache && texcache_load(image, &tc, cache, pic)) {
+        ret = Q_ERR_SUCCESS;
+        goto done;
+    }
+
+    // load the file, DDS pixels are copied out as is so map those instead
+    if (fmt == IM_DDS)
+        len = FS_MapFileEx(image->name, (const void **)&data, fs_flags);
+    else
+        len = FS_LoadFileFlags(image->name, (void **)&data, fs_flags);
     if (!data) {
         return len;
     }
 
     // decompress the image
-    ret = img_loaders[fmt].load(data, len, image, pic);
+    if (defer_decode(fmt, image, data, len, &tc)) {
+        *pic = NULL;
+        ret = Q_ERR_SUCCESS;
+    } else {
+        ret = img_loaders[fmt].load(data, len, image, pic);
+        if (fmt == IM_DDS)
+            FS_UnmapFile(data);
+        else
+            FS_FreeFile(data);
+        if (ret >= 0 && tc.path[0]) {
+            texcache_store(&tc, image, *pic);
+        }
+    }
 
-    FS_FreeFile(data);
+done:
 
     image->filepath[0] = 0;
     if (ret >= 0) {
@@ -1512,6 +2006,8 @@ static image_t *find_or_load_image(const char *name, size_t len,
 
     bool allow_override = true;
 
+    img_defer = r_parallel_decode->integer && Sys_NumParallelThreads() > 1;
+
     if(allow_override)
     {
         const char *last_slash = strrchr(name, '/');
@@ -1566,6 +2062,8 @@ static image_t *find_or_load_image(const char *name, size_t len,
         }
     }
 
+    img_defer = false;
+
     if (ret < 0) {
         print_error(image->name, flags, ret);
         if (flags & IF_PERMANENT) {
@@ -1582,8 +2080,9 @@ static image_t *find_or_load_image(const char *name, size_t len,
 
 	image->is_srgb = !!(flags & IF_SRGB);
 
-    // upload the image
-    IMG_Load(image, pic);
+    // upload the image, unless it is still being decoded
+    if (!img_pending[image - r_images])
+        IMG_Load(image, pic);
 
     return image;
 
@@ -1652,6 +2151,8 @@ image_t *IMG_Clone(image_t *image, const char* new_name)
     if(image == R_NOTEXTURE)
         return image;
 
+    IMG_FinishLoad(image);
+
     image_t* new_image = alloc_image();
     if (!new_image)
         return R_NOTEXTURE;
@@ -1940,6 +2441,8 @@ void IMG_Init(void)
     r_texture_formats->changed = r_texture_formats_changed;
     r_texture_formats_changed(r_texture_formats);
     r_texture_overrides = Cvar_Get("r_texture_overrides", "-1", CVAR_FILES);
+    r_parallel_decode = Cvar_Get("r_parallel_decode", "1", 0);
+    r_texture_cache = Cvar_Get("r_texture_cache", "0", 0);
 
     r_screenshot_format = Cvar_Get("gl_screenshot_format", "png", CVAR_ARCHIVE);
     r_screenshot_async = Cvar_Get("gl_screenshot_async", "1", 0);
@@ -1960,6 +2463,7 @@ void IMG_Init(void)
 
 void IMG_Shutdown(void)
 {
+    IMG_FinishLoads();
     Cmd_Deregister(img_cmd);
     r_numImages = 0;
 }
@@ -27,8 +27,18 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #include <format/iqm.h>
 #include <refresh/models.h>
 #include <refresh/refresh.h>
+#include <common/cmd.h>
+#include <common/common.h>
+#include <system/system.h>
 
-void R_ComputeIQMRelativeJoints(const iqm_model_t* model, int32_t frame, int32_t oldframe, float lerp, float backlerp, iqm_transform_t *relativeJoints)
+#if (defined __SSE2__) || (defined _M_X64) || (defined _M_IX86_FP && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define USE_SSE2    1
+#else
+#define USE_SSE2    0
+#endif
+
+static void ComputeRelativeJointsScalar(const iqm_model_t* model, int32_t frame, int32_t oldframe, float lerp, float backlerp, iqm_transform_t *relativeJoints)
 {
 	iqm_transform_t* relativeJoint = relativeJoints;
 
@@ -87,7 +97,7 @@ void R_ComputeIQMRelativeJoints(const iqm_model_t* model, int32_t frame, int32_t
 	}
 }
 
-void R_ComputeIQMLocalSpaceMatricesFromRelative(const iqm_model_t *model, const iqm_transform_t *relativeJoints, float *pose_matrices)
+static void ComputeLocalSpaceMatricesScalar(const iqm_model_t *model, const iqm_transform_t *relativeJoints, float *pose_matrices)
 {
 	// multiply by inverse of bind pose and parent 'pose mat' (bind pose transform matrix)
 	const iqm_transform_t *relativeJoint = relativeJoints;
@@ -113,6 +123,341 @@ void R_ComputeIQMLocalSpaceMatricesFromRelative(const iqm_model_t *model, const
 	}
 }
 
+#if USE_SSE2
+
+// Slerp without trigonometry, after "A Fast and Accurate Algorithm for Computing SLERP"
+// by David Eberly. The weights sin(t * angle) / sin(angle) are evaluated as a polynomial
+// in t and cos(angle), accurate to 1e-7 for angles up to 45 degrees.
+#define SLERP_TERMS 8
+#define SLERP_MU    1.85298109240830f
+
+static void SlerpWeights(float t, float weights[SLERP_TERMS])
+{
+	// (u[i] * t^2 - v[i]), with u[i] = 1 / (i * (2i + 1)) and v[i] = i / (2i + 1)
+	for (int i = 1; i <= SLERP_TERMS; i++)
+	{
+		float u = 1.0f / (i * (2 * i + 1));
+		float v = (float)i / (2 * i + 1);
+		if (i == SLERP_TERMS)
+		{
+			u *= SLERP_MU;
+			v *= SLERP_MU;
+		}
+		weights[i - 1] = u * t * t - v;
+	}
+}
+
+static inline __m128 SlerpFactor(const float weights[SLERP_TERMS], float t, __m128 cos_minus_one)
+{
+	__m128 one = _mm_set1_ps(1.0f);
+	__m128 f = one;
+	for (int i = SLERP_TERMS - 1; i >= 0; i--)
+		f = _mm_add_ps(one, _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(weights[i]), cos_minus_one), f));
+	return _mm_mul_ps(f, _mm_set1_ps(t));
+}
+
+static void ComputeRelativeJointsSSE2(const iqm_model_t* model, int32_t frame, int32_t oldframe, float lerp, float backlerp, iqm_transform_t *relativeJoints)
+{
+	frame = model->num_frames ? (frame % (int) model->num_frames) : 0;
+	oldframe = model->num_frames ? (oldframe % (int) model->num_frames) : 0;
+
+	const iqm_transform_t* pose = &model->poses[frame * model->num_poses];
+	const iqm_transform_t* oldpose = &model->poses[oldframe * model->num_poses];
+	uint32_t num_poses = model->num_poses;
+
+	if (oldframe == frame)
+	{
+		memcpy(relativeJoints, pose, num_poses * sizeof(iqm_transform_t));
+	}
+	else
+	{
+		float weights_to[SLERP_TERMS], weights_from[SLERP_TERMS];
+		SlerpWeights(lerp, weights_to);
+		SlerpWeights(1.0f - lerp, weights_from);
+
+		const __m128 sign_bit = _mm_set1_ps(-0.0f);
+		const __m128 one = _mm_set1_ps(1.0f);
+
+		uint32_t pose_idx = 0;
+		for (; pose_idx + 4 <= num_poses; pose_idx += 4)
+		{
+			const iqm_transform_t* p = pose + pose_idx;
+			const iqm_transform_t* o = oldpose + pose_idx;
+			iqm_transform_t* r = relativeJoints + pose_idx;
+
+			for (int i = 0; i < 4; i++)
+			{
+				r[i].translate[0] = o[i].translate[0] * backlerp + p[i].translate[0] * lerp;
+				r[i].translate[1] = o[i].translate[1] * backlerp + p[i].translate[1] * lerp;
+				r[i].translate[2] = o[i].translate[2] * backlerp + p[i].translate[2] * lerp;
+
+				r[i].scale[0] = o[i].scale[0] * backlerp + p[i].scale[0] * lerp;
+				r[i].scale[1] = o[i].scale[1] * backlerp + p[i].scale[1] * lerp;
+				r[i].scale[2] = o[i].scale[2] * backlerp + p[i].scale[2] * lerp;
+			}
+
+			// quaternions of 4 joints, transposed into x, y, z, w vectors
+			__m128 from0 = _mm_loadu_ps(o[0].rotate), from1 = _mm_loadu_ps(o[1].rotate);
+			__m128 from2 = _mm_loadu_ps(o[2].rotate), from3 = _mm_loadu_ps(o[3].rotate);
+			__m128 to0 = _mm_loadu_ps(p[0].rotate), to1 = _mm_loadu_ps(p[1].rotate);
+			__m128 to2 = _mm_loadu_ps(p[2].rotate), to3 = _mm_loadu_ps(p[3].rotate);
+			_MM_TRANSPOSE4_PS(from0, from1, from2, from3);
+			_MM_TRANSPOSE4_PS(to0, to1, to2, to3);
+
+			__m128 cos_angle = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(from0, to0), _mm_mul_ps(from1, to1)),
+				_mm_add_ps(_mm_mul_ps(from2, to2), _mm_mul_ps(from3, to3)));
+
+			// take the shortest path: flip the target where the cosine is negative
+			__m128 sign = _mm_and_ps(cos_angle, sign_bit);
+			cos_angle = _mm_xor_ps(cos_angle, sign);
+			to0 = _mm_xor_ps(to0, sign);
+			to1 = _mm_xor_ps(to1, sign);
+			to2 = _mm_xor_ps(to2, sign);
+			to3 = _mm_xor_ps(to3, sign);
+
+			__m128 cos_minus_one = _mm_sub_ps(cos_angle, one);
+			__m128 f_to = SlerpFactor(weights_to, lerp, cos_minus_one);
+			__m128 f_from = SlerpFactor(weights_from, 1.0f - lerp, cos_minus_one);
+
+			__m128 q0 = _mm_add_ps(_mm_mul_ps(from0, f_from), _mm_mul_ps(to0, f_to));
+			__m128 q1 = _mm_add_ps(_mm_mul_ps(from1, f_from), _mm_mul_ps(to1, f_to));
+			__m128 q2 = _mm_add_ps(_mm_mul_ps(from2, f_from), _mm_mul_ps(to2, f_to));
+			__m128 q3 = _mm_add_ps(_mm_mul_ps(from3, f_from), _mm_mul_ps(to3, f_to));
+			_MM_TRANSPOSE4_PS(q0, q1, q2, q3);
+
+			_mm_storeu_ps(r[0].rotate, q0);
+			_mm_storeu_ps(r[1].rotate, q1);
+			_mm_storeu_ps(r[2].rotate, q2);
+			_mm_storeu_ps(r[3].rotate, q3);
+		}
+
+		for (; pose_idx < num_poses; pose_idx++)
+		{
+			const iqm_transform_t* p = pose + pose_idx;
+			const iqm_transform_t* o = oldpose + pose_idx;
+			iqm_transform_t* r = relativeJoints + pose_idx;
+
+			r->translate[0] = o->translate[0] * backlerp + p->translate[0] * lerp;
+			r->translate[1] = o->translate[1] * backlerp + p->translate[1] * lerp;
+			r->translate[2] = o->translate[2] * backlerp + p->translate[2] * lerp;
+
+			r->scale[0] = o->scale[0] * backlerp + p->scale[0] * lerp;
+			r->scale[1] = o->scale[1] * backlerp + p->scale[1] * lerp;
+			r->scale[2] = o->scale[2] * backlerp + p->scale[2] * lerp;
+
+			QuatSlerp(o->rotate, p->rotate, lerp, r->rotate);
+		}
+	}
+
+	if ((uint32_t)model->root_id < num_poses)
+	{
+		iqm_transform_t* root = relativeJoints + model->root_id;
+		VectorClear(root->translate);
+		VectorSet(root->scale, 1, 1, 1);
+		QuatCopy(pose[model->root_id].rotate, root->rotate);
+	}
+}
+
+// loads the 3x4 matrices of 4 joints, transposed so that each vector holds one element of all 4
+static inline void LoadMatrices34(const float *m0, const float *m1, const float *m2, const float *m3, __m128 out[12])
+{
+	for (int row = 0; row < 3; row++)
+	{
+		__m128 r0 = _mm_loadu_ps(m0 + row * 4), r1 = _mm_loadu_ps(m1 + row * 4);
+		__m128 r2 = _mm_loadu_ps(m2 + row * 4), r3 = _mm_loadu_ps(m3 + row * 4);
+		_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+		out[row * 4 + 0] = r0;
+		out[row * 4 + 1] = r1;
+		out[row * 4 + 2] = r2;
+		out[row * 4 + 3] = r3;
+	}
+}
+
+static inline void StoreMatrices34(const __m128 in[12], float *m0, float *m1, float *m2, float *m3)
+{
+	for (int row = 0; row < 3; row++)
+	{
+		__m128 r0 = in[row * 4 + 0], r1 = in[row * 4 + 1];
+		__m128 r2 = in[row * 4 + 2], r3 = in[row * 4 + 3];
+		_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+		_mm_storeu_ps(m0 + row * 4, r0);
+		_mm_storeu_ps(m1 + row * 4, r1);
+		_mm_storeu_ps(m2 + row * 4, r2);
+		_mm_storeu_ps(m3 + row * 4, r3);
+	}
+}
+
+// Matrix34Multiply on 4 transposed matrices at once
+static inline void Matrix34MultiplySoA(const __m128 a[12], const __m128 b[12], __m128 out[12])
+{
+	for (int row = 0; row < 3; row++)
+	{
+		const __m128* ar = a + row * 4;
+		for (int col = 0; col < 4; col++)
+		{
+			__m128 sum = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ar[0], b[col]), _mm_mul_ps(ar[1], b[4 + col])), _mm_mul_ps(ar[2], b[8 + col]));
+			if (col == 3)
+				sum = _mm_add_ps(sum, ar[3]);
+			out[row * 4 + col] = sum;
+		}
+	}
+}
+
+// Matrix34Multiply with one output row per vector, out may alias b
+static inline void Matrix34MultiplySSE2(const float *a, const float *b, float *out)
+{
+	__m128 b0 = _mm_loadu_ps(b + 0);
+	__m128 b1 = _mm_loadu_ps(b + 4);
+	__m128 b2 = _mm_loadu_ps(b + 8);
+	__m128 b3 = _mm_setr_ps(0, 0, 0, 1);
+	__m128 rows[3];
+
+	for (int row = 0; row < 3; row++)
+	{
+		const float* ar = a + row * 4;
+		rows[row] = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(_mm_set1_ps(ar[0]), b0),
+			_mm_mul_ps(_mm_set1_ps(ar[1]), b1)),
+			_mm_mul_ps(_mm_set1_ps(ar[2]), b2)),
+			_mm_mul_ps(_mm_set1_ps(ar[3]), b3));
+	}
+
+	_mm_storeu_ps(out + 0, rows[0]);
+	_mm_storeu_ps(out + 4, rows[1]);
+	_mm_storeu_ps(out + 8, rows[2]);
+}
+
+static const float identity34[12] = {
+	1, 0, 0, 0,
+	0, 1, 0, 0,
+	0, 0, 1, 0
+};
+
+static void ComputeLocalSpaceMatricesSSE2(const iqm_model_t *model, const iqm_transform_t *relativeJoints, float *pose_matrices)
+{
+	const int* jointParents = model->jointParents;
+	uint32_t num_poses = model->num_poses;
+	uint32_t pose_idx = 0;
+
+	// First pass: the joint transform between the parent's bind pose and the inverse bind pose
+	// does not depend on other joints, so compute it for 4 joints at a time.
+	for (; pose_idx + 4 <= num_poses; pose_idx += 4)
+	{
+		const iqm_transform_t* r = relativeJoints + pose_idx;
+		const float* bind[4];
+		__m128 joint[12], parent[12], inv_bind[12], tmp[12], local[12];
+
+		for (int i = 0; i < 4; i++)
+		{
+			int parent_idx = jointParents[pose_idx + i];
+			bind[i] = parent_idx >= 0 ? &model->bindJoints[parent_idx * 12] : identity34;
+		}
+
+		// JointToMatrix for 4 joints
+		__m128 rx = _mm_setr_ps(r[0].rotate[0], r[1].rotate[0], r[2].rotate[0], r[3].rotate[0]);
+		__m128 ry = _mm_setr_ps(r[0].rotate[1], r[1].rotate[1], r[2].rotate[1], r[3].rotate[1]);
+		__m128 rz = _mm_setr_ps(r[0].rotate[2], r[1].rotate[2], r[2].rotate[2], r[3].rotate[2]);
+		__m128 rw = _mm_setr_ps(r[0].rotate[3], r[1].rotate[3], r[2].rotate[3], r[3].rotate[3]);
+		__m128 two = _mm_set1_ps(2.0f);
+		__m128 one = _mm_set1_ps(1.0f);
+
+		__m128 xx = _mm_mul_ps(_mm_mul_ps(two, rx), rx);
+		__m128 yy = _mm_mul_ps(_mm_mul_ps(two, ry), ry);
+		__m128 zz = _mm_mul_ps(_mm_mul_ps(two, rz), rz);
+		__m128 xy = _mm_mul_ps(_mm_mul_ps(two, rx), ry);
+		__m128 xz = _mm_mul_ps(_mm_mul_ps(two, rx), rz);
+		__m128 yz = _mm_mul_ps(_mm_mul_ps(two, ry), rz);
+		__m128 wx = _mm_mul_ps(_mm_mul_ps(two, rw), rx);
+		__m128 wy = _mm_mul_ps(_mm_mul_ps(two, rw), ry);
+		__m128 wz = _mm_mul_ps(_mm_mul_ps(two, rw), rz);
+
+		for (int axis = 0; axis < 3; axis++)
+		{
+			__m128 s = _mm_setr_ps(r[0].scale[axis], r[1].scale[axis], r[2].scale[axis], r[3].scale[axis]);
+			__m128 t = _mm_setr_ps(r[0].translate[axis], r[1].translate[axis], r[2].translate[axis], r[3].translate[axis]);
+			__m128* row = joint + axis * 4;
+
+			switch (axis)
+			{
+			case 0:
+				row[0] = _mm_mul_ps(s, _mm_sub_ps(one, _mm_add_ps(yy, zz)));
+				row[1] = _mm_mul_ps(s, _mm_sub_ps(xy, wz));
+				row[2] = _mm_mul_ps(s, _mm_add_ps(xz, wy));
+				break;
+			case 1:
+				row[0] = _mm_mul_ps(s, _mm_add_ps(xy, wz));
+				row[1] = _mm_mul_ps(s, _mm_sub_ps(one, _mm_add_ps(xx, zz)));
+				row[2] = _mm_mul_ps(s, _mm_sub_ps(yz, wx));
+				break;
+			case 2:
+				row[0] = _mm_mul_ps(s, _mm_sub_ps(xz, wy));
+				row[1] = _mm_mul_ps(s, _mm_add_ps(yz, wx));
+				row[2] = _mm_mul_ps(s, _mm_sub_ps(one, _mm_add_ps(xx, yy)));
+				break;
+			}
+			row[3] = t;
+		}
+
+		LoadMatrices34(bind[0], bind[1], bind[2], bind[3], parent);
+		LoadMatrices34(&model->invBindJoints[pose_idx * 12], &model->invBindJoints[(pose_idx + 1) * 12],
+			&model->invBindJoints[(pose_idx + 2) * 12], &model->invBindJoints[(pose_idx + 3) * 12], inv_bind);
+
+		Matrix34MultiplySoA(parent, joint, tmp);
+		Matrix34MultiplySoA(tmp, inv_bind, local);
+
+		StoreMatrices34(local, &pose_matrices[pose_idx * 12], &pose_matrices[(pose_idx + 1) * 12],
+			&pose_matrices[(pose_idx + 2) * 12], &pose_matrices[(pose_idx + 3) * 12]);
+	}
+
+	for (; pose_idx < num_poses; pose_idx++)
+	{
+		const iqm_transform_t* r = relativeJoints + pose_idx;
+		int parent_idx = jointParents[pose_idx];
+		float mat1[12], mat2[12];
+
+		JointToMatrix(r->rotate, r->scale, r->translate, mat1);
+
+		if (parent_idx >= 0)
+		{
+			Matrix34Multiply(&model->bindJoints[parent_idx * 12], mat1, mat2);
+			Matrix34Multiply(mat2, &model->invBindJoints[pose_idx * 12], &pose_matrices[pose_idx * 12]);
+		}
+		else
+		{
+			Matrix34Multiply(mat1, &model->invBindJoints[pose_idx * 12], &pose_matrices[pose_idx * 12]);
+		}
+	}
+
+	// Second pass: concatenate with the parent pose, which comes before its children
+	for (pose_idx = 0; pose_idx < num_poses; pose_idx++)
+	{
+		int parent_idx = jointParents[pose_idx];
+		if (parent_idx >= 0)
+			Matrix34MultiplySSE2(&pose_matrices[parent_idx * 12], &pose_matrices[pose_idx * 12], &pose_matrices[pose_idx * 12]);
+	}
+}
+
+#endif // USE_SSE2
+
+void R_ComputeIQMRelativeJoints(const iqm_model_t* model, int32_t frame, int32_t oldframe, float lerp, float backlerp, iqm_transform_t *relativeJoints)
+{
+#if USE_SSE2
+	ComputeRelativeJointsSSE2(model, frame, oldframe, lerp, backlerp, relativeJoints);
+#else
+	ComputeRelativeJointsScalar(model, frame, oldframe, lerp, backlerp, relativeJoints);
+#endif
+}
+
+void R_ComputeIQMLocalSpaceMatricesFromRelative(const iqm_model_t *model, const iqm_transform_t *relativeJoints, float *pose_matrices)
+{
+#if USE_SSE2
+	ComputeLocalSpaceMatricesSSE2(model, relativeJoints, pose_matrices);
+#else
+	ComputeLocalSpaceMatricesScalar(model, relativeJoints, pose_matrices);
+#endif
+}
+
 void R_ComputeIQMWorldSpaceMatricesFromRelative(const iqm_model_t *model, const iqm_transform_t *relativeJoints, float *pose_matrices)
 {
 	R_ComputeIQMLocalSpaceMatricesFromRelative(model, relativeJoints, pose_matrices);
@@ -121,9 +466,102 @@ void R_ComputeIQMWorldSpaceMatricesFromRelative(const iqm_model_t *model, const
 	float *outPose = pose_matrices;
 
 	for (size_t i = 0; i < model->num_poses; i++, poseMat += 12, outPose += 12) {
+#if USE_SSE2
+		Matrix34MultiplySSE2(outPose, poseMat, outPose);
+#else
 		float inPose[12];
 		memcpy(inPose, outPose, sizeof(inPose));
 		Matrix34Multiply(inPose, poseMat, outPose);
+#endif
 	}
 }
 
+// same pose sequence for every pass of the benchmark
+static void IQMBenchPose(const iqm_model_t* model, int iteration, int* frame, int* oldframe, float* backlerp)
+{
+	*frame = model->num_frames ? iteration % model->num_frames : 0;
+	*oldframe = model->num_frames ? (*frame + 1) % model->num_frames : 0;
+	*backlerp = (float)(iteration % 15 + 1) / 16.0f;
+}
+
+/*
+================
+MOD_IQMBench_f
+
+Evaluates poses of all loaded IQM models with the scalar code and with
+the version used by the renderer, interpolating between adjacent frames
+like entities do, prints the time per joint and compares the resulting
+matrices.
+================
+*/
+void MOD_IQMBench_f(void)
+{
+	int iterations = Cmd_Argc() > 1 ? atoi(Cmd_Argv(1)) : 100;
+	iterations = max(iterations, 1);
+
+	const float tolerance = 1e-3f;
+	uint64_t scalar_time = 0, active_time = 0, num_joints = 0;
+	float max_error = 0;
+	int num_models = 0;
+	int frame, oldframe;
+	float backlerp;
+
+	static iqm_transform_t relative[IQM_MAX_JOINTS];
+	static float scalar_matrices[IQM_MAX_JOINTS * 12];
+	static float active_matrices[IQM_MAX_JOINTS * 12];
+
+	for (int i = 0; i < r_numModels; i++)
+	{
+		const iqm_model_t* model = r_models[i].type ? r_models[i].iqmData : NULL;
+		if (!model || !model->num_poses || model->num_poses > IQM_MAX_JOINTS)
+			continue;
+
+		num_models++;
+		num_joints += (uint64_t)model->num_poses * iterations;
+
+		// time each path over all iterations at once, single poses take only a few microseconds
+		uint64_t start = Sys_Microseconds();
+		for (int it = 0; it < iterations; it++)
+		{
+			IQMBenchPose(model, it, &frame, &oldframe, &backlerp);
+			ComputeRelativeJointsScalar(model, frame, oldframe, 1.0f - backlerp, backlerp, relative);
+			ComputeLocalSpaceMatricesScalar(model, relative, scalar_matrices);
+		}
+		scalar_time += Sys_Microseconds() - start;
+
+		start = Sys_Microseconds();
+		for (int it = 0; it < iterations; it++)
+		{
+			IQMBenchPose(model, it, &frame, &oldframe, &backlerp);
+			R_ComputeIQMRelativeJoints(model, frame, oldframe, 1.0f - backlerp, backlerp, relative);
+			R_ComputeIQMLocalSpaceMatricesFromRelative(model, relative, active_matrices);
+		}
+		active_time += Sys_Microseconds() - start;
+
+		for (int it = 0; it < iterations; it++)
+		{
+			IQMBenchPose(model, it, &frame, &oldframe, &backlerp);
+			ComputeRelativeJointsScalar(model, frame, oldframe, 1.0f - backlerp, backlerp, relative);
+			ComputeLocalSpaceMatricesScalar(model, relative, scalar_matrices);
+			R_ComputeIQMRelativeJoints(model, frame, oldframe, 1.0f - backlerp, backlerp, relative);
+			R_ComputeIQMLocalSpaceMatricesFromRelative(model, relative, active_matrices);
+
+			for (uint32_t k = 0; k < model->num_poses * 12; k++)
+			{
+				float error = fabsf(active_matrices[k] - scalar_matrices[k]) / max(1.0f, fabsf(scalar_matrices[k]));
+				max_error = max(max_error, error);
+			}
+		}
+	}
+
+	if (!num_joints)
+	{
+		Com_Printf("No IQM models loaded.\n");
+		return;
+	}
+
+	Com_Printf("%d models, %d iterations, %llu joints\n", num_models, iterations, (unsigned long long)num_joints);
+	Com_Printf("scalar: %.1f ns per joint\n", scalar_time * 1000.0 / num_joints);
+	Com_Printf("active: %.1f ns per joint\n", active_time * 1000.0 / num_joints);
+	Com_Printf("max relative error: %g (%s)\n", max_error, max_error <= tolerance ? "ok" : "FAILED");
+}
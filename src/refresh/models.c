@@ -484,6 +484,7 @@ void MOD_Init(void)
     Q_assert(!r_numModels);
     Cmd_AddCommand("modellist", MOD_List_f);
     Cmd_AddCommand("puttest", MOD_PutTest_f);
+    Cmd_AddCommand("iqmbench", MOD_IQMBench_f);
 
     // Path to the test model - can be an .md2, .md3 or .iqm file
     cl_testmodel = Cvar_Get("cl_testmodel", "", 0);
@@ -500,5 +501,6 @@ void MOD_Shutdown(void)
     MOD_FreeAll();
     Cmd_RemoveCommand("modellist");
     Cmd_RemoveCommand("puttest");
+    Cmd_RemoveCommand("iqmbench");
 }
 
@@ -22,6 +22,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "material.h"
 #include "cameras.h"
 #include "conversion.h"
+#include "common/mdfour.h"
+#include "system/system.h"
 
 #include <assert.h>
 #include <float.h>
@@ -34,6 +36,8 @@ extern cvar_t *cvar_pt_enable_surface_lights;
 extern cvar_t *cvar_pt_enable_surface_lights_warp;
 extern cvar_t* cvar_pt_bsp_radiance_scale;
 extern cvar_t *cvar_pt_bsp_sky_lights;
+extern cvar_t *cvar_pt_bsp_mesh_cache;
+extern cvar_t *cvar_pt_bsp_mesh_parallel;
 
 static void
 remove_collinear_edges(float* positions, float* tex_coords, mbasis_t* bases, int* num_vertices)
@@ -320,17 +324,6 @@ create_poly(
 	return num_triangles;
 }
 
-static int
-belongs_to_model(bsp_t *bsp, mface_t *surf)
-{
-	for (int i = 0; i < bsp->nummodels; i++) {
-		if (surf >= bsp->models[i].firstface
-		&& surf < bsp->models[i].firstface + bsp->models[i].numfaces)
-			return 1;
-	}
-	return 0;
-}
-
 // Classification of what kind of sky a surface is
 enum sky_class_e
 {
@@ -631,19 +624,50 @@ static int count_triangles(const bsp_t* bsp)
 	return num_tris + 100; //  FIX FOR TEXTURE_MASK and TRANS33/66 being specified in the same material
 }
 
+/*
+  The world mesh is built on the job threads. Each job writes its triangles or lights
+  into the buffer of the thread that runs it and records where they went, and the
+  results are then merged in face or light order, so the mesh, the light lists and
+  the patched PVS come out exactly as a single-threaded build would make them.
+*/
+
+// Per-face information shared by all surface and light passes
+typedef struct {
+	uint32_t material_id; // material flags with the per-surface kind fixups applied
+	uint32_t surf_flags;
+	bool world; // not part of any inline model
+} face_class_t;
+
+// Output of one job in a per-thread buffer
+typedef struct {
+	int thread;
+	uint32_t offset;
+	uint32_t count;
+} job_range_t;
+
 static void
-collect_surfaces(uint32_t *prim_ctr, bsp_mesh_t *wm, bsp_t *bsp, int model_idx, int (*filter)(int, int))
+run_mesh_jobs(int count, parallelfunc_t func, void* arg)
 {
-	mface_t *surfaces = model_idx < 0 ? bsp->faces : bsp->models[model_idx].firstface;
-	int num_faces = model_idx < 0 ? bsp->numfaces : bsp->models[model_idx].numfaces;
-	bool any_pvs_patches = false;
+#if !DUMP_WORLD_MESH_TO_OBJ
+	if (cvar_pt_bsp_mesh_parallel->integer)
+	{
+		Sys_ParallelFor(count, func, arg);
+		return;
+	}
+#endif
 
-	for (int i = 0; i < num_faces; i++) {
-		mface_t *surf = surfaces + i;
+	for (int i = 0; i < count; i++)
+		func(arg, i);
+}
 
-		if (model_idx < 0 && belongs_to_model(bsp, surf)) {
-			continue;
-		}
+static face_class_t*
+classify_faces(bsp_t* bsp)
+{
+	face_class_t* classes = Z_Malloc(bsp->numfaces * sizeof(face_class_t));
+
+	for (int i = 0; i < bsp->numfaces; i++)
+	{
+		mface_t *surf = bsp->faces + i;
 
 		uint32_t material_id = surf->texinfo->material ? surf->texinfo->material->flags : 0;
 		uint32_t surf_flags = surf->drawflags | surf->texinfo->c.flags;
@@ -672,7 +696,154 @@ collect_surfaces(uint32_t *prim_ctr, bsp_mesh_t *wm, bsp_t *bsp, int model_idx,
 		if (surf_flags & SURF_FLOWING)
 			material_id |= MATERIAL_FLAG_FLOWING;
 
-		if (!filter(material_id, surf_flags))
+		classes[i].material_id = material_id;
+		classes[i].surf_flags = surf_flags;
+		classes[i].world = true;
+	}
+
+	for (int k = 0; k < bsp->nummodels; k++)
+	{
+		const mmodel_t* model = bsp->models + k;
+
+		for (int i = 0; i < model->numfaces; i++)
+			classes[model->firstface - bsp->faces + i].world = false;
+	}
+
+	return classes;
+}
+
+typedef struct {
+	VboPrimitive* prims;
+	int* anti_clusters; // cluster behind each triangle if the PVS needs patching, -1 otherwise
+	uint32_t num_prims;
+	uint32_t allocated;
+} thread_prims_t;
+
+typedef struct {
+	mface_t* surf;
+	uint32_t material_id;
+	uint32_t surf_flags;
+	job_range_t range;
+} surface_job_t;
+
+typedef struct {
+	bsp_mesh_t* wm;
+	bsp_t* bsp;
+	int model_idx;
+	surface_job_t* jobs;
+	thread_prims_t threads[MAX_JOB_THREADS + 1];
+} surface_pass_t;
+
+static void
+triangulate_surface_job(void* arg, int index)
+{
+	surface_pass_t* pass = arg;
+	surface_job_t* job = pass->jobs + index;
+	bsp_mesh_t* wm = pass->wm;
+	bsp_t* bsp = pass->bsp;
+	uint32_t material_id = job->material_id;
+	int thread = Sys_ThreadIndex();
+	thread_prims_t* buf = pass->threads + thread;
+
+	uint32_t max_prims = max(job->surf->numsurfedges - 2, 0);
+	if (buf->num_prims + max_prims > buf->allocated)
+	{
+		buf->allocated = max(max(buf->allocated * 2, buf->num_prims + max_prims), 1024);
+		buf->prims = Z_Realloc(buf->prims, buf->allocated * sizeof(VboPrimitive));
+		buf->anti_clusters = Z_Realloc(buf->anti_clusters, buf->allocated * sizeof(int));
+	}
+
+	VboPrimitive* surface_prims = buf->prims + buf->num_prims;
+	int* anti_clusters = buf->anti_clusters + buf->num_prims;
+
+	uint32_t prims_in_surface = create_poly(bsp, job->surf, material_id, buf->num_prims, buf->allocated, surface_prims);
+
+	for (uint32_t k = 0; k < prims_in_surface; ++k) 
+	{
+		anti_clusters[k] = -1;
+
+		if (pass->model_idx < 0)
+		{
+			// Collect the positions into one array for compatibility with get_triangle_off_center(...)
+			float positions[9];
+			VectorCopy(surface_prims[k].pos0, positions + 0);
+			VectorCopy(surface_prims[k].pos1, positions + 3);
+			VectorCopy(surface_prims[k].pos2, positions + 6);
+			
+			// Compute the BSP node for this specific triangle based on its center.
+			// The face lists in the BSP are slightly incorrect, or the original code 
+			// in q2vkpt that was extracting them was incorrect.
+
+			vec3_t center, anti_center;
+			get_triangle_off_center(positions, center, anti_center, 0.01f);
+
+			int cluster = BSP_PointLeaf(bsp->nodes, center)->cluster;
+
+			// If the small offset for the off-center point was too small, and that point
+			// is not inside any cluster, try a larger offset.
+			if (cluster < 0) {
+				get_triangle_off_center(positions, center, anti_center, 1.f);
+				cluster = BSP_PointLeaf(bsp->nodes, center)->cluster;
+			}
+			
+			surface_prims[k].cluster = cluster;
+
+			if (cluster >= 0 && (MAT_IsKind(material_id, MATERIAL_KIND_SKY) || MAT_IsKind(material_id, MATERIAL_KIND_LAVA)))
+			{
+				bool is_bsp_sky_light = (job->surf_flags & (SURF_LIGHT | SURF_SKY)) == (SURF_LIGHT | SURF_SKY);
+				if (is_sky_or_lava_cluster(wm, job->surf, cluster, material_id) || (cvar_pt_bsp_sky_lights->integer && is_bsp_sky_light))
+				{
+					surface_prims[k].material_id |= MATERIAL_FLAG_LIGHT;
+				}
+			}
+
+			// The PVS itself is patched when the triangles are merged, in face order
+			if (!bsp->pvs_patched)
+			{
+				if (MAT_IsKind(material_id, MATERIAL_KIND_SLIME) || MAT_IsKind(material_id, MATERIAL_KIND_WATER) || MAT_IsKind(material_id, MATERIAL_KIND_GLASS) || MAT_IsKind(material_id, MATERIAL_KIND_TRANSPARENT))
+				{
+					int anti_cluster = BSP_PointLeaf(bsp->nodes, anti_center)->cluster;
+
+					if (cluster >= 0 && anti_cluster >= 0 && cluster != anti_cluster)
+						anti_clusters[k] = anti_cluster;
+				}
+			}
+		}
+		else
+			surface_prims[k].cluster = -1;
+	}
+
+	job->range.thread = thread;
+	job->range.offset = buf->num_prims;
+	job->range.count = prims_in_surface;
+	buf->num_prims += prims_in_surface;
+}
+
+static void
+collect_surfaces(uint32_t *prim_ctr, bsp_mesh_t *wm, bsp_t *bsp, const face_class_t *classes, int model_idx, int (*filter)(int, int))
+{
+	mface_t *surfaces = model_idx < 0 ? bsp->faces : bsp->models[model_idx].firstface;
+	int num_faces = model_idx < 0 ? bsp->numfaces : bsp->models[model_idx].numfaces;
+	bool any_pvs_patches = false;
+
+	surface_pass_t pass = { .wm = wm, .bsp = bsp, .model_idx = model_idx };
+	pass.jobs = Z_Malloc(num_faces * sizeof(surface_job_t));
+	int num_jobs = 0;
+
+	// Select the faces and finish their materials serially, so that the random
+	// camera assignment doesn't depend on how the jobs are scheduled.
+
+	for (int i = 0; i < num_faces; i++) {
+		mface_t *surf = surfaces + i;
+		const face_class_t *fc = classes + (surf - bsp->faces);
+
+		if (model_idx < 0 && !fc->world) {
+			continue;
+		}
+
+		uint32_t material_id = fc->material_id;
+
+		if (!filter(material_id, fc->surf_flags))
 			continue;
 
 		if ((material_id & MATERIAL_FLAG_LIGHT) && surf->texinfo->material->light_styles)
@@ -688,74 +859,60 @@ collect_surfaces(uint32_t *prim_ctr, bsp_mesh_t *wm, bsp_t *bsp, int model_idx,
 			material_id = (material_id & ~MATERIAL_LIGHT_STYLE_MASK) | ((camera_id << MATERIAL_LIGHT_STYLE_SHIFT) & MATERIAL_LIGHT_STYLE_MASK);
 		}
 
-		VboPrimitive* surface_prims = wm->primitives + *prim_ctr;
+		surface_job_t *job = pass.jobs + num_jobs++;
+		job->surf = surf;
+		job->material_id = material_id;
+		job->surf_flags = fc->surf_flags;
+	}
+
+	run_mesh_jobs(num_jobs, triangulate_surface_job, &pass);
+
+	// Append the triangles in face order and connect the clusters on both sides
+	// of the transparent ones.
 
-		uint32_t prims_in_surface = create_poly(bsp, surf, material_id, *prim_ctr, wm->num_primitives_allocated, surface_prims);
+	for (int i = 0; i < num_jobs; i++) {
+		const job_range_t *range = &pass.jobs[i].range;
+		const thread_prims_t *buf = pass.threads + range->thread;
+		uint32_t prims_in_surface = range->count;
 
-		for (uint32_t k = 0; k < prims_in_surface; ++k) 
+		// The prititive buffer is allocated based on the expected number of prims generated by the bsp,
+		// so just verify that here, mostly for debugging.
+		if (*prim_ctr + prims_in_surface > wm->num_primitives_allocated)
 		{
-			if (model_idx < 0)
-			{
-				// Collect the positions into one array for compatibility with get_triangle_off_center(...)
-				float positions[9];
-				VectorCopy(surface_prims[k].pos0, positions + 0);
-				VectorCopy(surface_prims[k].pos1, positions + 3);
-				VectorCopy(surface_prims[k].pos2, positions + 6);
-				
-				// Compute the BSP node for this specific triangle based on its center.
-				// The face lists in the BSP are slightly incorrect, or the original code 
-				// in q2vkpt that was extracting them was incorrect.
+			assert(!"Primitive buffer overflow - there's a bug somewhere.");
+			prims_in_surface = wm->num_primitives_allocated - *prim_ctr;
+		}
 
-				vec3_t center, anti_center;
-				get_triangle_off_center(positions, center, anti_center, 0.01f);
+		memcpy(wm->primitives + *prim_ctr, buf->prims + range->offset, prims_in_surface * sizeof(VboPrimitive));
 
-				int cluster = BSP_PointLeaf(bsp->nodes, center)->cluster;
+		for (uint32_t k = 0; k < prims_in_surface; k++)
+		{
+			int cluster = buf->prims[range->offset + k].cluster;
+			int anti_cluster = buf->anti_clusters[range->offset + k];
 
-				// If the small offset for the off-center point was too small, and that point
-				// is not inside any cluster, try a larger offset.
-				if (cluster < 0) {
-					get_triangle_off_center(positions, center, anti_center, 1.f);
-					cluster = BSP_PointLeaf(bsp->nodes, center)->cluster;
-				}
-				
-				surface_prims[k].cluster = cluster;
+			if (anti_cluster < 0)
+				continue;
 
-				if (cluster >= 0 && (MAT_IsKind(material_id, MATERIAL_KIND_SKY) || MAT_IsKind(material_id, MATERIAL_KIND_LAVA)))
-				{
-					bool is_bsp_sky_light = (surf_flags & (SURF_LIGHT | SURF_SKY)) == (SURF_LIGHT | SURF_SKY);
-					if (is_sky_or_lava_cluster(wm, surf, cluster, material_id) || (cvar_pt_bsp_sky_lights->integer && is_bsp_sky_light))
-					{
-						surface_prims[k].material_id |= MATERIAL_FLAG_LIGHT;
-					}
-				}
+			byte* pvs_cluster = BSP_GetPvs(bsp, cluster);
+			byte* pvs_anti_cluster = BSP_GetPvs(bsp, anti_cluster);
 
-				if (!bsp->pvs_patched)
-				{
-					if (MAT_IsKind(material_id, MATERIAL_KIND_SLIME) || MAT_IsKind(material_id, MATERIAL_KIND_WATER) || MAT_IsKind(material_id, MATERIAL_KIND_GLASS) || MAT_IsKind(material_id, MATERIAL_KIND_TRANSPARENT))
-					{
-						int anti_cluster = BSP_PointLeaf(bsp->nodes, anti_center)->cluster;
-
-						if (cluster >= 0 && anti_cluster >= 0 && cluster != anti_cluster)
-						{
-							byte* pvs_cluster = BSP_GetPvs(bsp, cluster);
-							byte* pvs_anti_cluster = BSP_GetPvs(bsp, anti_cluster);
-
-							if (!Q_IsBitSet(pvs_cluster, anti_cluster) || !Q_IsBitSet(pvs_anti_cluster, cluster))
-							{
-								connect_pvs(bsp, cluster, pvs_cluster, anti_cluster, pvs_anti_cluster);
-								any_pvs_patches = true;
-							}
-						}
-					}
-				}
+			if (!Q_IsBitSet(pvs_cluster, anti_cluster) || !Q_IsBitSet(pvs_anti_cluster, cluster))
+			{
+				connect_pvs(bsp, cluster, pvs_cluster, anti_cluster, pvs_anti_cluster);
+				any_pvs_patches = true;
 			}
-			else
-				surface_prims[k].cluster = -1;
 		}
 
 		*prim_ctr += prims_in_surface;
 	}
 
+	for (int i = 0; i <= MAX_JOB_THREADS; i++)
+	{
+		Z_Free(pass.threads[i].prims);
+		Z_Free(pass.threads[i].anti_clusters);
+	}
+	Z_Free(pass.jobs);
+
 	if (any_pvs_patches)
 		make_pvs_symmetric(bsp);
 }
@@ -1171,169 +1328,228 @@ collect_frames_emissive_info(pbr_material_t* material, bool* entire_texture_emis
 }
 
 static void
-collect_light_polys(bsp_mesh_t *wm, bsp_t *bsp, int model_idx, int* num_lights, int* allocated_lights, light_poly_t** lights)
+collect_face_light_polys(bsp_mesh_t *wm, bsp_t *bsp, mface_t *surf, int model_idx, int* num_lights, int* allocated_lights, light_poly_t** lights)
 {
-	mface_t *surfaces = model_idx < 0 ? bsp->faces : bsp->models[model_idx].firstface;
-	int num_faces = model_idx < 0 ? bsp->numfaces : bsp->models[model_idx].numfaces;
-
-	for (int i = 0; i < num_faces; i++)
-	{
-		mface_t *surf = surfaces + i;
-
-		if (model_idx < 0 && belongs_to_model(bsp, surf))
-			continue;
-
-		mtexinfo_t *texinfo = surf->texinfo;
+	mtexinfo_t *texinfo = surf->texinfo;
 
-		if(!texinfo->material)
-			continue;
+	if(!texinfo->material)
+		return;
 
-		int flags = surf->drawflags;
-		if (surf->texinfo) flags |= surf->texinfo->c.flags;
+	int flags = surf->drawflags;
+	if (surf->texinfo) flags |= surf->texinfo->c.flags;
 
-		// Don't create light polys from SKY surfaces, those are handled separately.
-		// Sometimes, textures with a light fixture are used on sky polys (like in rlava1),
-		// and that leads to subdivision of those sky polys into a large number of lights.
-		if (flags & SURF_SKY)
-			continue;
+	// Don't create light polys from SKY surfaces, those are handled separately.
+	// Sometimes, textures with a light fixture are used on sky polys (like in rlava1),
+	// and that leads to subdivision of those sky polys into a large number of lights.
+	if (flags & SURF_SKY)
+		return;
 
-		// Check if any animation frame is a light material
-		bool any_light_frame = false;
+	// Check if any animation frame is a light material
+	bool any_light_frame = false;
+	{
+		pbr_material_t *current_material = texinfo->material;
+		do
 		{
-			pbr_material_t *current_material = texinfo->material;
-			do
-			{
-				any_light_frame |= is_light_material(current_material->flags);
-				current_material = r_materials + current_material->next_frame;
-			} while (current_material != texinfo->material);
-		}
-		if(!any_light_frame)
-			continue;
+			any_light_frame |= is_light_material(current_material->flags);
+			current_material = r_materials + current_material->next_frame;
+		} while (current_material != texinfo->material);
+	}
+	if(!any_light_frame)
+		return;
 
-		// Collect emissive texture info from across frames
-		bool entire_texture_emissive;
-		vec2_t min_light_texcoord;
-		vec2_t max_light_texcoord;
-		vec3_t light_color;
+	// Collect emissive texture info from across frames
+	bool entire_texture_emissive;
+	vec2_t min_light_texcoord;
+	vec2_t max_light_texcoord;
+	vec3_t light_color;
 
-		if (!collect_frames_emissive_info(texinfo->material, &entire_texture_emissive, min_light_texcoord, max_light_texcoord, light_color))
-		{
-			// This algorithm relies on information from the emissive texture,
-			// specifically the extents of the emissive pixels in that texture.
-			// Ignore surfaces that don't have an emissive texture attached.
-			continue;
-		}
+	if (!collect_frames_emissive_info(texinfo->material, &entire_texture_emissive, min_light_texcoord, max_light_texcoord, light_color))
+	{
+		// This algorithm relies on information from the emissive texture,
+		// specifically the extents of the emissive pixels in that texture.
+		// Ignore surfaces that don't have an emissive texture attached.
+		return;
+	}
 
-		float emissive_factor = compute_emissive(texinfo);
-		if(emissive_factor == 0)
-			continue;
+	float emissive_factor = compute_emissive(texinfo);
+	if(emissive_factor == 0)
+		return;
 
-		int light_style = (texinfo->material->light_styles) ? get_surf_light_style(surf) : 0;
+	int light_style = (texinfo->material->light_styles) ? get_surf_light_style(surf) : 0;
 
-		if (entire_texture_emissive)
-		{
-			collect_one_light_poly_entire_texture(bsp, surf, texinfo, model_idx, light_color, emissive_factor, light_style,
-												  num_lights, allocated_lights, lights);
-			continue;
-		}
+	if (entire_texture_emissive)
+	{
+		collect_one_light_poly_entire_texture(bsp, surf, texinfo, model_idx, light_color, emissive_factor, light_style,
+											  num_lights, allocated_lights, lights);
+		return;
+	}
 
-		vec4_t plane;
-		if (!get_surf_plane_equation(surf, plane))
-		{
-			// It's possible that some polygons in the game are degenerate, ignore these.
-			continue;
-		}
+	vec4_t plane;
+	if (!get_surf_plane_equation(surf, plane))
+	{
+		// It's possible that some polygons in the game are degenerate, ignore these.
+		return;
+	}
 
-		float tex_scale[2] = { 1.0f / texinfo->material->original_width, 1.0f / texinfo->material->original_height };
+	float tex_scale[2] = { 1.0f / texinfo->material->original_width, 1.0f / texinfo->material->original_height };
 
-		collect_one_light_poly(bsp, surf, texinfo, model_idx, plane,
-							   tex_scale, min_light_texcoord, max_light_texcoord,
-							   light_color, emissive_factor, light_style,
-							   num_lights, allocated_lights, lights);
-	}
+	collect_one_light_poly(bsp, surf, texinfo, model_idx, plane,
+						   tex_scale, min_light_texcoord, max_light_texcoord,
+						   light_color, emissive_factor, light_style,
+						   num_lights, allocated_lights, lights);
 }
 
 static void
-collect_sky_and_lava_light_polys(bsp_mesh_t *wm, bsp_t* bsp)
+collect_face_sky_and_lava_light_polys(bsp_mesh_t *wm, bsp_t* bsp, mface_t *surf, int model_idx, int* num_lights, int* allocated_lights, light_poly_t** lights)
 {
-	for (int i = 0; i < bsp->numfaces; i++)
+	if (!surf->texinfo)
+		return;
+
+	int flags = surf->drawflags;
+	if (surf->texinfo) flags |= surf->texinfo->c.flags;
+
+	bool is_sky = !!(flags & SURF_SKY);
+	bool is_light = !!(flags & SURF_LIGHT);
+	bool is_nodraw = !!(flags & SURF_NODRAW);
+	bool is_lava = surf->texinfo->material ? MAT_IsKind(surf->texinfo->material->flags, MATERIAL_KIND_LAVA) : false;
+	
+	is_lava &= (surf->texinfo->material->image_emissive != NULL);
+
+	if (!is_sky && !is_lava)
+		return;
+
+	float *positions = alloca(sizeof(float) * 3 * surf->numsurfedges);
+
+	for (int i = 0; i < surf->numsurfedges; i++)
 	{
-		mface_t *surf = bsp->faces + i;
+		msurfedge_t *src_surfedge = surf->firstsurfedge + i;
+		medge_t     *src_edge = src_surfedge->edge;
+		mvertex_t   *src_vert = src_edge->v[src_surfedge->vert];
 
-		if (belongs_to_model(bsp, surf))
-			continue;
+		float *p = positions + i * 3;
 
-		if (!surf->texinfo)
-			continue;
+		VectorCopy(src_vert->point, p);
+	}
 
-		int flags = surf->drawflags;
-		if (surf->texinfo) flags |= surf->texinfo->c.flags;
+	int num_vertices = surf->numsurfedges;
+	remove_collinear_edges(positions, NULL, NULL, &num_vertices);
 
-		bool is_sky = !!(flags & SURF_SKY);
-		bool is_light = !!(flags & SURF_LIGHT);
-		bool is_nodraw = !!(flags & SURF_NODRAW);
-		bool is_lava = surf->texinfo->material ? MAT_IsKind(surf->texinfo->material->flags, MATERIAL_KIND_LAVA) : false;
-		
-		is_lava &= (surf->texinfo->material->image_emissive != NULL);
+	const int num_triangles = num_vertices - 2;
 
-		if (!is_sky && !is_lava)
-			continue;
+	for (int i = 0; i < num_triangles; i++)
+	{
+		int i1 = (i + 2) % num_vertices;
+		int i2 = (i + 1) % num_vertices;
 
-		float *positions = alloca(sizeof(float) * 3 * surf->numsurfedges);
+		light_poly_t light;
+		VectorCopy(positions, light.positions + 0);
+		VectorCopy(positions + i1 * 3, light.positions + 3);
+		VectorCopy(positions + i2 * 3, light.positions + 6);
 
-		for (int i = 0; i < surf->numsurfedges; i++)
+		if (is_sky)
 		{
-			msurfedge_t *src_surfedge = surf->firstsurfedge + i;
-			medge_t     *src_edge = src_surfedge->edge;
-			mvertex_t   *src_vert = src_edge->v[src_surfedge->vert];
+			VectorSet(light.color, -1.f, -1.f, -1.f); // special value for the sky
+			light.material = 0;
+		}
+		else
+		{
+			VectorCopy(surf->texinfo->material->image_emissive->light_color, light.color);
+			light.material = surf->texinfo->material;
+		}
+
+		light.style = 0;
+		light.type = DYNLIGHT_POLYGON;
 
-			float *p = positions + i * 3;
+		if (!get_triangle_off_center(light.positions, light.off_center, NULL, 1.f))
+			continue;
 
-			VectorCopy(src_vert->point, p);
+		light.cluster = BSP_PointLeaf(bsp->nodes, light.off_center)->cluster;
+		
+		if (is_sky_or_lava_cluster(wm, surf, light.cluster, surf->texinfo->material->flags) ||
+			(cvar_pt_bsp_sky_lights->integer && is_sky && is_light && (cvar_pt_bsp_sky_lights->integer > 1 || !is_nodraw)))
+		{
+			light_poly_t* list_light = append_light_poly(num_lights, allocated_lights, lights);
+			memcpy(list_light, &light, sizeof(light_poly_t));
 		}
+	}
+}
 
-		int num_vertices = surf->numsurfedges;
-		remove_collinear_edges(positions, NULL, NULL, &num_vertices);
+typedef void (*face_lights_func_t)(bsp_mesh_t *wm, bsp_t *bsp, mface_t *surf, int model_idx, int* num_lights, int* allocated_lights, light_poly_t** lights);
 
-		const int num_triangles = num_vertices - 2;
+typedef struct {
+	light_poly_t* lights;
+	int num_lights;
+	int allocated;
+} thread_lights_t;
 
-		for (int i = 0; i < num_triangles; i++)
-		{
-			int i1 = (i + 2) % num_vertices;
-			int i2 = (i + 1) % num_vertices;
+typedef struct {
+	bsp_mesh_t* wm;
+	bsp_t* bsp;
+	const face_class_t* classes;
+	mface_t* surfaces;
+	int model_idx;
+	face_lights_func_t func;
+	job_range_t* ranges;
+	thread_lights_t threads[MAX_JOB_THREADS + 1];
+} light_pass_t;
+
+static void
+collect_face_lights_job(void* arg, int index)
+{
+	light_pass_t* pass = arg;
+	mface_t* surf = pass->surfaces + index;
+	int thread = Sys_ThreadIndex();
+	thread_lights_t* buf = pass->threads + thread;
+	job_range_t* range = pass->ranges + index;
 
-			light_poly_t light;
-			VectorCopy(positions, light.positions + 0);
-			VectorCopy(positions + i1 * 3, light.positions + 3);
-			VectorCopy(positions + i2 * 3, light.positions + 6);
+	range->thread = thread;
+	range->offset = buf->num_lights;
 
-			if (is_sky)
-			{
-				VectorSet(light.color, -1.f, -1.f, -1.f); // special value for the sky
-				light.material = 0;
-			}
-			else
-			{
-				VectorCopy(surf->texinfo->material->image_emissive->light_color, light.color);
-				light.material = surf->texinfo->material;
-			}
+	if (pass->model_idx >= 0 || pass->classes[surf - pass->bsp->faces].world)
+		pass->func(pass->wm, pass->bsp, surf, pass->model_idx, &buf->num_lights, &buf->allocated, &buf->lights);
 
-			light.style = 0;
-			light.type = DYNLIGHT_POLYGON;
+	range->count = buf->num_lights - range->offset;
+}
 
-			if (!get_triangle_off_center(light.positions, light.off_center, NULL, 1.f))
-				continue;
+// Runs `func` for every face of the world or a model and appends the lights in face order
+static void
+collect_face_lights(bsp_mesh_t *wm, bsp_t *bsp, const face_class_t *classes, int model_idx, face_lights_func_t func,
+					int* num_lights, int* allocated_lights, light_poly_t** lights)
+{
+	light_pass_t pass = { .wm = wm, .bsp = bsp, .classes = classes, .model_idx = model_idx, .func = func };
+	pass.surfaces = model_idx < 0 ? bsp->faces : bsp->models[model_idx].firstface;
+	int num_faces = model_idx < 0 ? bsp->numfaces : bsp->models[model_idx].numfaces;
+	pass.ranges = Z_Malloc(num_faces * sizeof(job_range_t));
 
-			light.cluster = BSP_PointLeaf(bsp->nodes, light.off_center)->cluster;
-			
-			if (is_sky_or_lava_cluster(wm, surf, light.cluster, surf->texinfo->material->flags) ||
-				(cvar_pt_bsp_sky_lights->integer && is_sky && is_light && (cvar_pt_bsp_sky_lights->integer > 1 || !is_nodraw)))
-			{
-				light_poly_t* list_light = append_light_poly(&wm->num_light_polys, &wm->allocated_light_polys, &wm->light_polys);
-				memcpy(list_light, &light, sizeof(light_poly_t));
-			}
+	run_mesh_jobs(num_faces, collect_face_lights_job, &pass);
+
+	for (int i = 0; i < num_faces; i++)
+	{
+		const job_range_t* range = pass.ranges + i;
+		const thread_lights_t* buf = pass.threads + range->thread;
+
+		for (uint32_t j = 0; j < range->count; j++)
+		{
+			light_poly_t* list_light = append_light_poly(num_lights, allocated_lights, lights);
+			memcpy(list_light, buf->lights + range->offset + j, sizeof(light_poly_t));
 		}
 	}
+
+	for (int i = 0; i <= MAX_JOB_THREADS; i++)
+		Z_Free(pass.threads[i].lights);
+	Z_Free(pass.ranges);
+}
+
+static void
+collect_light_polys(bsp_mesh_t *wm, bsp_t *bsp, const face_class_t *classes, int model_idx, int* num_lights, int* allocated_lights, light_poly_t** lights)
+{
+	collect_face_lights(wm, bsp, classes, model_idx, collect_face_light_polys, num_lights, allocated_lights, lights);
+}
+
+static void
+collect_sky_and_lava_light_polys(bsp_mesh_t *wm, bsp_t* bsp, const face_class_t *classes)
+{
+	collect_face_lights(wm, bsp, classes, -1, collect_face_sky_and_lava_light_polys, &wm->num_light_polys, &wm->allocated_light_polys, &wm->light_polys);
 }
 
 static bool
@@ -1664,37 +1880,76 @@ light_affects_cluster(light_poly_t* light, const aabb_t* aabb)
 	return true;
 }
 
+typedef struct {
+	int* clusters;
+	int num_clusters;
+	int allocated;
+} thread_clusters_t;
+
+typedef struct {
+	bsp_mesh_t* wm;
+	bsp_t* bsp;
+	job_range_t* ranges;
+	thread_clusters_t threads[MAX_JOB_THREADS + 1];
+} cluster_light_pass_t;
+
+// Finds the clusters that can see one light
 static void
-collect_cluster_lights(bsp_mesh_t *wm, bsp_t *bsp)
+cull_light_job(void* arg, int index)
 {
-#define MAX_LIGHTS_PER_CLUSTER 1024
-	int* cluster_lights = Z_Malloc(MAX_LIGHTS_PER_CLUSTER * wm->num_clusters * sizeof(int));
-	int* cluster_light_counts = Z_Mallocz(wm->num_clusters * sizeof(int));
-
-	// Construct an array of visible lights for each cluster.
-	// The array is in `cluster_lights`, with MAX_LIGHTS_PER_CLUSTER stride.
+	cluster_light_pass_t* pass = arg;
+	light_poly_t* light = pass->wm->light_polys + index;
+	int thread = Sys_ThreadIndex();
+	thread_clusters_t* buf = pass->threads + thread;
+	job_range_t* range = pass->ranges + index;
 
-	for (int nlight = 0; nlight < wm->num_light_polys; nlight++)
-	{
-		light_poly_t* light = wm->light_polys + nlight;
+	range->thread = thread;
+	range->offset = buf->num_clusters;
+	range->count = 0;
 
-		if(light->cluster < 0)
-			continue;
+	if(light->cluster < 0)
+		return;
 
-		const byte* pvs = (const byte*)BSP_GetPvs(bsp, light->cluster);
+	const byte* pvs = (const byte*)BSP_GetPvs(pass->bsp, light->cluster);
 
-		FOREACH_BIT_BEGIN(pvs, bsp->visrowsize, other_cluster)
-			aabb_t* cluster_aabb = wm->cluster_aabbs + other_cluster;
-			if (light_affects_cluster(light, cluster_aabb))
+	FOREACH_BIT_BEGIN(pvs, pass->bsp->visrowsize, other_cluster)
+		aabb_t* cluster_aabb = pass->wm->cluster_aabbs + other_cluster;
+		if (light_affects_cluster(light, cluster_aabb))
+		{
+			if (buf->num_clusters == buf->allocated)
 			{
-				int* num_cluster_lights = cluster_light_counts + other_cluster;
-				if (*num_cluster_lights < MAX_LIGHTS_PER_CLUSTER)
-				{
-					cluster_lights[other_cluster * MAX_LIGHTS_PER_CLUSTER + *num_cluster_lights] = nlight;
-					(*num_cluster_lights)++;
-				}
+				buf->allocated = max(buf->allocated * 2, 1024);
+				buf->clusters = Z_Realloc(buf->clusters, buf->allocated * sizeof(int));
 			}
-		FOREACH_BIT_END
+			buf->clusters[buf->num_clusters++] = other_cluster;
+		}
+	FOREACH_BIT_END
+
+	range->count = buf->num_clusters - range->offset;
+}
+
+static void
+collect_cluster_lights(bsp_mesh_t *wm, bsp_t *bsp)
+{
+	cluster_light_pass_t pass = { .wm = wm, .bsp = bsp };
+	pass.ranges = Z_Malloc(wm->num_light_polys * sizeof(job_range_t));
+
+	run_mesh_jobs(wm->num_light_polys, cull_light_job, &pass);
+
+	// Count the visible lights for each cluster. This and the fill below go
+	// in light order, so the lists come out sorted.
+
+	int* cluster_light_counts = Z_Mallocz(wm->num_clusters * sizeof(int));
+
+	for (int nlight = 0; nlight < wm->num_light_polys; nlight++)
+	{
+		const job_range_t* range = pass.ranges + nlight;
+		const int* clusters = pass.threads[range->thread].clusters + range->offset;
+
+		for (uint32_t i = 0; i < range->count; i++)
+		{
+			cluster_light_counts[clusters[i]]++;
+		}
 	}
 
 	// Count the total number of cluster <-> light relations to allocate memory
@@ -1710,25 +1965,35 @@ collect_cluster_lights(bsp_mesh_t *wm, bsp_t *bsp)
 
 	// Com_Printf("Total interactions: %d, culled bbox: %d, culled proj: %d\n", wm->num_cluster_lights, lights_culled_bbox, lights_culled_proj);
 
-	// Compact the previously constructed array into wm->cluster_lights
-
 	int list_offset = 0;
 	for (int cluster = 0; cluster < wm->num_clusters; cluster++)
 	{
 		assert(list_offset >= 0);
 		wm->cluster_light_offsets[cluster] = list_offset;
-		int count = cluster_light_counts[cluster];
-		memcpy(
-			wm->cluster_lights + list_offset, 
-			cluster_lights + MAX_LIGHTS_PER_CLUSTER * cluster, 
-			count * sizeof(int));
-		list_offset += count;
+		list_offset += cluster_light_counts[cluster];
 	}
 	wm->cluster_light_offsets[wm->num_clusters] = list_offset;
 
-	Z_Free(cluster_lights);
+	// Fill the lists, reusing the counts as write positions
+
+	memset(cluster_light_counts, 0, wm->num_clusters * sizeof(int));
+
+	for (int nlight = 0; nlight < wm->num_light_polys; nlight++)
+	{
+		const job_range_t* range = pass.ranges + nlight;
+		const int* clusters = pass.threads[range->thread].clusters + range->offset;
+
+		for (uint32_t i = 0; i < range->count; i++)
+		{
+			int cluster = clusters[i];
+			wm->cluster_lights[wm->cluster_light_offsets[cluster] + cluster_light_counts[cluster]++] = nlight;
+		}
+	}
+
+	for (int i = 0; i <= MAX_JOB_THREADS; i++)
+		Z_Free(pass.threads[i].clusters);
+	Z_Free(pass.ranges);
 	Z_Free(cluster_light_counts);
-#undef MAX_LIGHTS_PER_CLUSTER
 }
 
 static tinyobj_attrib_t custom_sky_attrib;
@@ -1825,6 +2090,494 @@ bsp_mesh_create_custom_sky_prims(uint32_t* prim_ctr, bsp_mesh_t* wm, const bsp_t
 	return custom_sky_attrib.num_face_num_verts;
 }
 
+/*
+  Mesh cache.
+
+  Everything bsp_mesh_create_from_bsp derives from the BSP is saved to
+  maps/mesh/<mapname>.bin after a full build: primitives, geometry ranges,
+  light polys, cluster AABBs and light lists, and sky visibility. Later loads
+  of the same map use it instead of rebuilding, as long as the key matches.
+  The key is the BSP checksum plus a hash of all other inputs of the build:
+  materials and their emissive images, relevant cvars, sky cluster and camera
+  definitions and the custom sky mesh.
+
+  The file is a header followed by flat arrays at offsets given in the header,
+  with no pointers, so it can be used directly from a mapped file.
+*/
+
+#define MESH_CACHE_IDENT    MakeLittleLong('M', 'E', 'S', 'H')
+#define MESH_CACHE_VERSION  2
+
+typedef struct {
+	uint32_t prim_offset;
+	uint32_t prim_count;
+} mesh_cache_range_t;
+
+typedef struct {
+	mesh_cache_range_t geometry;
+	vec3_t center;
+	vec3_t aabb_min;
+	vec3_t aabb_max;
+	uint32_t first_light_poly;
+	uint32_t num_light_polys;
+	uint32_t transparent;
+	uint32_t masked;
+} mesh_cache_model_t;
+
+// light_poly_t with the material pointer stored as an index
+typedef struct {
+	float positions[9];
+	vec3_t off_center;
+	vec3_t color;
+	int32_t material;
+	int32_t cluster;
+	int32_t style;
+	float emissive_factor;
+	int32_t type;
+} mesh_cache_light_t;
+
+typedef struct {
+	uint32_t ident;
+	uint32_t version;
+	uint32_t bsp_checksum;
+	uint8_t inputs[16];
+
+	uint32_t num_models;
+	uint32_t num_primitives;
+	uint32_t num_clusters;
+	uint32_t num_light_polys;
+	uint32_t num_model_light_polys;
+	uint32_t num_cluster_lights;
+
+	mesh_cache_range_t geom_opaque;
+	mesh_cache_range_t geom_transparent;
+	mesh_cache_range_t geom_masked;
+	mesh_cache_range_t geom_sky;
+	mesh_cache_range_t geom_custom_sky;
+
+	aabb_t world_aabb;
+	byte sky_visibility[VIS_MAX_BYTES];
+
+	uint32_t ofs_models;
+	uint32_t ofs_primitives;
+	uint32_t ofs_light_polys;           // world lights, then lights of all models
+	uint32_t ofs_cluster_aabbs;
+	uint32_t ofs_cluster_light_offsets;
+	uint32_t ofs_cluster_lights;
+	uint32_t size;
+} mesh_cache_header_t;
+
+static void
+hash_bytes(mdfour_t *md, const void *data, size_t size)
+{
+	mdfour_update(md, data, size);
+}
+
+static void
+hash_int(mdfour_t *md, int32_t value)
+{
+	hash_bytes(md, &value, sizeof(value));
+}
+
+static void
+hash_float(mdfour_t *md, float value)
+{
+	hash_bytes(md, &value, sizeof(value));
+}
+
+static void
+hash_material(mdfour_t *md, const pbr_material_t *mat)
+{
+	const image_t *image = mat->image_emissive;
+
+	hash_int(md, (int)(mat - r_materials));
+	hash_int(md, mat->flags);
+	hash_int(md, mat->num_frames);
+	hash_int(md, mat->next_frame);
+	hash_int(md, mat->light_styles);
+	hash_int(md, mat->bsp_radiance);
+	hash_float(md, mat->default_radiance);
+	hash_int(md, mat->original_width);
+	hash_int(md, mat->original_height);
+	hash_int(md, mat->image_mask != NULL);
+	hash_int(md, image != NULL);
+
+	if (image)
+	{
+		hash_bytes(md, image->light_color, sizeof(image->light_color));
+		hash_bytes(md, image->min_light_texcoord, sizeof(image->min_light_texcoord));
+		hash_bytes(md, image->max_light_texcoord, sizeof(image->max_light_texcoord));
+		hash_int(md, image->entire_texture_emissive);
+	}
+}
+
+static void
+compute_mesh_cache_key(const bsp_mesh_t *wm, const bsp_t *bsp, const char *map_name, uint8_t key[16])
+{
+	mdfour_t md;
+
+	mdfour_begin(&md);
+
+	hash_int(&md, sizeof(VboPrimitive));
+	hash_int(&md, cvar_pt_enable_nodraw->integer);
+	hash_int(&md, cvar_pt_bsp_sky_lights->integer);
+	hash_float(&md, cvar_pt_bsp_radiance_scale->value);
+
+	hash_int(&md, wm->num_sky_clusters);
+	hash_bytes(&md, wm->sky_clusters, wm->num_sky_clusters * sizeof(wm->sky_clusters[0]));
+	hash_int(&md, wm->all_lava_emissive);
+	hash_int(&md, wm->num_cameras);
+
+	char filename[MAX_QPATH];
+	Q_snprintf(filename, sizeof(filename), "maps/sky/%s.obj", map_name);
+
+	const void *custom_sky = NULL;
+	int custom_sky_size = FS_MapFile(filename, &custom_sky);
+	if (custom_sky)
+	{
+		hash_bytes(&md, custom_sky, custom_sky_size);
+		FS_UnmapFile(custom_sky);
+	}
+
+	for (int i = 0; i < bsp->numtexinfo; i++)
+	{
+		const pbr_material_t *material = bsp->texinfo[i].material;
+
+		if (!material)
+		{
+			hash_int(&md, -1);
+			continue;
+		}
+
+		// all animation frames contribute to light polys
+		const pbr_material_t *current_material = material;
+		do
+		{
+			hash_material(&md, current_material);
+			current_material = r_materials + current_material->next_frame;
+		} while (current_material != material);
+	}
+
+	mdfour_result(&md, key);
+}
+
+static void
+store_mesh_cache_range(mesh_cache_range_t *range, const model_geometry_t *geom)
+{
+	if (geom->num_geometries)
+	{
+		range->prim_offset = geom->prim_offsets[0];
+		range->prim_count = geom->prim_counts[0];
+	}
+	else
+	{
+		range->prim_offset = 0;
+		range->prim_count = 0;
+	}
+}
+
+static void
+store_mesh_cache_lights(mesh_cache_light_t *out, const light_poly_t *in, int count)
+{
+	for (int i = 0; i < count; i++, in++, out++)
+	{
+		memcpy(out->positions, in->positions, sizeof(out->positions));
+		VectorCopy(in->off_center, out->off_center);
+		VectorCopy(in->color, out->color);
+		out->material = in->material ? (int32_t)(in->material - r_materials) : -1;
+		out->cluster = in->cluster;
+		out->style = in->style;
+		out->emissive_factor = in->emissive_factor;
+		out->type = in->type;
+	}
+}
+
+static void
+save_mesh_cache(const bsp_mesh_t *wm, const bsp_t *bsp, const char *path, const uint8_t key[16])
+{
+	mesh_cache_header_t header;
+	uint32_t num_model_light_polys = 0;
+
+	for (int k = 0; k < wm->num_models; k++)
+		num_model_light_polys += wm->models[k].num_light_polys;
+
+	memset(&header, 0, sizeof(header));
+	header.ident = MESH_CACHE_IDENT;
+	header.version = MESH_CACHE_VERSION;
+	header.bsp_checksum = bsp->checksum;
+	memcpy(header.inputs, key, sizeof(header.inputs));
+
+	header.num_models = wm->num_models;
+	header.num_primitives = wm->num_primitives;
+	header.num_clusters = wm->num_clusters;
+	header.num_light_polys = wm->num_light_polys;
+	header.num_model_light_polys = num_model_light_polys;
+	header.num_cluster_lights = wm->num_cluster_lights;
+
+	store_mesh_cache_range(&header.geom_opaque, &wm->geom_opaque);
+	store_mesh_cache_range(&header.geom_transparent, &wm->geom_transparent);
+	store_mesh_cache_range(&header.geom_masked, &wm->geom_masked);
+	store_mesh_cache_range(&header.geom_sky, &wm->geom_sky);
+	store_mesh_cache_range(&header.geom_custom_sky, &wm->geom_custom_sky);
+
+	header.world_aabb = wm->world_aabb;
+	memcpy(header.sky_visibility, wm->sky_visibility, sizeof(header.sky_visibility));
+
+	size_t size = sizeof(header);
+	header.ofs_models = size;
+	size += header.num_models * sizeof(mesh_cache_model_t);
+	header.ofs_primitives = size;
+	size += header.num_primitives * sizeof(VboPrimitive);
+	header.ofs_light_polys = size;
+	size += (header.num_light_polys + num_model_light_polys) * sizeof(mesh_cache_light_t);
+	header.ofs_cluster_aabbs = size;
+	size += header.num_clusters * sizeof(aabb_t);
+	header.ofs_cluster_light_offsets = size;
+	size += (header.num_clusters + 1) * sizeof(int);
+	header.ofs_cluster_lights = size;
+	size += header.num_cluster_lights * sizeof(int);
+	header.size = size;
+
+	byte *buffer = Z_Malloc(size);
+	memcpy(buffer, &header, sizeof(header));
+
+	mesh_cache_model_t *models = (mesh_cache_model_t *)(buffer + header.ofs_models);
+	mesh_cache_light_t *lights = (mesh_cache_light_t *)(buffer + header.ofs_light_polys);
+
+	store_mesh_cache_lights(lights, wm->light_polys, wm->num_light_polys);
+	uint32_t light_ctr = wm->num_light_polys;
+
+	for (int k = 0; k < wm->num_models; k++)
+	{
+		const bsp_model_t *model = wm->models + k;
+		mesh_cache_model_t *out = models + k;
+
+		memset(out, 0, sizeof(*out));
+		store_mesh_cache_range(&out->geometry, &model->geometry);
+		VectorCopy(model->center, out->center);
+		VectorCopy(model->aabb_min, out->aabb_min);
+		VectorCopy(model->aabb_max, out->aabb_max);
+		out->first_light_poly = light_ctr;
+		out->num_light_polys = model->num_light_polys;
+		out->transparent = model->transparent;
+		out->masked = model->masked;
+
+		store_mesh_cache_lights(lights + light_ctr, model->light_polys, model->num_light_polys);
+		light_ctr += model->num_light_polys;
+	}
+
+	memcpy(buffer + header.ofs_primitives, wm->primitives, header.num_primitives * sizeof(VboPrimitive));
+	memcpy(buffer + header.ofs_cluster_aabbs, wm->cluster_aabbs, header.num_clusters * sizeof(aabb_t));
+	memcpy(buffer + header.ofs_cluster_light_offsets, wm->cluster_light_offsets, (header.num_clusters + 1) * sizeof(int));
+	memcpy(buffer + header.ofs_cluster_lights, wm->cluster_lights, header.num_cluster_lights * sizeof(int));
+
+	int ret = FS_WriteFile(path, buffer, size);
+	if (ret < 0)
+		Com_EPrintf("Couldn't save mesh cache %s: %s\n", path, Q_ErrorString(ret));
+
+	Z_Free(buffer);
+}
+
+static bool
+check_mesh_cache_range(const mesh_cache_range_t *range, uint32_t num_primitives)
+{
+	return range->prim_offset <= num_primitives && range->prim_count <= num_primitives - range->prim_offset;
+}
+
+static void
+load_mesh_cache_range(model_geometry_t *geom, const mesh_cache_range_t *range, const char *name)
+{
+	vkpt_init_model_geometry(geom, 1);
+	vkpt_append_model_geometry(geom, range->prim_count, range->prim_offset, name);
+}
+
+static light_poly_t *
+load_mesh_cache_lights(const mesh_cache_light_t *in, int count)
+{
+	if (!count)
+		return NULL;
+
+	light_poly_t *lights = Z_Mallocz(count * sizeof(light_poly_t));
+
+	for (int i = 0; i < count; i++, in++)
+	{
+		mesh_cache_light_t src;
+		light_poly_t *out = lights + i;
+
+		memcpy(&src, in, sizeof(src));  // may be unaligned in a mapped pack
+		memcpy(out->positions, src.positions, sizeof(out->positions));
+		VectorCopy(src.off_center, out->off_center);
+		VectorCopy(src.color, out->color);
+		out->material = src.material >= 0 ? r_materials + src.material : NULL;
+		out->cluster = src.cluster;
+		out->style = src.style;
+		out->emissive_factor = src.emissive_factor;
+		out->type = src.type;
+	}
+
+	return lights;
+}
+
+static void *
+load_mesh_cache_array(const byte *data, uint32_t offset, size_t size)
+{
+	void *out = Z_Malloc(size);
+	memcpy(out, data + offset, size);
+	return out;
+}
+
+// Returns false without touching the mesh if the cache is missing, stale or broken.
+static bool
+load_mesh_cache(bsp_mesh_t *wm, const bsp_t *bsp, const char *path, const uint8_t key[16])
+{
+	const byte *data = NULL;
+	mesh_cache_header_t header;
+
+	int len = FS_MapFile(path, (const void **)&data);
+	if (!data)
+		return false;
+
+	if (len < sizeof(header))
+		goto fail;
+
+	memcpy(&header, data, sizeof(header));
+
+	if (header.ident != MESH_CACHE_IDENT || header.version != MESH_CACHE_VERSION || header.size != len)
+		goto fail;
+
+	// silently rebuild if anything the mesh is built from has changed
+	if (header.bsp_checksum != bsp->checksum || memcmp(header.inputs, key, sizeof(header.inputs)))
+		goto fail_stale;
+
+	if (header.num_models != wm->num_models || header.num_clusters != wm->num_clusters)
+		goto fail;
+
+	// the file is laid out by save_mesh_cache, so the offsets must match exactly
+	uint64_t size = sizeof(header);
+	if (header.ofs_models != size)
+		goto fail;
+	size += (uint64_t)header.num_models * sizeof(mesh_cache_model_t);
+	if (header.ofs_primitives != size)
+		goto fail;
+	size += (uint64_t)header.num_primitives * sizeof(VboPrimitive);
+	if (header.ofs_light_polys != size)
+		goto fail;
+	size += ((uint64_t)header.num_light_polys + header.num_model_light_polys) * sizeof(mesh_cache_light_t);
+	if (header.ofs_cluster_aabbs != size)
+		goto fail;
+	size += (uint64_t)header.num_clusters * sizeof(aabb_t);
+	if (header.ofs_cluster_light_offsets != size)
+		goto fail;
+	size += ((uint64_t)header.num_clusters + 1) * sizeof(int);
+	if (header.ofs_cluster_lights != size)
+		goto fail;
+	size += (uint64_t)header.num_cluster_lights * sizeof(int);
+	if (header.size != size)
+		goto fail;
+
+	if (!check_mesh_cache_range(&header.geom_opaque, header.num_primitives) ||
+		!check_mesh_cache_range(&header.geom_transparent, header.num_primitives) ||
+		!check_mesh_cache_range(&header.geom_masked, header.num_primitives) ||
+		!check_mesh_cache_range(&header.geom_sky, header.num_primitives) ||
+		!check_mesh_cache_range(&header.geom_custom_sky, header.num_primitives))
+		goto fail;
+
+	uint32_t num_model_light_polys = 0;
+	for (uint32_t k = 0; k < header.num_models; k++)
+	{
+		mesh_cache_model_t model;
+		memcpy(&model, data + header.ofs_models + k * sizeof(model), sizeof(model));
+
+		if (!check_mesh_cache_range(&model.geometry, header.num_primitives))
+			goto fail;
+		if (model.first_light_poly != header.num_light_polys + num_model_light_polys)
+			goto fail;
+		num_model_light_polys += model.num_light_polys;
+		if (num_model_light_polys > header.num_model_light_polys)
+			goto fail;
+	}
+	if (num_model_light_polys != header.num_model_light_polys)
+		goto fail;
+
+	for (uint32_t i = 0; i < header.num_light_polys + header.num_model_light_polys; i++)
+	{
+		int32_t material;
+		memcpy(&material, data + header.ofs_light_polys + i * sizeof(mesh_cache_light_t) + q_offsetof(mesh_cache_light_t, material), sizeof(material));
+		if (material < -1 || material >= MAX_PBR_MATERIALS)
+			goto fail;
+	}
+
+	int prev_offset = 0;
+	for (uint32_t c = 0; c <= header.num_clusters; c++)
+	{
+		int offset;
+		memcpy(&offset, data + header.ofs_cluster_light_offsets + c * sizeof(int), sizeof(offset));
+		if (offset < prev_offset || offset > header.num_cluster_lights)
+			goto fail;
+		prev_offset = offset;
+	}
+	if (prev_offset != header.num_cluster_lights)
+		goto fail;
+
+	for (uint32_t i = 0; i < header.num_cluster_lights; i++)
+	{
+		int light;
+		memcpy(&light, data + header.ofs_cluster_lights + i * sizeof(int), sizeof(light));
+		if (light < 0 || light >= header.num_light_polys)
+			goto fail;
+	}
+
+	// everything checks out, fill in the mesh
+
+	wm->num_primitives = wm->num_primitives_allocated = header.num_primitives;
+	wm->primitives = load_mesh_cache_array(data, header.ofs_primitives, header.num_primitives * sizeof(VboPrimitive));
+
+	load_mesh_cache_range(&wm->geom_opaque, &header.geom_opaque, "bsp");
+	load_mesh_cache_range(&wm->geom_transparent, &header.geom_transparent, "bsp");
+	load_mesh_cache_range(&wm->geom_masked, &header.geom_masked, "bsp");
+	load_mesh_cache_range(&wm->geom_sky, &header.geom_sky, "bsp");
+	load_mesh_cache_range(&wm->geom_custom_sky, &header.geom_custom_sky, "bsp");
+
+	const mesh_cache_light_t *lights = (const mesh_cache_light_t *)(data + header.ofs_light_polys);
+
+	for (int k = 0; k < wm->num_models; k++)
+	{
+		bsp_model_t *model = wm->models + k;
+		mesh_cache_model_t in;
+
+		memcpy(&in, data + header.ofs_models + k * sizeof(in), sizeof(in));
+		load_mesh_cache_range(&model->geometry, &in.geometry, "bsp_model");
+		VectorCopy(in.center, model->center);
+		VectorCopy(in.aabb_min, model->aabb_min);
+		VectorCopy(in.aabb_max, model->aabb_max);
+		model->num_light_polys = model->allocated_light_polys = in.num_light_polys;
+		model->light_polys = load_mesh_cache_lights(lights + in.first_light_poly, in.num_light_polys);
+		model->transparent = in.transparent;
+		model->masked = in.masked;
+	}
+
+	wm->num_light_polys = wm->allocated_light_polys = header.num_light_polys;
+	wm->light_polys = load_mesh_cache_lights(lights, header.num_light_polys);
+
+	wm->world_aabb = header.world_aabb;
+	memcpy(wm->sky_visibility, header.sky_visibility, sizeof(wm->sky_visibility));
+
+	wm->cluster_aabbs = load_mesh_cache_array(data, header.ofs_cluster_aabbs, header.num_clusters * sizeof(aabb_t));
+	wm->num_cluster_lights = header.num_cluster_lights;
+	wm->cluster_light_offsets = load_mesh_cache_array(data, header.ofs_cluster_light_offsets, (header.num_clusters + 1) * sizeof(int));
+	wm->cluster_lights = load_mesh_cache_array(data, header.ofs_cluster_lights, header.num_cluster_lights * sizeof(int));
+
+	FS_UnmapFile(data);
+	Com_DPrintf("Loaded mesh cache %s\n", path);
+	return true;
+
+fail:
+	Com_WPrintf("Mesh cache %s is corrupt, rebuilding.\n", path);
+fail_stale:
+	FS_UnmapFile(data);
+	return false;
+}
+
 void
 bsp_mesh_create_from_bsp(bsp_mesh_t *wm, bsp_t *bsp, const char* map_name)
 {
@@ -1856,6 +2609,21 @@ bsp_mesh_create_from_bsp(bsp_mesh_t *wm, bsp_t *bsp, const char* map_name)
 		Com_Errorf(ERR_DROP, "The BSP model has too many clusters (%d)", wm->num_clusters);
 	}
 
+	// Reuse the mesh saved by a previous load of this map. Building it also patches the PVS,
+	// so the cache is only valid together with the patched PVS saved at the same time.
+	uint8_t cache_key[16];
+	char cache_path[MAX_QPATH];
+	bool use_cache = cvar_pt_bsp_mesh_cache->integer &&
+		Q_snprintf(cache_path, sizeof(cache_path), "maps/mesh/%s.bin", map_name) < sizeof(cache_path);
+
+	if (use_cache)
+	{
+		compute_mesh_cache_key(wm, bsp, full_game_map_name, cache_key);
+
+		if (bsp->pvs_patched && load_mesh_cache(wm, bsp, cache_path, cache_key))
+			return;
+	}
+
 	wm->num_primitives_allocated = count_triangles(bsp);
 
 	uint32_t num_custom_sky_prims = bsp_mesh_load_custom_sky(full_game_map_name);
@@ -1887,33 +2655,36 @@ bsp_mesh_create_from_bsp(bsp_mesh_t *wm, bsp_t *bsp, const char* map_name)
 	vkpt_init_model_geometry(&wm->geom_sky, 1);
 	vkpt_init_model_geometry(&wm->geom_custom_sky, 1);
 
+	// Material fixups and model membership only depend on the face, so work them out once for all passes
+	face_class_t *classes = classify_faces(bsp);
+
 	uint32_t first_prim = prim_ctr;
-	collect_surfaces(&prim_ctr, wm, bsp, -1, filter_static_opaque);
+	collect_surfaces(&prim_ctr, wm, bsp, classes, -1, filter_static_opaque);
 	vkpt_append_model_geometry(&wm->geom_opaque, prim_ctr - first_prim, first_prim, "bsp");
 
 	first_prim = prim_ctr;
-	collect_surfaces(&prim_ctr, wm, bsp, -1, filter_static_transparent);
+	collect_surfaces(&prim_ctr, wm, bsp, classes, -1, filter_static_transparent);
 	vkpt_append_model_geometry(&wm->geom_transparent, prim_ctr - first_prim, first_prim, "bsp");
 
 	first_prim = prim_ctr;
-	collect_surfaces(&prim_ctr, wm, bsp, -1, filter_static_masked);
+	collect_surfaces(&prim_ctr, wm, bsp, classes, -1, filter_static_masked);
 	vkpt_append_model_geometry(&wm->geom_masked, prim_ctr - first_prim, first_prim, "bsp");
 
 	first_prim = prim_ctr;
-	collect_surfaces(&prim_ctr, wm, bsp, -1, filter_static_sky);
+	collect_surfaces(&prim_ctr, wm, bsp, classes, -1, filter_static_sky);
 	vkpt_append_model_geometry(&wm->geom_sky, prim_ctr - first_prim, first_prim, "bsp");
 	
 	first_prim = prim_ctr;
 	if (num_custom_sky_prims > 0)
 		bsp_mesh_create_custom_sky_prims(&prim_ctr, wm, bsp);
 	if (cvar_pt_bsp_sky_lights->integer > 1)
-		collect_surfaces(&prim_ctr, wm, bsp, -1, filter_nodraw_sky_lights);
+		collect_surfaces(&prim_ctr, wm, bsp, classes, -1, filter_nodraw_sky_lights);
 	vkpt_append_model_geometry(&wm->geom_custom_sky, prim_ctr - first_prim, first_prim, "bsp");
 
     for (int k = 0; k < bsp->nummodels; k++) {
 		bsp_model_t* model = wm->models + k;
 		first_prim = prim_ctr;
-		collect_surfaces(&prim_ctr, wm, bsp, k, filter_all);
+		collect_surfaces(&prim_ctr, wm, bsp, classes, k, filter_all);
 		vkpt_init_model_geometry(&model->geometry, 1);
 		vkpt_append_model_geometry(&model->geometry, prim_ctr - first_prim, first_prim, "bsp_model");
     }
@@ -1957,8 +2728,8 @@ bsp_mesh_create_from_bsp(bsp_mesh_t *wm, bsp_t *bsp, const char* map_name)
 
 	compute_cluster_aabbs(wm);
 
-	collect_light_polys(wm, bsp, -1, &wm->num_light_polys, &wm->allocated_light_polys, &wm->light_polys);
-	collect_sky_and_lava_light_polys(wm, bsp);
+	collect_light_polys(wm, bsp, classes, -1, &wm->num_light_polys, &wm->allocated_light_polys, &wm->light_polys);
+	collect_sky_and_lava_light_polys(wm, bsp, classes);
 
 	for (int k = 0; k < bsp->nummodels; k++)
 	{
@@ -1968,15 +2739,20 @@ bsp_mesh_create_from_bsp(bsp_mesh_t *wm, bsp_t *bsp, const char* map_name)
 		model->allocated_light_polys = 0;
 		model->light_polys = NULL;
 		
-		collect_light_polys(wm, bsp, k, &model->num_light_polys, &model->allocated_light_polys, &model->light_polys);
+		collect_light_polys(wm, bsp, classes, k, &model->num_light_polys, &model->allocated_light_polys, &model->light_polys);
 
 		model->transparent = is_model_transparent(wm, model);
 		model->masked = is_model_masked(wm, model);
 	}
 
+	Z_Free(classes);
+
 	collect_cluster_lights(wm, bsp);
 
 	compute_sky_visibility(wm, bsp);
+
+	if (use_cache)
+		save_mesh_cache(wm, bsp, cache_path, cache_key);
 }
 
 void
@@ -65,6 +65,8 @@ cvar_t* cvar_pt_surface_lights_fake_emissive_algo = NULL;
 cvar_t* cvar_pt_surface_lights_threshold = NULL;
 cvar_t* cvar_pt_bsp_radiance_scale = NULL;
 cvar_t *cvar_pt_bsp_sky_lights = NULL;
+cvar_t *cvar_pt_bsp_mesh_cache = NULL;
+cvar_t *cvar_pt_bsp_mesh_parallel = NULL;
 cvar_t *cvar_pt_accumulation_rendering = NULL;
 cvar_t *cvar_pt_accumulation_rendering_framenum = NULL;
 cvar_t *cvar_pt_projection = NULL;
@@ -1938,6 +1940,57 @@ void MatrixTranspose(mat4_t m)
 	m[15] = c[15];
 }
 
+// Entities that show the same IQM model in the same pose share one set of pose matrices.
+// The cache is indexed by a hash of the pose and cleared each frame by bumping the generation.
+#define IQM_POSE_CACHE_SIZE 8192
+
+typedef struct {
+	const iqm_model_t* model;
+	int frame;
+	int oldframe;
+	float backlerp;
+	float spin_angle;
+	int matrix_index;
+	uint32_t generation;
+} iqm_pose_cache_entry_t;
+
+static iqm_pose_cache_entry_t iqm_pose_cache[IQM_POSE_CACHE_SIZE];
+static uint32_t iqm_pose_cache_generation;
+
+static iqm_pose_cache_entry_t*
+find_iqm_pose(const iqm_model_t* model, int frame, int oldframe, float backlerp, float spin_angle)
+{
+	uint32_t hash = (uint32_t)((uintptr_t)model >> 4) * 0x9e3779b1u;
+	hash ^= (uint32_t)frame * 0x85ebca6bu;
+	hash ^= (uint32_t)oldframe * 0xc2b2ae35u;
+	hash ^= (uint32_t)(backlerp * 65536.f) * 0x27d4eb2fu;
+	hash ^= (uint32_t)(spin_angle * 256.f) * 0x165667b1u;
+	hash ^= hash >> 15;
+
+	for (uint32_t probe = 0; probe < IQM_POSE_CACHE_SIZE; probe++)
+	{
+		iqm_pose_cache_entry_t* entry = &iqm_pose_cache[(hash + probe) & (IQM_POSE_CACHE_SIZE - 1)];
+
+		if (entry->generation != iqm_pose_cache_generation)
+		{
+			entry->model = model;
+			entry->frame = frame;
+			entry->oldframe = oldframe;
+			entry->backlerp = backlerp;
+			entry->spin_angle = spin_angle;
+			entry->matrix_index = -1;
+			entry->generation = iqm_pose_cache_generation;
+			return entry;
+		}
+
+		if (entry->model == model && entry->frame == frame && entry->oldframe == oldframe &&
+			entry->backlerp == backlerp && entry->spin_angle == spin_angle)
+			return entry;
+	}
+
+	return NULL;
+}
+
 static void process_regular_entity(
 	const entity_t* entity, 
 	const model_t* model, 
@@ -1966,7 +2019,16 @@ static void process_regular_entity(
 		*contains_transparent = false;
 
 	int iqm_matrix_index = -1;
+	iqm_pose_cache_entry_t* cached_pose = NULL;
 	if (model->iqmData && model->iqmData->num_poses) {
+		float spin_angle = (model->spin_id != -1) ? entity->spin_angle : 0.f;
+		cached_pose = find_iqm_pose(model->iqmData, entity->frame, entity->oldframe, entity->backlerp, spin_angle);
+	}
+
+	if (cached_pose && cached_pose->matrix_index >= 0) {
+		iqm_matrix_index = cached_pose->matrix_index;
+	}
+	else if (model->iqmData && model->iqmData->num_poses) {
 		iqm_matrix_index = *iqm_matrix_offset;
 		
 		if (iqm_matrix_index + model->iqmData->num_poses > MAX_IQM_MATRICES)
@@ -1975,6 +2037,9 @@ static void process_regular_entity(
 			return;
 		}
 
+		if (cached_pose)
+			cached_pose->matrix_index = iqm_matrix_index;
+
 		float *pose_mat = iqm_matrix_data + (iqm_matrix_index * 12);
 
 		iqm_transform_t relativeJoints[IQM_MAX_JOINTS];
@@ -2248,6 +2313,14 @@ prepare_entities(EntityUploadInfo* upload_info, refdef_t *fd)
 	int instance_idx = 0;
 	int iqm_matrix_offset = 0;
 
+	// invalidate the poses computed for the previous frame
+	iqm_pose_cache_generation++;
+	if (iqm_pose_cache_generation == 0)
+	{
+		memset(iqm_pose_cache, 0, sizeof(iqm_pose_cache));
+		iqm_pose_cache_generation = 1;
+	}
+
 	const bool first_person_model = (cl_player_model->integer == CL_PLAYER_MODEL_FIRST_PERSON) && cl.baseclientinfo.model;
 
 	for (int i = 0; i < vkpt_refdef.fd->num_entities; i++)
@@ -2717,8 +2790,10 @@ static void
 prepare_sky_matrix(float time, vec3_t sky_matrix[3])
 {
 	// check if user wants to rotate the sky
-	cvar_t* sky_rotation = Cvar_Get("physical_sky_rotate", "0", 0); // cvar defined in physical_sky.c
-	cvar_t* sky_orientation = Cvar_Get("physical_sky_orientation", "0.0", 0); // cvar defined in physical_sky.c
+	static cvarbind_t physical_sky_rotate = CVAR_BIND("physical_sky_rotate", "0", 0); // cvar defined in physical_sky.c
+	static cvarbind_t physical_sky_orientation = CVAR_BIND("physical_sky_orientation", "0.0", 0); // cvar defined in physical_sky.c
+	cvar_t* sky_rotation = Cvar_BoundVar(&physical_sky_rotate);
+	cvar_t* sky_orientation = Cvar_BoundVar(&physical_sky_orientation);
 
 	if(sky_rotation->value != -1.0f) // -1.0f means "use the value from the map"
 		requested_sky_rotation = sky_rotation->value;
@@ -3828,6 +3903,14 @@ R_Init(bool total)
 	// Nonzero settings should only be used for custom maps where sky surfaces are marked properly for Q2RTX.
 	cvar_pt_bsp_sky_lights = Cvar_Get("pt_bsp_sky_lights", "0", 0);
 
+	// Save the world mesh built from the BSP to maps/mesh/<mapname>.bin and reuse it on
+	// later loads of the same map, as long as the BSP, materials and settings are unchanged.
+	cvar_pt_bsp_mesh_cache = Cvar_Get("pt_bsp_mesh_cache", "1", 0);
+
+	// Build the world mesh and its light lists on the job threads. The result is the same
+	// either way, so this is only useful for comparing the load times.
+	cvar_pt_bsp_mesh_parallel = Cvar_Get("pt_bsp_mesh_parallel", "1", 0);
+
 	// 0 -> disabled, regular pause; 1 -> enabled; 2 -> enabled, hide GUI
 	cvar_pt_accumulation_rendering = Cvar_Get("pt_accumulation_rendering", "1", CVAR_ARCHIVE);
 
@@ -4272,6 +4355,8 @@ R_SetSky(const char *name, float rotate, int autorotate, const vec3_t axis)
 			break;
 		}
 
+		IMG_FinishLoad(img);
+
 		size_t s = img->upload_width * img->upload_height * 4;
 		if(!data) {
 			data = Z_Malloc(s * 6);
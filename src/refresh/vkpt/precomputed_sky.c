@@ -284,7 +284,7 @@ VkResult UploadImage(void* FirstPixel, size_t total_size, unsigned int Width, un
 bool LoadImageFromDDS(const char* FileName, uint32_t Binding, struct ImageGPUInfo* Info, const char* DebugName)
 {
 	unsigned char* data = NULL;
-	int len = FS_LoadFile(FileName, (void**)&data);
+	int len = FS_MapFile(FileName, (const void**)&data);
 
 	if (!data)
 	{
@@ -347,7 +347,7 @@ bool LoadImageFromDDS(const char* FileName, uint32_t Binding, struct ImageGPUInf
 	UploadImage(data + dds_header_size, len - dds_header_size, dds->width, dds->height, dds->depth, ArraySize, Cube, PixelFormat, Binding, Info, DebugName);
 
 done:
-	FS_FreeFile(data);
+	FS_UnmapFile(data);
 	return retval;
 }
 
@@ -345,6 +345,11 @@ draw_profiler(int enable_asvgf)
 	}
 #undef PROFILER_DO
 
+	char buf[64];
+	snprintf(buf, sizeof buf, "%8.1f KB", vkpt_light_buffer_upload_bytes() / 1024.0);
+	R_DrawString(x, y, 0, 128, "light upload", font);
+	R_DrawString(x + 256, y, 0, 128, buf, font);
+
 	R_SetScale(1.0f);
 }
 
@@ -285,8 +285,8 @@ sample_lights(
 	if(list_idx == ~0u)
 		return;
 
-	uint list_start = light_buffer.light_list_offsets[list_idx];
-	uint list_end   = light_buffer.light_list_offsets[list_idx + 1];
+	uint list_start = light_list_offsets[list_idx];
+	uint list_end   = light_list_offsets[list_idx + 1];
 	/* The light count we base light selection on may differ from the current count
 	 * to avoid gradient estimation breaking (see comment on light_counts_history).
 	 * Obtain the frame number for the historical count from the RNG seed
@@ -316,15 +316,7 @@ sample_lights(
 			continue;
 		}
 
-		uint current_idx = light_buffer.light_list_lights[n_idx];
-
-		// In case of polygon light overflow, the host code will still populate the light lists
-		// with invalid indices. Skip those lights here, so they have pdf=0 and will not be selected.
-		if (current_idx >= MAX_LIGHT_POLYS)
-		{
-			light_masses[i] = 0;
-			continue;
-		}
+		uint current_idx = light_list_lights[n_idx];
 
 		LightPolygon light = get_light_polygon(current_idx);
 
@@ -417,7 +409,7 @@ sample_lights(
 
 	// assert: current_idx >= 0?
 	if (current_idx >= 0) {
-		current_idx = int(light_buffer.light_list_lights[current_idx]);
+		current_idx = int(light_list_lights[current_idx]);
 
 		LightPolygon light = get_light_polygon(current_idx);
 
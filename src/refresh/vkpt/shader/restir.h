@@ -343,8 +343,8 @@ get_direct_illumination_restir(
 
 	float rng, p_hat;
 
-	uint list_start = light_buffer.light_list_offsets[cluster_idx];
-	uint list_end   = light_buffer.light_list_offsets[cluster_idx + 1];
+	uint list_start = light_list_offsets[cluster_idx];
+	uint list_end   = light_list_offsets[cluster_idx + 1];
 	
 	rng = get_rng(RNG_NEE_LIGHT_SELECTION(bounce));
 	
@@ -377,7 +377,7 @@ get_direct_illumination_restir(
 		if (n_idx >= list_end)
 			break;
     
-		current_light_idx = n_idx != sun_idx ? light_buffer.light_list_lights[n_idx] : RESTIR_ENV_ID;
+		current_light_idx = n_idx != sun_idx ? light_list_lights[n_idx] : RESTIR_ENV_ID;
 		
 		if(current_light_idx == ~0u) continue;
 
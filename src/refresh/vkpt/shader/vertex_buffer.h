@@ -22,13 +22,13 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "shader_structs.h"
 
-#define MAX_LIGHT_LISTS         (1 << 14)
-#define MAX_LIGHT_LIST_NODES    (1 << 19)
+// Upper bound on the cluster count, same as MAX_MAP_LEAFS. Light polygons and light lists
+// are stored in separate buffers sized for the loaded map.
+#define MAX_LIGHT_LISTS         (1 << 16)
 #define LIGHT_COUNT_HISTORY     16
 
 #define MAX_IQM_MATRICES        32768
 
-#define MAX_LIGHT_POLYS         4096
 #define LIGHT_POLY_VEC4S        4
 #define MATERIAL_UINTS          6
 
@@ -49,6 +49,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #define SUN_COLOR_BUFFER_BINDING_IDX 7
 #define SUN_COLOR_UBO_BINDING_IDX 8
 #define LIGHT_STATS_BUFFER_BINDING_IDX 9
+#define LIGHT_POLYS_BUFFER_BINDING_IDX 10
+#define LIGHT_LIST_OFFSETS_BUFFER_BINDING_IDX 11
+#define LIGHT_LIST_LIGHTS_BUFFER_BINDING_IDX 12
 
 #define VERTEX_BUFFER_WORLD 0
 #define VERTEX_BUFFER_INSTANCED 1
@@ -95,9 +98,6 @@ END_SHADER_STRUCT( VboPrimitive )
 BEGIN_SHADER_STRUCT( LightBuffer )
 {
 	uint material_table[MAX_PBR_MATERIALS * MATERIAL_UINTS];
-	vec4 light_polys[MAX_LIGHT_POLYS * LIGHT_POLY_VEC4S];
-	uint light_list_offsets[MAX_LIGHT_LISTS];
-	uint light_list_lights[MAX_LIGHT_LIST_NODES];
 	float light_styles[MAX_LIGHT_STYLES];
 	uint cluster_debug_mask[MAX_LIGHT_LISTS / 32];
 	uint sky_visibility[MAX_LIGHT_LISTS / 32];
@@ -201,6 +201,20 @@ layout(set = VERTEX_BUFFER_DESC_SET_IDX, binding = LIGHT_BUFFER_BINDING_IDX) rea
 	LightBuffer light_buffer;
 };
 
+// Light polygons, LIGHT_POLY_VEC4S vec4's each: the static lights of the map followed by the model lights.
+layout(set = VERTEX_BUFFER_DESC_SET_IDX, binding = LIGHT_POLYS_BUFFER_BINDING_IDX) readonly buffer LIGHT_POLYS_BUFFER {
+	vec4 light_polys[];
+};
+
+// The lights potentially visible from cluster c are light_list_lights[light_list_offsets[c] .. light_list_offsets[c + 1]).
+layout(set = VERTEX_BUFFER_DESC_SET_IDX, binding = LIGHT_LIST_OFFSETS_BUFFER_BINDING_IDX) readonly buffer LIGHT_LIST_OFFSETS_BUFFER {
+	uint light_list_offsets[];
+};
+
+layout(set = VERTEX_BUFFER_DESC_SET_IDX, binding = LIGHT_LIST_LIGHTS_BUFFER_BINDING_IDX) readonly buffer LIGHT_LIST_LIGHTS_BUFFER {
+	uint light_list_lights[];
+};
+
 /* History of light count in cluster, used for sampling.
  * This is used to make gradient estimation work correctly:
  * "The A-SVGF algorithm uses old random numbers to select lights for a subset of pixels,
@@ -469,10 +483,10 @@ animate_material(uint material, int frame)
 LightPolygon
 get_light_polygon(uint index)
 {
-	vec4 p0 = light_buffer.light_polys[index * LIGHT_POLY_VEC4S + 0];
-	vec4 p1 = light_buffer.light_polys[index * LIGHT_POLY_VEC4S + 1];
-	vec4 p2 = light_buffer.light_polys[index * LIGHT_POLY_VEC4S + 2];
-	vec4 p3 = light_buffer.light_polys[index * LIGHT_POLY_VEC4S + 3];
+	vec4 p0 = light_polys[index * LIGHT_POLY_VEC4S + 0];
+	vec4 p1 = light_polys[index * LIGHT_POLY_VEC4S + 1];
+	vec4 p2 = light_polys[index * LIGHT_POLY_VEC4S + 2];
+	vec4 p3 = light_polys[index * LIGHT_POLY_VEC4S + 3];
 
 	LightPolygon light;
 	light.positions = mat3x3(p0.xyz, p1.xyz, p2.xyz);
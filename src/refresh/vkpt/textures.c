@@ -885,6 +885,8 @@ image_t *vkpt_fake_emissive_texture(image_t *image, int bright_threshold_int)
 void
 vkpt_extract_emissive_texture_info(image_t *image)
 {
+	IMG_FinishLoad(image);
+
 	int w = image->upload_width;
 	int h = image->upload_height;
 
@@ -940,6 +942,8 @@ vkpt_extract_emissive_texture_info(image_t *image)
 	image->entire_texture_emissive = (min_x == 0) && (min_y == 0) && (max_x == w - 1) && (max_y == h - 1);
 
 	image->processing_complete = true;
+
+	IMG_CacheEmissiveInfo(image);
 }
 
 void
@@ -952,6 +956,9 @@ IMG_Load(image_t *image, byte *pic)
 void
 IMG_Unload(image_t *image)
 {
+	// don't let a pending decode hand pixels to a freed slot
+	IMG_FinishLoad(image);
+
 	if(image->pix_data)
 		Z_Free(image->pix_data);
 	image->pix_data = NULL;
@@ -984,6 +991,8 @@ void IMG_ReloadAll(void)
     int i, reloaded=0;
     image_t * image;
 
+    IMG_FinishLoads();
+
     for (i = 1, image = r_images + 1; i < r_numImages; i++, image++)
     {
         if (!image->registration_sequence)
@@ -1554,6 +1563,9 @@ static VkFormat get_image_format(image_t *q_img)
 VkResult
 vkpt_textures_end_registration()
 {
+	// hand over pixels of all images that are still being decoded
+	IMG_FinishLoads();
+
 	if(!image_loading_dirty_flag)
 		return VK_SUCCESS;
 	image_loading_dirty_flag = 0;
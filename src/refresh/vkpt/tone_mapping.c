@@ -73,6 +73,16 @@ static VkPipelineLayout pipeline_layout_tone_mapping_curve;
 static VkPipelineLayout pipeline_layout_tone_mapping_apply;
 static int reset_required = 1; // If 1, recomputes tone curve based only on this frame
 
+// Note that the second argument of CVAR_BIND only specifies the default
+// value in code if none is set; the values specified in global_ubo.h will
+// override these.
+static cvarbind_t tm_slope_blur_sigma = CVAR_BIND("tm_slope_blur_sigma", "6.0", 0);
+static cvarbind_t tm_knee_start = CVAR_BIND("tm_knee_start", "0.9", 0);
+static cvarbind_t tm_white_point = CVAR_BIND("tm_white_point", "10.0", 0);
+
+// Normalized slope kernel, rebuilt only when tm_slope_blur_sigma changes.
+static float slope_kernel[14];
+
 // Creates our pipeline layouts.
 VkResult
 vkpt_tone_mapping_initialize()
@@ -306,33 +316,30 @@ vkpt_tone_mapping_record_cmd_buffer(VkCommandBuffer cmd_buf, float frame_time)
 	// shadow edges in some scenes.
 	// In addition, we assume the kernel is symmetric; this allows us to only
 	// specify half of it in our push constant buffer.
-	
-	// Note that the second argument of Cvar_Get only specifies the default
-	// value in code if none is set; the value of tm_slope_blur_sigma specified
-	// in global_ubo.h will override this.
-	float slope_blur_sigma = Cvar_Get("tm_slope_blur_sigma", "6.0", 0)->value;
+	if (Cvar_BindChanged(&tm_slope_blur_sigma))
+	{
+		float slope_blur_sigma = Cvar_BoundValue(&tm_slope_blur_sigma);
+
+		// Compute Gaussian curve and sum, taking symmetry into account.
+		float gaussian_sum = 0.0;
+		for (int i = 0; i < 14; ++i)
+		{
+			float kernel_value = exp(-i * i / (2.0 * slope_blur_sigma * slope_blur_sigma));
+			gaussian_sum += kernel_value * (i == 0 ? 1 : 2);
+			slope_kernel[i] = kernel_value;
+		}
+		// Normalize the result (since even with an analytic normalization factor,
+		// the results may not sum to one).
+		for (int i = 0; i < 14; ++i) {
+			slope_kernel[i] /= gaussian_sum;
+		}
+	}
+
 	float push_constants_tm2_curve[16] = {
 		 reset_required ? 1.0 : 0.0, // 1 means reset the histogram
 		 frame_time, // Frame time
-		 0.0, 0.0, 0.0, 0.0, // Slope kernel filter
-		 0.0, 0.0, 0.0, 0.0,
-		 0.0, 0.0, 0.0, 0.0,
-		 0.0, 0.0
 	};
-
-	// Compute Gaussian curve and sum, taking symmetry into account.
-	float gaussian_sum = 0.0;
-	for (int i = 0; i < 14; ++i)
-	{
-		float kernel_value = exp(-i * i / (2.0 * slope_blur_sigma * slope_blur_sigma));
-		gaussian_sum += kernel_value * (i == 0 ? 1 : 2);
-		push_constants_tm2_curve[i + 2] = kernel_value;
-	}
-	// Normalize the result (since even with an analytic normalization factor,
-	// the results may not sum to one).
-	for (int i = 0; i < 14; ++i) {
-		push_constants_tm2_curve[i + 2] /= gaussian_sum;
-	}
+	memcpy(push_constants_tm2_curve + 2, slope_kernel, sizeof(slope_kernel)); // Slope kernel filter
 
 	vkCmdPushConstants(cmd_buf, pipeline_layout_tone_mapping_curve,
 		VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push_constants_tm2_curve), push_constants_tm2_curve);
@@ -377,9 +384,9 @@ vkpt_tone_mapping_record_cmd_buffer(VkCommandBuffer cmd_buf, float frame_time)
 	// end of the previous tone mapping pipeline.
 	// Must be between 0 and 1; pixels with luminances above this value have
 	// their RGB values slowly clamped to 1, up to tm_white_point.
-	float knee_start = Cvar_Get("tm_knee_start", "0.9", 0)->value;
+	float knee_start = Cvar_BoundValue(&tm_knee_start);
 	// Should be greater than 1; defines those RGB values that get mapped to 1.
-	float knee_white_point = Cvar_Get("tm_white_point", "10.0", 0)->value;
+	float knee_white_point = Cvar_BoundValue(&tm_white_point);
 
 	// We modify Reinhard to smoothly blend with the identity transform up to tm_knee_start.
 	// We need to find w, a, and b such that in y(x) = (wx+a)/(x+b),
@@ -44,6 +44,55 @@ static uint32_t current_primbuf_size = 0;
 #define PRIMBUF_SIZE_MAX (1 << 26)
 #define PRIMBUF_SIZE_DEFAULT (1 << 20)
 
+// Light data stays resident on the GPU. Each storage keeps a CPU copy of what the device buffer
+// holds; new contents are compared against it, and only the changed ranges go through staging.
+// Light polygons and cluster light lists are sized for the loaded map and grow when the
+// model lights need more room, which stalls the GPU once.
+#define MAX_LIGHT_UPLOAD_REGIONS 64
+
+typedef struct {
+	BufferResource_t buffer;
+	BufferResource_t staging[MAX_FRAMES_IN_FLIGHT];
+	byte* shadow;
+	uint32_t binding;
+	uint32_t element_size;
+	uint32_t capacity;
+	bool reset; // set when the buffer is (re)created, cleared by the code that refills it
+	VkBufferCopy regions[MAX_LIGHT_UPLOAD_REGIONS];
+	uint32_t num_regions;
+	const char* name;
+} light_storage_t;
+
+static light_storage_t light_buffer_storage = {
+	.binding = LIGHT_BUFFER_BINDING_IDX,
+	.element_size = sizeof(LightBuffer),
+	.name = "light",
+};
+
+static light_storage_t light_polys_storage = {
+	.binding = LIGHT_POLYS_BUFFER_BINDING_IDX,
+	.element_size = sizeof(vec4) * LIGHT_POLY_VEC4S,
+	.name = "light polygon",
+};
+
+static light_storage_t light_list_offsets_storage = {
+	.binding = LIGHT_LIST_OFFSETS_BUFFER_BINDING_IDX,
+	.element_size = sizeof(uint32_t),
+	.name = "light list offset",
+};
+
+static light_storage_t light_list_lights_storage = {
+	.binding = LIGHT_LIST_LIGHTS_BUFFER_BINDING_IDX,
+	.element_size = sizeof(uint32_t),
+	.name = "light list",
+};
+
+// Light storage capacities are rounded up to a multiple of this many elements
+#define LIGHT_STORAGE_GRANULARITY 1024
+
+// Light data is compared and uploaded in chunks of this many bytes
+#define LIGHT_UPLOAD_CHUNK 256
+
 // Per Vulkan spec, acceleration structure offset must be a multiple of 256
 // https://www.khronos.org/registry/vulkan/specs/1.2-extensions/man/html/VkAccelerationStructureCreateInfoKHR.html
 #define ACCEL_STRUCT_ALIGNMENT 256
@@ -425,17 +474,175 @@ void vkpt_vertex_buffer_cleanup_bsp_mesh(bsp_mesh_t* bsp_mesh)
 	}
 }
 
-VkResult
-vkpt_light_buffer_upload_staging(VkCommandBuffer cmd_buf)
+static void
+mark_light_storage_dirty(light_storage_t* storage, VkDeviceSize offset, VkDeviceSize size)
 {
-	BufferResource_t* staging = qvk.buf_light_staging + qvk.current_frame_index;
+	// Ranges mostly come in increasing order, so only try to merge with the last region.
+	// When out of regions, the last one grows to cover the new range.
+	VkBufferCopy* last = storage->num_regions ? storage->regions + storage->num_regions - 1 : NULL;
 
-	assert(!staging->is_mapped);
+	if (last)
+	{
+		VkDeviceSize last_end = last->srcOffset + last->size;
+		bool adjacent = offset <= last_end + LIGHT_UPLOAD_CHUNK && offset + size + LIGHT_UPLOAD_CHUNK >= last->srcOffset;
 
-	VkBufferCopy copyRegion = {
-		.size = sizeof(LightBuffer),
+		if (adjacent || storage->num_regions == MAX_LIGHT_UPLOAD_REGIONS)
+		{
+			VkDeviceSize start = min(last->srcOffset, offset);
+			last->size = max(last_end, offset + size) - start;
+			last->srcOffset = start;
+			last->dstOffset = start;
+			return;
+		}
+	}
+
+	VkBufferCopy* region = storage->regions + storage->num_regions++;
+	region->srcOffset = offset;
+	region->dstOffset = offset;
+	region->size = size;
+}
+
+// Stores new contents for elements [first, first + count) in the shadow copy,
+// and records the chunks that differ from it for upload.
+static void
+update_light_storage(light_storage_t* storage, uint32_t first, uint32_t count, const void* data)
+{
+	assert(first + count <= storage->capacity);
+
+	const byte* src = data;
+	VkDeviceSize begin = (VkDeviceSize)first * storage->element_size;
+	VkDeviceSize end = begin + (VkDeviceSize)count * storage->element_size;
+
+	for (VkDeviceSize offset = begin; offset < end; offset += LIGHT_UPLOAD_CHUNK)
+	{
+		VkDeviceSize size = min(end - offset, LIGHT_UPLOAD_CHUNK);
+		if (memcmp(storage->shadow + offset, src + (offset - begin), size) != 0)
+		{
+			memcpy(storage->shadow + offset, src + (offset - begin), size);
+			mark_light_storage_dirty(storage, offset, size);
+		}
+	}
+}
+
+static void
+create_light_storage(light_storage_t* storage, uint32_t capacity)
+{
+	capacity = max(capacity, 1);
+	VkDeviceSize size = (VkDeviceSize)capacity * storage->element_size;
+
+	buffer_create(&storage->buffer, size,
+		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	for (int frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++)
+	{
+		buffer_create(storage->staging + frame, size,
+			VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	}
+
+	VkDescriptorBufferInfo buf_info = {
+		.buffer = storage->buffer.buffer,
+		.offset = 0,
+		.range  = storage->buffer.size,
+	};
+
+	VkWriteDescriptorSet output_buf_write = {
+		.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+		.dstSet          = qvk.desc_set_vertex_buffer,
+		.dstBinding      = storage->binding,
+		.dstArrayElement = 0,
+		.descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		.descriptorCount = 1,
+		.pBufferInfo     = &buf_info,
 	};
-	vkCmdCopyBuffer(cmd_buf, staging->buffer, qvk.buf_light.buffer, 1, &copyRegion);
+
+	vkUpdateDescriptorSets(qvk.device, 1, &output_buf_write, 0, NULL);
+
+	// The new device buffer is uninitialized: upload the whole (zeroed) shadow copy once,
+	// so that the comparisons against it are valid from here on.
+	storage->shadow = Z_Mallocz(size);
+	storage->capacity = capacity;
+	storage->reset = true;
+	storage->num_regions = 0;
+	mark_light_storage_dirty(storage, 0, size);
+}
+
+static void
+destroy_light_storage(light_storage_t* storage)
+{
+	buffer_destroy(&storage->buffer);
+
+	for (int frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++)
+	{
+		buffer_destroy(storage->staging + frame);
+	}
+
+	Z_Free(storage->shadow);
+	storage->shadow = NULL;
+	storage->capacity = 0;
+	storage->num_regions = 0;
+}
+
+static void
+ensure_light_storage_size(light_storage_t* storage, uint32_t count)
+{
+	if (count <= storage->capacity)
+		return;
+
+	vkDeviceWaitIdle(qvk.device);
+
+	destroy_light_storage(storage);
+
+	// Leave some headroom so that a slowly growing number of model lights doesn't resize every frame
+	create_light_storage(storage, (uint32_t)align(count + count / 4, LIGHT_STORAGE_GRANULARITY));
+
+	Com_DPrintf("Resizing the %s buffer to %u entries.\n", storage->name, storage->capacity);
+}
+
+// Number of bytes streamed into the light buffers by the last upload
+static uint32_t light_upload_bytes;
+
+static void
+upload_light_storage(VkCommandBuffer cmd_buf, light_storage_t* storage)
+{
+	if (storage->num_regions == 0)
+		return;
+
+	BufferResource_t* staging = storage->staging + qvk.current_frame_index;
+
+	byte* staging_data = (byte*)buffer_map(staging);
+	assert(staging_data);
+
+	for (uint32_t i = 0; i < storage->num_regions; i++)
+	{
+		const VkBufferCopy* region = storage->regions + i;
+		memcpy(staging_data + region->srcOffset, storage->shadow + region->srcOffset, region->size);
+		light_upload_bytes += (uint32_t)region->size;
+	}
+
+	buffer_unmap(staging);
+
+	vkCmdCopyBuffer(cmd_buf, staging->buffer, storage->buffer.buffer, storage->num_regions, storage->regions);
+
+	storage->num_regions = 0;
+}
+
+uint32_t
+vkpt_light_buffer_upload_bytes(void)
+{
+	return light_upload_bytes;
+}
+
+VkResult
+vkpt_light_buffer_upload_staging(VkCommandBuffer cmd_buf)
+{
+	light_upload_bytes = 0;
+
+	upload_light_storage(cmd_buf, &light_buffer_storage);
+	upload_light_storage(cmd_buf, &light_polys_storage);
+	upload_light_storage(cmd_buf, &light_list_offsets_storage);
+	upload_light_storage(cmd_buf, &light_list_lights_storage);
 
 	int buffer_idx = qvk.frame_counter % 3;
 	if (qvk.buf_light_stats[buffer_idx].buffer)
@@ -466,16 +673,29 @@ static int cluster_light_counts[MAX_MAP_LEAFS];
 static int light_list_tails[MAX_MAP_LEAFS];
 static int max_model_lights;
 
+// Indices of the BSP lights that can change between frames: light styles, sky lights and animated materials.
+// The other BSP lights are only uploaded when the buffer is created or the material table changes.
+static int* dynamic_bsp_lights;
+static int num_dynamic_bsp_lights;
+
+// Set when the device light lists hold the BSP lists without any model lights
+static bool light_lists_static;
+
+// Light lists with the model lights injected are built here, then compared against the shadow copies
+static uint32_t* light_list_offsets_scratch;
+static uint32_t* light_list_lights_scratch;
+static uint32_t light_list_lights_scratch_size;
+
+// LightBuffer contents for the current frame, compared against the shadow copy
+static LightBuffer light_buffer_scratch;
+
 void vkpt_light_buffer_reset_counts()
 {
 	max_model_lights = 0;
 }
 
-static void copy_bsp_lights(bsp_mesh_t* bsp_mesh, LightBuffer *lbo)
+static void store_bsp_light_counts(bsp_mesh_t* bsp_mesh)
 {
-	// Copy the BSP light lists verbatim
-	memcpy(lbo->light_list_lights, bsp_mesh->cluster_lights, sizeof(uint32_t) * bsp_mesh->cluster_light_offsets[bsp_mesh->num_clusters]);
-	memcpy(lbo->light_list_offsets, bsp_mesh->cluster_light_offsets, sizeof(uint32_t) * (bsp_mesh->num_clusters + 1));
 	// Store the light counts in the light counts history entry for the current frame
 	uint history_index = qvk.frame_counter % LIGHT_COUNT_HISTORY;
 	uint *sample_light_counts = (uint *)buffer_map(qvk.buf_light_counts_history + history_index);
@@ -486,12 +706,11 @@ static void copy_bsp_lights(bsp_mesh_t* bsp_mesh, LightBuffer *lbo)
 	buffer_unmap(qvk.buf_light_counts_history + history_index);
 }
 
-static void
-inject_model_lights(bsp_mesh_t* bsp_mesh, bsp_t* bsp, int num_model_lights, light_poly_t* transformed_model_lights, int model_light_offset, LightBuffer *lbo)
+// Counts the model lights visible from each cluster into cluster_light_counts,
+// and returns the total size of the light lists with these lights injected.
+static uint32_t
+count_model_light_interactions(bsp_mesh_t* bsp_mesh, bsp_t* bsp, int num_model_lights, light_poly_t* transformed_model_lights)
 {
-	uint32_t *dst_list_offsets = lbo->light_list_offsets;
-	uint32_t *dst_lists = lbo->light_list_lights;
-
 	memset(local_light_counts, 0, bsp_mesh->num_clusters * sizeof(int));
 	memset(cluster_light_counts, 0, bsp_mesh->num_clusters * sizeof(int));
 
@@ -523,24 +742,29 @@ inject_model_lights(bsp_mesh_t* bsp_mesh, bsp_t* bsp, int num_model_lights, ligh
 
 	// Count the total required list size
 
-	int required_size = bsp_mesh->cluster_light_offsets[bsp_mesh->num_clusters];
+	uint32_t required_size = bsp_mesh->cluster_light_offsets[bsp_mesh->num_clusters];
 	for (int c = 0; c < bsp_mesh->num_clusters; c++)
 	{
 		required_size += cluster_light_counts[c];
 	}
 
-	// See if we have enough room in the interaction buffer
-	
-	if (required_size > MAX_LIGHT_LIST_NODES)
+	return required_size;
+}
+
+// Builds the light lists with the model lights injected into the scratch lists,
+// using the counts from count_model_light_interactions.
+static void
+inject_model_lights(bsp_mesh_t* bsp_mesh, bsp_t* bsp, int num_model_lights, light_poly_t* transformed_model_lights, int model_light_offset, uint32_t list_size)
+{
+	if (list_size > light_list_lights_scratch_size)
 	{
-		Com_WPrintf("Insufficient light interaction buffer size (%d needed). Increase MAX_LIGHT_LIST_NODES.\n", required_size);
+		light_list_lights_scratch_size = (uint32_t)align(list_size, LIGHT_STORAGE_GRANULARITY);
+		light_list_lights_scratch = Z_Realloc(light_list_lights_scratch, light_list_lights_scratch_size * sizeof(uint32_t));
+	}
 
-		// Copy the BSP light lists verbatim
-		copy_bsp_lights(bsp_mesh, lbo);
+	uint32_t *dst_list_offsets = light_list_offsets_scratch;
+	uint32_t *dst_lists = light_list_lights_scratch;
 
-		return;
-	}
-	
 	// Store the light counts in the light counts history entry for the current frame
 	uint history_index = qvk.frame_counter % LIGHT_COUNT_HISTORY;
 	uint *sample_light_counts = (uint *)buffer_map(qvk.buf_light_counts_history + history_index);
@@ -555,9 +779,7 @@ inject_model_lights(bsp_mesh_t* bsp_mesh, bsp_t* bsp, int num_model_lights, ligh
 		dst_list_offsets[c] = tail;
 		memcpy(dst_lists + tail, bsp_mesh->cluster_lights + bsp_mesh->cluster_light_offsets[c], sizeof(uint32_t) * original_size);
 		tail += original_size;
-		
-		assert(tail + cluster_light_counts[c] < MAX_LIGHT_LIST_NODES);
-		
+
 		light_list_tails[c] = tail;
 		tail += cluster_light_counts[c];
 
@@ -647,67 +869,7 @@ vkpt_light_buffer_upload_to_staging(bool render_world, bsp_mesh_t *bsp_mesh, bsp
 {
 	assert(bsp_mesh);
 
-	BufferResource_t* staging = qvk.buf_light_staging + qvk.current_frame_index;
-
-	LightBuffer *lbo = (LightBuffer *)buffer_map(staging);
-	assert(lbo);
-
-	if (render_world)
-	{
-		assert(bsp_mesh->num_clusters + 1 < MAX_LIGHT_LISTS);
-		assert(bsp_mesh->num_cluster_lights < MAX_LIGHT_LIST_NODES);
-
-		int total_lights = bsp_mesh->num_light_polys + num_model_lights;
-		static bool warning_printed = false;
-		if (total_lights >= MAX_LIGHT_POLYS)
-		{
-			if (!warning_printed)
-			{
-				Com_WPrintf("The map has %d light polygons, which is more than the maximum count of %d.\n"
-							"Some lights were removed. Increase MAX_LIGHT_POLYS in the source code.\n",
-							total_lights, MAX_LIGHT_POLYS);
-				warning_printed = true;
-			}
-		}
-		else
-		{
-			warning_printed = false;
-		}
-
-		int model_light_offset = bsp_mesh->num_light_polys;
-		max_model_lights = max(max_model_lights, num_model_lights);
-
-		if(max_model_lights > 0)
-		{
-			// If any of the BSP models contain lights, inject these lights right into the visibility lists.
-			// The shader doesn't know that these lights are dynamic.
-
-			inject_model_lights(bsp_mesh, bsp, num_model_lights, transformed_model_lights, model_light_offset, lbo);
-		}
-		else
-		{
-			copy_bsp_lights(bsp_mesh, lbo);
-		}
-
-		for (int nlight = 0; nlight < bsp_mesh->num_light_polys && nlight < MAX_LIGHT_POLYS; nlight++)
-		{
-			light_poly_t* light = bsp_mesh->light_polys + nlight;
-			float* vblight = *(lbo->light_polys + nlight * LIGHT_POLY_VEC4S);
-			copy_light(light, vblight, sky_radiance);
-		}
-
-		for (int nlight = 0; nlight < num_model_lights && nlight + model_light_offset < MAX_LIGHT_POLYS; nlight++)
-		{
-			light_poly_t* light = transformed_model_lights + nlight;
-			float* vblight = *(lbo->light_polys + (nlight + model_light_offset) * LIGHT_POLY_VEC4S);
-			copy_light(light, vblight, sky_radiance);
-		}
-	}
-	else
-	{
-		lbo->light_list_offsets[0] = 0;
-		lbo->light_list_offsets[1] = 0;
-	}
+	LightBuffer *lbo = &light_buffer_scratch;
 
 	/* effects.c declares this - hence the assert below:
 		typedef struct clightstyle_s {
@@ -758,8 +920,92 @@ vkpt_light_buffer_upload_to_staging(bool render_world, bsp_mesh_t *bsp_mesh, bsp
 	memcpy(lbo->cluster_debug_mask, cluster_debug_mask, MAX_LIGHT_LISTS / 8);
 	memcpy(lbo->sky_visibility, bsp_mesh->sky_visibility, MAX_LIGHT_LISTS / 8);
 
-	buffer_unmap(staging);
-	lbo = NULL;
+	// The static lights are scaled by their material's emissive factor, so refresh them when any material changes
+	const LightBuffer* uploaded = (const LightBuffer*)light_buffer_storage.shadow;
+	bool materials_changed = memcmp(lbo->material_table, uploaded->material_table, sizeof(lbo->material_table)) != 0;
+
+	update_light_storage(&light_buffer_storage, 0, 1, lbo);
+
+	if (render_world)
+	{
+		assert(bsp_mesh->num_clusters + 1 < MAX_LIGHT_LISTS);
+
+		int model_light_offset = bsp_mesh->num_light_polys;
+		int total_lights = bsp_mesh->num_light_polys + num_model_lights;
+		max_model_lights = max(max_model_lights, num_model_lights);
+
+		// If any of the BSP models contain lights, inject these lights right into the visibility lists.
+		// The shader doesn't know that these lights are dynamic.
+		// Count the interactions first so that the light list buffer can be resized before it's written.
+
+		uint32_t list_size = bsp_mesh->num_cluster_lights;
+		if (max_model_lights > 0)
+			list_size = count_model_light_interactions(bsp_mesh, bsp, num_model_lights, transformed_model_lights);
+
+		ensure_light_storage_size(&light_polys_storage, total_lights);
+		ensure_light_storage_size(&light_list_offsets_storage, bsp_mesh->num_clusters + 1);
+		ensure_light_storage_size(&light_list_lights_storage, list_size);
+
+		if (light_list_offsets_storage.reset || light_list_lights_storage.reset)
+		{
+			light_lists_static = false;
+			light_list_offsets_storage.reset = false;
+			light_list_lights_storage.reset = false;
+		}
+
+		if (max_model_lights > 0)
+		{
+			inject_model_lights(bsp_mesh, bsp, num_model_lights, transformed_model_lights, model_light_offset, list_size);
+			update_light_storage(&light_list_offsets_storage, 0, bsp_mesh->num_clusters + 1, light_list_offsets_scratch);
+			update_light_storage(&light_list_lights_storage, 0, list_size, light_list_lights_scratch);
+			light_lists_static = false;
+		}
+		else
+		{
+			if (!light_lists_static)
+			{
+				update_light_storage(&light_list_offsets_storage, 0, bsp_mesh->num_clusters + 1, bsp_mesh->cluster_light_offsets);
+				update_light_storage(&light_list_lights_storage, 0, list_size, bsp_mesh->cluster_lights);
+				light_lists_static = true;
+			}
+
+			store_bsp_light_counts(bsp_mesh);
+		}
+
+		float vblight[LIGHT_POLY_VEC4S * 4];
+
+		if (light_polys_storage.reset || materials_changed)
+		{
+			for (int nlight = 0; nlight < bsp_mesh->num_light_polys; nlight++)
+			{
+				copy_light(bsp_mesh->light_polys + nlight, vblight, sky_radiance);
+				update_light_storage(&light_polys_storage, nlight, 1, vblight);
+			}
+
+			light_polys_storage.reset = false;
+		}
+		else
+		{
+			for (int i = 0; i < num_dynamic_bsp_lights; i++)
+			{
+				int nlight = dynamic_bsp_lights[i];
+				copy_light(bsp_mesh->light_polys + nlight, vblight, sky_radiance);
+				update_light_storage(&light_polys_storage, nlight, 1, vblight);
+			}
+		}
+
+		for (int nlight = 0; nlight < num_model_lights; nlight++)
+		{
+			copy_light(transformed_model_lights + nlight, vblight, sky_radiance);
+			update_light_storage(&light_polys_storage, nlight + model_light_offset, 1, vblight);
+		}
+	}
+	else
+	{
+		static const uint32_t empty_list_offsets[2] = { 0, 0 };
+		update_light_storage(&light_list_offsets_storage, 0, LENGTH(empty_list_offsets), empty_list_offsets);
+		light_lists_static = false;
+	}
 
 	return VK_SUCCESS;
 }
@@ -1296,6 +1542,24 @@ vkpt_vertex_buffer_create()
 			.descriptorCount = 3,
 			.binding = LIGHT_STATS_BUFFER_BINDING_IDX,
 			.stageFlags = VK_SHADER_STAGE_ALL,
+		},
+		{
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.descriptorCount = 1,
+			.binding = LIGHT_POLYS_BUFFER_BINDING_IDX,
+			.stageFlags = VK_SHADER_STAGE_ALL,
+		},
+		{
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.descriptorCount = 1,
+			.binding = LIGHT_LIST_OFFSETS_BUFFER_BINDING_IDX,
+			.stageFlags = VK_SHADER_STAGE_ALL,
+		},
+		{
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.descriptorCount = 1,
+			.binding = LIGHT_LIST_LIGHTS_BUFFER_BINDING_IDX,
+			.stageFlags = VK_SHADER_STAGE_ALL,
 		}
 	};
 
@@ -1307,17 +1571,6 @@ vkpt_vertex_buffer_create()
 
 	_VK(vkCreateDescriptorSetLayout(qvk.device, &layout_info, NULL, &qvk.desc_set_layout_vertex_buffer));
 	
-	buffer_create(&qvk.buf_light, sizeof(LightBuffer),
-		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-
-	for (int frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++)
-	{
-		buffer_create(qvk.buf_light_staging + frame, sizeof(LightBuffer),
-			VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-	}
-
 	buffer_create(&qvk.buf_readback, sizeof(ReadbackBuffer),
 		VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
 		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
@@ -1394,13 +1647,8 @@ vkpt_vertex_buffer_create()
 
 	vkUpdateDescriptorSets(qvk.device, 1, &output_buf_write, 0, NULL);
 	
-	output_buf_write.dstBinding = LIGHT_BUFFER_BINDING_IDX;
-	output_buf_write.dstArrayElement = 0;
-	buf_info.buffer = qvk.buf_light.buffer;
-	buf_info.range = sizeof(LightBuffer);
-	vkUpdateDescriptorSets(qvk.device, 1, &output_buf_write, 0, NULL);
-
 	output_buf_write.dstBinding = IQM_MATRIX_BUFFER_BINDING_IDX;
+	output_buf_write.dstArrayElement = 0;
 	buf_info.buffer = qvk.buf_iqm_matrices.buffer;
 	buf_info.range = sizeof(IqmMatrixBuffer);
 	vkUpdateDescriptorSets(qvk.device, 1, &output_buf_write, 0, NULL);
@@ -1427,6 +1675,13 @@ vkpt_vertex_buffer_create()
 	vkUpdateDescriptorSets(qvk.device, 1, &output_buf_write, 0, NULL);
 
 	create_primbuf();
+
+	create_light_storage(&light_buffer_storage, 1);
+
+	// Minimal light storage until a map is loaded, enough for the empty light lists
+	create_light_storage(&light_polys_storage, 0);
+	create_light_storage(&light_list_offsets_storage, 2);
+	create_light_storage(&light_list_lights_storage, 0);
 	
 	memset(model_vertex_data, 0, sizeof(model_vertex_data));
 
@@ -1464,6 +1719,20 @@ vkpt_vertex_buffer_destroy()
 
 	destroy_primbuf();
 
+	destroy_light_storage(&light_buffer_storage);
+	destroy_light_storage(&light_polys_storage);
+	destroy_light_storage(&light_list_offsets_storage);
+	destroy_light_storage(&light_list_lights_storage);
+
+	Z_Free(dynamic_bsp_lights);
+	Z_Free(light_list_offsets_scratch);
+	Z_Free(light_list_lights_scratch);
+	dynamic_bsp_lights = NULL;
+	num_dynamic_bsp_lights = 0;
+	light_list_offsets_scratch = NULL;
+	light_list_lights_scratch = NULL;
+	light_list_lights_scratch_size = 0;
+
 	for (int model = 0; model < MAX_MODELS; model++)
 	{
 		destroy_model_vbo(&model_vertex_data[model]);
@@ -1472,12 +1741,10 @@ vkpt_vertex_buffer_destroy()
 	buffer_destroy(&null_buffer);
 
 	buffer_destroy(&qvk.buf_world);
-	buffer_destroy(&qvk.buf_light);
 	buffer_destroy(&qvk.buf_iqm_matrices);
 	buffer_destroy(&qvk.buf_readback);
 	for (int frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++)
 	{
-		buffer_destroy(qvk.buf_light_staging + frame);
 		buffer_destroy(qvk.buf_iqm_matrices_staging + frame);
 		buffer_destroy(qvk.buf_readback_staging + frame);
 	}
@@ -1497,6 +1764,30 @@ VkResult vkpt_light_buffers_create(bsp_mesh_t *bsp_mesh)
 {
 	vkpt_light_buffers_destroy();
 
+	// Size the light polygon and light list buffers for the static lights of the map,
+	// with some room for model lights. They grow later if necessary.
+	destroy_light_storage(&light_polys_storage);
+	destroy_light_storage(&light_list_offsets_storage);
+	destroy_light_storage(&light_list_lights_storage);
+	create_light_storage(&light_polys_storage, (uint32_t)align(bsp_mesh->num_light_polys + LIGHT_STORAGE_GRANULARITY, LIGHT_STORAGE_GRANULARITY));
+	create_light_storage(&light_list_offsets_storage, max(bsp_mesh->num_clusters + 1, 2));
+	create_light_storage(&light_list_lights_storage, (uint32_t)align(bsp_mesh->num_cluster_lights + bsp_mesh->num_cluster_lights / 4, LIGHT_STORAGE_GRANULARITY));
+
+	light_list_offsets_scratch = Z_Realloc(light_list_offsets_scratch, (bsp_mesh->num_clusters + 1) * sizeof(uint32_t));
+
+	// Find the BSP lights that need to be refreshed every frame
+	Z_Free(dynamic_bsp_lights);
+	dynamic_bsp_lights = Z_Malloc(max(bsp_mesh->num_light_polys, 1) * sizeof(int));
+	num_dynamic_bsp_lights = 0;
+
+	for (int nlight = 0; nlight < bsp_mesh->num_light_polys; nlight++)
+	{
+		const light_poly_t* light = bsp_mesh->light_polys + nlight;
+		bool animated = light->material && light->material->num_frames > 1;
+		if (light->style != 0 || light->color[0] < 0.f || animated)
+			dynamic_bsp_lights[num_dynamic_bsp_lights++] = nlight;
+	}
+
 	// Light statistics: 2 uints (shadowed, unshadowed) per light per surface orientation (6) per cluster.
 	uint32_t num_stats = bsp_mesh->num_clusters * bsp_mesh->num_light_polys * 6 * 2;
 
@@ -260,8 +260,6 @@ typedef struct QVK_s {
 	BufferResource_t            buf_primitive_instanced;
 	BufferResource_t            buf_positions_instanced;
 
-	BufferResource_t            buf_light;
-	BufferResource_t            buf_light_staging[MAX_FRAMES_IN_FLIGHT];
 	BufferResource_t            buf_light_stats[NUM_LIGHT_STATS_BUFFERS];
 	BufferResource_t            buf_light_counts_history[LIGHT_COUNT_HISTORY];
 	
@@ -640,6 +638,7 @@ VkResult vkpt_vertex_buffer_upload_models(void);
 void vkpt_light_buffer_reset_counts(void);
 VkResult vkpt_light_buffer_upload_to_staging(bool render_world, bsp_mesh_t *bsp_mesh, bsp_t* bsp, int num_model_lights, light_poly_t* transformed_model_lights, const float* sky_radiance);
 VkResult vkpt_light_buffer_upload_staging(VkCommandBuffer cmd_buf);
+uint32_t vkpt_light_buffer_upload_bytes(void);
 VkResult vkpt_light_buffers_create(bsp_mesh_t *bsp_mesh);
 VkResult vkpt_light_buffers_destroy(void);
 bool vkpt_model_is_static(const model_t* model);
@@ -0,0 +1,711 @@
+/*
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+//
+// bench.c -- synthetic client load generator
+//
+
+#include "server.h"
+#include "common/intreadwrite.h"
+
+/*
+===============================================================================
+
+Synthetic clients connect to the local server over UDP and go through the
+normal connection sequence, one at a time, since challenges are kept per IP
+address. They implement the client side of the netchan and send usercmds
+written with MSG_WriteDeltaUsercmd, but never parse server messages.
+Signon progress and the last frame sent to each of them are looked up in
+their client_t instead, which is possible because they live in the server
+process.
+
+Once all clients are in game, the profiler is held enabled and its zone times
+are recorded for each server frame of the requested duration and summarized.
+
+===============================================================================
+*/
+
+#define MAX_BENCH_CLIENTS   255     // qport is sent as a single byte
+#define BENCH_RESEND        1000    // msec between signon retries
+#define BENCH_KEEPALIVE     100     // msec between packets while not in game
+#define BENCH_CONNECT_TIME  30000   // msec to wait for all clients to spawn
+
+typedef enum {
+    BOT_CHALLENGE,
+    BOT_CONNECT,
+    BOT_CONNECTED,
+    BOT_FAILED
+} botstate_t;
+
+typedef enum {
+    BENCH_MODE_IDLE,
+    BENCH_MODE_RANDOM,
+    BENCH_MODE_CIRCLE
+} benchmode_t;
+
+typedef struct {
+    botstate_t  state;
+    qsocket_t   sock;
+    netadr_t    local;
+    int         qport;
+    int         challenge;
+    unsigned    resend_time;    // next OOB or signon retry
+    unsigned    last_sent;
+    int         last_move;      // server frame of last move command
+    client_t    *client;
+
+    // netchan state
+    int         outgoing_sequence;
+    int         incoming_sequence;
+    int         incoming_reliable_sequence;
+    bool        ack_pending;
+
+    usercmd_t   cmd;
+
+    uint64_t    bytes_rcvd;
+    uint64_t    bytes_sent;
+} benchbot_t;
+
+// profiler zones reported, total is frame plus packets
+static const profzone_t bench_zones[] = {
+    PROF_PACKETS, PROF_GAME, PROF_BUILD, PROF_SEND, PROF_FRAME
+};
+
+#define BENCH_NUM_ZONES     q_countof(bench_zones)
+
+typedef struct {
+    uint32_t    usec[BENCH_NUM_ZONES];
+} benchframe_t;
+
+static struct {
+    benchbot_t      *bots;
+    int             numbots;
+    int             connecting;     // bot currently doing OOB handshake
+    benchmode_t     mode;
+    netadr_t        server;
+    unsigned        duration;
+    unsigned        connect_time;
+    unsigned        start_time;     // when measurement started
+    bool            measuring;
+    char            saved_iplimit[16];
+
+    benchframe_t    *frames;
+    int             numframes;
+    int             maxframes;
+} bench;
+
+/*
+===============================================================================
+
+CLIENT SIDE
+
+===============================================================================
+*/
+
+static void bot_send_raw(benchbot_t *bot, const void *data, size_t len)
+{
+    int ret = NET_SendUdp(bot->sock, data, len, &bench.server);
+
+    if (ret > 0) {
+        bot->bytes_sent += ret;
+    }
+    bot->last_sent = svs.realtime;
+}
+
+static void bot_send_oob(benchbot_t *bot, const char *fmt, ...)
+{
+    char        buffer[MAX_PACKETLEN_DEFAULT];
+    va_list     argptr;
+    size_t      len;
+
+    WL32(buffer, -1);
+
+    va_start(argptr, fmt);
+    len = Q_vsnprintf(buffer + 4, sizeof(buffer) - 4, fmt, argptr);
+    va_end(argptr);
+
+    if (len < sizeof(buffer) - 4) {
+        bot_send_raw(bot, buffer, len + 4);
+    }
+}
+
+// sends contents of msg_write as unreliable netchan payload
+static void bot_transmit(benchbot_t *bot)
+{
+    byte        buffer[MAX_PACKETLEN];
+    uint32_t    w1, w2;
+
+    if (msg_write.overflowed || msg_write.cursize > sizeof(buffer) - 9) {
+        SZ_Clear(&msg_write);
+        return;
+    }
+
+    w1 = bot->outgoing_sequence & 0x3FFFFFFF;
+    w2 = (bot->incoming_sequence & 0x3FFFFFFF) |
+         ((unsigned)bot->incoming_reliable_sequence << 31);
+
+    WL32(buffer, w1);
+    WL32(buffer + 4, w2);
+    buffer[8] = bot->qport;
+    memcpy(buffer + 9, msg_write.data, msg_write.cursize);
+
+    bot_send_raw(bot, buffer, msg_write.cursize + 9);
+
+    bot->outgoing_sequence++;
+    bot->ack_pending = false;
+
+    SZ_Clear(&msg_write);
+}
+
+static void bot_stringcmd(const char *s)
+{
+    MSG_WriteByte(clc_stringcmd);
+    MSG_WriteString(s);
+}
+
+static void bot_process_oob(benchbot_t *bot, const char *s)
+{
+    if (!strncmp(s, "challenge ", 10)) {
+        if (bot->state == BOT_CHALLENGE) {
+            bot->challenge = atoi(s + 10);
+            bot->state = BOT_CONNECT;
+            bot->resend_time = svs.realtime;
+        }
+        return;
+    }
+
+    if (!strncmp(s, "client_connect", 14)) {
+        if (bot->state == BOT_CONNECT) {
+            bot->state = BOT_CONNECTED;
+            bot->resend_time = svs.realtime;
+        }
+        return;
+    }
+
+    if (!strncmp(s, "print\n", 6)) {
+        if (bot->state < BOT_CONNECTED) {
+            Com_WPrintf("Bench client %d rejected: %s", bot->qport, s + 6);
+            bot->state = BOT_FAILED;
+        }
+        return;
+    }
+}
+
+static void bot_process_netchan(benchbot_t *bot, const byte *data, size_t len)
+{
+    uint32_t    sequence;
+    uint16_t    fragment;
+
+    sequence = RL32(data);
+
+    // only complete messages are sequenced
+    if (sequence & (1U << 30)) {
+        if (len < 10)
+            return;
+        fragment = RL16(data + 8);
+        if (fragment & 0x8000)
+            return;
+    }
+
+    if ((sequence & 0x3FFFFFFF) <= bot->incoming_sequence)
+        return;
+
+    bot->incoming_sequence = sequence & 0x3FFFFFFF;
+    if (sequence >> 31)
+        bot->incoming_reliable_sequence ^= 1;
+
+    bot->ack_pending = true;
+}
+
+static void bot_read_packets(benchbot_t *bot)
+{
+    byte        buffer[MAX_PACKETLEN + 1];
+    netadr_t    from;
+    int         ret;
+
+    while (1) {
+        ret = NET_RecvUdp(bot->sock, buffer, MAX_PACKETLEN, &from);
+        if (ret < 0)
+            break;
+
+        bot->bytes_rcvd += ret;
+
+        if (ret < 8)
+            continue;
+
+        if (RL32(buffer) == 0xffffffff) {
+            buffer[ret] = 0;
+            bot_process_oob(bot, (char *)buffer + 4);
+        } else {
+            bot_process_netchan(bot, buffer, ret);
+        }
+    }
+}
+
+static client_t *bot_find_client(benchbot_t *bot)
+{
+    client_t *cl;
+
+    if (bot->client && bot->client->state > cs_zombie &&
+        bot->client->netchan->qport == bot->qport &&
+        NET_IsEqualAdr(&bot->client->netchan->remote_address, &bot->local))
+        return bot->client;
+
+    FOR_EACH_CLIENT(cl) {
+        if (cl->state > cs_zombie && cl->netchan->qport == bot->qport &&
+            NET_IsEqualAdr(&cl->netchan->remote_address, &bot->local))
+            return cl;
+    }
+
+    return NULL;
+}
+
+static void bot_build_cmd(benchbot_t *bot)
+{
+    usercmd_t *cmd = &bot->cmd;
+
+    cmd->msec = BASE_FRAMETIME;
+    cmd->buttons = 0;
+    cmd->upmove = 0;
+
+    switch (bench.mode) {
+    case BENCH_MODE_IDLE:
+        break;
+    case BENCH_MODE_RANDOM:
+        // change direction about once a second
+        if (Q_rand() % BASE_FRAMERATE == 0) {
+            cmd->forwardmove = (int)(Q_rand() % 3 - 1) * 400;
+            cmd->sidemove = (int)(Q_rand() % 3 - 1) * 400;
+            cmd->angles[YAW] = Q_rand() % 360;
+        }
+        cmd->angles[PITCH] = (int)(Q_rand() % 31) - 15;
+        if (Q_rand() % 10 == 0)
+            cmd->buttons |= BUTTON_ATTACK;
+        if (Q_rand() % 20 == 0)
+            cmd->upmove = 200;
+        break;
+    case BENCH_MODE_CIRCLE:
+        cmd->forwardmove = 400;
+        cmd->sidemove = 0;
+        cmd->angles[YAW] = anglemod(cmd->angles[YAW] + 10);
+        break;
+    }
+
+    cmd->buttons |= cmd->forwardmove || cmd->sidemove ? BUTTON_ANY : 0;
+}
+
+static void bot_send_move(benchbot_t *bot, client_t *cl)
+{
+    int lastframe = cl->framenum - 1;
+
+    bot_build_cmd(bot);
+
+    // acknowledge the last frame sent, like a client would on receipt
+    if (lastframe > 0) {
+        MSG_WriteByte(clc_move_batched);
+        MSG_WriteLong(lastframe);
+    } else {
+        MSG_WriteByte(clc_move_nodelta);
+    }
+    MSG_WriteByte(0);   // lightlevel
+    MSG_WriteBits(1, 5);
+    MSG_WriteDeltaUsercmd(NULL, &bot->cmd);
+
+    bot_transmit(bot);
+    bot->last_move = sv.framenum;
+}
+
+static void bot_run(benchbot_t *bot, int index)
+{
+    client_t *cl;
+
+    switch (bot->state) {
+    case BOT_CHALLENGE:
+        if (index != bench.connecting || svs.realtime < bot->resend_time)
+            break;
+        bot_send_oob(bot, "getchallenge\n");
+        bot->resend_time = svs.realtime + BENCH_RESEND;
+        break;
+
+    case BOT_CONNECT:
+        if (svs.realtime < bot->resend_time)
+            break;
+        bot_send_oob(bot, "connect %d %d %d \"\\name\\bench%d\\skin\\male/grunt"
+                     "\\rate\\100000\\msg\\1\" %d\n", PROTOCOL_VERSION_NAC,
+                     bot->qport, bot->challenge, bot->qport,
+                     MAX_PACKETLEN_WRITABLE_DEFAULT);
+        bot->resend_time = svs.realtime + BENCH_RESEND;
+        break;
+
+    case BOT_CONNECTED:
+        cl = bot->client = bot_find_client(bot);
+        if (!cl) {
+            Com_WPrintf("Bench client %d was dropped.\n", bot->qport);
+            bot->state = BOT_FAILED;
+            break;
+        }
+
+        if (cl->state == cs_spawned) {
+            if (bot->last_move != sv.framenum)
+                bot_send_move(bot, cl);
+            break;
+        }
+
+        // go through signon again after map changes, like a client would
+        // when told to reconnect
+        if (svs.realtime >= bot->resend_time) {
+            if (cl->state == cs_primed) {
+                bot_stringcmd(va("begin %i\n", sv.spawncount));
+            } else {
+                bot_stringcmd("new");
+                bot_stringcmd("\177c version " APPLICATION " bench");
+            }
+            bot_transmit(bot);
+            bot->resend_time = svs.realtime + BENCH_RESEND;
+            break;
+        }
+
+        if (bot->ack_pending || svs.realtime - bot->last_sent >= BENCH_KEEPALIVE)
+            bot_transmit(bot);
+        break;
+
+    default:
+        break;
+    }
+}
+
+/*
+===============================================================================
+
+RESULTS
+
+===============================================================================
+*/
+
+static int cmp_usec(const void *p1, const void *p2)
+{
+    uint32_t a = *(const uint32_t *)p1;
+    uint32_t b = *(const uint32_t *)p2;
+
+    return a < b ? -1 : a > b;
+}
+
+static void bench_report(void)
+{
+    uint32_t    *samples;
+    uint64_t    sum, rcvd, sent;
+    float       sec;
+    int         i, j, n, spawned;
+
+    n = bench.numframes;
+    sec = (svs.realtime - bench.start_time) * 0.001f;
+    if (!n || sec <= 0) {
+        Com_Printf("No server frames were measured.\n");
+        return;
+    }
+
+    spawned = rcvd = sent = 0;
+    for (i = 0; i < bench.numbots; i++) {
+        if (bench.bots[i].state == BOT_CONNECTED) {
+            rcvd += bench.bots[i].bytes_rcvd;
+            sent += bench.bots[i].bytes_sent;
+            spawned++;
+        }
+    }
+
+    Com_Printf("%d of %d clients in game, %d frames in %.1f sec\n",
+               spawned, bench.numbots, n, sec);
+    Com_Printf("zone        mean      p50      p90      p99      max (usec)\n"
+               "-------- -------- -------- -------- -------- --------\n");
+
+    samples = SV_Malloc(n * sizeof(samples[0]));
+    for (i = 0; i < BENCH_NUM_ZONES; i++) {
+        sum = 0;
+        for (j = 0; j < n; j++) {
+            samples[j] = bench.frames[j].usec[i];
+            sum += samples[j];
+        }
+        qsort(samples, n, sizeof(samples[0]), cmp_usec);
+        Com_Printf("%-8s %8"PRIu64" %8u %8u %8u %8u\n",
+                   bench_zones[i] == PROF_FRAME ? "total" : PROF_ZoneName(bench_zones[i]), sum / n,
+                   samples[n / 2], samples[n * 9 / 10], samples[n * 99 / 100],
+                   samples[n - 1]);
+    }
+    Z_Free(samples);
+
+    Com_Printf("Build time is included in send time.\n");
+    if (spawned) {
+        Com_Printf("Per client: %.0f bytes/sec received, %.0f bytes/sec sent\n",
+                   rcvd / spawned / sec, sent / spawned / sec);
+    }
+}
+
+/*
+===============================================================================
+
+CONTROL
+
+===============================================================================
+*/
+
+static void bench_stop(bool disconnect)
+{
+    benchbot_t *bot;
+    int i;
+
+    for (i = 0; i < bench.numbots; i++) {
+        bot = &bench.bots[i];
+        if (disconnect && bot->state == BOT_CONNECTED) {
+            bot_stringcmd("disconnect");
+            bot_transmit(bot);
+        }
+        NET_CloseUdpSocket(bot->sock);
+    }
+
+    if (bench.saved_iplimit[0])
+        Cvar_Set("sv_iplimit", bench.saved_iplimit);
+
+    if (bench.measuring)
+        PROF_Hold(false);
+
+    Z_Free(bench.bots);
+    Z_Free(bench.frames);
+    memset(&bench, 0, sizeof(bench));
+}
+
+static void bench_start_measuring(void)
+{
+    benchbot_t *bot;
+    int i;
+
+    for (i = 0; i < bench.numbots; i++) {
+        bot = &bench.bots[i];
+        bot->bytes_rcvd = 0;
+        bot->bytes_sent = 0;
+    }
+
+    Com_Printf("Measuring for %u seconds...\n", bench.duration / 1000);
+    bench.start_time = svs.realtime;
+    bench.measuring = true;
+    PROF_Hold(true);
+}
+
+/*
+==================
+SV_BenchRun
+
+Runs synthetic clients. Called each server tick before packets are read.
+==================
+*/
+void SV_BenchRun(void)
+{
+    benchbot_t *bot;
+    int i, spawned, waiting;
+
+    if (!bench.numbots)
+        return;
+
+    for (i = 0; i < bench.numbots; i++)
+        bot_read_packets(&bench.bots[i]);
+
+    // let the next client start handshake
+    while (bench.connecting < bench.numbots &&
+           bench.bots[bench.connecting].state >= BOT_CONNECTED)
+        bench.connecting++;
+
+    spawned = waiting = 0;
+    for (i = 0; i < bench.numbots; i++) {
+        bot = &bench.bots[i];
+        bot_run(bot, i);
+        if (bot->state == BOT_FAILED)
+            continue;
+        if (bot->state == BOT_CONNECTED && bot->client->state == cs_spawned)
+            spawned++;
+        else
+            waiting++;
+    }
+
+    if (!spawned && !waiting) {
+        Com_EPrintf("No clients got in game.\n");
+        bench_stop(false);
+        return;
+    }
+
+    if (!bench.measuring) {
+        if (!waiting) {
+            bench_start_measuring();
+        } else if (svs.realtime - bench.connect_time > BENCH_CONNECT_TIME) {
+            Com_WPrintf("Only %d of %d clients got in game.\n", spawned, bench.numbots);
+            bench_start_measuring();
+        }
+        return;
+    }
+
+    if (svs.realtime - bench.start_time >= bench.duration) {
+        bench_report();
+        bench_stop(true);
+    }
+}
+
+/*
+==================
+SV_BenchEndFrame
+
+Called after each server frame, once profiler has ended it.
+==================
+*/
+void SV_BenchEndFrame(void)
+{
+    benchframe_t *frame;
+    int i;
+
+    if (!bench.measuring)
+        return;
+
+    if (bench.numframes == bench.maxframes) {
+        bench.maxframes = max(bench.maxframes * 2, 1024);
+        bench.frames = Z_Realloc(bench.frames, bench.maxframes * sizeof(bench.frames[0]));
+    }
+
+    frame = &bench.frames[bench.numframes++];
+    for (i = 0; i < BENCH_NUM_ZONES; i++)
+        frame->usec[i] = PROF_FrameTime(bench_zones[i]);
+    frame->usec[BENCH_NUM_ZONES - 1] += PROF_FrameTime(PROF_PACKETS);
+}
+
+/*
+==================
+SV_BenchShutdown
+
+Drops synthetic clients without waiting for results.
+==================
+*/
+void SV_BenchShutdown(void)
+{
+    if (bench.numbots) {
+        Com_Printf("Load test aborted.\n");
+        bench_stop(false);
+    }
+}
+
+static void SV_LoadTest_f(void)
+{
+    static const char *const modes[] = { "idle", "random", "circle" };
+    benchbot_t *bot;
+    netadr_t adr;
+    int i, count, seconds, mode, avail;
+
+    if (Cmd_Argc() < 2) {
+        Com_Printf("Usage: %s <clients> [seconds] [idle|random|circle]\n"
+                   "       %s stop\n", Cmd_Argv(0), Cmd_Argv(0));
+        return;
+    }
+
+    if (!strcmp(Cmd_Argv(1), "stop")) {
+        if (bench.measuring)
+            bench_report();
+        SV_BenchShutdown();
+        return;
+    }
+
+    if (bench.numbots) {
+        Com_Printf("Load test is already running.\n");
+        return;
+    }
+
+    if (sv.state != ss_game) {
+        Com_Printf("No game running.\n");
+        return;
+    }
+
+    avail = sv_maxclients->integer - SV_CountClients();
+    count = atoi(Cmd_Argv(1));
+    if (count < 1 || count > min(avail, MAX_BENCH_CLIENTS)) {
+        Com_Printf("Number of clients must be between 1 and %d.\n",
+                   min(avail, MAX_BENCH_CLIENTS));
+        return;
+    }
+
+    seconds = 10;
+    if (Cmd_Argc() > 2) {
+        seconds = atoi(Cmd_Argv(2));
+        if (seconds < 1) {
+            Com_Printf("Bad duration.\n");
+            return;
+        }
+    }
+
+    mode = BENCH_MODE_RANDOM;
+    if (Cmd_Argc() > 3) {
+        for (mode = 0; mode < q_countof(modes); mode++)
+            if (!strcmp(Cmd_Argv(3), modes[mode]))
+                break;
+        if (mode == q_countof(modes)) {
+            Com_Printf("Unknown mode \"%s\".\n", Cmd_Argv(3));
+            return;
+        }
+    }
+
+    if (!NET_GetAddress(NS_SERVER, &bench.server) || bench.server.type != NA_IP) {
+        Com_Printf("Server IPv4 socket is not open.\n");
+        return;
+    }
+
+    // server may be bound to all interfaces
+    if (!bench.server.ip.u32[0])
+        NET_StringToAdr("127.0.0.1", &bench.server, 0);
+
+    bench.bots = SV_Mallocz(count * sizeof(bench.bots[0]));
+    for (i = 0; i < count; i++) {
+        bot = &bench.bots[i];
+        bot->sock = NET_OpenUdpSocket(NET_BaseAdrToString(&bench.server), &adr);
+        if (bot->sock == -1) {
+            Com_EPrintf("Couldn't open bench client socket: %s\n", NET_ErrorString());
+            break;
+        }
+        bot->local = adr;
+        bot->qport = i + 1;
+        bot->last_move = -1;
+        bench.numbots++;
+    }
+
+    if (bench.numbots < count) {
+        bench_stop(false);
+        return;
+    }
+
+    // all clients come from the same address
+    Q_strlcpy(bench.saved_iplimit, Cvar_VariableString("sv_iplimit"),
+              sizeof(bench.saved_iplimit));
+    Cvar_Set("sv_iplimit", "0");
+
+    bench.mode = mode;
+    bench.duration = seconds * 1000;
+    bench.connect_time = svs.realtime;
+
+    Com_Printf("Connecting %d clients to %s...\n", count, NET_AdrToString(&bench.server));
+}
+
+static const cmdreg_t c_bench[] = {
+    { "loadtest", SV_LoadTest_f },
+
+    { NULL }
+};
+
+void SV_BenchInit(void)
+{
+    Cmd_Register(c_bench);
+}
@@ -1638,6 +1638,13 @@ static const cmdreg_t c_server[] = {
     { "demomap", SV_DemoMap_f },
     { "gamemap", SV_GameMap_f, SV_Map_c },
     { "dumpents", SV_DumpEnts_f },
+    { "areastats", SV_AreaStats_f },
+    { "tracerecord", SV_TraceRecord_f },
+    { "tracebench", SV_TraceBench_f },
+    { "visstats", SV_VisStats_f },
+    { "deltabench", SV_DeltaBench_f },
+    { "deltastats", SV_DeltaStats_f },
+    { "testbatch", SV_TestBatch_f },
     { "setmaster", SV_SetMaster_f },
     { "listmasters", SV_ListMasters_f },
     { "killserver", SV_KillServer_f },
@@ -31,6 +31,179 @@ Encode a client frame onto the network channel
 #define Q2PRO_OPTIMIZE(c) \
     (!(c)->settings[CLS_RECORDING])
 
+/*
+=============================================================================
+
+Entity delta cache
+
+Clients that see the same entity and acknowledged the same earlier frame
+get identical updates for it. Encoded update depends only on the new state,
+update bits and flags, so updates written during a server frame are kept in
+a hash table keyed by these and copied for subsequent clients instead of
+being encoded again. Update bits still come from MSG_EntityWillWrite, which
+accounts for the old state.
+
+=============================================================================
+*/
+
+#define DELTA_HASH_SIZE     4096    // must be power of two
+#define DELTA_MAX_ENTRIES   (DELTA_HASH_SIZE / 2)
+#define DELTA_BUFFER_SIZE   0x40000
+
+typedef struct {
+    entity_state_t  to;
+    uint32_t        bits;
+    msgEsFlags_t    flags;
+    unsigned        offset;
+    unsigned        length;
+} delta_entry_t;
+
+static struct {
+    int             framenum;
+    int             spawncount;
+    uint16_t        hash[DELTA_HASH_SIZE];  // entry index + 1, 0 if empty
+    delta_entry_t   entries[DELTA_MAX_ENTRIES];
+    int             numentries;
+    byte            buffer[DELTA_BUFFER_SIZE];
+    unsigned        bufsize;
+} sv_delta;
+
+static struct {
+    unsigned    lookups;
+    unsigned    hits;
+    unsigned    mismatches;
+} delta_stats;
+
+static cvarbind_t   sv_delta_cache = CVAR_BIND("sv_delta_cache", "1", 0);
+
+static uint32_t hash_delta(const entity_state_t *to, uint32_t bits, msgEsFlags_t flags)
+{
+    const uint32_t *w = (const uint32_t *)to;
+    uint32_t hash = 2166136261U;
+    int i;
+
+    for (i = 0; i < sizeof(*to) / sizeof(*w); i++)
+        hash = (hash ^ w[i]) * 16777619U;
+
+    hash = (hash ^ bits) * 16777619U;
+    hash = (hash ^ flags) * 16777619U;
+    return hash;
+}
+
+// returns slot for the key, either empty or holding matching entry
+static uint16_t *find_delta(const entity_state_t *to, uint32_t bits, msgEsFlags_t flags)
+{
+    uint32_t hash = hash_delta(to, bits, flags);
+    const delta_entry_t *e;
+    uint16_t *slot;
+
+    if (sv_delta.framenum != sv.framenum || sv_delta.spawncount != sv.spawncount) {
+        memset(sv_delta.hash, 0, sizeof(sv_delta.hash));
+        sv_delta.numentries = 0;
+        sv_delta.bufsize = 0;
+        sv_delta.framenum = sv.framenum;
+        sv_delta.spawncount = sv.spawncount;
+    }
+
+    while (1) {
+        slot = &sv_delta.hash[hash & (DELTA_HASH_SIZE - 1)];
+        if (!*slot)
+            return slot;
+        e = &sv_delta.entries[*slot - 1];
+        if (e->bits == bits && e->flags == flags && !memcmp(&e->to, to, sizeof(*to)))
+            return slot;
+        hash++;
+    }
+}
+
+/*
+=============
+write_delta_entity
+
+Writes delta update of an entity, copying bytes from the cache when
+possible. With sv_delta_cache 2, update is always encoded and compared
+with the cached one.
+=============
+*/
+static void write_delta_entity(const entity_state_t *from,
+                               const entity_state_t *to,
+                               msgEsFlags_t         flags,
+                               int                  mode)
+{
+    const delta_entry_t *hit;
+    delta_entry_t *e;
+    uint16_t *slot;
+    unsigned start;
+    uint32_t bits;
+
+    if (to->number < 1 || to->number >= MAX_PACKET_ENTITIES)
+        Com_Errorf(ERR_DROP, "%s: bad number: %d", __func__, to->number);
+
+    bits = MSG_EntityWillWrite(from, to, flags);
+    if (!bits && !(flags & MSG_ES_FORCE))
+        return;     // nothing to send!
+
+    if (!mode) {
+        MSG_WriteDeltaEntityBits(to, bits, flags);
+        return;
+    }
+
+    delta_stats.lookups++;
+
+    slot = find_delta(to, bits, flags);
+    if (*slot) {
+        delta_stats.hits++;
+        hit = &sv_delta.entries[*slot - 1];
+        if (mode == 1) {
+            MSG_WriteData(sv_delta.buffer + hit->offset, hit->length);
+            return;
+        }
+
+        start = msg_write.cursize;
+        MSG_WriteDeltaEntityBits(to, bits, flags);
+        if (msg_write.cursize - start != hit->length ||
+            memcmp(msg_write.data + start, sv_delta.buffer + hit->offset, hit->length)) {
+            Com_WPrintf("Cached delta for entity %d doesn't match\n", to->number);
+            delta_stats.mismatches++;
+        }
+        return;
+    }
+
+    start = msg_write.cursize;
+    MSG_WriteDeltaEntityBits(to, bits, flags);
+
+    if (sv_delta.numentries == DELTA_MAX_ENTRIES)
+        return;
+    if (sv_delta.bufsize + msg_write.cursize - start > DELTA_BUFFER_SIZE)
+        return;
+
+    e = &sv_delta.entries[sv_delta.numentries++];
+    e->to = *to;
+    e->bits = bits;
+    e->flags = flags;
+    e->offset = sv_delta.bufsize;
+    e->length = msg_write.cursize - start;
+    memcpy(sv_delta.buffer + e->offset, msg_write.data + start, e->length);
+    sv_delta.bufsize += e->length;
+    *slot = sv_delta.numentries;
+}
+
+/*
+=============
+SV_DeltaStats_f
+=============
+*/
+void SV_DeltaStats_f(void)
+{
+    Com_Printf("%u entity updates looked up, %u found in cache (%.1f%%), %u mismatches\n",
+               delta_stats.lookups, delta_stats.hits,
+               delta_stats.lookups ? delta_stats.hits * 100.0f / delta_stats.lookups : 0.0f,
+               delta_stats.mismatches);
+
+    if (Cmd_Argc() > 1 && !strcmp(Cmd_Argv(1), "reset"))
+        memset(&delta_stats, 0, sizeof(delta_stats));
+}
+
 /*
 =============
 SV_EmitPacketEntities
@@ -47,6 +220,7 @@ static void SV_EmitPacketEntities(client_t         *client,
     const entity_state_t *oldent;
     int i, oldnum, newnum, oldindex, newindex, from_num_entities;
     msgEsFlags_t flags;
+    int mode = Cvar_BoundInteger(&sv_delta_cache);
 
     if (!from)
         from_num_entities = 0;
@@ -88,7 +262,7 @@ static void SV_EmitPacketEntities(client_t         *client,
                 VectorCopy(oldent->origin, newent->origin);
                 VectorCopy(oldent->angles, newent->angles);
             }
-            MSG_WriteDeltaPacketEntity(oldent, newent, flags);
+            write_delta_entity(oldent, newent, flags, mode);
             oldindex++;
             newindex++;
             continue;
@@ -107,7 +281,7 @@ static void SV_EmitPacketEntities(client_t         *client,
                 VectorCopy(oldent->origin, newent->origin);
                 VectorCopy(oldent->angles, newent->angles);
             }
-            MSG_WriteDeltaPacketEntity(oldent, newent, flags);
+            write_delta_entity(oldent, newent, flags, mode);
             newindex++;
             continue;
         }
@@ -291,34 +465,227 @@ Build a client frame structure
 =============================================================================
 */
 
+// entity list entries are entity numbers, with this bit set if the
+// entity is sent despite not being visible (sv_novis)
+#define FRAME_ENT_HIDDEN    0x8000
+
+#define VIS_MAX_CLUSTERS    64
+#define VIS_WORDS           (MAX_PACKET_ENTITIES / 64)
+
+/*
+=============================================================================
+
+Entity visibility cache
+
+Visibility of an entity only depends on the client area, cluster and the
+set of clusters making up the fat PVS. Each server frame, a bitset of
+visible entities is computed once for every distinct key and shared by all
+clients with that key. Per-client checks (own entity, sound distance) are
+applied when walking the bitset.
+
+=============================================================================
+*/
+
+typedef struct {
+    int         area;
+    int         cluster;
+    int         numclusters;
+    int         clusters[VIS_MAX_CLUSTERS];
+    uint64_t    visible[VIS_WORDS];
+} vis_entry_t;
+
+typedef struct {
+    vec3_t      org;
+    int         area;
+    int         cluster;
+    vis_entry_t *vis;
+} frame_vis_t;
+
+static vis_entry_t  sv_vis_entries[MAX_CLIENTS];
+static int          sv_num_vis_entries;
+
+// packet entities that pass visibility-independent checks
+static uint16_t     sv_sendable[MAX_PACKET_ENTITIES];
+static int          sv_num_sendable;
+static int          sv_cull_nonvisible;
+
+static cvarbind_t   sv_cull_nonvisible_entities =
+    CVAR_BIND("sv_cull_nonvisible_entities", "1", CVAR_CHEAT);
+
+static struct {
+    unsigned    clients;
+    unsigned    entries;
+} vis_stats;
+
+static bool entity_sendable(edict_t *ent)
+{
+    // ignore entities not in use
+    if (!ent->inuse && (g_features->integer & GMF_PROPERINUSE)) {
+        return false;
+    }
+
+    // ignore ents without visible models
+    if (ent->svflags & SVF_NOCLIENT)
+        return false;
+
+    // ignore ents without visible models unless they have an effect
+    if (!ent->s.modelindex && !ent->s.effects && !ent->s.sound && !ent->s.event) {
+        return false;
+    }
+
+    return true;
+}
+
 /*
 =============
-SV_BuildClientFrame
+find_sendable_entities
 
-Decides which entities are going to be visible to the client, and
-copies off the playerstat and areabits.
+Called once per server frame before building client frames.
 =============
 */
-void SV_BuildClientFrame(client_t *client)
+static void find_sendable_entities(void)
+{
+    edict_t *ent;
+    int     e;
+
+    sv_num_sendable = 0;
+    sv_num_vis_entries = 0;
+    sv_cull_nonvisible = Cvar_BoundInteger(&sv_cull_nonvisible_entities);
+
+    for (e = 1; e < ge->num_entities[ENT_PACKET]; e++) {
+        ent = EDICT_NUM(e);
+        if (!entity_sendable(ent))
+            continue;
+
+        // sanity check entity number once for all clients
+        if (ent->s.number != e) {
+            Com_WPrintf("%s: fixing ent->s.number: %d to %d\n",
+                        __func__, ent->s.number, e);
+            ent->s.number = e;
+        }
+
+        sv_sendable[sv_num_sendable++] = e;
+    }
+}
+
+static void compute_vis_entry(vis_entry_t *v)
 {
-    int         e, i;
-    vec3_t      org;
-    edict_t     *ent;
-    edict_t     *clent;
-    client_frame_t *frame;
-    entity_state_t *state;
-    player_state_t *ps;
-	entity_state_t es;
-    int         clientarea, clientcluster;
-    mleaf_t     *leaf;
     byte        clientphs[VIS_MAX_BYTES];
     byte        clientpvs[VIS_MAX_BYTES];
-    bool    ent_visible;
-    int cull_nonvisible_entities = Cvar_Get("sv_cull_nonvisible_entities", "1", CVAR_CHEAT)->integer;
+    edict_t     *ent;
+    server_entity_t *sent;
+    int         e, i, n;
+
+    if (v->cluster >= 0) {
+        CM_ClusterListVis(&sv.cm, clientpvs, v->clusters, v->numclusters, DVIS_PVS2);
+    } else {
+        BSP_ClusterVis(sv.cm.cache, clientpvs, v->clusters[0], DVIS_PVS2);
+    }
+
+    BSP_ClusterVis(sv.cm.cache, clientphs, v->cluster, DVIS_PHS);
+
+    memset(v->visible, 0, sizeof(v->visible));
+
+    for (n = 0; n < sv_num_sendable; n++) {
+        e = sv_sendable[n];
+        ent = EDICT_NUM(e);
+        sent = &sv.entities[e];
+
+        // check area
+        if (v->cluster >= 0 && !CM_AreasConnected(&sv.cm, v->area, ent->areanum)) {
+            // doors can legally straddle two areas, so
+            // we may need to check another one
+            if (!CM_AreasConnected(&sv.cm, v->area, ent->areanum2)) {
+                continue;       // blocked by a door
+            }
+        }
+
+        if (ent->s.renderfx & RF_MASK_BEAMLIKE) {
+            // beams just check one point for PHS
+            if (!Q_IsBitSet(clientphs, sent->clusternums[0]))
+                continue;
+        } else if (sv_cull_nonvisible) {
+            if (sent->num_clusters == -1) {
+                // too many leafs for individual check, go by headnode
+                if (!CM_HeadnodeVisible(CM_NodeNum(&sv.cm, sent->headnode), clientpvs))
+                    continue;
+            } else {
+                // check individual leafs
+                for (i = 0; i < sent->num_clusters; i++)
+                    if (Q_IsBitSet(clientpvs, sent->clusternums[i]))
+                        break;
+                if (i == sent->num_clusters)
+                    continue;       // not visible
+            }
+        }
+
+        v->visible[e >> 6] |= 1ULL << (e & 63);
+    }
+}
+
+static int compare_clusters(const void *p1, const void *p2)
+{
+    return *(const int *)p1 - *(const int *)p2;
+}
+
+/*
+=============
+setup_vis_entry
+
+Fills in visibility key for the client view position
+=============
+*/
+static void setup_vis_entry(client_t *client, vis_entry_t *v, const frame_vis_t *vis)
+{
+    v->area = vis->area;
+    v->cluster = vis->cluster;
+
+    if (v->cluster < 0) {
+        v->numclusters = 1;
+        v->clusters[0] = client->last_valid_cluster;
+        return;
+    }
+
+    client->last_valid_cluster = v->cluster;
+
+    v->numclusters = CM_FatClusters(&sv.cm, v->clusters, VIS_MAX_CLUSTERS, vis->org);
+    qsort(v->clusters, v->numclusters, sizeof(v->clusters[0]), compare_clusters);
+}
+
+static vis_entry_t *find_vis_entry(const vis_entry_t *key)
+{
+    vis_entry_t *v;
+    int         i;
+
+    for (i = 0, v = sv_vis_entries; i < sv_num_vis_entries; i++, v++) {
+        if (v->area == key->area && v->cluster == key->cluster &&
+            v->numclusters == key->numclusters &&
+            !memcmp(v->clusters, key->clusters, key->numclusters * sizeof(key->clusters[0]))) {
+            return v;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+=============
+build_frame_header
+
+Sets up the frame being created and copies off the playerstate and
+areabits. Returns false if client is not in game.
+=============
+*/
+static bool build_frame_header(client_t *client, frame_vis_t *vis)
+{
+    edict_t         *clent;
+    client_frame_t  *frame;
+    player_state_t  *ps;
+    mleaf_t         *leaf;
 
     clent = client->edict;
     if (!clent->client)
-        return;        // not in game yet
+        return false;      // not in game yet
 
     // this is the frame we are creating
     frame = &client->frames[client->framenum & UPDATE_MASK];
@@ -330,14 +697,14 @@ void SV_BuildClientFrame(client_t *client)
 
     // find the client's PVS
     ps = &clent->client->ps;
-    VectorAdd(ps->viewoffset, ps->pmove.origin, org);
+    VectorAdd(ps->viewoffset, ps->pmove.origin, vis->org);
 
-    leaf = CM_PointLeaf(&sv.cm, org);
-    clientarea = leaf->area;
-    clientcluster = leaf->cluster;
+    leaf = CM_PointLeaf(&sv.cm, vis->org);
+    vis->area = leaf->area;
+    vis->cluster = leaf->cluster;
 
     // calculate the visible areas
-    frame->areabytes = CM_WriteAreaBits(&sv.cm, frame->areabits, clientarea);
+    frame->areabytes = CM_WriteAreaBits(&sv.cm, frame->areabits, vis->area);
 
     // grab the current player_state_t
     frame->ps = *ps;
@@ -349,111 +716,122 @@ void SV_BuildClientFrame(client_t *client)
         frame->clientNum = client->number;
     }
 
-	if (clientcluster >= 0)
-	{
-		CM_FatPVS(&sv.cm, clientpvs, org, DVIS_PVS2);
-		client->last_valid_cluster = clientcluster;
-	}
-	else
-	{
-		BSP_ClusterVis(sv.cm.cache, clientpvs, client->last_valid_cluster, DVIS_PVS2);
-	}
+    return true;
+}
 
-    BSP_ClusterVis(sv.cm.cache, clientphs, clientcluster, DVIS_PHS);
+static bool entity_audible(edict_t *ent, const vec3_t org)
+{
+    vec3_t  delta;
 
-    // build up the list of visible entities
-    frame->num_entities = 0;
-    frame->first_entity = svs.next_entity;
+    if (ent->s.modelindex || (ent->s.renderfx & RF_MASK_BEAMLIKE))
+        return true;
 
-    for (e = 1; e < ge->num_entities[ENT_PACKET]; e++) {
-        ent = EDICT_NUM(e);
+    // don't send sounds if they will be attenuated away
+    VectorSubtract(org, ent->s.origin, delta);
+    return VectorLength(delta) <= 400;
+}
 
-        // ignore entities not in use
-        if (!ent->inuse && (g_features->integer & GMF_PROPERINUSE)) {
-            continue;
-        }
+/*
+=============
+collect_entities
 
-        // ignore ents without visible models
-        if (ent->svflags & SVF_NOCLIENT)
-            continue;
+Fills in the list of entities to be sent to the client by walking the
+shared visibility bitset. Only reads shared server state, so it may run
+for several clients at once.
+=============
+*/
+static int collect_entities(client_t *client, const frame_vis_t *vis, uint16_t *list)
+{
+    uint64_t    visible[VIS_WORDS];
+    uint64_t    w;
+    edict_t     *ent;
+    edict_t     *clent;
+    int         e, i, n, count;
+    bool        ent_visible;
 
-        // ignore ents without visible models unless they have an effect
-        if (!ent->s.modelindex && !ent->s.effects && !ent->s.sound && !ent->s.event) {
-            continue;
+    clent = client->edict;
+    count = 0;
+
+    if (sv_novis->integer) {
+        // invisible entities with models are sent too
+        for (n = 0; n < sv_num_sendable; n++) {
+            e = sv_sendable[n];
+            ent = EDICT_NUM(e);
+
+            ent_visible = ent == clent || (Q_IsBitSet((const byte *)vis->vis->visible, e) &&
+                                           entity_audible(ent, vis->org));
+            if (!ent_visible && !ent->s.modelindex)
+                continue;
+
+            list[count] = e;
+            if (!ent_visible)
+                list[count] |= FRAME_ENT_HIDDEN;
+
+            if (++count == MAX_PACKET_ENTITIES)
+                break;
         }
 
-        ent_visible = true;
-
-        // ignore if not touching a PV leaf
-        if (ent != clent) {
-            // check area
-			if (clientcluster >= 0 && !CM_AreasConnected(&sv.cm, clientarea, ent->areanum)) {
-                // doors can legally straddle two areas, so
-                // we may need to check another one
-                if (!CM_AreasConnected(&sv.cm, clientarea, ent->areanum2)) {
-                    ent_visible = false;        // blocked by a door
-                }
-            }
+        return count;
+    }
 
-            if (ent_visible)
-            {
-                server_entity_t *sent = &sv.entities[e];
-
-                // beams just check one point for PHS
-                if (ent->s.renderfx & RF_MASK_BEAMLIKE) {
-                    if (!Q_IsBitSet(clientphs, sent->clusternums[0]))
-                        ent_visible = false;
-                }
-                else {
-                    if (cull_nonvisible_entities) {
-                        if (sent->num_clusters == -1) {
-                            // too many leafs for individual check, go by headnode
-                            if (!CM_HeadnodeVisible(CM_NodeNum(&sv.cm, sent->headnode), clientpvs))
-                                ent_visible = false;
-                        } else {
-                            // check individual leafs
-                            for (i = 0; i < sent->num_clusters; i++)
-                                if (Q_IsBitSet(clientpvs, sent->clusternums[i]))
-                                    break;
-                            if (i == sent->num_clusters)
-                                ent_visible = false;       // not visible
-                        }
-                    }
-
-                    if (!ent->s.modelindex) {
-                        // don't send sounds if they will be attenuated away
-                        vec3_t    delta;
-                        float    len;
-
-                        VectorSubtract(org, ent->s.origin, delta);
-                        len = VectorLength(delta);
-                        if (len > 400)
-                            ent_visible = false;
-                    }
-                }
-            }
+    memcpy(visible, vis->vis->visible, sizeof(visible));
+
+    // client always sees its own entity
+    e = ((byte *)clent - (byte *)ge->entities) / ge->edict_size;
+    if (e < MAX_PACKET_ENTITIES && entity_sendable(clent))
+        visible[e >> 6] |= 1ULL << (e & 63);
+
+    for (i = 0; i < VIS_WORDS; i++) {
+        for (w = visible[i], e = i << 6; w; w >>= 1, e++) {
+            if (!(w & 1))
+                continue;
+
+            ent = EDICT_NUM(e);
+            if (ent != clent && !entity_audible(ent, vis->org))
+                continue;
+
+            list[count] = e;
+
+            if (++count == MAX_PACKET_ENTITIES)
+                return count;
         }
+    }
 
-        if(!ent_visible && (!sv_novis->integer || !ent->s.modelindex))
-            continue;
-        
-		if (ent->s.number != e) {
-			Com_WPrintf("%s: fixing ent->s.number: %d to %d\n",
-				__func__, ent->s.number, e);
-			ent->s.number = e;
-		}
+    return count;
+}
+
+/*
+=============
+emit_entities
+
+Copies entity states into the range of the circular client_entities
+array reserved for the frame.
+=============
+*/
+static void emit_entities(client_t *client, const uint16_t *list)
+{
+    client_frame_t  *frame;
+    entity_state_t  *state;
+    edict_t         *ent;
+    edict_t         *clent;
+    int             i, e;
 
-		memcpy(&es, &ent->s, sizeof(entity_state_t));
+    clent = client->edict;
+    frame = &client->frames[client->framenum & UPDATE_MASK];
 
-		if (!ent_visible) {
-			// if the entity is invisible, kill its sound
-			es.sound = 0;
-		}
+    for (i = 0; i < frame->num_entities; i++) {
+        e = list[i] & ~FRAME_ENT_HIDDEN;
+        ent = EDICT_NUM(e);
 
         // add it to the circular client_entities array
-        state = &svs.entities[svs.next_entity % svs.num_entities];
+        state = &svs.entities[(frame->first_entity + i) % svs.num_entities];
+
+        *state = ent->s;
 
-        *state = es;
+        if (list[i] & FRAME_ENT_HIDDEN) {
+            // if the entity is invisible, kill its sound
+            state->sound = 0;
+        }
 
         // hide POV entity from renderer, unless this is player's own entity
         if (e == frame->clientNum + 1 && ent != clent &&
@@ -465,12 +843,343 @@ void SV_BuildClientFrame(client_t *client)
             // don't mark players missiles as solid
             state->bbox = 0;
         }
+    }
+}
 
-        svs.next_entity++;
+/*
+=============
+SV_BuildClientFrame
 
-        if (++frame->num_entities == MAX_PACKET_ENTITIES) {
-            break;
+Decides which entities are going to be visible to the client, and
+copies off the playerstat and areabits. Doesn't use visibility cache,
+this is only called for frames SV_PrepareClientFrames didn't build.
+=============
+*/
+void SV_BuildClientFrame(client_t *client)
+{
+    client_frame_t  *frame;
+    frame_vis_t     vis;
+    vis_entry_t     entry;
+    uint16_t        list[MAX_PACKET_ENTITIES];
+
+    if (!build_frame_header(client, &vis))
+        return;
+
+    // entities may have changed since SV_PrepareClientFrames
+    find_sendable_entities();
+
+    setup_vis_entry(client, &entry, &vis);
+    compute_vis_entry(&entry);
+    vis.vis = &entry;
+
+    frame = &client->frames[client->framenum & UPDATE_MASK];
+
+    // build up the list of visible entities
+    frame->num_entities = collect_entities(client, &vis, list);
+    frame->first_entity = svs.next_entity;
+    svs.next_entity += frame->num_entities;
+
+    emit_entities(client, list);
+}
+
+/*
+=============================================================================
+
+Batched frame building
+
+Visibility for every client only depends on game state, which is frozen
+while messages are sent, so lists are collected concurrently. Ranges of
+the circular client_entities array are then reserved serially in client
+order, which keeps the result identical to building frames one by one.
+
+=============================================================================
+*/
+
+typedef struct {
+    client_t    **clients;
+    frame_vis_t *vis;
+    int         *counts;
+} frame_job_t;
+
+static uint16_t *frame_list(client_t *client)
+{
+    return svs.frame_entities + client->number * MAX_PACKET_ENTITIES;
+}
+
+static void vis_job(void *arg, int index)
+{
+    PROF_Begin(PROF_BUILD_JOB);
+    compute_vis_entry(&sv_vis_entries[index]);
+    PROF_End(PROF_BUILD_JOB);
+}
+
+static void collect_job(void *arg, int index)
+{
+    frame_job_t *job = arg;
+
+    PROF_Begin(PROF_BUILD_JOB);
+    if (job->counts[index] >= 0)
+        job->counts[index] = collect_entities(job->clients[index], &job->vis[index],
+                                              frame_list(job->clients[index]));
+    PROF_End(PROF_BUILD_JOB);
+}
+
+static void emit_job(void *arg, int index)
+{
+    frame_job_t *job = arg;
+
+    PROF_Begin(PROF_BUILD_JOB);
+    if (job->counts[index] >= 0)
+        emit_entities(job->clients[index], frame_list(job->clients[index]));
+    PROF_End(PROF_BUILD_JOB);
+}
+
+static void run_jobs(int count, parallelfunc_t func, void *arg)
+{
+    int i;
+
+    if (sv_parallel_frames->integer) {
+        Sys_ParallelFor(count, func, arg);
+        return;
+    }
+
+    for (i = 0; i < count; i++)
+        func(arg, i);
+}
+
+#if USE_DEBUG
+static void verify_frames(frame_job_t *job, int count)
+{
+    vis_entry_t     entry;
+    frame_vis_t     vis;
+    uint16_t        list[MAX_PACKET_ENTITIES];
+    client_frame_t  *frame;
+    client_t        *client;
+    int             i, n;
+
+    for (i = 0; i < count; i++) {
+        if (job->counts[i] < 0)
+            continue;
+
+        client = job->clients[i];
+        frame = &client->frames[client->framenum & UPDATE_MASK];
+
+        vis = job->vis[i];
+        setup_vis_entry(client, &entry, &vis);
+        compute_vis_entry(&entry);
+        vis.vis = &entry;
+
+        n = collect_entities(client, &vis, list);
+        if (n != frame->num_entities || memcmp(list, frame_list(client), n * sizeof(list[0]))) {
+            Com_EPrintf("%s: frame %d mismatch for %s\n", __func__,
+                        client->framenum, client->name);
+        }
+    }
+}
+#endif
+
+/*
+=============
+SV_PrepareClientFrames
+
+Called before any client frames are written. Builds frames for the given
+list of clients, sharing visibility between clients with the same view
+cluster and running on the worker threads if sv_parallel_frames is
+enabled. Sets frame_built flag for these clients.
+=============
+*/
+void SV_PrepareClientFrames(client_t **clients, int count)
+{
+    frame_vis_t     vis[MAX_CLIENTS];
+    int             counts[MAX_CLIENTS];
+    frame_job_t     job;
+    client_frame_t  *frame;
+    vis_entry_t     *v;
+    int             i;
+
+    find_sendable_entities();
+
+    if (!count)
+        return;
+
+    // find distinct visibility keys
+    for (i = 0; i < count; i++) {
+        if (!build_frame_header(clients[i], &vis[i])) {
+            counts[i] = -1;
+            continue;
+        }
+        counts[i] = 0;
+
+        v = &sv_vis_entries[sv_num_vis_entries];
+        setup_vis_entry(clients[i], v, &vis[i]);
+        vis[i].vis = find_vis_entry(v);
+        if (!vis[i].vis)
+            vis[i].vis = &sv_vis_entries[sv_num_vis_entries++];
+    }
+
+    vis_stats.clients += count;
+    vis_stats.entries += sv_num_vis_entries;
+
+    job.clients = clients;
+    job.vis = vis;
+    job.counts = counts;
+
+    run_jobs(sv_num_vis_entries, vis_job, &job);
+    run_jobs(count, collect_job, &job);
+
+#if USE_DEBUG
+    if (sv_parallel_frames->integer > 1)
+        verify_frames(&job, count);
+#endif
+
+    // reserve client_entities ranges in client order
+    for (i = 0; i < count; i++) {
+        if (counts[i] < 0)
+            continue;
+        frame = &clients[i]->frames[clients[i]->framenum & UPDATE_MASK];
+        frame->num_entities = counts[i];
+        frame->first_entity = svs.next_entity;
+        svs.next_entity += counts[i];
+    }
+
+    run_jobs(count, emit_job, &job);
+
+    for (i = 0; i < count; i++)
+        clients[i]->frame_built = true;
+}
+
+/*
+=============
+SV_VisStats_f
+=============
+*/
+void SV_VisStats_f(void)
+{
+    Com_Printf("%u client frames, %u visibility sets computed (%.1f%%)\n",
+               vis_stats.clients, vis_stats.entries,
+               vis_stats.clients ? vis_stats.entries * 100.0f / vis_stats.clients : 0.0f);
+
+    if (Cmd_Argc() > 1 && !strcmp(Cmd_Argv(1), "reset"))
+        memset(&vis_stats, 0, sizeof(vis_stats));
+}
+
+typedef struct {
+    const entity_state_t    *from;
+    const entity_state_t    *to;
+    msgEsFlags_t            flags;
+} deltapair_t;
+
+static int collect_delta_pairs(deltapair_t **pairs, int numpairs, client_t *client,
+                               const client_frame_t *from, const client_frame_t *to)
+{
+    const entity_state_t *oldent, *newent;
+    int oldindex, newindex;
+
+    oldindex = newindex = 0;
+    while (oldindex < from->num_entities && newindex < to->num_entities) {
+        oldent = &svs.entities[(from->first_entity + oldindex) % svs.num_entities];
+        newent = &svs.entities[(to->first_entity + newindex) % svs.num_entities];
+        if (oldent->number < newent->number) {
+            oldindex++;
+            continue;
+        }
+        if (oldent->number > newent->number) {
+            newindex++;
+            continue;
         }
+
+        if (!(numpairs & 1023))
+            *pairs = Z_Realloc(*pairs, (numpairs + 1024) * sizeof((*pairs)[0]));
+
+        (*pairs)[numpairs].from = oldent;
+        (*pairs)[numpairs].to = newent;
+        (*pairs)[numpairs].flags = client->esFlags;
+        if (newent->number <= sv.maxclients)
+            (*pairs)[numpairs].flags |= MSG_ES_NEWENTITY;
+        if (newent->number == to->clientNum + 1)
+            (*pairs)[numpairs].flags |= MSG_ES_FIRSTPERSON;
+        numpairs++;
+
+        oldindex++;
+        newindex++;
     }
+
+    return numpairs;
 }
 
+/*
+=============
+SV_DeltaBench_f
+
+Times MSG_EntityWillWrite against the scalar version on entity deltas
+between consecutive frames still stored for each client.
+=============
+*/
+void SV_DeltaBench_f(void)
+{
+    deltapair_t *pairs = NULL;
+    const client_frame_t *from, *to;
+    client_t *client;
+    uint64_t start, scalar, vector;
+    uint32_t sum1, sum2;
+    int i, j, n, numpairs, iterations, mismatches;
+
+    if (!svs.initialized) {
+        Com_Printf("No server running.\n");
+        return;
+    }
+
+    iterations = 100;
+    if (Cmd_Argc() > 1) {
+        iterations = atoi(Cmd_Argv(1));
+        clamp(iterations, 1, 100000);
+    }
+
+    numpairs = 0;
+    FOR_EACH_CLIENT(client) {
+        if (!CLIENT_ACTIVE(client))
+            continue;
+        for (n = client->framenum - UPDATE_BACKUP + 1; n < client->framenum; n++) {
+            from = &client->frames[(n - 1) & UPDATE_MASK];
+            to = &client->frames[n & UPDATE_MASK];
+            if (from->number != n - 1 || to->number != n)
+                continue;
+            if (svs.next_entity - from->first_entity > svs.num_entities)
+                continue;
+            numpairs = collect_delta_pairs(&pairs, numpairs, client, from, to);
+        }
+    }
+
+    if (!numpairs) {
+        Com_Printf("No entity deltas recorded.\n");
+        return;
+    }
+
+    mismatches = 0;
+    for (i = 0; i < numpairs; i++)
+        if (MSG_EntityWillWrite(pairs[i].from, pairs[i].to, pairs[i].flags) !=
+            MSG_EntityWillWriteScalar(pairs[i].from, pairs[i].to, pairs[i].flags))
+            mismatches++;
+
+    sum1 = 0;
+    start = Sys_Microseconds();
+    for (j = 0; j < iterations; j++)
+        for (i = 0; i < numpairs; i++)
+            sum1 += MSG_EntityWillWriteScalar(pairs[i].from, pairs[i].to, pairs[i].flags);
+    scalar = Sys_Microseconds() - start;
+
+    sum2 = 0;
+    start = Sys_Microseconds();
+    for (j = 0; j < iterations; j++)
+        for (i = 0; i < numpairs; i++)
+            sum2 += MSG_EntityWillWrite(pairs[i].from, pairs[i].to, pairs[i].flags);
+    vector = Sys_Microseconds() - start;
+
+    Com_Printf("%d entity deltas, %d iterations\n", numpairs, iterations);
+    Com_Printf("scalar: %.1f ns per delta\n", scalar * 1000.0 / ((uint64_t)numpairs * iterations));
+    Com_Printf("active: %.1f ns per delta\n", vector * 1000.0 / ((uint64_t)numpairs * iterations));
+    if (mismatches || sum1 != sum2)
+        Com_EPrintf("%d mismatched deltas\n", mismatches);
+
+    Z_Free(pairs);
+}
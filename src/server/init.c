@@ -383,6 +383,7 @@ void SV_InitGame()
 
     svs.num_entities = sv_maxclients->integer * UPDATE_BACKUP * MAX_PACKET_ENTITIES;
     svs.entities = SV_Mallocz(sizeof(entity_state_t) * svs.num_entities);
+    svs.frame_entities = SV_Malloc(sizeof(uint16_t) * sv_maxclients->integer * MAX_PACKET_ENTITIES);
 
     Cvar_ClampInteger(sv_reserved_slots, 0, sv_maxclients->integer - 1);
 
@@ -58,6 +58,7 @@ cvar_t  *sv_show_name_changes;
 
 cvar_t  *sv_qwmod;              // atu QW Physics modificator
 cvar_t  *sv_novis;
+cvar_t  *sv_parallel_frames;
 
 cvar_t  *sv_maxclients;
 cvar_t  *sv_reserved_slots;
@@ -1728,8 +1729,13 @@ unsigned SV_Frame(unsigned msec)
         Cbuf_Execute(&cmd_buffer);
     }
 
+    // run synthetic clients of a load test
+    SV_BenchRun();
+
     // read packets from UDP clients
+    PROF_Begin(PROF_PACKETS);
     NET_GetPackets(NS_SERVER, SV_PacketEvent);
+    PROF_End(PROF_PACKETS);
 
     if (svs.initialized) {
         // deliver fragments and reliable messages for connecting clients
@@ -1743,6 +1749,8 @@ unsigned SV_Frame(unsigned msec)
     }
 
     if (svs.initialized && !check_paused()) {
+        PROF_Begin(PROF_FRAME);
+
         // check timeouts
         SV_CheckTimeouts();
 
@@ -1753,13 +1761,19 @@ unsigned SV_Frame(unsigned msec)
         SV_GiveMsec();
 
         // let everything in the world think and move
+        PROF_Begin(PROF_GAME);
         SV_RunGameFrame();
+        PROF_End(PROF_GAME);
 
         // calculate ambient entity changes
+        PROF_Begin(PROF_AMBIENT);
         SV_CheckAmbientEntities();
+        PROF_End(PROF_AMBIENT);
 
         // send messages back to the UDP clients
+        PROF_Begin(PROF_SEND);
         SV_SendClientMessages();
+        PROF_End(PROF_SEND);
 
         // send a heartbeat to the master if needed
         SV_MasterHeartbeat();
@@ -1767,6 +1781,15 @@ unsigned SV_Frame(unsigned msec)
         // clear teleport flags, etc for next frame
         SV_PrepWorldFrame();
 
+        // push out batched packets now so they are accounted for
+        PROF_Begin(PROF_NETSEND);
+        NET_FlushPackets();
+        PROF_End(PROF_NETSEND);
+
+        PROF_End(PROF_FRAME);
+        PROF_EndFrame();
+        SV_BenchEndFrame();
+
         // advance for next frame
         sv.framenum++;
     }
@@ -1951,6 +1974,8 @@ void SV_Init(void)
 {
     SV_InitOperatorCommands();
 
+    SV_BenchInit();
+
     SV_RegisterSavegames();
 
     Cvar_Get("protocol", STRINGIFY(PROTOCOL_VERSION_NAC), CVAR_SERVERINFO | CVAR_ROM);
@@ -2001,6 +2026,7 @@ void SV_Init(void)
     sv_reserved_password = Cvar_Get("sv_reserved_password", "", CVAR_PRIVATE);
     sv_locked = Cvar_Get("sv_locked", "0", 0);
     sv_novis = Cvar_Get("sv_novis", "0", 0);
+    sv_parallel_frames = Cvar_Get("sv_parallel_frames", "1", 0);
     sv_downloadserver = Cvar_Get("sv_downloadserver", "", 0);
     sv_redirect_address = Cvar_Get("sv_redirect_address", "", 0);
 
@@ -2140,6 +2166,8 @@ void SV_Shutdown(const char *finalmsg, error_type_t type)
     if (!sv_registered)
         return;
 
+    SV_BenchShutdown();
+
     SV_FinalMessage(finalmsg, type);
     SV_MasterShutdown();
     SV_ShutdownGameProgs();
@@ -2152,6 +2180,7 @@ void SV_Shutdown(const char *finalmsg, error_type_t type)
     // free server static data
     Z_Free(svs.client_pool);
     Z_Free(svs.entities);
+    Z_Free(svs.frame_entities);
     deflateEnd(&svs.z);
     memset(&svs, 0, sizeof(svs));
 
@@ -54,20 +54,29 @@ Returns true if the client is over its current
 bandwidth estimation and should not be sent another packet
 =======================
 */
-static bool SV_RateDrop(client_t *client)
+static size_t SV_RateTotal(client_t *client)
 {
     size_t  total;
     int     i;
 
+    total = 0;
+    for (i = 0; i < RATE_MESSAGES; i++) {
+        total += client->message_size[i];
+    }
+
+    return total;
+}
+
+static bool SV_RateDrop(client_t *client)
+{
+    size_t  total;
+
     // never drop over the loopback
     if (!client->rate) {
         return false;
     }
 
-    total = 0;
-    for (i = 0; i < RATE_MESSAGES; i++) {
-        total += client->message_size[i];
-    }
+    total = SV_RateTotal(client);
 
     if (total > client->rate) {
         SV_DPrintf(0, "Frame %d suppressed for %s (total = %zu)\n",
@@ -102,9 +111,22 @@ static void SV_CalcSendTime(client_t *client, size_t size)
 
 EVENT MESSAGES
 
+Messages delivered to several clients at once are compressed at most once,
+and large unreliable ones are stored once and referenced from the queue of
+each recipient.
+
 =============================================================================
 */
 
+typedef struct {
+    sharedmsg_t     *raw;           // shared copy of the write buffer
+    sharedmsg_t     *packed;        // compressed write buffer, if it paid off
+    bool            compressed;     // compression was attempted
+} msgbatch_t;
+
+static void add_batch_message(client_t *client, int flags, msgbatch_t *batch);
+static void release_batch(msgbatch_t *batch);
+
 
 /*
 =================
@@ -141,6 +163,7 @@ Sends text to all active clients.
 */
 void SV_BroadcastPrintf(int level, const char *fmt, ...)
 {
+    msgbatch_t  batch = { 0 };
     client_t    *client;
 
     Com_VarArgs(MAX_STRING_CHARS);
@@ -159,9 +182,10 @@ void SV_BroadcastPrintf(int level, const char *fmt, ...)
             continue;
         if (level < client->messagelevel)
             continue;
-        SV_ClientAddMessage(client, MSG_RELIABLE);
+        add_batch_message(client, MSG_RELIABLE, &batch);
     }
 
+    release_batch(&batch);
     SZ_Clear(&msg_write);
 }
 
@@ -189,6 +213,7 @@ Sends command to all active clients.
 */
 void SV_BroadcastCommand(const char *fmt, ...)
 {
+    msgbatch_t  batch = { 0 };
     client_t    *client;
 
     Com_VarArgs(MAX_STRING_CHARS);
@@ -202,9 +227,10 @@ void SV_BroadcastCommand(const char *fmt, ...)
     MSG_WriteData(msg, len + 1);
 
     FOR_EACH_CLIENT(client) {
-        SV_ClientAddMessage(client, MSG_RELIABLE);
+        add_batch_message(client, MSG_RELIABLE, &batch);
     }
 
+    release_batch(&batch);
     SZ_Clear(&msg_write);
 }
 
@@ -223,11 +249,12 @@ MULTICAST_PHS    send to clients potentially hearable from org
 */
 void SV_Multicast(const vec3_t origin, multicast_t to, bool reliable)
 {
+    msgbatch_t  batch = { 0 };
     client_t    *client;
     byte        mask[VIS_MAX_BYTES];
     mleaf_t     *leaf1 = NULL, *leaf2;
     int         leafnum q_unused = 0;
-    int         flags = 0;
+    int         flags = MSG_COMPRESS_AUTO;
 
     if (!sv.cm.cache) {
         Com_Errorf(ERR_DROP, "%s: no map loaded", __func__);
@@ -274,17 +301,19 @@ void SV_Multicast(const vec3_t origin, multicast_t to, bool reliable)
                 continue;
         }
 
-        SV_ClientAddMessage(client, flags);
+        add_batch_message(client, flags, &batch);
     }
 
+    release_batch(&batch);
+
     // clear the buffer
     SZ_Clear(&msg_write);
 }
 
 static void add_message(client_t *client, byte *data,
-                        size_t len, bool reliable);
+                        size_t len, bool reliable, sharedmsg_t *shared);
 
-static size_t max_compressed_len(client_t *client)
+static size_t max_compressed_len(void)
 {
     return MAX_MSGLEN - ZPACKET_HEADER;
 }
@@ -298,7 +327,32 @@ static bool can_compress_message(client_t *client)
     return true;
 }
 
-static bool compress_message(client_t *client, int flags)
+static sharedmsg_t *alloc_shared_msg(const byte *data, size_t len)
+{
+    sharedmsg_t *shared = SV_Malloc(sizeof(*shared) + len);
+
+    shared->refcount = 1;
+    shared->cursize = (uint16_t)len;
+    memcpy(shared->data, data, len);
+    return shared;
+}
+
+static void release_shared_msg(sharedmsg_t *shared)
+{
+    if (shared && !--shared->refcount) {
+        Z_Free(shared);
+    }
+}
+
+static void release_batch(msgbatch_t *batch)
+{
+    release_shared_msg(batch->raw);
+    release_shared_msg(batch->packed);
+}
+
+// returns compressed contents of the write buffer, or NULL if it didn't
+// compress well enough
+static sharedmsg_t *compress_message(void)
 {
     byte    buffer[MAX_MSGLEN];
     int     ret, len;
@@ -306,7 +360,7 @@ static bool compress_message(client_t *client, int flags)
     svs.z.next_in = msg_write.data;
     svs.z.avail_in = msg_write.cursize;
     svs.z.next_out = buffer + ZPACKET_HEADER;
-    svs.z.avail_out = max_compressed_len(client);
+    svs.z.avail_out = max_compressed_len();
 
     ret = deflate(&svs.z, Z_FINISH);
     len = svs.z.total_out;
@@ -315,9 +369,9 @@ static bool compress_message(client_t *client, int flags)
     deflateReset(&svs.z);
 
     if (ret != Z_STREAM_END) {
-        Com_WPrintf("Error %d compressing %zu bytes message for %s\n",
-                    ret, msg_write.cursize, client->name);
-        return false;
+        Com_WPrintf("Error %d compressing %zu bytes message\n",
+                    ret, msg_write.cursize);
+        return NULL;
     }
 
     buffer[0] = svc_zpacket;
@@ -328,30 +382,23 @@ static bool compress_message(client_t *client, int flags)
 
     len += ZPACKET_HEADER;
 
-    SV_DPrintf(0, "%s: comp: %zu into %d\n",
-               client->name, msg_write.cursize, len);
+    SV_DPrintf(0, "comp: %zu into %d\n", msg_write.cursize, len);
 
     // did it compress good enough?
     if (len >= msg_write.cursize)
-        return false;
+        return NULL;
 
-    add_message(client, buffer, len, flags & MSG_RELIABLE);
-    return true;
+    return alloc_shared_msg(buffer, len);
 }
 
-/*
-=======================
-SV_ClientAddMessage
-
-Adds contents of the current write buffer to client's message list.
-Does NOT clean the buffer for multicast delivery purpose,
-unless told otherwise.
-=======================
-*/
-void SV_ClientAddMessage(client_t *client, int flags)
+// adds contents of the write buffer to client's message list, reusing
+// compressed and shared copies of it made for previous recipients
+static void add_batch_message(client_t *client, int flags, msgbatch_t *batch)
 {
+    bool reliable = flags & MSG_RELIABLE;
+
     SV_DPrintf(1, "Added %sreliable message to %s: %zu bytes\n",
-               (flags & MSG_RELIABLE) ? "" : "un", client->name, msg_write.cursize);
+               reliable ? "" : "un", client->name, msg_write.cursize);
 
     if (!msg_write.cursize) {
         return;
@@ -361,15 +408,49 @@ void SV_ClientAddMessage(client_t *client, int flags)
         flags |= MSG_COMPRESS;
     }
 
-    if (!(flags & MSG_COMPRESS) || !compress_message(client, flags)) {
-        add_message(client, msg_write.data, msg_write.cursize, flags & MSG_RELIABLE);
+    if (flags & MSG_COMPRESS) {
+        if (!batch->compressed) {
+            batch->packed = compress_message();
+            batch->compressed = true;
+        }
+        if (batch->packed) {
+            add_message(client, batch->packed->data, batch->packed->cursize,
+                        reliable, batch->packed);
+            goto clear;
+        }
     }
 
+    // reliables are copied into netchan buffer, only unreliables are shared
+    if (!reliable && msg_write.cursize > MSG_TRESHOLD && !batch->raw) {
+        batch->raw = alloc_shared_msg(msg_write.data, msg_write.cursize);
+    }
+
+    add_message(client, batch->raw ? batch->raw->data : msg_write.data,
+                msg_write.cursize, reliable, batch->raw);
+
+clear:
     if (flags & MSG_CLEAR) {
         SZ_Clear(&msg_write);
     }
 }
 
+/*
+=======================
+SV_ClientAddMessage
+
+Adds contents of the current write buffer to client's message list.
+Does NOT clean the buffer for multicast delivery purpose,
+unless told otherwise.
+=======================
+*/
+void SV_ClientAddMessage(client_t *client, int flags)
+{
+    msgbatch_t batch = { 0 };
+
+    add_batch_message(client, flags, &batch);
+    release_batch(&batch);
+}
+
 /*
 ===============================================================================
 
@@ -385,10 +466,10 @@ static inline void free_msg_packet(client_t *client, message_packet_t *msg)
     if (msg->cursize > MSG_TRESHOLD) {
         Q_assert(msg->cursize <= client->msg_dynamic_bytes);
         client->msg_dynamic_bytes -= msg->cursize;
-        Z_Free(msg);
-    } else {
-        List_Insert(&client->msg_free_list, &msg->entry);
+        release_shared_msg(msg->shared);
     }
+
+    List_Insert(&client->msg_free_list, &msg->entry);
 }
 
 #define FOR_EACH_MSG_SAFE(list) \
@@ -410,10 +491,12 @@ static void free_all_messages(client_t *client)
     client->msg_dynamic_bytes = 0;
 }
 
+// large messages reference shared data if given one, or a private copy
 static void add_msg_packet(client_t     *client,
                            byte         *data,
                            size_t       len,
-                           bool         reliable)
+                           bool         reliable,
+                           sharedmsg_t  *shared)
 {
     message_packet_t    *msg;
 
@@ -423,25 +506,32 @@ static void add_msg_packet(client_t     *client,
 
     Q_assert(len <= MAX_MSGLEN);
 
+    if (len > MSG_TRESHOLD && client->msg_dynamic_bytes > MAX_MSGLEN - len) {
+        Com_WPrintf("%s: %s: out of dynamic memory\n",
+                    __func__, client->name);
+        goto overflowed;
+    }
+
+    if (LIST_EMPTY(&client->msg_free_list)) {
+        Com_WPrintf("%s: %s: out of message slots\n",
+                    __func__, client->name);
+        goto overflowed;
+    }
+    msg = MSG_FIRST(&client->msg_free_list);
+    List_Remove(&msg->entry);
+
     if (len > MSG_TRESHOLD) {
-        if (client->msg_dynamic_bytes > MAX_MSGLEN - len) {
-            Com_WPrintf("%s: %s: out of dynamic memory\n",
-                        __func__, client->name);
-            goto overflowed;
+        if (shared) {
+            Q_assert(shared->data == data && shared->cursize == len);
+            shared->refcount++;
+        } else {
+            shared = alloc_shared_msg(data, len);
         }
-        msg = SV_Malloc(sizeof(*msg) + len - MSG_TRESHOLD);
+        msg->shared = shared;
         client->msg_dynamic_bytes += len;
     } else {
-        if (LIST_EMPTY(&client->msg_free_list)) {
-            Com_WPrintf("%s: %s: out of message slots\n",
-                        __func__, client->name);
-            goto overflowed;
-        }
-        msg = MSG_FIRST(&client->msg_free_list);
-        List_Remove(&msg->entry);
+        memcpy(msg->data, data, len);
     }
-
-    memcpy(msg->data, data, len);
     msg->cursize = (uint16_t)len;
 
     if (reliable) {
@@ -527,7 +617,10 @@ static inline void write_msg(client_t *client, message_packet_t *msg, size_t max
 {
     // if this msg fits, write it
     if (msg_write.cursize + msg->cursize <= maxsize) {
-        MSG_WriteData(msg->data, msg->cursize);
+        if (msg->cursize > MSG_TRESHOLD)
+            MSG_WriteData(msg->shared->data, msg->cursize);
+        else
+            MSG_WriteData(msg->data, msg->cursize);
     }
     free_msg_packet(client, msg);
 }
@@ -553,14 +646,14 @@ FRAME UPDATES
 ===============================================================================
 */
 static void add_message(client_t *client, byte *data,
-                        size_t len, bool reliable)
+                        size_t len, bool reliable, sharedmsg_t *shared)
 {
     if (reliable) {
         // don't packetize, netchan level will do fragmentation as needed
         SZ_Write(&client->netchan->message, data, len);
     } else {
         // still have to packetize, relative sounds need special processing
-        add_msg_packet(client, data, len, false);
+        add_msg_packet(client, data, len, false, shared);
     }
 }
 
@@ -635,6 +728,7 @@ static void finish_frame(client_t *client)
         free_msg_packet(client, msg);
     }
     client->msg_unreliable_bytes = 0;
+    client->frame_built = false;
 }
 
 /*
@@ -648,8 +742,32 @@ Clients in earlier connection state are handled in SV_SendAsyncPackets.
 void SV_SendClientMessages(void)
 {
     client_t    *client;
+    client_t    *build[MAX_CLIENTS];
+    int         count;
     size_t      cursize;
 
+    // find clients that are going to get a new frame
+    count = 0;
+    FOR_EACH_CLIENT(client) {
+        if (!CLIENT_ACTIVE(client))
+            continue;
+        if (client->netchan->message.overflowed) {
+            // client is going to be dropped, which calls into the game
+            // and may change what subsequent clients see
+            count = 0;
+            break;
+        }
+        if (client->rate && SV_RateTotal(client) > client->rate)
+            continue;
+        if (client->netchan->fragment_pending)
+            continue;
+        build[count++] = client;
+    }
+
+    PROF_Begin(PROF_BUILD);
+    SV_PrepareClientFrames(build, count);
+    PROF_End(PROF_BUILD);
+
     // send a message to each connected client
     FOR_EACH_CLIENT(client) {
         if (!CLIENT_ACTIVE(client))
@@ -676,8 +794,14 @@ void SV_SendClientMessages(void)
         }
 
         // build the new frame and write it
-        SV_BuildClientFrame(client);
+        if (!client->frame_built) {
+            PROF_Begin(PROF_BUILD);
+            SV_BuildClientFrame(client);
+            PROF_End(PROF_BUILD);
+        }
+        PROF_Begin(PROF_WRITE);
         write_datagram(client);
+        PROF_End(PROF_WRITE);
 
 advance:
         // advance for next frame
@@ -782,6 +906,84 @@ calctime:
     }
 }
 
+/*
+==================
+SV_TestBatch_f
+
+Queues a large unreliable message for several fake clients from a single
+batch and checks that all of them reference one shared copy of it.
+==================
+*/
+void SV_TestBatch_f(void)
+{
+    static client_t clients[4];
+    message_packet_t *msg;
+    sharedmsg_t *shared = NULL;
+    msgbatch_t batch = { 0 };
+    int num_clients = q_countof(clients);
+    int len = MSG_TRESHOLD * 4;
+    int i, j, errors = 0;
+
+    SZ_Clear(&msg_write);
+    for (i = 0; i < len; i++) {
+        MSG_WriteByte(i & 255);
+    }
+
+    for (i = 0; i < num_clients; i++) {
+        memset(&clients[i], 0, sizeof(clients[i]));
+        Q_snprintf(clients[i].name, sizeof(clients[i].name), "test%d", i);
+        SV_InitClientSend(&clients[i]);
+        add_batch_message(&clients[i], 0, &batch);
+    }
+    release_batch(&batch);
+
+    // single recipient that clears the write buffer
+    SV_ClientAddMessage(&clients[0], MSG_CLEAR);
+    if (msg_write.cursize) {
+        Com_EPrintf("write buffer not cleared\n");
+        errors++;
+    }
+
+    for (i = 0; i < num_clients; i++) {
+        if (LIST_EMPTY(&clients[i].msg_unreliable_list)) {
+            Com_EPrintf("%s: no message queued\n", clients[i].name);
+            errors++;
+            continue;
+        }
+        msg = MSG_FIRST(&clients[i].msg_unreliable_list);
+        if (msg->cursize != len || msg->shared->cursize != len) {
+            Com_EPrintf("%s: queued %u bytes, expected %d\n",
+                        clients[i].name, msg->cursize, len);
+            errors++;
+            continue;
+        }
+        if (!shared) {
+            shared = msg->shared;
+        } else if (msg->shared != shared) {
+            Com_EPrintf("%s: message not shared\n", clients[i].name);
+            errors++;
+        }
+        for (j = 0; j < len; j++) {
+            if (msg->shared->data[j] != (j & 255)) {
+                Com_EPrintf("%s: corrupted message at %d\n", clients[i].name, j);
+                errors++;
+                break;
+            }
+        }
+    }
+
+    if (shared && shared->refcount != num_clients) {
+        Com_EPrintf("refcount %u, expected %d\n", shared->refcount, num_clients);
+        errors++;
+    }
+
+    for (i = 0; i < num_clients; i++) {
+        SV_ShutdownClientSend(&clients[i]);
+    }
+
+    Com_Printf("%d failures, %d clients tested\n", errors, num_clients);
+}
+
 void SV_InitClientSend(client_t *newcl)
 {
     int i;
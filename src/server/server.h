@@ -31,6 +31,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common/net/net.h"
 #include "common/net/chan.h"
 #include "common/pmove.h"
+#include "common/prof.h"
 #include "common/prompt.h"
 #include "common/protocol.h"
 #include "common/zone.h"
@@ -91,6 +92,8 @@ typedef struct {
     int         clusternums[MAX_ENT_CLUSTERS];
     int         headnode;           // unused if num_clusters != -1
     list_t      area;               // linked to a division node or leaf
+    struct areanode_s   *areanode;  // node the entity is linked to
+    int         areatype;           // 0 = solid, 1 = trigger
 } server_entity_t;
 
 typedef struct {
@@ -138,11 +141,19 @@ typedef enum {
 
 #define MAX_SOUND_PACKET   14
 
+// immutable message data shared by queues of several clients
+typedef struct {
+    unsigned            refcount;
+    uint16_t            cursize;
+    uint8_t             data[];
+} sharedmsg_t;
+
 typedef struct {
     list_t              entry;
     uint16_t            cursize;    // zero means sound packet
     union {
         uint8_t         data[MSG_TRESHOLD];
+        sharedmsg_t     *shared;    // if cursize > MSG_TRESHOLD
         struct {
             uint8_t     flags;
             uint8_t     index;
@@ -193,6 +204,7 @@ typedef struct client_s {
     bool            unreachable: 1;
 #endif
     bool            http_download: 1;
+    bool            frame_built: 1;     // built by SV_PrepareClientFrames
 
     // userinfo
     char            userinfo[MAX_INFO_STRING];  // name, etc
@@ -361,6 +373,7 @@ typedef struct server_static_s {
     unsigned        num_entities;   // maxclients*UPDATE_BACKUP*MAX_PACKET_ENTITIES
     unsigned        next_entity;    // next state to use
     entity_state_t  *entities;      // [num_entities]
+    uint16_t        *frame_entities;    // [maxclients*MAX_PACKET_ENTITIES]
 
     z_stream        z;  // for compressing messages at once
 
@@ -409,6 +422,7 @@ extern cvar_t       *sv_debug;
 extern cvar_t       *sv_pad_packets;
 #endif
 extern cvar_t       *sv_novis;
+extern cvar_t       *sv_parallel_frames;
 extern cvar_t       *sv_lan_force_rate;
 extern cvar_t       *sv_calcpings_method;
 extern cvar_t       *sv_changemapcmd;
@@ -505,6 +519,7 @@ void SV_BroadcastCommand(const char *fmt, ...) q_printf(1, 2);
 void SV_ClientAddMessage(client_t *client, int flags);
 void SV_ShutdownClientSend(client_t *client);
 void SV_InitClientSend(client_t *newcl);
+void SV_TestBatch_f(void);
 
 //
 // sv_user.c
@@ -532,6 +547,10 @@ void SV_PrintMiscInfo(void);
     ((s)->modelindex || (s)->effects || (s)->sound || (s)->event)
 
 void SV_BuildClientFrame(client_t *client);
+void SV_PrepareClientFrames(client_t **clients, int count);
+void SV_VisStats_f(void);
+void SV_DeltaBench_f(void);
+void SV_DeltaStats_f(void);
 void SV_WriteFrameToClient(client_t *client);
 void SV_WriteAmbientsToClient(client_t *client);
 
@@ -565,6 +584,14 @@ void SV_RegisterSavegames(void);
 int SV_NoSaveGames(void);
 void SV_AutoSave_f(void);
 
+//
+// sv_bench.c
+//
+void SV_BenchInit(void);
+void SV_BenchShutdown(void);
+void SV_BenchRun(void);
+void SV_BenchEndFrame(void);
+
 //============================================================
 
 //
@@ -595,6 +622,10 @@ size_t SV_AreaEdicts(const vec3_t mins, const vec3_t maxs, edict_t **list, size_
 // returns the number of pointers filled in
 // ??? does this always return the world?
 
+void SV_AreaStats_f(void);
+void SV_TraceRecord_f(void);
+void SV_TraceBench_f(void);
+
 //===================================================================
 
 //
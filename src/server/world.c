@@ -29,67 +29,141 @@ FIXME: this use of "area" is different from the bsp file use
 */
 
 typedef struct areanode_s {
-    int     axis;       // -1 = leaf node
-    float   dist;
-    struct areanode_s   *children[2];
-    list_t  trigger_edicts;
+    vec3_t  origin;     // center of the node cell
+    float   size;       // half-size of the node cell
+    int     depth;
+    int     index;      // slot in parent children array
+    struct areanode_s   *parent;
+    struct areanode_s   *children[8];
     list_t  solid_edicts;
+    list_t  trigger_edicts;
+    int     num_edicts[2];      // linked to this node
+    int     total_edicts[2];    // linked to this node and below
 } areanode_t;
 
-#define    AREA_DEPTH    4
-#define    AREA_NODES    32
+// loose octree: each node cell is extended by its half-size on every
+// side, so an entity only has to fit by size, not by position. nodes are
+// created on demand when entities are linked and freed once empty.
+#define    AREA_NODES       4096
+#define    AREA_MAX_DEPTH   10
+#define    AREA_MIN_SIZE    32
+
+#define    AREA_LOOSE(node) ((node)->size * 2)
 
 static areanode_t   sv_areanodes[AREA_NODES];
-static int          sv_numareanodes;
+static areanode_t   *sv_freeareanodes;
+static int          sv_numareanodes;    // high water mark
+static int          sv_activeareanodes;
 
 static const vec_t  *area_mins, *area_maxs;
 static edict_t  **area_list;
 static size_t   area_count, area_maxcount;
 static int      area_type;
 
-/*
-===============
-SV_CreateAreaNode
+static struct {
+    unsigned    queries;
+    unsigned    nodes_visited;
+    unsigned    edicts_tested;
+    unsigned    edicts_returned;
+    unsigned    overflows;
+    unsigned    alloc_failures;
+} area_stats;
 
-Builds a uniformly subdivided tree for the given world size
-===============
-*/
-static areanode_t *SV_CreateAreaNode(int depth, const vec3_t mins, const vec3_t maxs)
+static areanode_t *SV_AllocAreaNode(areanode_t *parent, int index)
 {
     areanode_t  *anode;
-    vec3_t      size;
-    vec3_t      mins1, maxs1, mins2, maxs2;
-
-    anode = &sv_areanodes[sv_numareanodes];
-    sv_numareanodes++;
+    float       size;
+    int         i;
+
+    if (sv_freeareanodes) {
+        anode = sv_freeareanodes;
+        sv_freeareanodes = anode->parent;
+    } else if (sv_numareanodes < AREA_NODES) {
+        anode = &sv_areanodes[sv_numareanodes++];
+    } else {
+        area_stats.alloc_failures++;
+        return NULL;
+    }
 
-    List_Init(&anode->trigger_edicts);
+    memset(anode, 0, sizeof(*anode));
     List_Init(&anode->solid_edicts);
+    List_Init(&anode->trigger_edicts);
+    sv_activeareanodes++;
 
-    if (depth == AREA_DEPTH) {
-        anode->axis = -1;
-        anode->children[0] = anode->children[1] = NULL;
+    if (!parent)
         return anode;
+
+    size = parent->size * 0.5f;
+    for (i = 0; i < 3; i++) {
+        if (index & (1 << i))
+            anode->origin[i] = parent->origin[i] + size;
+        else
+            anode->origin[i] = parent->origin[i] - size;
     }
+    anode->size = size;
+    anode->depth = parent->depth + 1;
+    anode->index = index;
+    anode->parent = parent;
+    parent->children[index] = anode;
 
-    VectorSubtract(maxs, mins, size);
-    if (size[0] > size[1])
-        anode->axis = 0;
-    else
-        anode->axis = 1;
+    return anode;
+}
+
+static void SV_FreeAreaNode(areanode_t *anode)
+{
+    anode->parent->children[anode->index] = NULL;
+    anode->parent = sv_freeareanodes;
+    sv_freeareanodes = anode;
+    sv_activeareanodes--;
+}
 
-    anode->dist = 0.5f * (maxs[anode->axis] + mins[anode->axis]);
-    VectorCopy(mins, mins1);
-    VectorCopy(mins, mins2);
-    VectorCopy(maxs, maxs1);
-    VectorCopy(maxs, maxs2);
+/*
+===============
+SV_FindAreaNode
 
-    maxs1[anode->axis] = mins2[anode->axis] = anode->dist;
+Returns the deepest node whose loose bounds fully contain the entity,
+creating missing nodes along the way
+===============
+*/
+static areanode_t *SV_FindAreaNode(const edict_t *ent)
+{
+    areanode_t  *node, *child;
+    vec3_t      center;
+    float       extent, v;
+    int         i, index;
 
-    anode->children[0] = SV_CreateAreaNode(depth + 1, mins2, maxs2);
-    anode->children[1] = SV_CreateAreaNode(depth + 1, mins1, maxs1);
+    node = sv_areanodes;
 
-    return anode;
+    extent = 0;
+    for (i = 0; i < 3; i++) {
+        center[i] = 0.5f * (ent->absmin[i] + ent->absmax[i]);
+        v = 0.5f * (ent->absmax[i] - ent->absmin[i]);
+        if (v > extent)
+            extent = v;
+
+        // entities outside of the world are kept at the root
+        if (fabsf(center[i] - node->origin[i]) > node->size)
+            return node;
+    }
+
+    while (node->depth < AREA_MAX_DEPTH && node->size * 0.5f >= AREA_MIN_SIZE) {
+        // child loose bounds are child cell expanded by child half-size
+        if (extent > node->size * 0.5f)
+            break;
+
+        index = 0;
+        for (i = 0; i < 3; i++) {
+            if (center[i] >= node->origin[i])
+                index |= 1 << i;
+        }
+
+        child = node->children[index];
+        if (!child && !(child = SV_AllocAreaNode(node, index)))
+            break;
+        node = child;
+    }
+
+    return node;
 }
 
 /*
@@ -101,13 +175,26 @@ SV_ClearWorld
 void SV_ClearWorld(void)
 {
     mmodel_t *cm;
+    areanode_t *anode;
+    float v;
+    int i;
 
-    memset(sv_areanodes, 0, sizeof(sv_areanodes));
+    sv_freeareanodes = NULL;
     sv_numareanodes = 0;
+    sv_activeareanodes = 0;
+    memset(&area_stats, 0, sizeof(area_stats));
+
+    anode = SV_AllocAreaNode(NULL, 0);
 
     if (sv.cm.cache) {
+        // root cell is the cube enclosing the world model
         cm = &sv.cm.cache->models[0];
-        SV_CreateAreaNode(0, cm->mins, cm->maxs);
+        for (i = 0; i < 3; i++) {
+            anode->origin[i] = 0.5f * (cm->mins[i] + cm->maxs[i]);
+            v = 0.5f * (cm->maxs[i] - cm->mins[i]);
+            if (v > anode->size)
+                anode->size = v;
+        }
     }
 
     // make sure all entities are unlinked
@@ -233,19 +320,40 @@ void PF_UnlinkEdict(edict_t *ent)
     int entnum = NUM_FOR_EDICT(ent);
     server_entity_t *sent = &sv.entities[entnum];
 
+    areanode_t *node;
+    int type;
+
     // check if we're even linked
     if (!sent->area.prev)
         return;
 
     List_Remove(&sent->area);
     sent->area.prev = sent->area.next = NULL;
+
+    type = sent->areatype;
+    node = sent->areanode;
+    sent->areanode = NULL;
+
+    node->num_edicts[type]--;
+    while (1) {
+        node->total_edicts[type]--;
+        if (!node->parent)
+            break;
+        if (!node->total_edicts[0] && !node->total_edicts[1]) {
+            areanode_t *parent = node->parent;
+            SV_FreeAreaNode(node);
+            node = parent;
+        } else {
+            node = node->parent;
+        }
+    }
 }
 
 void PF_LinkEdict(edict_t *ent)
 {
     areanode_t *node;
     server_entity_t *sent;
-    int entnum;
+    int entnum, type;
 
     // world is allowed to be (silently) ignored
     if (ent == ge->entities)
@@ -296,24 +404,22 @@ void PF_LinkEdict(edict_t *ent)
     if (ent->solid == SOLID_NOT)
         return;
 
-// find the first node that the ent's box crosses
-    node = sv_areanodes;
-    while (1) {
-        if (node->axis == -1)
-            break;
-        if (ent->absmin[node->axis] > node->dist)
-            node = node->children[0];
-        else if (ent->absmax[node->axis] < node->dist)
-            node = node->children[1];
-        else
-            break;        // crosses the node
-    }
+// find the smallest node that loosely contains the ent's box
+    node = SV_FindAreaNode(ent);
+    type = ent->solid == SOLID_TRIGGER;
 
     // link it in
-    if (ent->solid == SOLID_TRIGGER)
+    if (type)
         List_Append(&node->trigger_edicts, &sent->area);
     else
         List_Append(&node->solid_edicts, &sent->area);
+
+    sent->areanode = node;
+    sent->areatype = type;
+
+    node->num_edicts[type]++;
+    for (; node; node = node->parent)
+        node->total_edicts[type]++;
 }
 
 
@@ -327,15 +433,24 @@ static void SV_AreaEdicts_r(areanode_t *node)
 {
     list_t              *start;
     server_entity_t     *check_sent;
+    areanode_t          *child;
+    float               size;
+    int                 i, type;
+
+    area_stats.nodes_visited++;
 
     // touch linked edicts
-    if (area_type == AREA_SOLID)
+    if (area_type == AREA_SOLID) {
         start = &node->solid_edicts;
-    else
+        type = 0;
+    } else {
         start = &node->trigger_edicts;
+        type = 1;
+    }
 
     LIST_FOR_EACH(server_entity_t, check_sent, start, area) {
         edict_t *check = EDICT_NUM(check_sent - sv.entities);
+        area_stats.edicts_tested++;
         if (check->solid == SOLID_NOT)
             continue;        // deactivated
         if (check->absmin[0] > area_maxs[0]
@@ -348,6 +463,7 @@ static void SV_AreaEdicts_r(areanode_t *node)
 
         if (area_count == area_maxcount) {
             Com_WPrintf("SV_AreaEdicts: MAXCOUNT\n");
+            area_stats.overflows++;
             return;
         }
 
@@ -355,14 +471,23 @@ static void SV_AreaEdicts_r(areanode_t *node)
         area_count++;
     }
 
-    if (node->axis == -1)
-        return;        // terminal node
+    // recurse down children whose loose bounds touch the area
+    for (i = 0; i < 8; i++) {
+        child = node->children[i];
+        if (!child || !child->total_edicts[type])
+            continue;
+
+        size = AREA_LOOSE(child);
+        if (child->origin[0] - size > area_maxs[0]
+            || child->origin[1] - size > area_maxs[1]
+            || child->origin[2] - size > area_maxs[2]
+            || child->origin[0] + size < area_mins[0]
+            || child->origin[1] + size < area_mins[1]
+            || child->origin[2] + size < area_mins[2])
+            continue;
 
-    // recurse down both sides
-    if (area_maxs[node->axis] > node->dist)
-        SV_AreaEdicts_r(node->children[0]);
-    if (area_mins[node->axis] < node->dist)
-        SV_AreaEdicts_r(node->children[1]);
+        SV_AreaEdicts_r(child);
+    }
 }
 
 /*
@@ -380,11 +505,120 @@ size_t SV_AreaEdicts(const vec3_t mins, const vec3_t maxs, edict_t **list,
     area_maxcount = maxcount;
     area_type = areatype;
 
+    area_stats.queries++;
+
     SV_AreaEdicts_r(sv_areanodes);
 
+    area_stats.edicts_returned += area_count;
+
     return area_count;
 }
 
+/*
+================
+SV_AreaStats_f
+
+Prints area tree occupancy and query statistics
+================
+*/
+void SV_AreaStats_f(void)
+{
+    int         nodes[AREA_MAX_DEPTH + 1];
+    int         solid[AREA_MAX_DEPTH + 1];
+    int         trigger[AREA_MAX_DEPTH + 1];
+    int         maxocc[AREA_MAX_DEPTH + 1];
+    areanode_t  *node;
+    int         i, n, q;
+
+    if (!sv.cm.cache) {
+        Com_Printf("No map loaded.\n");
+        return;
+    }
+
+    memset(nodes, 0, sizeof(nodes));
+    memset(solid, 0, sizeof(solid));
+    memset(trigger, 0, sizeof(trigger));
+    memset(maxocc, 0, sizeof(maxocc));
+
+    for (i = 0; i < sv_numareanodes; i++) {
+        node = &sv_areanodes[i];
+        if (i && !node->total_edicts[0] && !node->total_edicts[1])
+            continue;   // on free list
+        nodes[node->depth]++;
+        solid[node->depth] += node->num_edicts[0];
+        trigger[node->depth] += node->num_edicts[1];
+        n = node->num_edicts[0] + node->num_edicts[1];
+        if (n > maxocc[node->depth])
+            maxocc[node->depth] = n;
+    }
+
+    Com_Printf("%d nodes active, %d allocated, %d max\n",
+               sv_activeareanodes, sv_numareanodes, AREA_NODES);
+    Com_Printf("depth  size nodes solid trigger maxocc\n"
+               "----- ----- ----- ----- ------- ------\n");
+    for (i = 0; i <= AREA_MAX_DEPTH; i++) {
+        if (!nodes[i])
+            continue;
+        Com_Printf("%5d %5.f %5d %5d %7d %6d\n", i,
+                   sv_areanodes[0].size * 2 / (1 << i),
+                   nodes[i], solid[i], trigger[i], maxocc[i]);
+    }
+
+    q = area_stats.queries ? area_stats.queries : 1;
+    Com_Printf("%u queries: %.1f nodes, %.1f tested, %.1f returned per query\n",
+               area_stats.queries,
+               (float)area_stats.nodes_visited / q,
+               (float)area_stats.edicts_tested / q,
+               (float)area_stats.edicts_returned / q);
+    if (area_stats.overflows || area_stats.alloc_failures) {
+        Com_Printf("%u overflows, %u node allocation failures\n",
+                   area_stats.overflows, area_stats.alloc_failures);
+    }
+
+    if (Cmd_Argc() > 1 && !strcmp(Cmd_Argv(1), "reset")) {
+        area_stats.queries = 0;
+        area_stats.nodes_visited = 0;
+        area_stats.edicts_tested = 0;
+        area_stats.edicts_returned = 0;
+        area_stats.overflows = 0;
+        area_stats.alloc_failures = 0;
+    }
+}
+
+/*
+================
+SV_TraceRecord_f
+================
+*/
+void SV_TraceRecord_f(void)
+{
+    int count = 10000;
+
+    if (Cmd_Argc() > 1) {
+        count = atoi(Cmd_Argv(1));
+        clamp(count, 1, 1000000);
+    }
+
+    CM_RecordTraces(&sv.cm, count, Cmd_Argc() > 2 ? Cmd_Argv(2) : NULL);
+}
+
+/*
+================
+SV_TraceBench_f
+================
+*/
+void SV_TraceBench_f(void)
+{
+    int iterations = 10;
+
+    if (Cmd_Argc() > 1) {
+        iterations = atoi(Cmd_Argv(1));
+        clamp(iterations, 1, 10000);
+    }
+
+    CM_TraceBench(&sv.cm, iterations, Cmd_Argc() > 2 ? Cmd_Argv(2) : NULL);
+}
+
 
 //===========================================================================
 
@@ -65,114 +65,405 @@ unsigned Sys_Milliseconds(void)
     return SDL_GetTicks();
 }
 
+uint64_t Sys_Microseconds(void)
+{
+    static uint64_t freq;
+    uint64_t count = SDL_GetPerformanceCounter();
+
+    if (!freq)
+        freq = SDL_GetPerformanceFrequency();
+
+    return count / freq * 1000000 + count % freq * 1000000 / freq;
+}
+
 /*
 ===============================================================================
 
-ASYNC WORK QUEUE
+JOB SYSTEM
 
 ===============================================================================
 */
 
-#if USE_CLIENT
+#define MAX_JOBS            4096
+
+typedef struct job_s {
+    jobfunc_t       func;
+    void            *arg;
+    jobcounter_t    *counter;
+    struct job_s    *next;
+} job_t;
+
+static int          job_numthreads = -1;
+static SDL_Thread   *job_threads[MAX_JOB_THREADS];
+static SDL_mutex    *job_lock;
+static SDL_cond     *job_wake_cond;     // signaled when a job is queued
+static SDL_cond     *job_done_cond;     // broadcast when a counter drops to zero
+static bool         job_terminate;
+static SDL_TLSID    job_tls;            // worker thread index
+
+// everything below is protected by job_lock
+static job_t        job_pool[MAX_JOBS];
+static job_t        *job_free;
+static job_t        *job_head[JOB_NUM_PRIORITIES];
+static job_t        **job_tail[JOB_NUM_PRIORITIES];
+
+static asyncwork_t  *done_head;
+static asyncwork_t  **done_tail = &done_head;
+
+// pops the most urgent job not less urgent than maxprio
+static job_t *pop_job(jobpriority_t maxprio)
+{
+    job_t *job;
+    int i;
 
-static bool work_initialized;
-static bool work_terminate;
-static SDL_mutex *work_lock;
-static SDL_cond *work_cond;
-static SDL_Thread *work_thread;
-static asyncwork_t *pend_head;
-static asyncwork_t *done_head;
+    for (i = 0; i <= maxprio; i++) {
+        job = job_head[i];
+        if (job) {
+            job_head[i] = job->next;
+            if (!job_head[i])
+                job_tail[i] = &job_head[i];
+            return job;
+        }
+    }
+
+    return NULL;
+}
 
-static void append_work(asyncwork_t **head, asyncwork_t *work)
+static void finish_job(jobcounter_t *counter)
 {
-    asyncwork_t *c, **p;
-    for (p = head, c = *head; c; p = &c->next, c = c->next);
-    work->next = NULL;
-    *p = work;
+    if (counter && --counter->pending == 0)
+        SDL_CondBroadcast(job_done_cond);
 }
 
-void Sys_CompleteAsyncQueue(void)
+// called with job_lock held, returns with it held
+static void run_job(job_t *job)
 {
-    asyncwork_t *work, *next;
+    jobfunc_t func = job->func;
+    void *arg = job->arg;
+    jobcounter_t *counter = job->counter;
 
-    if (!work_initialized)
-        return;
-    if (SDL_TryLockMutex(work_lock))
-        return;
-    if (q_unlikely(done_head)) {
-        for (work = done_head; work; work = next) {
-            next = work->next;
-            if (work->done_cb)
-                work->done_cb(work->cb_arg);
-            Z_Free(work);
-        }
-        done_head = NULL;
-    }
-    SDL_UnlockMutex(work_lock);
+    job->next = job_free;
+    job_free = job;
+
+    SDL_UnlockMutex(job_lock);
+    func(arg);
+    SDL_LockMutex(job_lock);
+
+    finish_job(counter);
 }
 
-static int thread_func(void *arg)
+static int job_thread_func(void *arg)
 {
-    SDL_LockMutex(work_lock);
+    job_t *job;
+
+    SDL_TLSSet(job_tls, arg, NULL);
+
+    SDL_LockMutex(job_lock);
     while (1) {
-        while (!pend_head && !work_terminate)
-            SDL_CondWait(work_cond, work_lock);
+        job = pop_job(JOB_LOW);
+        if (job)
+            run_job(job);
+        else if (job_terminate)
+            break;
+        else
+            SDL_CondWait(job_wake_cond, job_lock);
+    }
+    SDL_UnlockMutex(job_lock);
+
+    return 0;
+}
 
-        asyncwork_t *work = pend_head;
-        if (!work)
+static void job_init(void)
+{
+    int i, count;
+
+    job_lock = SDL_CreateMutex();
+    job_tls = SDL_TLSCreate();
+    job_wake_cond = SDL_CreateCond();
+    job_done_cond = SDL_CreateCond();
+
+    job_free = NULL;
+    for (i = MAX_JOBS - 1; i >= 0; i--) {
+        job_pool[i].next = job_free;
+        job_free = &job_pool[i];
+    }
+
+    for (i = 0; i < JOB_NUM_PRIORITIES; i++) {
+        job_head[i] = NULL;
+        job_tail[i] = &job_head[i];
+    }
+
+    count = min(SDL_GetCPUCount() - 1, MAX_JOB_THREADS);
+    job_numthreads = 0;
+    for (i = 0; i < count; i++) {
+        job_threads[i] = SDL_CreateThread(job_thread_func, "job worker",
+                                          (void *)(intptr_t)(i + 1));
+        if (!job_threads[i])
             break;
-        pend_head = work->next;
+        job_numthreads++;
+    }
+}
+
+/*
+=================
+Sys_NumParallelThreads
+
+Returns the number of threads that execute jobs, including the caller.
+=================
+*/
+int Sys_NumParallelThreads(void)
+{
+    if (job_numthreads < 0)
+        job_init();
+
+    return job_numthreads + 1;
+}
 
-        SDL_UnlockMutex(work_lock);
-        work->work_cb(work->cb_arg);
-        SDL_LockMutex(work_lock);
+/*
+=================
+Sys_ThreadIndex
 
-        append_work(&done_head, work);
+Returns 1 to MAX_JOB_THREADS for worker threads and 0 for any other thread.
+=================
+*/
+int Sys_ThreadIndex(void)
+{
+    if (!job_tls)
+        return 0;
+
+    return (intptr_t)SDL_TLSGet(job_tls);
+}
+
+/*
+=================
+Sys_QueueJob
+
+Queues func(arg) for execution on a worker thread. If counter is not NULL,
+it is incremented now and decremented once the job has finished. When
+there are no worker threads or the job pool is exhausted, the job runs
+immediately on the calling thread.
+=================
+*/
+void Sys_QueueJob(jobfunc_t func, void *arg, jobpriority_t priority, jobcounter_t *counter)
+{
+    job_t *job;
+
+    Q_assert(priority >= 0 && priority < JOB_NUM_PRIORITIES);
+
+    if (job_numthreads < 0)
+        job_init();
+
+    SDL_LockMutex(job_lock);
+    if (counter)
+        counter->pending++;
+
+    job = job_free;
+    if (!job_numthreads || !job) {
+        SDL_UnlockMutex(job_lock);
+        func(arg);
+        SDL_LockMutex(job_lock);
+        finish_job(counter);
+        SDL_UnlockMutex(job_lock);
+        return;
     }
-    SDL_UnlockMutex(work_lock);
+    job_free = job->next;
 
-    return 0;
+    job->func = func;
+    job->arg = arg;
+    job->counter = counter;
+    job->next = NULL;
+    *job_tail[priority] = job;
+    job_tail[priority] = &job->next;
+
+    SDL_CondSignal(job_wake_cond);
+    SDL_UnlockMutex(job_lock);
 }
 
-void Sys_ShutdownAsyncQueue(void)
+/*
+=================
+Sys_JobsPending
+
+Returns true if any job tracked by counter hasn't finished yet.
+=================
+*/
+bool Sys_JobsPending(jobcounter_t *counter)
+{
+    bool pending;
+
+    if (job_numthreads < 0)
+        return counter->pending;
+
+    SDL_LockMutex(job_lock);
+    pending = counter->pending;
+    SDL_UnlockMutex(job_lock);
+
+    return pending;
+}
+
+/*
+=================
+Sys_WaitForJobs
+
+Returns when every job tracked by counter has finished. While waiting, the
+calling thread executes queued jobs of JOB_NORMAL or higher priority, so it
+is safe to wait from inside a job. Background (JOB_LOW) jobs are left to
+the workers.
+=================
+*/
+void Sys_WaitForJobs(jobcounter_t *counter)
 {
-    if (!work_initialized)
+    job_t *job;
+
+    if (job_numthreads < 0)
         return;
 
-    SDL_LockMutex(work_lock);
-    work_terminate = true;
-    SDL_CondSignal(work_cond);
-    SDL_UnlockMutex(work_lock);
+    SDL_LockMutex(job_lock);
+    while (counter->pending) {
+        job = pop_job(JOB_NORMAL);
+        if (job)
+            run_job(job);
+        else
+            SDL_CondWait(job_done_cond, job_lock);
+    }
+    SDL_UnlockMutex(job_lock);
+}
 
-    SDL_WaitThread(work_thread, NULL);
-    Sys_CompleteAsyncQueue();
+typedef struct {
+    parallelfunc_t  func;
+    void            *arg;
+    int             count;
+    SDL_atomic_t    next;
+} parallel_t;
 
-    SDL_DestroyMutex(work_lock);
-    SDL_DestroyCond(work_cond);
+static void parallel_job(void *arg)
+{
+    parallel_t *p = arg;
+    int index;
 
-    work_lock = NULL;
-    work_cond = NULL;
-    work_thread = NULL;
-    work_initialized = false;
+    while ((index = SDL_AtomicAdd(&p->next, 1)) < p->count)
+        p->func(p->arg, index);
 }
 
-void Sys_QueueAsyncWork(asyncwork_t *work)
+/*
+=================
+Sys_ParallelFor
+
+Runs func(arg, index) for every index in [0, count) on the worker threads
+and the calling thread, returning when all of them have completed.
+=================
+*/
+void Sys_ParallelFor(int count, parallelfunc_t func, void *arg)
 {
-    if (!work_initialized) {
-        work_lock = SDL_CreateMutex();
-        work_cond = SDL_CreateCond();
-        if (!(work_thread = SDL_CreateThread(thread_func, "async work queue", NULL)))
-            Sys_Error("Couldn't create async work thread");
-        work_initialized = true;
+    jobcounter_t counter = { 0 };
+    parallel_t p;
+    int i, n;
+
+    if (count < 1)
+        return;
+
+    if (job_numthreads < 0)
+        job_init();
+
+    if (!job_numthreads || count == 1) {
+        for (i = 0; i < count; i++)
+            func(arg, i);
+        return;
     }
 
-    SDL_LockMutex(work_lock);
-    append_work(&pend_head, Z_CopyStruct(work));
-    SDL_CondSignal(work_cond);
-    SDL_UnlockMutex(work_lock);
+    p.func = func;
+    p.arg = arg;
+    p.count = count;
+    SDL_AtomicSet(&p.next, 0);
+
+    n = min(count - 1, job_numthreads);
+    for (i = 0; i < n; i++)
+        Sys_QueueJob(parallel_job, &p, JOB_HIGH, &counter);
+
+    parallel_job(&p);
+    Sys_WaitForJobs(&counter);
 }
 
-#endif
+static void async_job(void *arg)
+{
+    asyncwork_t *work = arg;
+
+    work->work_cb(work->cb_arg);
+
+    SDL_LockMutex(job_lock);
+    work->next = NULL;
+    *done_tail = work;
+    done_tail = &work->next;
+    SDL_UnlockMutex(job_lock);
+}
+
+/*
+=================
+Sys_QueueAsyncWork
+
+Runs work_cb on a worker thread in the background, then done_cb on the
+main thread from Sys_CompleteAsyncQueue.
+=================
+*/
+void Sys_QueueAsyncWork(asyncwork_t *work)
+{
+    Sys_QueueJob(async_job, Z_CopyStruct(work), JOB_LOW, NULL);
+}
+
+void Sys_CompleteAsyncQueue(void)
+{
+    asyncwork_t *work, *next;
+
+    if (job_numthreads < 0)
+        return;
+    if (SDL_TryLockMutex(job_lock))
+        return;
+    work = done_head;
+    done_head = NULL;
+    done_tail = &done_head;
+    SDL_UnlockMutex(job_lock);
+
+    for (; work; work = next) {
+        next = work->next;
+        if (work->done_cb)
+            work->done_cb(work->cb_arg);
+        Z_Free(work);
+    }
+}
+
+/*
+=================
+Sys_ShutdownJobs
+
+Finishes all queued jobs and stops the worker threads.
+=================
+*/
+void Sys_ShutdownJobs(void)
+{
+    int i;
+
+    if (job_numthreads < 0)
+        return;
+
+    SDL_LockMutex(job_lock);
+    job_terminate = true;
+    SDL_CondBroadcast(job_wake_cond);
+    SDL_UnlockMutex(job_lock);
+
+    for (i = 0; i < job_numthreads; i++)
+        SDL_WaitThread(job_threads[i], NULL);
+
+    Sys_CompleteAsyncQueue();
+
+    SDL_DestroyMutex(job_lock);
+    SDL_DestroyCond(job_wake_cond);
+    SDL_DestroyCond(job_done_cond);
+
+    job_lock = NULL;
+    job_wake_cond = NULL;
+    job_done_cond = NULL;
+    job_terminate = false;
+    job_numthreads = -1;
+}
 
 /*
 ===============================================================================
@@ -80,9 +80,7 @@ This function never returns.
 */
 _Noreturn void Sys_Quit(void)
 {
-#if USE_CLIENT
-    Sys_ShutdownAsyncQueue();
-#endif
+    Sys_ShutdownJobs();
     tty_shutdown_input();
 #if USE_SDL
     SDL_Quit();
@@ -179,6 +177,42 @@ Sys_IsFile(const char *path)
 	return false;
 }
 
+/*
+=================
+Sys_MapFile
+=================
+*/
+const void *Sys_MapFile(FILE *fp, int64_t offset, size_t length, mappedfile_t *map)
+{
+    static long pagesize;
+    int64_t start;
+    void *base;
+
+    if (!pagesize)
+        pagesize = sysconf(_SC_PAGESIZE);
+
+    // mappings must start at page boundary
+    start = offset - offset % pagesize;
+
+    base = mmap(NULL, length + (offset - start), PROT_READ, MAP_PRIVATE, fileno(fp), start);
+    if (base == MAP_FAILED)
+        return NULL;
+
+    map->base = base;
+    map->size = length + (offset - start);
+    return (byte *)base + (offset - start);
+}
+
+/*
+=================
+Sys_UnmapFile
+=================
+*/
+void Sys_UnmapFile(mappedfile_t *map)
+{
+    munmap(map->base, map->size);
+}
+
 /*
 =================
 Sys_Init
@@ -515,9 +549,7 @@ int main(int argc, char **argv)
 
     Qcommon_Init(argc, argv);
     while (!terminate) {
-#if USE_CLIENT
         Sys_CompleteAsyncQueue();
-#endif
         if (flush_logs) {
             Com_FlushLogs();
             flush_logs = false;
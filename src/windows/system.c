@@ -22,6 +22,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common/prompt.h"
 #if USE_WINSVC
 #include <winsvc.h>
+#include <io.h>
 #endif
 #include <versionhelpers.h>
 
@@ -898,8 +899,8 @@ This function never returns.
 */
 _Noreturn void Sys_Quit(void)
 {
+    Sys_ShutdownJobs();
 #if USE_CLIENT
-    Sys_ShutdownAsyncQueue();
 #if USE_SYSCON
     if (dedicated && dedicated->integer) {
         FreeConsole();
@@ -1242,6 +1243,57 @@ bool Sys_IsFile(const char *path)
 	return (fileAttributes & (FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_DEVICE)) == 0;
 }
 
+/*
+=================
+Sys_MapFile
+=================
+*/
+const void *Sys_MapFile(FILE *fp, int64_t offset, size_t length, mappedfile_t *map)
+{
+    static DWORD granularity;
+    HANDLE file, mapping;
+    int64_t start;
+    void *base;
+
+    if (!granularity) {
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        granularity = info.dwAllocationGranularity;
+    }
+
+    file = (HANDLE)_get_osfhandle(_fileno(fp));
+    if (file == INVALID_HANDLE_VALUE)
+        return NULL;
+
+    mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mapping)
+        return NULL;
+
+    // views must start at allocation granularity boundary
+    start = offset - offset % granularity;
+
+    // the view keeps mapping object alive
+    base = MapViewOfFile(mapping, FILE_MAP_READ, (DWORD)(start >> 32), (DWORD)start,
+                         length + (offset - start));
+    CloseHandle(mapping);
+    if (!base)
+        return NULL;
+
+    map->base = base;
+    map->size = length + (offset - start);
+    return (byte *)base + (offset - start);
+}
+
+/*
+=================
+Sys_UnmapFile
+=================
+*/
+void Sys_UnmapFile(mappedfile_t *map)
+{
+    UnmapViewOfFile(map->base);
+}
+
 /*
 ========================================================================
 
@@ -1295,9 +1347,7 @@ static int Sys_Main(int argc, char **argv)
 
     // main program loop
     while (1) {
-#if USE_CLIENT
         Sys_CompleteAsyncQueue();
-#endif
         Qcommon_Frame();
         if (shouldExit) {
 #if USE_WINSVC